@@ -1,7 +1,7 @@
 Texture2D<float4> tex;
 Texture2D<float4> sph;
 Texture2D<float4> spa;
-Texture2D<float4> toon;
+Texture2DArray<float4> toon : register(t3);
 SamplerState smp;
 SamplerState smpToon;
 
@@ -33,6 +33,8 @@ cbuffer Material
 	float4 diffuse;
 	float4 specular;
 	float4 ambient;
+	float4 textureTransforms[3];
+	uint toonIndex;
 };
 
 Output BasicVS(
@@ -67,23 +69,25 @@ float4 BasicPS(Output input) : SV_TARGET
 	float3 lightColor = float3(1, 1, 1);
 
 	float diffuseB = saturate(dot(-light, input.normal));
-	float4 toonDiff = toon.Sample(smpToon, float2(0, 1.0 - diffuseB));
+	float4 toonDiff = toon.Sample(smpToon, float3(0, 1.0 - diffuseB, toonIndex));
 
 	float3 refLight = normalize(reflect(light, input.normal.xyz));
 	float specularB = pow(saturate(dot(refLight, -input.ray)), specular.a);
 
 	float2 sphere_map_uv = (input.vnormal.xy + float2(1.0, -1.0)) * float2(0.5, -0.5);
+	float2 sph_uv = sphere_map_uv * textureTransforms[1].xy + textureTransforms[1].zw;
+	float2 spa_uv = sphere_map_uv * textureTransforms[2].xy + textureTransforms[2].zw;
 
-	float4 texColor = tex.Sample(smp, input.uv);
+	float4 texColor = tex.Sample(smp, input.uv * textureTransforms[0].xy + textureTransforms[0].zw);
 
 	return max(
 		saturate(
 			toonDiff *
 			diffuse *
 			texColor *
-			sph.Sample(smp, sphere_map_uv)
+			sph.Sample(smp, sph_uv)
 		) +
-		saturate(spa.Sample(smp, sphere_map_uv) * texColor) +
+		saturate(spa.Sample(smp, spa_uv) * texColor) +
 		float4(specularB * specular.rgb, 1),
 		texColor * ambient
 	);
@@ -0,0 +1,229 @@
+﻿#include "allocation_tracker.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace
+{
+	// 自明な型だけにして，operator newの中から初期化なしで触れるようにする
+	struct ThreadCounters
+	{
+		uint64_t allocationCount;
+		uint64_t deallocationCount;
+		uint64_t allocatedBytes;
+	};
+
+	thread_local ThreadCounters threadCounters {};
+
+	atomic<uint64_t> totalAllocationCount { 0 };
+	atomic<uint64_t> totalDeallocationCount { 0 };
+	atomic<uint64_t> totalAllocatedBytes { 0 };
+
+	allocation_tracker::Counters frameBeginCounters;
+	allocation_tracker::Counters lastFrameCounters;
+
+	atomic<uint64_t> violationCount { 0 };
+	atomic<const char *> lastViolationName { nullptr };
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+	void recordAllocation(size_t size)
+	{
+		++threadCounters.allocationCount;
+		threadCounters.allocatedBytes += size;
+
+		totalAllocationCount.fetch_add(1, memory_order_relaxed);
+		totalAllocatedBytes.fetch_add(size, memory_order_relaxed);
+	}
+
+	void recordDeallocation()
+	{
+		++threadCounters.deallocationCount;
+
+		totalDeallocationCount.fetch_add(1, memory_order_relaxed);
+	}
+
+	void * allocate(size_t size)
+	{
+		recordAllocation(size);
+
+		// 0バイトでも異なるポインタを返す必要がある
+		return malloc(size > 0 ? size : 1);
+	}
+
+	void * allocateAligned(size_t size, size_t alignment)
+	{
+		recordAllocation(size);
+
+#ifdef _MSC_VER
+		return _aligned_malloc(size > 0 ? size : 1, alignment);
+#else
+		// aligned_allocはサイズがalignmentの倍数でなければならない
+		return aligned_alloc(alignment, size > 0 ? (size + alignment - 1) / alignment * alignment : alignment);
+#endif
+	}
+
+	void deallocate(void * p)
+	{
+		if(p == nullptr)
+		{
+			return;
+		}
+
+		recordDeallocation();
+		free(p);
+	}
+
+	void deallocateAligned(void * p)
+	{
+		if(p == nullptr)
+		{
+			return;
+		}
+
+		recordDeallocation();
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+#endif
+}
+
+bool allocation_tracker::isEnabled()
+{
+#ifdef ENABLE_ALLOCATION_TRACKER
+	return true;
+#else
+	return false;
+#endif
+}
+
+allocation_tracker::Counters allocation_tracker::getThreadCounters()
+{
+	return { threadCounters.allocationCount, threadCounters.deallocationCount, threadCounters.allocatedBytes };
+}
+
+allocation_tracker::Counters allocation_tracker::getTotalCounters()
+{
+	return {
+		totalAllocationCount.load(memory_order_relaxed),
+		totalDeallocationCount.load(memory_order_relaxed),
+		totalAllocatedBytes.load(memory_order_relaxed),
+	};
+}
+
+void allocation_tracker::endFrame()
+{
+	auto counters = getTotalCounters();
+
+	lastFrameCounters.allocationCount = counters.allocationCount - frameBeginCounters.allocationCount;
+	lastFrameCounters.deallocationCount = counters.deallocationCount - frameBeginCounters.deallocationCount;
+	lastFrameCounters.allocatedBytes = counters.allocatedBytes - frameBeginCounters.allocatedBytes;
+
+	frameBeginCounters = counters;
+}
+
+allocation_tracker::Counters allocation_tracker::getLastFrameCounters()
+{
+	return lastFrameCounters;
+}
+
+uint64_t allocation_tracker::getViolationCount()
+{
+	return violationCount.load();
+}
+
+const char * allocation_tracker::getLastViolationName()
+{
+	return lastViolationName.load();
+}
+
+void allocation_tracker::resetViolations()
+{
+	violationCount = 0;
+	lastViolationName = nullptr;
+}
+
+allocation_tracker::NoAllocationScope::NoAllocationScope(const char * name)
+	: mName(name)
+	, mBeginAllocationCount(threadCounters.allocationCount)
+{
+}
+
+allocation_tracker::NoAllocationScope::~NoAllocationScope()
+{
+	if(threadCounters.allocationCount == mBeginAllocationCount)
+	{
+		return;
+	}
+
+	violationCount.fetch_add(threadCounters.allocationCount - mBeginAllocationCount);
+	lastViolationName = mName;
+}
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+void * operator new(size_t size)
+{
+	if(auto p = allocate(size))
+	{
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void * operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void * operator new(size_t size, const nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void * operator new[](size_t size, const nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void * operator new(size_t size, align_val_t alignment)
+{
+	if(auto p = allocateAligned(size, static_cast<size_t>(alignment)))
+	{
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void * operator new[](size_t size, align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void * operator new(size_t size, align_val_t alignment, const nothrow_t &) noexcept
+{
+	return allocateAligned(size, static_cast<size_t>(alignment));
+}
+
+void * operator new[](size_t size, align_val_t alignment, const nothrow_t &) noexcept
+{
+	return allocateAligned(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void * p) noexcept { deallocate(p); }
+void operator delete[](void * p) noexcept { deallocate(p); }
+void operator delete(void * p, size_t) noexcept { deallocate(p); }
+void operator delete[](void * p, size_t) noexcept { deallocate(p); }
+void operator delete(void * p, const nothrow_t &) noexcept { deallocate(p); }
+void operator delete[](void * p, const nothrow_t &) noexcept { deallocate(p); }
+
+void operator delete(void * p, align_val_t) noexcept { deallocateAligned(p); }
+void operator delete[](void * p, align_val_t) noexcept { deallocateAligned(p); }
+void operator delete(void * p, size_t, align_val_t) noexcept { deallocateAligned(p); }
+void operator delete[](void * p, size_t, align_val_t) noexcept { deallocateAligned(p); }
+void operator delete(void * p, align_val_t, const nothrow_t &) noexcept { deallocateAligned(p); }
+void operator delete[](void * p, align_val_t, const nothrow_t &) noexcept { deallocateAligned(p); }
+#endif
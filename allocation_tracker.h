@@ -0,0 +1,63 @@
+﻿#pragma once
+#ifndef ALLOCATION_TRACKER_H_INCLUDED
+#define ALLOCATION_TRACKER_H_INCLUDED
+
+#include <cstdint>
+
+// グローバルなoperator new/deleteを差し替えてヒープ確保を数える
+// ENABLE_ALLOCATION_TRACKERを定義しないときは差し替えず，マクロも空になる
+namespace allocation_tracker
+{
+	struct Counters
+	{
+		uint64_t allocationCount = 0;
+		uint64_t deallocationCount = 0;
+		uint64_t allocatedBytes = 0;
+	};
+
+	// operator newを差し替えているか
+	bool isEnabled();
+
+	// 呼び出したスレッドの累計
+	Counters getThreadCounters();
+
+	// 全スレッドの累計
+	Counters getTotalCounters();
+
+	// 前回のendFrameからの全スレッドの確保を，1フレーム分として確定する
+	void endFrame();
+	Counters getLastFrameCounters();
+
+	// 確保を禁止した区間での違反
+	uint64_t getViolationCount();
+	const char * getLastViolationName();
+	void resetViolations();
+
+	// 区間内でこのスレッドが確保したら違反として記録する
+	class NoAllocationScope
+	{
+	public:
+		explicit NoAllocationScope(const char * name);
+		~NoAllocationScope();
+
+		NoAllocationScope(const NoAllocationScope &) = delete;
+		NoAllocationScope & operator=(const NoAllocationScope &) = delete;
+
+	private:
+		const char * mName;
+		uint64_t mBeginAllocationCount;
+	};
+}
+
+#define ALLOCATION_CONCAT_IMPL(a, b) a##b
+#define ALLOCATION_CONCAT(a, b) ALLOCATION_CONCAT_IMPL(a, b)
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+#define NO_ALLOCATION_SCOPE(name) allocation_tracker::NoAllocationScope ALLOCATION_CONCAT(no_allocation_scope_, __LINE__)(name)
+#define ALLOCATION_END_FRAME() allocation_tracker::endFrame()
+#else
+#define NO_ALLOCATION_SCOPE(name)
+#define ALLOCATION_END_FRAME()
+#endif
+
+#endif // ALLOCATION_TRACKER_H_INCLUDED
@@ -0,0 +1,140 @@
+﻿#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "allocation_tracker.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	// 確保と解放の組を最適化で消されないよう，ポインタを外に逃がす
+	void * volatile escaped_pointer = nullptr;
+
+	void allocateOnce(size_t size)
+	{
+		escaped_pointer = new char[size];
+		delete[] static_cast<char *>(escaped_pointer);
+	}
+
+	// 呼び出したスレッドと全スレッドの確保を数える
+	void testCounters()
+	{
+		expect(allocation_tracker::isEnabled(), "operator new is not replaced.");
+
+		const auto thread_begin = allocation_tracker::getThreadCounters();
+		const auto total_begin = allocation_tracker::getTotalCounters();
+		allocateOnce(100);
+		const auto thread_end = allocation_tracker::getThreadCounters();
+
+		expect(thread_end.allocationCount == thread_begin.allocationCount + 1, "an allocation was not counted.");
+		expect(thread_end.deallocationCount == thread_begin.deallocationCount + 1, "a deallocation was not counted.");
+		expect(thread_end.allocatedBytes == thread_begin.allocatedBytes + 100, "the allocated bytes are wrong.");
+
+		thread other([]() { allocateOnce(10); });
+		other.join();
+
+		const auto total_end = allocation_tracker::getTotalCounters();
+		expect(total_end.allocationCount >= total_begin.allocationCount + 2, "an allocation on another thread was not counted in the total.");
+
+		// endFrameまでの全スレッドの確保が1フレーム分になる
+		allocation_tracker::endFrame();
+		allocateOnce(8);
+		allocateOnce(8);
+		allocation_tracker::endFrame();
+		const auto frame = allocation_tracker::getLastFrameCounters();
+		expect(frame.allocationCount == 2 && frame.deallocationCount == 2 && frame.allocatedBytes == 16, "the last frame counters are wrong.");
+	}
+
+	// 確保禁止の区間で確保すると違反になり，確保しなければならない
+	void testNoAllocationScope()
+	{
+		allocation_tracker::resetViolations();
+
+		vector<int> values;
+		values.reserve(16);
+		{
+			allocation_tracker::NoAllocationScope scope("Reserved");
+			for(int i = 0; i < 16; ++i)
+			{
+				values.push_back(i);
+			}
+		}
+		expect(allocation_tracker::getViolationCount() == 0, "a scope without allocations reported a violation.");
+		expect(allocation_tracker::getLastViolationName() == nullptr, "a scope without allocations set a violation name.");
+
+		{
+			allocation_tracker::NoAllocationScope scope("Growing");
+			values.push_back(16);
+		}
+		expect(allocation_tracker::getViolationCount() == 1, "an allocation in a scope was not reported.");
+		expect(
+			allocation_tracker::getLastViolationName() != nullptr && strcmp(allocation_tracker::getLastViolationName(), "Growing") == 0,
+			"the violation has a wrong name."
+		);
+
+		allocation_tracker::resetViolations();
+		expect(allocation_tracker::getViolationCount() == 0 && allocation_tracker::getLastViolationName() == nullptr, "resetViolations did not reset.");
+
+		// 他のスレッドの確保は区間の違反にならない．スレッドの生成での確保は区間の外で済ませる
+		atomic<bool> started { false };
+		atomic<bool> allocated { false };
+		thread other(
+			[&started, &allocated]()
+			{
+				while(!started.load())
+				{
+					this_thread::yield();
+				}
+				allocateOnce(10);
+				allocated = true;
+			}
+		);
+		{
+			allocation_tracker::NoAllocationScope scope("Main");
+			started = true;
+			while(!allocated.load())
+			{
+				this_thread::yield();
+			}
+		}
+		other.join();
+		expect(allocation_tracker::getViolationCount() == 0, "an allocation on another thread was reported.");
+
+		{
+			allocation_tracker::NoAllocationScope scope("Main");
+			allocation_tracker::getTotalCounters();
+		}
+		expect(allocation_tracker::getViolationCount() == 0, "reading the counters allocated.");
+	}
+}
+
+// allocation_tracker_test
+// ヒープ確保の数え方と，確保禁止の区間で確保したときに違反になることを確かめる
+int main()
+{
+	testCounters();
+	testNoAllocationScope();
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
@@ -0,0 +1,232 @@
+﻿#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "allocation_tracker.h"
+#include "baked_motion.h"
+#include "pmd_file.h"
+#include "pmd_skeleton.h"
+#include "profiler.h"
+#include "vmd_motion.h"
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t WarmupFrameCount = 30;
+
+	// 全員が同じポーズにならないよう，アクターごとにフレームをずらす
+	constexpr uint32_t ActorFrameOffset = 7;
+
+	// プロファイラの負荷は揺らぎより小さいので，同じフレームを交互に測った最小値で比べる
+	constexpr uint32_t ProfilerRepeatCount = 3;
+
+	// Profileなら，本体と同じくアクターごとに区間を記録し，フレームごとに集計する
+	template<bool Profile>
+	float step(vector<PMDSkeleton> & skeletons, const VMDMotion & motion, uint32_t begin_frame, uint32_t frame_count)
+	{
+		float checksum = 0.0f;
+		for(uint32_t frame = begin_frame; frame < begin_frame + frame_count; ++frame)
+		{
+			PROFILE_SCOPE("Frame");
+			NO_ALLOCATION_SCOPE("Frame");
+
+			for(uint32_t i = 0; i < skeletons.size(); ++i)
+			{
+				auto & skeleton = skeletons[i];
+				auto update = [&]()
+				{
+					skeleton.update(motion, (frame + i * ActorFrameOffset) % motion.getMaxFrame());
+					skeleton.solveIK();
+				};
+
+				if constexpr(Profile)
+				{
+					profiler::Scope scope("Skeleton");
+					update();
+				}
+				else
+				{
+					update();
+				}
+
+				checksum += XMVectorGetX(skeleton.getBoneMatrices().back().r[3]);
+			}
+
+			if constexpr(Profile)
+			{
+				profiler::endFrame();
+			}
+		}
+
+		return checksum;
+	}
+
+	template<bool Profile>
+	double measureStep(vector<PMDSkeleton> & skeletons, const VMDMotion & motion, uint32_t begin_frame, uint32_t frame_count, float & checksum)
+	{
+		auto start = chrono::steady_clock::now();
+		checksum += step<Profile>(skeletons, motion, begin_frame, frame_count);
+
+		return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+	}
+
+	// モーションの全フレームを補間する時間 (トラック1本あたり)
+	template<typename Motion>
+	double measureSampling(const Motion & motion, uint32_t frame_count, uint32_t track_count, float & checksum)
+	{
+		vector<VMDMotion::TrackPose> poses(track_count);
+
+		auto start = chrono::steady_clock::now();
+		for(uint32_t frame = 0; frame < frame_count; ++frame)
+		{
+			motion.sample(frame, poses.data());
+			checksum += XMVectorGetX(poses.back().rotation);
+		}
+		auto elapsed_nanoseconds = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+		return elapsed_nanoseconds / (static_cast<double>(frame_count) * track_count);
+	}
+}
+
+// animation_benchmark <model.pmd> <motion.vmd> [<frame count> [<max actor count>]]
+int main(int argc, char * argv[])
+{
+	if(argc < 3)
+	{
+		fprintf(stderr, "usage: %s <model.pmd> <motion.vmd> [<frame count> [<max actor count>]]\n", argv[0]);
+		return 1;
+	}
+
+	const uint32_t frame_count = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 300;
+	const uint32_t max_actor_count = argc > 4 ? static_cast<uint32_t>(atoi(argv[4])) : 64;
+	if(frame_count == 0 || max_actor_count == 0)
+	{
+		fprintf(stderr, "error: frame count and max actor count must be positive.\n");
+		return 1;
+	}
+
+	PROFILE_THREAD_NAME("Main");
+
+	pmd::File file;
+	if(!pmd::loadFile(argv[1], file))
+	{
+		fprintf(stderr, "error: failed to load %s.\n", argv[1]);
+		return 1;
+	}
+
+	auto p_motion = make_shared<VMDMotion>();
+	if(!p_motion->load(argv[2]) || p_motion->getMaxFrame() == 0 || p_motion->getTrackCount() == 0)
+	{
+		fprintf(stderr, "error: failed to load %s.\n", argv[2]);
+		return 1;
+	}
+	const auto & motion = *p_motion;
+
+	const auto bone_count = static_cast<uint32_t>(file.bones.size());
+	if(bone_count == 0)
+	{
+		fprintf(stderr, "error: %s has no bones.\n", argv[1]);
+		return 1;
+	}
+
+	float checksum = 0.0f;
+
+	BakedMotion baked_motion;
+	const bool is_baked = baked_motion.bake(p_motion);
+	{
+		const auto & statistics = baked_motion.getStatistics();
+		const double raw_ns = measureSampling(motion, motion.getMaxFrame(), motion.getTrackCount(), checksum);
+		const double baked_ns = measureSampling(baked_motion, motion.getMaxFrame(), motion.getTrackCount(), checksum);
+		printf(
+			"sampling: key frames %.1f ns/track, %llu bytes; baked %.1f ns/track, %llu bytes, %.1f%% of key frames "
+			"(%u constant, %u linear, %u keyed channels, %u keys)\n",
+			raw_ns,
+			static_cast<unsigned long long>(statistics.rawBytes),
+			baked_ns,
+			static_cast<unsigned long long>(statistics.bakedBytes),
+			100.0 * statistics.bakedBytes / max<uint64_t>(statistics.rawBytes, 1),
+			statistics.constantChannelCount,
+			statistics.linearChannelCount,
+			statistics.keyedChannelCount,
+			statistics.keyCount
+		);
+	}
+
+	// 焼き込んでキーフレームより大きくなるなら失敗
+	if(!is_baked)
+	{
+		fprintf(stderr, "error: the baked motion is not smaller than the key frames.\n");
+		return 1;
+	}
+
+	printf("bones %u, iks %zu, motion frames %u, frames %u\n", bone_count, file.iks.size(), motion.getMaxFrame(), frame_count);
+	printf("%8s %12s %12s %10s %14s %10s\n", "actors", "total ms", "ns/actor", "ns/bone", "actors/s", "profiler");
+
+	for(uint32_t actor_count = 1; actor_count <= max_actor_count; actor_count *= 2)
+	{
+		vector<PMDSkeleton> skeletons(actor_count);
+		for(auto & skeleton : skeletons)
+		{
+			skeleton.initialize(file);
+		}
+
+		checksum += step<false>(skeletons, motion, 0, WarmupFrameCount);
+		// 集計の配列が伸びきるまで，一度は集計の周期を回しておく
+		checksum += step<true>(skeletons, motion, 0, profiler::SummaryFrameCount);
+		allocation_tracker::resetViolations();
+
+		// 30fps固定で進めるので，実行ごとに同じフレームを評価する
+		const double elapsed_nanoseconds = measureStep<false>(skeletons, motion, WarmupFrameCount, frame_count, checksum);
+
+		double plain_nanoseconds = 0.0;
+		double profiled_nanoseconds = 0.0;
+		for(uint32_t frame = WarmupFrameCount; frame < WarmupFrameCount + frame_count; ++frame)
+		{
+			double plain_frame_nanoseconds = DBL_MAX;
+			double profiled_frame_nanoseconds = DBL_MAX;
+			for(uint32_t repeat = 0; repeat < ProfilerRepeatCount; ++repeat)
+			{
+				plain_frame_nanoseconds = min(plain_frame_nanoseconds, measureStep<false>(skeletons, motion, frame, 1, checksum));
+				profiled_frame_nanoseconds = min(profiled_frame_nanoseconds, measureStep<true>(skeletons, motion, frame, 1, checksum));
+			}
+
+			plain_nanoseconds += plain_frame_nanoseconds;
+			profiled_nanoseconds += profiled_frame_nanoseconds;
+		}
+
+		const double ns_per_actor = elapsed_nanoseconds / (static_cast<double>(frame_count) * actor_count);
+		printf(
+			"%8u %12.3f %12.1f %10.2f %14.0f %+9.2f%%\n",
+			actor_count,
+			elapsed_nanoseconds / 1000000.0,
+			ns_per_actor,
+			ns_per_actor / bone_count,
+			1000000000.0 / ns_per_actor,
+			100.0 * (profiled_nanoseconds - plain_nanoseconds) / plain_nanoseconds
+		);
+
+		// ウォームアップ後のフレームでは確保しないこと
+		if(allocation_tracker::getViolationCount() > 0)
+		{
+			fprintf(
+				stderr,
+				"error: %llu allocations in \"%s\" after warm-up with %u actors.\n",
+				static_cast<unsigned long long>(allocation_tracker::getViolationCount()),
+				allocation_tracker::getLastViolationName(),
+				actor_count
+			);
+			return 1;
+		}
+	}
+
+	printf("checksum %f\n", checksum);
+
+	PROFILE_WRITE_TRACE("animation_benchmark.json");
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+﻿#include "animation_clock.h"
+#include <algorithm>
+
+using namespace std;
+
+void AnimationClock::setRealTime()
+{
+	mMode = Mode::RealTime;
+	reset();
+}
+
+void AnimationClock::setFixedStep(double frames_per_tick)
+{
+	mMode = Mode::FixedStep;
+	mFramesPerTick = frames_per_tick;
+	reset();
+}
+
+void AnimationClock::setScripted(std::vector<double> frames)
+{
+	mMode = Mode::Scripted;
+	mScript = move(frames);
+	reset();
+}
+
+void AnimationClock::reset()
+{
+	mFrame = 0.0;
+	mTickCount = 0;
+	mStartTime = chrono::steady_clock::now();
+}
+
+void AnimationClock::tick()
+{
+	switch(mMode)
+	{
+	case Mode::RealTime:
+		mFrame = chrono::duration<double>(chrono::steady_clock::now() - mStartTime).count() * FramesPerSecond;
+		break;
+	case Mode::FixedStep:
+		mFrame = mFramesPerTick * mTickCount;
+		break;
+	case Mode::Scripted:
+		mFrame = mScript.empty() ? 0.0 : mScript[min<size_t>(mTickCount, mScript.size() - 1)];
+		break;
+	}
+
+	++mTickCount;
+}
@@ -0,0 +1,50 @@
+﻿#pragma once
+#ifndef ANIMATION_CLOCK_H_INCLUDED
+#define ANIMATION_CLOCK_H_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// モーションの再生時刻．単位はVMDのフレーム(30fps)
+// 実時間，1ティックごとに一定量進める固定ステップ，指定した時刻を順に返すスクリプトを切り替えられる
+class AnimationClock
+{
+public:
+	enum class Mode
+	{
+		RealTime,
+		FixedStep,
+		Scripted,
+	};
+
+	static constexpr double FramesPerSecond = 30.0;
+
+	// モードを切り替えると時刻は0に戻る
+	void setRealTime();
+	void setFixedStep(double frames_per_tick = 1.0);
+	void setScripted(std::vector<double> frames);
+
+	void reset();
+
+	// 描画フレームごとに1回呼ぶ．最初のティックの時刻は0
+	void tick();
+
+	Mode getMode() const { return mMode; }
+	double getFrame() const { return mFrame; }
+	uint64_t getTickCount() const { return mTickCount; }
+
+private:
+	Mode mMode = Mode::RealTime;
+	double mFrame = 0.0;
+	uint64_t mTickCount = 0;
+
+	std::chrono::steady_clock::time_point mStartTime = std::chrono::steady_clock::now();
+
+	double mFramesPerTick = 1.0;
+
+	// 最後まで進んだら最後の時刻に留まる
+	std::vector<double> mScript;
+};
+
+#endif // ANIMATION_CLOCK_H_INCLUDED
@@ -0,0 +1,71 @@
+﻿#include "animation_lod.h"
+#include <algorithm>
+
+using namespace std;
+using namespace DirectX;
+
+AnimationLODPolicy::AnimationLODPolicy()
+{
+	// IKはこれまでどおり無効にしておく
+	const AnimationLOD default_lods[]
+	{
+		{ 0.25f, 1, 0, false },
+		{ 0.1f, 2, 1, false },
+		{ 0.04f, 4, 2, false },
+		{ 0.0f, 8, 3, false },
+	};
+
+	setLODs(default_lods, static_cast<uint32_t>(size(default_lods)));
+}
+
+bool AnimationLODPolicy::setLODs(const AnimationLOD * p_lods, uint32_t lod_count)
+{
+	if(lod_count == 0 || lod_count > MaxLODCount)
+	{
+		return false;
+	}
+
+	for(uint32_t i = 0; i < lod_count; ++i)
+	{
+		if(p_lods[i].frameStep == 0 || (i > 0 && p_lods[i].minScreenHeight > p_lods[i - 1].minScreenHeight))
+		{
+			return false;
+		}
+	}
+
+	copy(p_lods, p_lods + lod_count, mLODs.begin());
+	mLODCount = lod_count;
+
+	return true;
+}
+
+uint32_t AnimationLODPolicy::select(float screen_height) const
+{
+	for(uint32_t i = 0; i + 1 < mLODCount; ++i)
+	{
+		if(screen_height >= mLODs[i].minScreenHeight)
+		{
+			return i;
+		}
+	}
+
+	return mLODCount - 1;
+}
+
+float AnimationLODPolicy::computeScreenHeight(
+	DirectX::FXMVECTOR center,
+	float radius,
+	DirectX::CXMMATRIX view,
+	DirectX::CXMMATRIX projection
+)
+{
+	// カメラの中や後ろにあるときは最も詳細にする
+	const float depth = XMVectorGetZ(XMVector3Transform(center, view));
+	if(depth <= radius)
+	{
+		return 1.0f;
+	}
+
+	// 透視投影のy方向の拡大率で，深さdepthにある直径2 * radiusの高さを画面の高さ2に対する割合にする
+	return radius * XMVectorGetY(projection.r[1]) / depth;
+}
@@ -0,0 +1,52 @@
+﻿#pragma once
+#ifndef ANIMATION_LOD_H_INCLUDED
+#define ANIMATION_LOD_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <DirectXMath.h>
+
+// 画面上の大きさで選ぶアニメーションの詳細度
+struct AnimationLOD
+{
+	// 画面の高さに対するアクターの高さの割合．これ以上ならこのLODを使う
+	float minScreenHeight;
+
+	// モーションをサンプリングするフレームの間隔．区切りのポーズをアクターに覚えておき，間のフレームは補間する
+	uint32_t frameStep;
+
+	// 末端からの高さがこれ未満のボーン(指先など)にはモーションを適用せず，親のボーン行列をそのまま使う
+	uint32_t skippedLeafHeight;
+
+	bool solveIK;
+};
+
+class AnimationLODPolicy
+{
+public:
+	static constexpr uint32_t MaxLODCount = 4;
+
+	AnimationLODPolicy();
+
+	// minScreenHeightの大きい順に並べる．最後のLODはそれより小さいもの全部に使う
+	bool setLODs(const AnimationLOD * p_lods, uint32_t lod_count);
+
+	uint32_t getLODCount() const { return mLODCount; }
+	const AnimationLOD & getLOD(uint32_t lod) const { return mLODs[lod]; }
+
+	uint32_t select(float screen_height) const;
+
+	// 中心centerと半径radiusの球が画面の高さに占める割合
+	static float computeScreenHeight(
+		DirectX::FXMVECTOR center,
+		float radius,
+		DirectX::CXMMATRIX view,
+		DirectX::CXMMATRIX projection
+	);
+
+private:
+	std::array<AnimationLOD, MaxLODCount> mLODs;
+	uint32_t mLODCount = 0;
+};
+
+#endif // ANIMATION_LOD_H_INCLUDED
@@ -0,0 +1,493 @@
+﻿#include "asset_archive.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+#include "hash.h"
+#include "lz4_block.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace asset_archive
+{
+	namespace
+	{
+		struct Header
+		{
+			char signature[4];
+			uint32_t version;
+			uint32_t entryCount;
+			uint32_t slotCount;
+			uint64_t entryOffset;
+			uint64_t slotOffset;
+			uint64_t stringOffset;
+			uint64_t stringSize;
+			uint64_t fileSize;
+		};
+
+		constexpr char ArchiveSignature[4] { 'L', 'G', 'A', 'P' };
+
+		uint64_t alignUp(uint64_t value, uint64_t alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		// 範囲がファイルに収まるか．offset + sizeの桁あふれも弾く
+		bool isInside(uint64_t offset, uint64_t size, uint64_t file_size)
+		{
+			return offset <= file_size && size <= file_size - offset;
+		}
+
+		void writePadding(ofstream & fout, uint64_t alignment)
+		{
+			static const char zeros[4096] {};
+			auto padding = alignUp(static_cast<uint64_t>(fout.tellp()), alignment) - static_cast<uint64_t>(fout.tellp());
+			while(padding > 0)
+			{
+				const auto size = min<uint64_t>(padding, sizeof(zeros));
+				fout.write(zeros, size);
+				padding -= size;
+			}
+		}
+	}
+
+	string normalizePath(const filesystem::path & path)
+	{
+		auto normalized_path = path.lexically_normal().generic_u8string();
+		for(auto & c : normalized_path)
+		{
+			if(c >= 'A' && c <= 'Z')
+			{
+				c = static_cast<char>(c - 'A' + 'a');
+			}
+		}
+
+		if(normalized_path.compare(0, 2, "./") == 0)
+		{
+			normalized_path.erase(0, 2);
+		}
+
+		return normalized_path;
+	}
+
+	uint64_t hashPath(const string & normalized_path)
+	{
+		return hashing::xxh64(normalized_path.data(), normalized_path.size());
+	}
+
+	Archive::~Archive()
+	{
+		close();
+	}
+
+	bool Archive::open(const filesystem::path & path)
+	{
+		close();
+
+#if defined(_WIN32)
+		HANDLE h_file = CreateFileW(
+			path.c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			nullptr
+		);
+		if(h_file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER file_size;
+		if(!GetFileSizeEx(h_file, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(sizeof(Header)))
+		{
+			CloseHandle(h_file);
+			return false;
+		}
+
+		// マッピングがファイルを参照し続けるので，ファイルのハンドルはすぐ閉じてよい
+		HANDLE h_mapping = CreateFileMappingW(h_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(h_file);
+		if(h_mapping == nullptr)
+		{
+			return false;
+		}
+
+		auto p_data = MapViewOfFile(h_mapping, FILE_MAP_READ, 0, 0, 0);
+		if(p_data == nullptr)
+		{
+			CloseHandle(h_mapping);
+			return false;
+		}
+
+		mhMapping = h_mapping;
+		mSize = static_cast<uint64_t>(file_size.QuadPart);
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			return false;
+		}
+
+		struct stat file_stat;
+		if(fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(sizeof(Header)))
+		{
+			::close(fd);
+			return false;
+		}
+
+		auto p_data = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(p_data == MAP_FAILED)
+		{
+			return false;
+		}
+
+		mSize = static_cast<uint64_t>(file_stat.st_size);
+#endif
+
+		mpData = static_cast<const uint8_t *>(p_data);
+
+		Header header;
+		memcpy(&header, mpData, sizeof(header));
+		if(
+			!equal(begin(header.signature), end(header.signature), begin(ArchiveSignature)) ||
+			header.version != FormatVersion ||
+			header.fileSize != mSize ||
+			header.slotCount == 0 ||
+			(header.slotCount & (header.slotCount - 1)) != 0 ||
+			header.slotCount <= header.entryCount ||
+			header.entryOffset % alignof(Entry) != 0 ||
+			header.slotOffset % alignof(uint32_t) != 0 ||
+			!isInside(header.entryOffset, sizeof(Entry) * static_cast<uint64_t>(header.entryCount), mSize) ||
+			!isInside(header.slotOffset, sizeof(uint32_t) * static_cast<uint64_t>(header.slotCount), mSize) ||
+			!isInside(header.stringOffset, header.stringSize, mSize)
+		)
+		{
+			close();
+			return false;
+		}
+
+		mpEntries = reinterpret_cast<const Entry *>(mpData + header.entryOffset);
+		mEntryCount = header.entryCount;
+		mpSlots = reinterpret_cast<const uint32_t *>(mpData + header.slotOffset);
+		mSlotCount = header.slotCount;
+		mpStrings = reinterpret_cast<const char *>(mpData + header.stringOffset);
+		mStringSize = header.stringSize;
+
+		if(!validate())
+		{
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	// 読むときに範囲を確かめなくて済むよう，開くときに全てのエントリを確かめる
+	bool Archive::validate() const
+	{
+		for(uint32_t i = 0; i < mEntryCount; ++i)
+		{
+			const auto & entry = mpEntries[i];
+			if(
+				!isInside(entry.offset, entry.storedSize, mSize) ||
+				!isInside(entry.pathOffset, entry.pathLength, mStringSize)
+			)
+			{
+				return false;
+			}
+
+			switch(entry.compression)
+			{
+			case Compression::None:
+				if(entry.storedSize != entry.size)
+				{
+					return false;
+				}
+				break;
+
+			case Compression::LZ4:
+				// LZ4は1バイトから高々255バイトにしか展開しないので，壊れた大きさで巨大な確保をしない
+				if(entry.size / 255 > entry.storedSize)
+				{
+					return false;
+				}
+				break;
+
+			default:
+				return false;
+			}
+		}
+
+		for(uint32_t i = 0; i < mSlotCount; ++i)
+		{
+			if(mpSlots[i] > mEntryCount)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void Archive::close()
+	{
+		if(mpData == nullptr)
+		{
+			return;
+		}
+
+#if defined(_WIN32)
+		UnmapViewOfFile(mpData);
+		CloseHandle(mhMapping);
+#else
+		munmap(const_cast<uint8_t *>(mpData), static_cast<size_t>(mSize));
+#endif
+
+		mpData = nullptr;
+		mSize = 0;
+		mpEntries = nullptr;
+		mEntryCount = 0;
+		mpSlots = nullptr;
+		mSlotCount = 0;
+		mpStrings = nullptr;
+		mStringSize = 0;
+		mhMapping = nullptr;
+	}
+
+	const Entry * Archive::find(const filesystem::path & path) const
+	{
+		if(mpData == nullptr)
+		{
+			return nullptr;
+		}
+
+		const auto normalized_path = normalizePath(path);
+		const auto path_hash = hashPath(normalized_path);
+
+		// 空きは必ずあるが，壊れたファイルでも止まるよう一周で打ち切る
+		const auto mask = mSlotCount - 1;
+		auto slot = static_cast<uint32_t>(path_hash) & mask;
+		for(uint32_t probe = 0; probe < mSlotCount; ++probe, slot = (slot + 1) & mask)
+		{
+			const auto entry_number = mpSlots[slot];
+			if(entry_number == 0)
+			{
+				return nullptr;
+			}
+
+			const auto & entry = mpEntries[entry_number - 1];
+			if(
+				entry.pathHash == path_hash &&
+				entry.pathLength == normalized_path.size() &&
+				normalized_path.compare(0, string::npos, mpStrings + entry.pathOffset, entry.pathLength) == 0
+			)
+			{
+				return &entry;
+			}
+		}
+
+		return nullptr;
+	}
+
+	bool Archive::read(const filesystem::path & path, Data & data) const
+	{
+		const auto p_entry = find(path);
+		if(p_entry == nullptr)
+		{
+			return false;
+		}
+
+		return read(*p_entry, data);
+	}
+
+	bool Archive::read(const Entry & entry, Data & data) const
+	{
+		const auto p_stored = mpData + entry.offset;
+		if(entry.compression == Compression::None)
+		{
+			data.buffer.clear();
+			data.pData = p_stored;
+			data.size = static_cast<size_t>(entry.size);
+
+			return true;
+		}
+
+		data.buffer.resize(static_cast<size_t>(entry.size));
+		data.pData = data.buffer.data();
+		data.size = data.buffer.size();
+
+		if(!lz4::decompress(p_stored, static_cast<size_t>(entry.storedSize), data.buffer.data(), data.buffer.size()))
+		{
+			data = {};
+			return false;
+		}
+
+		return true;
+	}
+
+	string Archive::getEntryPath(const Entry & entry) const
+	{
+		return string(mpStrings + entry.pathOffset, entry.pathLength);
+	}
+
+	bool read(const Archive * p_archive, const filesystem::path & path, Data & data)
+	{
+		if(p_archive != nullptr && p_archive->read(path, data))
+		{
+			return true;
+		}
+
+		return readFile(path, data);
+	}
+
+	bool readFile(const filesystem::path & path, Data & data)
+	{
+		ifstream fin(path, ios::binary | ios::ate);
+		if(!fin)
+		{
+			return false;
+		}
+
+		data.buffer.resize(static_cast<size_t>(fin.tellg()));
+		fin.seekg(0);
+		fin.read(reinterpret_cast<char *>(data.buffer.data()), data.buffer.size());
+		data.pData = data.buffer.data();
+		data.size = data.buffer.size();
+
+		return static_cast<bool>(fin);
+	}
+
+	bool write(const filesystem::path & path, const vector<Source> & sources, const WriteOptions & options)
+	{
+		if(options.alignment == 0 || (options.alignment & (options.alignment - 1)) != 0)
+		{
+			return false;
+		}
+
+		auto tmp_path = path;
+		tmp_path += ".tmp";
+
+		vector<Entry> entries;
+		string strings;
+		{
+			ofstream fout(tmp_path, ios::binary);
+			if(!fout)
+			{
+				return false;
+			}
+
+			// ヘッダは最後に書き直す
+			Header header {};
+			fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+			unordered_set<string> paths;
+			vector<uint8_t> compressed;
+			for(const auto & source : sources)
+			{
+				const auto normalized_path = normalizePath(source.path);
+				if(!paths.insert(normalized_path).second)
+				{
+					continue;
+				}
+
+				Data data;
+				if(!readFile(source.filePath, data))
+				{
+					return false;
+				}
+
+				Entry entry {};
+				entry.pathHash = hashPath(normalized_path);
+				entry.size = data.size;
+				entry.pathOffset = static_cast<uint32_t>(strings.size());
+				entry.pathLength = static_cast<uint32_t>(normalized_path.size());
+				strings += normalized_path;
+
+				const uint8_t * p_stored = data.pData;
+				entry.storedSize = data.size;
+				entry.compression = Compression::None;
+				if(options.isCompressed && data.size > 0)
+				{
+					compressed.resize(lz4::getCompressBound(data.size));
+					const auto compressed_size = lz4::compress(data.pData, data.size, compressed.data(), compressed.size());
+					if(compressed_size > 0 && compressed_size <= data.size / 8 * 7)
+					{
+						p_stored = compressed.data();
+						entry.storedSize = compressed_size;
+						entry.compression = Compression::LZ4;
+					}
+				}
+
+				// 圧縮したものは展開先にコピーするので，揃えなくてよい
+				if(entry.compression == Compression::None)
+				{
+					writePadding(fout, options.alignment);
+				}
+				entry.offset = static_cast<uint64_t>(fout.tellp());
+				fout.write(reinterpret_cast<const char *>(p_stored), entry.storedSize);
+
+				entries.push_back(entry);
+			}
+
+			// 表の半分以上を空けて，線形探索を短く保つ
+			header.slotCount = 1;
+			while(header.slotCount < entries.size() * 2)
+			{
+				header.slotCount *= 2;
+			}
+
+			vector<uint32_t> slots(header.slotCount, 0);
+			for(uint32_t i = 0; i < entries.size(); ++i)
+			{
+				auto slot = static_cast<uint32_t>(entries[i].pathHash) & (header.slotCount - 1);
+				while(slots[slot] != 0)
+				{
+					slot = (slot + 1) & (header.slotCount - 1);
+				}
+				slots[slot] = i + 1;
+			}
+
+			writePadding(fout, alignof(Entry));
+			header.entryOffset = static_cast<uint64_t>(fout.tellp());
+			fout.write(reinterpret_cast<const char *>(entries.data()), sizeof(Entry) * entries.size());
+
+			header.slotOffset = static_cast<uint64_t>(fout.tellp());
+			fout.write(reinterpret_cast<const char *>(slots.data()), sizeof(uint32_t) * slots.size());
+
+			header.stringOffset = static_cast<uint64_t>(fout.tellp());
+			header.stringSize = strings.size();
+			fout.write(strings.data(), strings.size());
+
+			copy(begin(ArchiveSignature), end(ArchiveSignature), begin(header.signature));
+			header.version = FormatVersion;
+			header.entryCount = static_cast<uint32_t>(entries.size());
+			header.fileSize = static_cast<uint64_t>(fout.tellp());
+			fout.seekp(0);
+			fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+			if(!fout)
+			{
+				return false;
+			}
+		}
+
+		error_code error;
+		filesystem::rename(tmp_path, path, error);
+
+		return !error;
+	}
+}
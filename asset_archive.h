@@ -0,0 +1,108 @@
+﻿#pragma once
+#ifndef ASSET_ARCHIVE_H_INCLUDED
+#define ASSET_ARCHIVE_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// モデル，モーション，テクスチャを1つにまとめたファイル
+// ヘッダ | データ | エントリ表 | パスのハッシュ表 | パスの文字列 の順に並べ，全体をメモリにマップして読む
+// 圧縮しないデータはアラインして置くので，マップしたメモリをコピーせずに渡せる
+namespace asset_archive
+{
+	constexpr uint32_t FormatVersion = 1;
+
+	enum class Compression : uint32_t
+	{
+		None,
+		LZ4,
+	};
+
+	struct Entry
+	{
+		uint64_t pathHash;
+		uint64_t offset;
+		uint64_t storedSize;
+		uint64_t size;
+		uint32_t pathOffset;
+		uint32_t pathLength;
+		Compression compression;
+		uint32_t reserved;
+	};
+
+	// 読んだファイルの中身．圧縮していないエントリはアーカイブのメモリを直接指すので，アーカイブより長く持たない
+	struct Data
+	{
+		const uint8_t * pData = nullptr;
+		size_t size = 0;
+		std::vector<uint8_t> buffer;
+	};
+
+	// 区切りを/にして小文字にしたパス．大文字と小文字の違うパスは同じファイルとして扱う
+	std::string normalizePath(const std::filesystem::path & path);
+	uint64_t hashPath(const std::string & normalized_path);
+
+	class Archive
+	{
+	public:
+		Archive() = default;
+		~Archive();
+		Archive(const Archive &) = delete;
+		Archive & operator=(const Archive &) = delete;
+
+		bool open(const std::filesystem::path & path);
+		void close();
+		bool isOpen() const { return mpData != nullptr; }
+
+		// ハッシュ表を引き，衝突したときはパスの文字列を比べる
+		const Entry * find(const std::filesystem::path & path) const;
+		bool read(const std::filesystem::path & path, Data & data) const;
+		bool read(const Entry & entry, Data & data) const;
+
+		uint32_t getEntryCount() const { return mEntryCount; }
+		const Entry & getEntry(uint32_t index) const { return mpEntries[index]; }
+		std::string getEntryPath(const Entry & entry) const;
+		uint64_t getFileSize() const { return mSize; }
+
+	private:
+		bool validate() const;
+
+	private:
+		const uint8_t * mpData = nullptr;
+		uint64_t mSize = 0;
+		const Entry * mpEntries = nullptr;
+		uint32_t mEntryCount = 0;
+		const uint32_t * mpSlots = nullptr;
+		uint32_t mSlotCount = 0;
+		const char * mpStrings = nullptr;
+		uint64_t mStringSize = 0;
+
+		// マップの解放に使う．WindowsではファイルマッピングのHANDLE
+		void * mhMapping = nullptr;
+	};
+
+	// アーカイブになければファイルを読む．p_archiveはnullptrでもよい
+	bool read(const Archive * p_archive, const std::filesystem::path & path, Data & data);
+	bool readFile(const std::filesystem::path & path, Data & data);
+
+	struct Source
+	{
+		// アーカイブの中でのパス
+		std::filesystem::path path;
+		std::filesystem::path filePath;
+	};
+
+	struct WriteOptions
+	{
+		bool isCompressed = false;
+		// 圧縮しないデータの先頭を揃える大きさ．2の累乗
+		uint32_t alignment = 64;
+	};
+
+	// 圧縮は元の7/8以下に縮むときだけ使う
+	bool write(const std::filesystem::path & path, const std::vector<Source> & sources, const WriteOptions & options);
+}
+
+#endif // ASSET_ARCHIVE_H_INCLUDED
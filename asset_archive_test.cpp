@@ -0,0 +1,389 @@
+﻿#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include "asset_archive.h"
+#include "lz4_block.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	// asset_archive.cppのヘッダでのフィールドの位置
+	constexpr size_t HeaderSize = 56;
+	constexpr size_t SignatureOffset = 0;
+	constexpr size_t VersionOffset = 4;
+	constexpr size_t EntryCountOffset = 8;
+	constexpr size_t SlotCountOffset = 12;
+	constexpr size_t EntryTableOffset = 16;
+	constexpr size_t SlotTableOffset = 24;
+	constexpr size_t StringTableOffset = 32;
+
+	void writeFile(const filesystem::path & path, const vector<uint8_t> & bytes)
+	{
+		ofstream fout(path, ios::out | ios::binary | ios::trunc);
+		fout.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+	}
+
+	vector<uint8_t> readFile(const filesystem::path & path)
+	{
+		ifstream fin(path, ios::binary);
+		return vector<uint8_t>(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+	}
+
+	template<typename T>
+	T get(const vector<uint8_t> & bytes, size_t offset)
+	{
+		T value;
+		memcpy(&value, bytes.data() + offset, sizeof(value));
+		return value;
+	}
+
+	template<typename T>
+	void set(vector<uint8_t> & bytes, size_t offset, T value)
+	{
+		memcpy(bytes.data() + offset, &value, sizeof(value));
+	}
+
+	// 繰り返しの多いテキストと，圧縮できない乱数
+	vector<uint8_t> makeText(size_t size)
+	{
+		const string words = "bone motion texture model archive ";
+		vector<uint8_t> bytes(size);
+		for(size_t i = 0; i < size; ++i)
+		{
+			bytes[i] = static_cast<uint8_t>(words[(i * 7 / 5) % words.size()]);
+		}
+		return bytes;
+	}
+
+	vector<uint8_t> makeNoise(size_t size, uint32_t seed)
+	{
+		mt19937 random(seed);
+		vector<uint8_t> bytes(size);
+		for(auto & byte : bytes)
+		{
+			byte = static_cast<uint8_t>(random());
+		}
+		return bytes;
+	}
+
+	bool decompress(const vector<uint8_t> & compressed, size_t size, vector<uint8_t> & output)
+	{
+		output.assign(size, 0);
+		return lz4::decompress(compressed.data(), compressed.size(), output.data(), output.size());
+	}
+
+	vector<uint8_t> compress(const vector<uint8_t> & source)
+	{
+		vector<uint8_t> compressed(lz4::getCompressBound(source.size()));
+		compressed.resize(lz4::compress(source.data(), source.size(), compressed.data(), compressed.size()));
+		return compressed;
+	}
+
+	// 圧縮したものが元に戻り，大きさが違えば失敗する
+	void testLZ4RoundTrip()
+	{
+		const vector<vector<uint8_t>> sources {
+			{},
+			makeText(5),
+			makeText(11),
+			makeText(4096),
+			// 255より長い一致とリテラルで，長さの続きのバイトを使う
+			vector<uint8_t>(1000, 'a'),
+			makeNoise(600, 1),
+			makeNoise(100000, 2),
+		};
+
+		for(const auto & source : sources)
+		{
+			const auto compressed = compress(source);
+			expect(!compressed.empty(), "compression failed with the bound capacity.");
+
+			vector<uint8_t> output;
+			expect(decompress(compressed, source.size(), output) && output == source, "decompression did not restore the source.");
+			expect(!decompress(compressed, source.size() + 1, output), "decompression into a larger buffer succeeded.");
+			if(!source.empty())
+			{
+				expect(!decompress(compressed, source.size() - 1, output), "decompression into a smaller buffer succeeded.");
+			}
+		}
+
+		const auto text = makeText(4096);
+		expect(compress(text).size() < text.size() / 4, "repetitive text was not compressed.");
+
+		vector<uint8_t> small(16);
+		expect(lz4::compress(text.data(), text.size(), small.data(), small.size()) == 0, "compression into a small buffer did not fail.");
+	}
+
+	// 壊れたストリームは範囲外を読み書きせずに失敗する
+	void testLZ4Corruption()
+	{
+		const auto source = makeText(4096);
+		const auto compressed = compress(source);
+
+		vector<uint8_t> output;
+		for(size_t size = 0; size < compressed.size(); ++size)
+		{
+			const vector<uint8_t> truncated(compressed.begin(), compressed.begin() + size);
+			if(decompress(truncated, source.size(), output))
+			{
+				expect(false, "a truncated stream was decompressed.");
+				break;
+			}
+		}
+
+		// 一致の長さが1バイト延びると，出力に収まらない
+		expect(decompress({ 0x10, 'a', 0x01, 0x00 }, 5, output), "a valid hand-written stream failed.");
+		expect(output == vector<uint8_t>(5, 'a'), "an overlapping match was copied wrong.");
+
+		expect(!decompress({ 0x10, 'a', 0x00, 0x00 }, 5, output), "a zero offset was accepted.");
+		expect(!decompress({ 0x10, 'a', 0x02, 0x00 }, 5, output), "an offset before the output was accepted.");
+		expect(!decompress({ 0x10, 'a', 0x01 }, 5, output), "a truncated offset was accepted.");
+		expect(!decompress({ 0x50, 'a' }, 5, output), "a literal past the input was accepted.");
+		expect(!decompress({ 0x50, 'a', 'b', 'c', 'd', 'e' }, 4, output), "a literal past the output was accepted.");
+		expect(!decompress({ 0xf0, 0xff }, 300, output), "a truncated literal length was accepted.");
+		expect(!decompress({ 0x1f, 'a', 0x01, 0x00, 0xff, 0xff, 0x0a }, 10, output), "a match past the output was accepted.");
+	}
+
+	bool writeArchive(const filesystem::path & directory, const filesystem::path & archive_path)
+	{
+		writeFile(directory / "model.pmd", makeText(8192));
+		writeFile(directory / "tex.bin", makeNoise(3000, 3));
+		writeFile(directory / "empty.vmd", {});
+
+		const vector<asset_archive::Source> sources {
+			{ "Model/Model.pmd", directory / "model.pmd" },
+			{ "./model/texture.png", directory / "tex.bin" },
+			{ "motion/empty.vmd", directory / "empty.vmd" },
+			// 同じパスは最初のものだけを入れる
+			{ "model/model.pmd", directory / "tex.bin" },
+		};
+
+		asset_archive::WriteOptions options;
+		options.isCompressed = true;
+
+		return asset_archive::write(archive_path, sources, options);
+	}
+
+	// 書いたアーカイブを開いて，大文字小文字や./の違うパスでも同じ中身が読める
+	void testArchiveRoundTrip(const filesystem::path & directory)
+	{
+		const auto archive_path = directory / "round_trip.pak";
+		expect(writeArchive(directory, archive_path), "failed to write an archive.");
+
+		asset_archive::Archive archive;
+		if(!archive.open(archive_path))
+		{
+			expect(false, "failed to open a written archive.");
+			return;
+		}
+
+		expect(archive.getEntryCount() == 3, "a duplicate path was written.");
+
+		asset_archive::Data data;
+		expect(archive.read("model/model.pmd", data), "failed to read a compressed entry.");
+		expect(vector<uint8_t>(data.pData, data.pData + data.size) == makeText(8192), "a compressed entry changed.");
+
+		const auto p_model = archive.find("./Model/../model/./MODEL.PMD");
+		expect(p_model != nullptr && p_model->compression == asset_archive::Compression::LZ4, "a compressible entry was not compressed.");
+		expect(p_model != nullptr && archive.getEntryPath(*p_model) == "model/model.pmd", "the entry path is not normalized.");
+
+		expect(archive.read("Model/Texture.PNG", data), "failed to read a stored entry.");
+		expect(vector<uint8_t>(data.pData, data.pData + data.size) == makeNoise(3000, 3), "a stored entry changed.");
+		expect(data.buffer.empty() && reinterpret_cast<uintptr_t>(data.pData) % 64 == 0, "a stored entry was copied or not aligned.");
+
+		expect(archive.read("motion/empty.vmd", data) && data.size == 0, "failed to read an empty entry.");
+
+		expect(archive.find("model/missing.pmd") == nullptr, "a missing path was found.");
+		expect(!archive.read("model/missing.pmd", data), "a missing path was read.");
+
+		// アーカイブに無ければファイルを読む
+		expect(
+			asset_archive::read(&archive, directory / "model.pmd", data) && data.size == 8192,
+			"a path outside the archive did not fall back to the file."
+		);
+	}
+
+	// ヘッダ，エントリ，ハッシュ表のどれかが壊れていれば開かず，壊れたLZ4は読まない
+	void testArchiveCorruption(const filesystem::path & directory)
+	{
+		const auto archive_path = directory / "source.pak";
+		if(!writeArchive(directory, archive_path))
+		{
+			expect(false, "failed to write an archive.");
+			return;
+		}
+
+		const auto original = readFile(archive_path);
+		const auto entry_offset = static_cast<size_t>(get<uint64_t>(original, EntryTableOffset));
+		const auto slot_offset = static_cast<size_t>(get<uint64_t>(original, SlotTableOffset));
+		const auto slot_count = get<uint32_t>(original, SlotCountOffset);
+		// 最初のエントリは圧縮したmodel.pmd
+		const auto model_offset = entry_offset;
+
+		const auto corrupted_path = directory / "corrupted.pak";
+		auto opens = [&](const function<void(vector<uint8_t> &)> & corrupt)
+		{
+			auto bytes = original;
+			corrupt(bytes);
+			writeFile(corrupted_path, bytes);
+
+			asset_archive::Archive archive;
+			return archive.open(corrupted_path);
+		};
+
+		expect(opens([](vector<uint8_t> &) {}), "an unmodified archive did not open.");
+
+		expect(!opens([](vector<uint8_t> & bytes) { bytes.resize(HeaderSize - 1); }), "a file shorter than the header opened.");
+		expect(!opens([](vector<uint8_t> & bytes) { bytes.pop_back(); }), "a truncated archive opened.");
+		expect(!opens([](vector<uint8_t> & bytes) { bytes.push_back(0); }), "an archive with trailing bytes opened.");
+
+		expect(!opens([](vector<uint8_t> & bytes) { bytes[SignatureOffset] ^= 0xff; }), "a wrong signature was accepted.");
+		expect(!opens([](vector<uint8_t> & bytes) { set<uint32_t>(bytes, VersionOffset, asset_archive::FormatVersion + 1); }), "a wrong version was accepted.");
+		expect(!opens([](vector<uint8_t> & bytes) { set<uint32_t>(bytes, SlotCountOffset, 0); }), "an empty hash table was accepted.");
+		expect(!opens([](vector<uint8_t> & bytes) { set<uint32_t>(bytes, SlotCountOffset, 3); }), "a hash table size that is not a power of two was accepted.");
+		expect(!opens([&](vector<uint8_t> & bytes) { set<uint32_t>(bytes, EntryCountOffset, slot_count); }), "a full hash table was accepted.");
+		expect(!opens([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, EntryTableOffset, entry_offset + 1); }), "a misaligned entry table was accepted.");
+		expect(!opens([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, EntryTableOffset, bytes.size() / 8 * 8); }), "an entry table past the end was accepted.");
+		expect(!opens([](vector<uint8_t> & bytes) { set<uint64_t>(bytes, StringTableOffset, UINT64_MAX - 1); }), "a string table offset that overflows was accepted.");
+
+		auto entry_field = [&](size_t field) { return model_offset + field; };
+		expect(
+			!opens([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, entry_field(offsetof(asset_archive::Entry, offset)), bytes.size()); }),
+			"an entry past the end was accepted."
+		);
+		expect(
+			!opens([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, entry_field(offsetof(asset_archive::Entry, storedSize)), UINT64_MAX - 8); }),
+			"an entry size that overflows was accepted."
+		);
+		expect(
+			!opens([&](vector<uint8_t> & bytes) { set<uint32_t>(bytes, entry_field(offsetof(asset_archive::Entry, pathOffset)), 1000); }),
+			"a path past the string table was accepted."
+		);
+		expect(
+			!opens([&](vector<uint8_t> & bytes) { set<uint32_t>(bytes, entry_field(offsetof(asset_archive::Entry, compression)), 7); }),
+			"an unknown compression was accepted."
+		);
+		expect(
+			!opens([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, entry_field(offsetof(asset_archive::Entry, size)), UINT64_MAX); }),
+			"an LZ4 entry with an impossible size was accepted."
+		);
+		expect(
+			!opens([&](vector<uint8_t> & bytes)
+			{
+				const auto size_field = entry_field(sizeof(asset_archive::Entry) + offsetof(asset_archive::Entry, size));
+				set<uint64_t>(bytes, size_field, get<uint64_t>(bytes, size_field) + 1);
+			}),
+			"a stored entry with a different size was accepted."
+		);
+		expect(
+			!opens([&](vector<uint8_t> & bytes) { set<uint32_t>(bytes, slot_offset, slot_count); }),
+			"a hash slot past the entries was accepted."
+		);
+
+		// 開けても，LZ4のストリームや展開後の大きさが合わなければ読まない
+		auto reads = [&](const function<void(vector<uint8_t> &)> & corrupt)
+		{
+			auto bytes = original;
+			corrupt(bytes);
+			writeFile(corrupted_path, bytes);
+
+			asset_archive::Archive archive;
+			asset_archive::Data data;
+			if(!archive.open(corrupted_path))
+			{
+				expect(false, "an archive with a corrupted LZ4 entry did not open.");
+				return true;
+			}
+
+			const bool is_read = archive.read("model/model.pmd", data);
+			expect(is_read || (data.pData == nullptr && data.size == 0), "a failed read left data behind.");
+			return is_read;
+		};
+
+		const auto stored_size_field = entry_field(offsetof(asset_archive::Entry, storedSize));
+		const auto size_field = entry_field(offsetof(asset_archive::Entry, size));
+		expect(
+			!reads([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, stored_size_field, get<uint64_t>(bytes, stored_size_field) - 1); }),
+			"a truncated LZ4 entry was read."
+		);
+		expect(
+			!reads([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, size_field, get<uint64_t>(bytes, size_field) + 1); }),
+			"an LZ4 entry shorter than its size was read."
+		);
+		expect(
+			!reads([&](vector<uint8_t> & bytes) { set<uint64_t>(bytes, size_field, get<uint64_t>(bytes, size_field) - 1); }),
+			"an LZ4 entry longer than its size was read."
+		);
+		expect(
+			!reads([&](vector<uint8_t> & bytes)
+			{
+				// 最初のリテラルの後ろのオフセットを，出力より前を指すように書き換える
+				auto position = static_cast<size_t>(get<uint64_t>(bytes, entry_field(offsetof(asset_archive::Entry, offset))));
+				size_t literal_length = bytes[position++] >> 4;
+				if(literal_length == 15)
+				{
+					uint8_t value;
+					do
+					{
+						value = bytes[position++];
+						literal_length += value;
+					}
+					while(value == 255);
+				}
+				set<uint16_t>(bytes, position + literal_length, 0xffff);
+			}),
+			"an LZ4 entry with an offset before the output was read."
+		);
+	}
+}
+
+// asset_archive_test
+// アーカイブとLZ4が書いたものを読み戻せて，壊れた入力を範囲外に触れずに拒むことを確かめる
+int main()
+{
+	const auto directory = filesystem::temp_directory_path() / "asset_archive_test";
+	error_code ec;
+	filesystem::remove_all(directory, ec);
+	if(!filesystem::create_directories(directory, ec))
+	{
+		fprintf(stderr, "error: failed to create %s.\n", directory.string().c_str());
+		return 1;
+	}
+
+	testLZ4RoundTrip();
+	testLZ4Corruption();
+	testArchiveRoundTrip(directory);
+	testArchiveCorruption(directory);
+
+	filesystem::remove_all(directory, ec);
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
@@ -0,0 +1,423 @@
+﻿#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "pmd_file.h"
+#include "pmd_skeleton.h"
+#include "vmd_motion.h"
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	// "センター" (Shift-JIS)
+	constexpr char CenterBoneName[] = "\x83\x5a\x83\x93\x83\x5e\x81\x5b";
+
+	constexpr uint16_t NoBone = 0xffff;
+	constexpr float BoneLength = 0.5f;
+	constexpr float PI = 3.14159265f;
+
+	struct Options
+	{
+		uint32_t vertexCount = 3000;
+		uint32_t materialCount = 8;
+		uint32_t chainCount = 8;
+		uint32_t chainLength = 8;
+		uint32_t ikCount = 2;
+		uint32_t ikLength = 2;
+		uint32_t keyFrameCount = 30;
+		uint32_t frameCount = 900;
+		uint32_t seed = 1;
+		filesystem::path modelPath = "generated/model.pmd";
+		filesystem::path motionPath = "generated/motion.vmd";
+	};
+
+	// 実行ごとに同じファイルになるよう，標準の乱数は使わない
+	class Random
+	{
+	public:
+		explicit Random(uint32_t seed) : mState(seed * 2654435761u + 1) {}
+
+		float next()
+		{
+			mState ^= mState << 13;
+			mState ^= mState >> 17;
+			mState ^= mState << 5;
+			return static_cast<float>(mState & 0xffffff) / static_cast<float>(0x1000000);
+		}
+
+		float next(float min, float max) { return min + (max - min) * next(); }
+
+	private:
+		uint32_t mState;
+	};
+
+	void printUsage(const char * program)
+	{
+		fprintf(
+			stderr,
+			"usage: %s [options]\n"
+			"  --vertices <n>       vertex count (3 - 65535)\n"
+			"  --materials <n>      material count\n"
+			"  --chains <n>         bone chains under the center bone (hierarchy width)\n"
+			"  --chain-length <n>   bones per chain (hierarchy depth)\n"
+			"  --iks <n>            IK chain count (at most one per bone chain)\n"
+			"  --ik-length <n>      bones rotated by each IK (less than chain length)\n"
+			"  --keyframes <n>      key frames per bone (at least 2)\n"
+			"  --frames <n>         motion length in frames\n"
+			"  --seed <n>\n"
+			"  --model <path>       output .pmd (default generated/model.pmd)\n"
+			"  --motion <path>      output .vmd (default generated/motion.vmd)\n",
+			program
+		);
+	}
+
+	bool parseOptions(int argc, char * argv[], Options & options)
+	{
+		for(int i = 1; i < argc; ++i)
+		{
+			if(i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const string name = argv[i];
+			const char * value = argv[++i];
+
+			uint32_t * p_number = nullptr;
+			if(name == "--vertices") p_number = &options.vertexCount;
+			else if(name == "--materials") p_number = &options.materialCount;
+			else if(name == "--chains") p_number = &options.chainCount;
+			else if(name == "--chain-length") p_number = &options.chainLength;
+			else if(name == "--iks") p_number = &options.ikCount;
+			else if(name == "--ik-length") p_number = &options.ikLength;
+			else if(name == "--keyframes") p_number = &options.keyFrameCount;
+			else if(name == "--frames") p_number = &options.frameCount;
+			else if(name == "--seed") p_number = &options.seed;
+			else if(name == "--model") options.modelPath = value;
+			else if(name == "--motion") options.motionPath = value;
+			else return false;
+
+			if(p_number != nullptr)
+			{
+				*p_number = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+			}
+		}
+
+		return true;
+	}
+
+	const char * validateOptions(const Options & options)
+	{
+		if(options.vertexCount < 3 || options.vertexCount > 0xffff)
+		{
+			return "vertex count must be in 3 - 65535";
+		}
+		if(options.materialCount == 0 || options.materialCount > (options.vertexCount - 2))
+		{
+			return "material count must be in 1 - (vertex count - 2)";
+		}
+		if(options.chainCount == 0 || options.chainLength == 0)
+		{
+			return "chain count and chain length must be positive";
+		}
+		if(options.ikCount > options.chainCount)
+		{
+			return "IK count must not exceed chain count";
+		}
+		if(options.ikCount > 0 && (options.ikLength == 0 || options.ikLength >= options.chainLength || options.ikLength > 0xff))
+		{
+			return "IK length must be in 1 - (chain length - 1)";
+		}
+		// センター + チェーン + IKボーン
+		const uint64_t bone_count = 1 + static_cast<uint64_t>(options.chainCount) * options.chainLength + options.ikCount;
+		if(bone_count >= NoBone)
+		{
+			return "too many bones";
+		}
+		if(options.keyFrameCount < 2 || options.frameCount == 0)
+		{
+			return "key frame count must be at least 2 and frame count must be positive";
+		}
+		return nullptr;
+	}
+
+	uint16_t getChainBoneIndex(const Options & options, uint32_t chain, uint32_t depth)
+	{
+		return static_cast<uint16_t>(1 + chain * options.chainLength + depth);
+	}
+
+	XMFLOAT3 getChainBonePosition(const Options & options, uint32_t chain, uint32_t depth)
+	{
+		// チェーンはセンターから放射状に，少しずつ上に伸ばす
+		const float angle = 2.0f * PI * chain / options.chainCount;
+		const float distance = BoneLength * (depth + 1);
+		return XMFLOAT3(cosf(angle) * distance, 10.0f + distance * 0.25f, sinf(angle) * distance);
+	}
+
+	void generateBones(const Options & options, pmd::File & file)
+	{
+		pmd::FileBone center {};
+		memcpy(center.boneName, CenterBoneName, sizeof(CenterBoneName));
+		center.parentNo = NoBone;
+		center.nextNo = NoBone;
+		center.type = 1;
+		center.pos = XMFLOAT3(0.0f, 10.0f, 0.0f);
+		file.bones.push_back(center);
+
+		for(uint32_t chain = 0; chain < options.chainCount; ++chain)
+		{
+			for(uint32_t depth = 0; depth < options.chainLength; ++depth)
+			{
+				// ボーン数が0xffff未満なので名前は11文字までに収まり，VMDの15バイトにも入る．
+				// 書式の上での最長に合わせた場所に書いてから，終端を残して写す
+				char name[sizeof("bone4294967295_4294967295")];
+				const int name_length = snprintf(name, sizeof(name), "bone%u_%u", chain, depth);
+
+				pmd::FileBone bone {};
+				memcpy(bone.boneName, name, min(static_cast<size_t>(name_length), sizeof(bone.boneName) - 1));
+				bone.parentNo = depth == 0 ? 0 : getChainBoneIndex(options, chain, depth - 1);
+				bone.nextNo = depth + 1 < options.chainLength ? getChainBoneIndex(options, chain, depth + 1) : NoBone;
+				bone.pos = getChainBonePosition(options, chain, depth);
+				file.bones.push_back(bone);
+			}
+		}
+
+		// IKボーンはセンターの子にして，チェーンの先端に置く
+		for(uint32_t i = 0; i < options.ikCount; ++i)
+		{
+			const uint32_t chain = i * options.chainCount / options.ikCount;
+			const auto ik_bone_index = static_cast<uint16_t>(file.bones.size());
+			const auto target_index = getChainBoneIndex(options, chain, options.chainLength - 1);
+
+			pmd::FileBone ik_bone {};
+			snprintf(ik_bone.boneName, sizeof(ik_bone.boneName), "ik%u", i);
+			ik_bone.parentNo = 0;
+			ik_bone.nextNo = NoBone;
+			ik_bone.type = 2;
+			ik_bone.ikBoneNo = target_index;
+			ik_bone.pos = file.bones[target_index].pos;
+			file.bones.push_back(ik_bone);
+
+			pmd::FileIK ik {};
+			ik.boneIndex = ik_bone_index;
+			ik.targetIndex = target_index;
+			ik.iterations = 16;
+			ik.limit = 1.0f;
+			for(uint32_t j = 0; j < options.ikLength; ++j)
+			{
+				const auto node_index = getChainBoneIndex(options, chain, options.chainLength - 2 - j);
+				file.bones[node_index].type = 4;
+				ik.nodeIndices.push_back(node_index);
+			}
+			file.iks.push_back(move(ik));
+		}
+	}
+
+	void generateMesh(const Options & options, Random & random, pmd::File & file)
+	{
+		// センター以外のチェーンのボーンに頂点を割り振る
+		const uint32_t chain_bone_count = options.chainCount * options.chainLength;
+		for(uint32_t i = 0; i < options.vertexCount; ++i)
+		{
+			const auto bone_index = static_cast<uint16_t>(1 + i % chain_bone_count);
+			const auto & bone = file.bones[bone_index];
+
+			pmd::FileVertex vertex {};
+			vertex.position = XMFLOAT3(
+				bone.pos.x + random.next(-0.2f, 0.2f),
+				bone.pos.y + random.next(-0.2f, 0.2f),
+				bone.pos.z + random.next(-0.2f, 0.2f)
+			);
+			XMStoreFloat3(&vertex.normal, XMVector3Normalize(XMVectorSet(random.next(-1.0f, 1.0f), 1.0f, random.next(-1.0f, 1.0f), 0.0f)));
+			vertex.uv = XMFLOAT2(random.next(), random.next());
+			vertex.boneNo[0] = bone_index;
+			vertex.boneNo[1] = bone.parentNo;
+			vertex.boneWeight = static_cast<uint8_t>(50 + random.next() * 50.0f);
+			file.vertices.push_back(vertex);
+		}
+
+		// 隣り合う3頂点で三角形を作る
+		const uint32_t triangle_count = options.vertexCount - 2;
+		for(uint32_t i = 0; i < triangle_count; ++i)
+		{
+			file.indices.push_back(static_cast<uint16_t>(i));
+			file.indices.push_back(static_cast<uint16_t>(i % 2 == 0 ? i + 1 : i + 2));
+			file.indices.push_back(static_cast<uint16_t>(i % 2 == 0 ? i + 2 : i + 1));
+		}
+
+		for(uint32_t i = 0; i < options.materialCount; ++i)
+		{
+			const uint32_t begin = triangle_count * i / options.materialCount;
+			const uint32_t end = triangle_count * (i + 1) / options.materialCount;
+
+			pmd::FileMaterial material {};
+			material.diffuse = XMFLOAT3(random.next(0.2f, 1.0f), random.next(0.2f, 1.0f), random.next(0.2f, 1.0f));
+			material.diffuseAlpha = 1.0f;
+			material.specularity = 5.0f;
+			material.specular = XMFLOAT3(0.1f, 0.1f, 0.1f);
+			material.ambient = XMFLOAT3(material.diffuse.x * 0.5f, material.diffuse.y * 0.5f, material.diffuse.z * 0.5f);
+			material.toonIndex = static_cast<uint8_t>(i % 10);
+			material.edgeFlag = 1;
+			material.indexCount = (end - begin) * 3;
+			file.materials.push_back(material);
+		}
+	}
+
+	void generateMotion(const Options & options, Random & random, const pmd::File & file, vector<VMDMotion::FileKeyFrame> & key_frames)
+	{
+		for(uint16_t bone_index = 0; bone_index < file.bones.size(); ++bone_index)
+		{
+			const auto & bone = file.bones[bone_index];
+			const bool is_movable = bone_index == 0 || bone.type == 2;
+
+			const XMVECTOR axis = XMVector3Normalize(XMVectorSet(random.next(-1.0f, 1.0f), random.next(-1.0f, 1.0f), random.next(-1.0f, 1.0f), 0.0f));
+			const float amplitude = random.next(0.1f, 0.8f);
+			const float phase = random.next(0.0f, 2.0f * PI);
+
+			for(uint32_t i = 0; i < options.keyFrameCount; ++i)
+			{
+				VMDMotion::FileKeyFrame key_frame {};
+				memcpy(key_frame.boneName, bone.boneName, strnlen(bone.boneName, sizeof(key_frame.boneName)));
+				key_frame.frameNo = options.frameCount * i / (options.keyFrameCount - 1);
+
+				const float t = phase + 2.0f * PI * i / (options.keyFrameCount - 1);
+				XMStoreFloat4(&key_frame.quaternion, XMQuaternionRotationAxis(axis, amplitude * sinf(t)));
+				if(is_movable)
+				{
+					key_frame.location = XMFLOAT3(sinf(t) * 0.5f, cosf(t) * 0.25f, 0.0f);
+				}
+
+				// X, Y, Z, 回転の補間曲線 (x1, y1, x2, y2) を4行分並べる
+				const auto x1 = static_cast<uint8_t>(random.next(0.0f, 127.0f));
+				const auto y1 = static_cast<uint8_t>(random.next(0.0f, 127.0f));
+				const auto x2 = static_cast<uint8_t>(random.next(0.0f, 127.0f));
+				const auto y2 = static_cast<uint8_t>(random.next(0.0f, 127.0f));
+				for(uint32_t row = 0; row < 4; ++row)
+				{
+					for(uint32_t channel = 0; channel < 4; ++channel)
+					{
+						key_frame.bezier[row * 16 + 0 + channel] = x1;
+						key_frame.bezier[row * 16 + 4 + channel] = y1;
+						key_frame.bezier[row * 16 + 8 + channel] = x2;
+						key_frame.bezier[row * 16 + 12 + channel] = y2;
+					}
+				}
+
+				key_frames.push_back(key_frame);
+			}
+		}
+	}
+
+	bool createParentDirectory(const filesystem::path & path)
+	{
+		if(!path.has_parent_path())
+		{
+			return true;
+		}
+		error_code error;
+		filesystem::create_directories(path.parent_path(), error);
+		return !error;
+	}
+}
+
+// asset_generator [options]
+// ベンチマーク用のPMDとVMDを作る．同じオプションとシードなら同じファイルになる
+int main(int argc, char * argv[])
+{
+	Options options;
+	if(!parseOptions(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	if(auto p_error = validateOptions(options))
+	{
+		fprintf(stderr, "error: %s.\n", p_error);
+		return 1;
+	}
+
+	Random random(options.seed);
+
+	pmd::File file {};
+	memcpy(file.header.signature, "Pmd", sizeof(file.header.signature));
+	file.header.version = 1.0f;
+	snprintf(file.header.modelName, sizeof(file.header.modelName), "generated%u", options.seed);
+	snprintf(
+		file.header.comment,
+		sizeof(file.header.comment),
+		"vertices %u, materials %u, chains %u x %u, iks %u x %u",
+		options.vertexCount,
+		options.materialCount,
+		options.chainCount,
+		options.chainLength,
+		options.ikCount,
+		options.ikLength
+	);
+
+	generateBones(options, file);
+	generateMesh(options, random, file);
+
+	vector<VMDMotion::FileKeyFrame> key_frames;
+	generateMotion(options, random, file, key_frames);
+
+	if(!createParentDirectory(options.modelPath) || !pmd::saveFile(options.modelPath, file))
+	{
+		fprintf(stderr, "error: failed to write %s.\n", options.modelPath.string().c_str());
+		return 1;
+	}
+
+	if(!createParentDirectory(options.motionPath) || !VMDMotion::saveFile(options.motionPath, file.header.modelName, key_frames))
+	{
+		fprintf(stderr, "error: failed to write %s.\n", options.motionPath.string().c_str());
+		return 1;
+	}
+
+	// PMDActor::loadと同じ経路で読み戻して確認する
+	pmd::File loaded_file;
+	PMDSkeleton skeleton;
+	if(
+		!pmd::loadFile(options.modelPath, loaded_file) ||
+		loaded_file.vertices.size() != file.vertices.size() ||
+		loaded_file.indices.size() != file.indices.size() ||
+		loaded_file.materials.size() != file.materials.size() ||
+		loaded_file.bones.size() != file.bones.size() ||
+		loaded_file.iks.size() != file.iks.size() ||
+		!skeleton.initialize(loaded_file)
+	)
+	{
+		fprintf(stderr, "error: failed to read back %s.\n", options.modelPath.string().c_str());
+		return 1;
+	}
+
+	VMDMotion motion;
+	if(!motion.load(options.motionPath) || motion.getTrackCount() != file.bones.size() || motion.getMaxFrame() != options.frameCount)
+	{
+		fprintf(stderr, "error: failed to read back %s.\n", options.motionPath.string().c_str());
+		return 1;
+	}
+
+	printf(
+		"%s: vertices %zu, indices %zu, materials %zu, bones %zu, iks %zu\n",
+		options.modelPath.string().c_str(),
+		file.vertices.size(),
+		file.indices.size(),
+		file.materials.size(),
+		file.bones.size(),
+		file.iks.size()
+	);
+	printf(
+		"%s: key frames %zu, frames %u\n",
+		options.motionPath.string().c_str(),
+		key_frames.size(),
+		motion.getMaxFrame()
+	);
+
+	return 0;
+}
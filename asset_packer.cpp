@@ -0,0 +1,220 @@
+﻿#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "asset_archive.h"
+
+using namespace std;
+
+namespace
+{
+	struct Options
+	{
+		vector<filesystem::path> inputs;
+		filesystem::path output = "assets.pak";
+		asset_archive::WriteOptions writeOptions;
+		bool verify = false;
+	};
+
+	void printUsage(const char * program)
+	{
+		fprintf(
+			stderr,
+			"usage: %s <file or directory>... [options]\n"
+			"  --output <file>   output archive (default assets.pak)\n"
+			"  --compress        compress entries with LZ4 when they shrink to 7/8 or less\n"
+			"  --alignment <n>   alignment of uncompressed entries, power of two (default 64)\n"
+			"  --verify          read every entry back and compare with the loose files\n"
+			"Paths in the archive are the input paths relative to the current directory.\n",
+			program
+		);
+	}
+
+	bool parseOptions(int argc, char * argv[], Options & options)
+	{
+		for(int i = 1; i < argc; ++i)
+		{
+			const string argument = argv[i];
+			if(argument == "--compress")
+			{
+				options.writeOptions.isCompressed = true;
+				continue;
+			}
+
+			if(argument == "--verify")
+			{
+				options.verify = true;
+				continue;
+			}
+
+			if(argument.compare(0, 2, "--") != 0)
+			{
+				options.inputs.push_back(argument);
+				continue;
+			}
+
+			if(i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char * value = argv[++i];
+			if(argument == "--output")
+			{
+				options.output = value;
+			}
+			else if(argument == "--alignment")
+			{
+				options.writeOptions.alignment = static_cast<uint32_t>(atoi(value));
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		const auto alignment = options.writeOptions.alignment;
+
+		return !options.inputs.empty() && alignment != 0 && (alignment & (alignment - 1)) == 0;
+	}
+
+	// 実行時はカレントディレクトリからの相対パスで引くので，同じ形にする
+	filesystem::path getArchivePath(const filesystem::path & file)
+	{
+		return file.is_absolute() ? file.lexically_proximate(filesystem::current_path()) : file;
+	}
+
+	// 全てのエントリをファイルと比べ，ファイルから読む時間とアーカイブから読む時間を測る
+	bool verify(const Options & options, const vector<asset_archive::Source> & sources)
+	{
+		const auto open_start = chrono::steady_clock::now();
+		asset_archive::Archive archive;
+		if(!archive.open(options.output))
+		{
+			fprintf(stderr, "error: failed to open %s.\n", options.output.string().c_str());
+			return false;
+		}
+		const auto open_seconds = chrono::duration<double>(chrono::steady_clock::now() - open_start).count();
+
+		double file_seconds = 0.0;
+		double archive_seconds = 0.0;
+		uint32_t zero_copy_count = 0;
+		for(const auto & source : sources)
+		{
+			auto start = chrono::steady_clock::now();
+			asset_archive::Data file_data;
+			const bool is_file_read = asset_archive::readFile(source.filePath, file_data);
+			file_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			start = chrono::steady_clock::now();
+			asset_archive::Data archive_data;
+			const bool is_archive_read = archive.read(source.path, archive_data);
+			archive_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if(
+				!is_file_read ||
+				!is_archive_read ||
+				file_data.size != archive_data.size ||
+				(file_data.size > 0 && memcmp(file_data.pData, archive_data.pData, file_data.size) != 0)
+			)
+			{
+				fprintf(stderr, "error: %s differs from the archive.\n", source.filePath.string().c_str());
+				return false;
+			}
+
+			if(archive_data.buffer.empty())
+			{
+				++zero_copy_count;
+			}
+		}
+
+		printf(
+			"verified %u entries (%u without copy), open %.3f ms, loose files %.3f ms, archive %.3f ms\n",
+			archive.getEntryCount(),
+			zero_copy_count,
+			open_seconds * 1000.0,
+			file_seconds * 1000.0,
+			archive_seconds * 1000.0
+		);
+
+		return true;
+	}
+}
+
+// asset_packer <file or directory>... [--output <file>] [--compress] [--alignment <n>] [--verify]
+// モデル，モーション，テクスチャを1つのアーカイブにまとめる
+int main(int argc, char * argv[])
+{
+	Options options;
+	if(!parseOptions(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	vector<asset_archive::Source> sources;
+	for(const auto & input : options.inputs)
+	{
+		if(filesystem::is_directory(input))
+		{
+			for(const auto & entry : filesystem::recursive_directory_iterator(input))
+			{
+				if(entry.is_regular_file())
+				{
+					sources.push_back({ getArchivePath(entry.path()), entry.path() });
+				}
+			}
+		}
+		else
+		{
+			sources.push_back({ getArchivePath(input), input });
+		}
+	}
+
+	const auto start = chrono::steady_clock::now();
+	if(!asset_archive::write(options.output, sources, options.writeOptions))
+	{
+		fprintf(stderr, "error: failed to write %s.\n", options.output.string().c_str());
+		return 1;
+	}
+	const auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	asset_archive::Archive archive;
+	if(!archive.open(options.output))
+	{
+		fprintf(stderr, "error: failed to open %s.\n", options.output.string().c_str());
+		return 1;
+	}
+
+	uint64_t source_size = 0;
+	uint32_t compressed_count = 0;
+	for(uint32_t i = 0; i < archive.getEntryCount(); ++i)
+	{
+		const auto & entry = archive.getEntry(i);
+		source_size += entry.size;
+		if(entry.compression != asset_archive::Compression::None)
+		{
+			++compressed_count;
+		}
+	}
+
+	printf(
+		"%s : %u entries (%u compressed), %.1f KB -> %.1f KB, %.2f ms\n",
+		options.output.string().c_str(),
+		archive.getEntryCount(),
+		compressed_count,
+		source_size / 1024.0,
+		archive.getFileSize() / 1024.0,
+		seconds * 1000.0
+	);
+
+	if(options.verify && !verify(options, sources))
+	{
+		return 1;
+	}
+
+	return 0;
+}
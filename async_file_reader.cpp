@@ -0,0 +1,193 @@
+﻿#include "async_file_reader.h"
+#include <algorithm>
+#include "profiler.h"
+
+using namespace std;
+
+AsyncFileReader::AsyncFileReader(uint32_t thread_count, const asset_archive::Archive * p_archive)
+	: mpArchive(p_archive)
+{
+	if(thread_count == 0)
+	{
+		thread_count = 1;
+	}
+
+	mThreads.reserve(thread_count);
+	for(uint32_t i = 0; i < thread_count; ++i)
+	{
+		mThreads.emplace_back(&AsyncFileReader::workerMain, this);
+	}
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mCondition.notify_all();
+
+	for(auto & t : mThreads)
+	{
+		t.join();
+	}
+}
+
+future<AsyncFileReader::Result> AsyncFileReader::read(const filesystem::path & path)
+{
+	return move(read(vector<filesystem::path> { path }).front());
+}
+
+vector<future<AsyncFileReader::Result>> AsyncFileReader::read(const vector<filesystem::path> & paths)
+{
+	vector<future<Result>> futures;
+	futures.reserve(paths.size());
+
+	vector<function<void()>> tasks;
+	tasks.reserve(paths.size());
+	for(const auto & path : paths)
+	{
+		auto p_promise = make_shared<promise<Result>>();
+		futures.push_back(p_promise->get_future());
+		tasks.emplace_back(
+			[this, path, p_promise]()
+			{
+				Result result;
+				result.path = path;
+				readFile(result);
+				p_promise->set_value(move(result));
+			}
+		);
+	}
+
+	enqueue(tasks);
+
+	return futures;
+}
+
+void AsyncFileReader::read(const vector<filesystem::path> & paths, Callback callback)
+{
+	// 全ての要求で同じcallbackを共有する
+	auto p_callback = make_shared<Callback>(move(callback));
+
+	vector<function<void()>> tasks;
+	tasks.reserve(paths.size());
+	for(const auto & path : paths)
+	{
+		tasks.emplace_back(
+			[this, path, p_callback]()
+			{
+				Result result;
+				result.path = path;
+				readFile(result);
+				(*p_callback)(result);
+			}
+		);
+	}
+
+	enqueue(tasks);
+}
+
+void AsyncFileReader::prefetch(const vector<filesystem::path> & paths)
+{
+	vector<filesystem::path> new_paths;
+	vector<string> keys;
+	for(const auto & path : paths)
+	{
+		auto key = asset_archive::normalizePath(path);
+		if(mPrefetches.count(key) == 0 && find(keys.begin(), keys.end(), key) == keys.end())
+		{
+			new_paths.push_back(path);
+			keys.push_back(move(key));
+		}
+	}
+
+	auto futures = read(new_paths);
+	for(size_t i = 0; i < futures.size(); ++i)
+	{
+		mPrefetches.emplace(move(keys[i]), move(futures[i]));
+	}
+}
+
+bool AsyncFileReader::take(const filesystem::path & path, asset_archive::Data & data)
+{
+	PROFILE_FUNCTION();
+
+	// 同じファイルを何度も使うときは，2回目以降はその場で読む
+	auto it = mPrefetches.find(asset_archive::normalizePath(path));
+	if(it == mPrefetches.end())
+	{
+		++mPrefetchMissCount;
+
+		Result result;
+		result.path = path;
+		readFile(result);
+		data = move(result.data);
+
+		return result.isSucceeded;
+	}
+
+	++mPrefetchHitCount;
+
+	auto result = it->second.get();
+	mPrefetches.erase(it);
+	data = move(result.data);
+
+	return result.isSucceeded;
+}
+
+void AsyncFileReader::enqueue(vector<function<void()>> & tasks)
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		for(auto & task : tasks)
+		{
+			mTasks.push_back(move(task));
+		}
+	}
+
+	if(tasks.size() == 1)
+	{
+		mCondition.notify_one();
+	}
+	else
+	{
+		mCondition.notify_all();
+	}
+}
+
+void AsyncFileReader::readFile(Result & result) const
+{
+	PROFILE_SCOPE("ReadFile");
+
+	result.isSucceeded = asset_archive::read(mpArchive, result.path, result.data);
+	if(!result.isSucceeded)
+	{
+		result.data = {};
+	}
+}
+
+void AsyncFileReader::workerMain()
+{
+	PROFILE_THREAD_NAME("IO");
+
+	while(true)
+	{
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+
+			// 停止時も積まれている要求は最後まで読む
+			if(mTasks.empty())
+			{
+				return;
+			}
+
+			task = move(mTasks.front());
+			mTasks.pop_front();
+		}
+
+		task();
+	}
+}
@@ -0,0 +1,100 @@
+﻿#pragma once
+#ifndef ASYNC_FILE_READER_H_INCLUDED
+#define ASYNC_FILE_READER_H_INCLUDED
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "asset_archive.h"
+
+// ファイルの読み込みだけを受け持つスレッド
+// 読み込みはディスクを待つ間CPUを使わないので，デコード用のThreadPoolとは分け，読み込みとデコードやパースを重ねる
+// 要求はまとめて積み，読み終えたものから結果を返す
+class AsyncFileReader
+{
+public:
+	// ディスクに同時に出す要求の数．SSDは複数の要求を並べた方が速い
+	static constexpr uint32_t DefaultThreadCount = 4;
+
+	struct Result
+	{
+		std::filesystem::path path;
+		asset_archive::Data data;
+		bool isSucceeded = false;
+	};
+
+	// 読み終えたI/Oスレッドで呼ぶ．重い処理をすると他の読み込みが遅れる
+	using Callback = std::function<void(Result & result)>;
+
+	// p_archiveにあるファイルはアーカイブから読む．アーカイブはリーダより長く持つ
+	explicit AsyncFileReader(uint32_t thread_count = DefaultThreadCount, const asset_archive::Archive * p_archive = nullptr);
+	~AsyncFileReader();
+
+	AsyncFileReader(const AsyncFileReader &) = delete;
+	AsyncFileReader & operator=(const AsyncFileReader &) = delete;
+
+	std::future<Result> read(const std::filesystem::path & path);
+
+	// 全てを一度に積んでスレッドを起こす．結果はpathsと同じ順
+	std::vector<std::future<Result>> read(const std::vector<std::filesystem::path> & paths);
+
+	// 読み終えた順にcallbackを呼ぶ
+	void read(const std::vector<std::filesystem::path> & paths, Callback callback);
+
+	// テクスチャのように，読むファイルをI/Oスレッドで選ぶもの
+	template<typename F>
+	std::future<std::invoke_result_t<F>> submit(F && f)
+	{
+		using TaskResult = std::invoke_result_t<F>;
+
+		auto p_task = std::make_shared<std::packaged_task<TaskResult()>>(std::forward<F>(f));
+		auto future = p_task->get_future();
+
+		std::vector<std::function<void()>> tasks;
+		tasks.emplace_back([p_task]() { (*p_task)(); });
+		enqueue(tasks);
+
+		return future;
+	}
+
+	// 後で読むファイルを先に積んでおく．takeはメインスレッドから呼ぶ
+	void prefetch(const std::vector<std::filesystem::path> & paths);
+
+	// 先読みしていれば読み終わるのを待って受け取り，していなければこのスレッドで読む
+	bool take(const std::filesystem::path & path, asset_archive::Data & data);
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(mThreads.size()); }
+	uint32_t getPrefetchHitCount() const { return mPrefetchHitCount; }
+	uint32_t getPrefetchMissCount() const { return mPrefetchMissCount; }
+
+private:
+	void enqueue(std::vector<std::function<void()>> & tasks);
+	void readFile(Result & result) const;
+	void workerMain();
+
+private:
+	const asset_archive::Archive * mpArchive;
+
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<std::function<void()>> mTasks;
+	bool mStopping = false;
+
+	// 正規化したパスごとの先読み
+	std::unordered_map<std::string, std::future<Result>> mPrefetches;
+	uint32_t mPrefetchHitCount = 0;
+	uint32_t mPrefetchMissCount = 0;
+};
+
+#endif // ASYNC_FILE_READER_H_INCLUDED
@@ -0,0 +1,184 @@
+﻿#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "texture_atlas.h"
+
+using namespace std;
+
+namespace
+{
+	// PMDのテクスチャによくある，辺が2の累乗のものと半端なものを混ぜる
+	vector<texture_atlas::Size> generateSizes(uint32_t count, uint32_t max_size)
+	{
+		mt19937 engine(1);
+		uniform_int_distribution<uint32_t> shift(4, 8);
+		uniform_int_distribution<uint32_t> length(8, max_size);
+		bernoulli_distribution is_power_of_two(0.6);
+
+		vector<texture_atlas::Size> sizes(count);
+		for(auto & size : sizes)
+		{
+			if(is_power_of_two(engine))
+			{
+				size.width = min(1u << shift(engine), max_size);
+				size.height = min(1u << shift(engine), max_size);
+			}
+			else
+			{
+				size.width = length(engine);
+				size.height = length(engine);
+			}
+		}
+
+		return sizes;
+	}
+
+	// 区画が重ならず，アトラスからはみ出していないことを確かめる
+	bool validate(
+		const vector<texture_atlas::Size> & sizes,
+		const texture_atlas::PaddingPolicy & policy,
+		const vector<texture_atlas::Size> & atlas_sizes,
+		const vector<texture_atlas::Placement> & placements
+	)
+	{
+		const auto padding = policy.getPadding();
+		for(size_t i = 0; i < placements.size(); ++i)
+		{
+			const auto & a = placements[i];
+			const auto ax = a.rect.x - padding;
+			const auto ay = a.rect.y - padding;
+			const auto aw = policy.getCellSize(sizes[i].width);
+			const auto ah = policy.getCellSize(sizes[i].height);
+			if(ax % policy.getAlignment() != 0 || ay % policy.getAlignment() != 0)
+			{
+				return false;
+			}
+			if(ax + aw > atlas_sizes[a.atlas].width || ay + ah > atlas_sizes[a.atlas].height)
+			{
+				return false;
+			}
+
+			for(size_t j = i + 1; j < placements.size(); ++j)
+			{
+				const auto & b = placements[j];
+				const auto bx = b.rect.x - padding;
+				const auto by = b.rect.y - padding;
+				const auto bw = policy.getCellSize(sizes[j].width);
+				const auto bh = policy.getCellSize(sizes[j].height);
+				if(a.atlas == b.atlas && ax < bx + bw && bx < ax + aw && ay < by + bh && by < ay + ah)
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+}
+
+// atlas_packer_benchmark [--repeat <count>] [--size <max atlas size>] [--mips <count>] [--block <1 or 4>]
+// テクスチャ数を倍にしながら，SkylineとMaxRectsの詰める時間と占有率を比べる
+int main(int argc, char * argv[])
+{
+	uint32_t repeat_count = 20;
+	uint32_t max_size = 2048;
+	texture_atlas::PaddingPolicy policy;
+	for(int i = 1; i < argc; ++i)
+	{
+		const string argument = argv[i];
+		if(i + 1 >= argc)
+		{
+			fprintf(stderr, "usage: %s [--repeat <count>] [--size <max atlas size>] [--mips <count>] [--block <1 or 4>]\n", argv[0]);
+			return 1;
+		}
+
+		const auto value = static_cast<uint32_t>(atoi(argv[++i]));
+		if(argument == "--repeat")
+		{
+			repeat_count = value;
+		}
+		else if(argument == "--size")
+		{
+			max_size = value;
+		}
+		else if(argument == "--mips")
+		{
+			policy.mipCount = value;
+		}
+		else if(argument == "--block")
+		{
+			policy.blockSize = value;
+		}
+	}
+
+	if(repeat_count == 0 || policy.mipCount == 0 || policy.blockSize == 0)
+	{
+		return 1;
+	}
+
+	printf(
+		"max %u, gutter %u, %u mips, padding %u, alignment %u\n",
+		max_size,
+		policy.gutter,
+		policy.mipCount,
+		policy.getPadding(),
+		policy.getAlignment()
+	);
+	printf("   textures  algorithm  atlases  occupancy   ms/pack   us/texture\n");
+
+	for(uint32_t count = 16; count <= 1024; count *= 2)
+	{
+		// 1枚のアトラスに多くの画像が入るよう，画像の大きさはmax_sizeの1/8までにする
+		const auto sizes = generateSizes(count, max_size / 8);
+
+		uint64_t image_area = 0;
+		for(const auto & size : sizes)
+		{
+			image_area += static_cast<uint64_t>(size.width) * size.height;
+		}
+
+		for(const auto algorithm : { texture_atlas::Algorithm::Skyline, texture_atlas::Algorithm::MaxRects })
+		{
+			vector<texture_atlas::Size> atlas_sizes;
+			vector<texture_atlas::Placement> placements;
+
+			const auto start = chrono::steady_clock::now();
+			for(uint32_t repeat = 0; repeat < repeat_count; ++repeat)
+			{
+				if(!texture_atlas::pack(sizes, policy, max_size, algorithm, atlas_sizes, placements))
+				{
+					fprintf(stderr, "error: failed to pack %u textures.\n", count);
+					return 1;
+				}
+			}
+			const auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / repeat_count;
+
+			if(!validate(sizes, policy, atlas_sizes, placements))
+			{
+				fprintf(stderr, "error: %s placed overlapping cells.\n", texture_atlas::getAlgorithmName(algorithm));
+				return 1;
+			}
+
+			uint64_t atlas_area = 0;
+			for(const auto & atlas_size : atlas_sizes)
+			{
+				atlas_area += static_cast<uint64_t>(atlas_size.width) * atlas_size.height;
+			}
+
+			printf(
+				"  %9u  %9s  %7zu  %8.1f%%  %8.3f  %11.2f\n",
+				count,
+				texture_atlas::getAlgorithmName(algorithm),
+				atlas_sizes.size(),
+				100.0 * image_area / atlas_area,
+				seconds * 1000.0,
+				seconds * 1000000.0 / count
+			);
+		}
+	}
+
+	return 0;
+}
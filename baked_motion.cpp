@@ -0,0 +1,414 @@
+﻿#include "baked_motion.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t QuaternionComponentBits = 10;
+	constexpr uint32_t QuaternionComponentMax = (1 << QuaternionComponentBits) - 1;
+
+	// 最大の成分以外は[-1/√2, 1/√2]に収まる
+	constexpr float QuaternionComponentRange = 0.70710678f;
+
+	constexpr float TranslationStepCount = 65535.0f;
+
+	float getQuaternionError(FXMVECTOR a, FXMVECTOR b)
+	{
+		// qと-qは同じ回転
+		return 1.0f - abs(XMVectorGetX(XMQuaternionDot(a, b)));
+	}
+
+	float getTranslationError(FXMVECTOR a, FXMVECTOR b)
+	{
+		return XMVectorGetX(XMVector3Length(XMVectorSubtract(a, b)));
+	}
+
+	// 短い方の弧で線形補間して正規化する．slerpより安く，誤差はキーを選ぶときに同じ補間で測る
+	XMVECTOR nlerpQuaternion(FXMVECTOR q0, FXMVECTOR q1, float t)
+	{
+		const auto is_far = XMVectorLess(XMQuaternionDot(q0, q1), XMVectorZero());
+		const auto near_q1 = XMVectorSelect(q1, XMVectorNegate(q1), is_far);
+
+		return XMQuaternionNormalize(XMVectorLerp(q0, near_q1, t));
+	}
+
+	// 最初のフレームから，間のフレームを両端のキーの補間で許容誤差内に再現できる限りキーを延ばす．
+	// is_within_tolerance(begin, end)はbeginとendの間のフレームを確かめる
+	template<typename IsWithinTolerance>
+	void reduceKeys(uint32_t frame_count, IsWithinTolerance is_within_tolerance, vector<uint16_t> & key_frames)
+	{
+		key_frames.push_back(0);
+
+		uint32_t begin = 0;
+		while(begin + 1 < frame_count)
+		{
+			uint32_t end = begin + 1;
+			while(end + 1 < frame_count && is_within_tolerance(begin, end + 1))
+			{
+				++end;
+			}
+
+			key_frames.push_back(static_cast<uint16_t>(end));
+			begin = end;
+		}
+	}
+
+	// indexを挟む2つのキーの前の方を返し，その間の位置をtに書く
+	uint32_t findKey(const uint16_t * p_key_frames, uint32_t key_count, uint32_t index, float & t)
+	{
+		const auto p_next = upper_bound(p_key_frames + 1, p_key_frames + key_count - 1, index);
+		const auto key = static_cast<uint32_t>(p_next - p_key_frames) - 1;
+		t = static_cast<float>(index - p_key_frames[key]) / static_cast<float>(p_key_frames[key + 1] - p_key_frames[key]);
+
+		return key;
+	}
+}
+
+uint32_t BakedMotion::encodeQuaternion(DirectX::FXMVECTOR q)
+{
+	XMFLOAT4 f;
+	XMStoreFloat4(&f, XMQuaternionNormalize(q));
+	const float components[] { f.x, f.y, f.z, f.w };
+
+	uint32_t largest = 0;
+	for(uint32_t i = 1; i < 4; ++i)
+	{
+		if(abs(components[i]) > abs(components[largest]))
+		{
+			largest = i;
+		}
+	}
+
+	// 最大の成分が正になるように符号を揃えれば，残りの3成分から復元できる
+	const float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+	uint32_t packed = largest << (QuaternionComponentBits * 3);
+	uint32_t shift = QuaternionComponentBits * 2;
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		if(i == largest)
+		{
+			continue;
+		}
+
+		const float normalized = (components[i] * sign / QuaternionComponentRange) * 0.5f + 0.5f;
+		const auto quantized = static_cast<uint32_t>(
+			clamp(lround(normalized * QuaternionComponentMax), 0l, static_cast<long>(QuaternionComponentMax))
+		);
+		packed |= quantized << shift;
+		shift -= QuaternionComponentBits;
+	}
+
+	return packed;
+}
+
+DirectX::XMVECTOR BakedMotion::decodeQuaternion(uint32_t packed)
+{
+	const uint32_t largest = packed >> (QuaternionComponentBits * 3);
+
+	float components[4];
+	float square_sum = 0.0f;
+	uint32_t shift = QuaternionComponentBits * 2;
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		if(i == largest)
+		{
+			continue;
+		}
+
+		const auto quantized = (packed >> shift) & QuaternionComponentMax;
+		components[i] = (static_cast<float>(quantized) / QuaternionComponentMax * 2.0f - 1.0f) * QuaternionComponentRange;
+		square_sum += components[i] * components[i];
+		shift -= QuaternionComponentBits;
+	}
+	components[largest] = sqrt(max(1.0f - square_sum, 0.0f));
+
+	return XMVectorSet(components[0], components[1], components[2], components[3]);
+}
+
+bool BakedMotion::bake(std::shared_ptr<const VMDMotion> p_motion)
+{
+	if(p_motion == nullptr || p_motion->getMaxFrame() == 0 || p_motion->getMaxFrame() > MaxFrameCount)
+	{
+		return false;
+	}
+
+	mpSource = move(p_motion);
+	mFrameCount = mpSource->getMaxFrame();
+
+	const auto & source_tracks = mpSource->getTracks();
+	const auto track_count = static_cast<uint32_t>(source_tracks.size());
+
+	// 全フレームを一度補間しておく．[frame * track_count + track]
+	vector<VMDMotion::TrackPose> poses(static_cast<size_t>(mFrameCount) * track_count);
+	for(uint32_t frame = 0; frame < mFrameCount; ++frame)
+	{
+		mpSource->sample(frame, poses.data() + static_cast<size_t>(frame) * track_count);
+	}
+
+	mTracks.assign(track_count, Track());
+	mRotationKeyFrames.clear();
+	mRotations.clear();
+	mTranslationKeyFrames.clear();
+	mTranslations.clear();
+	mStatistics = Statistics();
+	mStatistics.trackCount = track_count;
+
+	for(uint32_t i = 0; i < track_count; ++i)
+	{
+		auto & track = mTracks[i];
+		auto get_pose = [&](uint32_t frame) -> const VMDMotion::TrackPose &
+		{
+			return poses[static_cast<size_t>(frame) * track_count + i];
+		};
+
+		track.firstFrame = 0;
+		while(track.firstFrame < mFrameCount && !get_pose(track.firstFrame).isValid)
+		{
+			++track.firstFrame;
+		}
+
+		const uint32_t first = min(track.firstFrame, mFrameCount - 1);
+		const uint32_t last = mFrameCount - 1;
+		const uint32_t frame_count = last - first + 1;
+		const float length = static_cast<float>(max(last - first, 1u));
+
+		// 回転
+		{
+			auto r0 = get_pose(first).rotation;
+			auto r1 = get_pose(last).rotation;
+			if(XMVectorGetX(XMQuaternionDot(r0, r1)) < 0.0f)
+			{
+				r1 = XMVectorNegate(r1);
+			}
+
+			bool is_constant = true;
+			bool is_linear = true;
+			for(uint32_t frame = first; frame <= last && (is_constant || is_linear); ++frame)
+			{
+				const auto & rotation = get_pose(frame).rotation;
+				is_constant = is_constant && getQuaternionError(rotation, r0) <= RotationTolerance;
+				is_linear = is_linear && getQuaternionError(rotation, XMQuaternionSlerp(r0, r1, (frame - first) / length)) <= RotationTolerance;
+			}
+
+			XMStoreFloat4(&track.rotations[0], r0);
+			XMStoreFloat4(&track.rotations[1], r1);
+
+			if(is_constant)
+			{
+				track.rotationMode = ChannelMode::Constant;
+				++mStatistics.constantChannelCount;
+			}
+			else if(is_linear)
+			{
+				track.rotationMode = ChannelMode::Linear;
+				++mStatistics.linearChannelCount;
+			}
+			else
+			{
+				// 量子化した後の値で補間して測るので，展開した値も許容誤差に収まる
+				vector<uint32_t> encoded(frame_count);
+				vector<XMVECTOR> decoded(frame_count);
+				for(uint32_t j = 0; j < frame_count; ++j)
+				{
+					encoded[j] = encodeQuaternion(get_pose(first + j).rotation);
+					decoded[j] = decodeQuaternion(encoded[j]);
+				}
+
+				track.rotationMode = ChannelMode::Keyed;
+				track.rotationOffset = static_cast<uint32_t>(mRotationKeyFrames.size());
+				reduceKeys(
+					frame_count,
+					[&](uint32_t begin, uint32_t end)
+					{
+						for(uint32_t j = begin + 1; j < end; ++j)
+						{
+							const auto rotation = nlerpQuaternion(decoded[begin], decoded[end], static_cast<float>(j - begin) / (end - begin));
+							if(getQuaternionError(get_pose(first + j).rotation, rotation) > RotationTolerance)
+							{
+								return false;
+							}
+						}
+						return true;
+					},
+					mRotationKeyFrames
+				);
+				track.rotationKeyCount = static_cast<uint32_t>(mRotationKeyFrames.size()) - track.rotationOffset;
+
+				for(uint32_t key = 0; key < track.rotationKeyCount; ++key)
+				{
+					mRotations.push_back(encoded[mRotationKeyFrames[track.rotationOffset + key]]);
+				}
+				++mStatistics.keyedChannelCount;
+				mStatistics.keyCount += track.rotationKeyCount;
+			}
+		}
+
+		// 移動
+		{
+			const auto t0 = get_pose(first).translation;
+			const auto t1 = get_pose(last).translation;
+
+			bool is_constant = true;
+			bool is_linear = true;
+			auto t_min = t0;
+			auto t_max = t0;
+			for(uint32_t frame = first; frame <= last; ++frame)
+			{
+				const auto & translation = get_pose(frame).translation;
+				is_constant = is_constant && getTranslationError(translation, t0) <= TranslationTolerance;
+				is_linear = is_linear && getTranslationError(translation, XMVectorLerp(t0, t1, (frame - first) / length)) <= TranslationTolerance;
+				t_min = XMVectorMin(t_min, translation);
+				t_max = XMVectorMax(t_max, translation);
+			}
+
+			if(is_constant)
+			{
+				track.translationMode = ChannelMode::Constant;
+				XMStoreFloat3(&track.translations[0], t0);
+				++mStatistics.constantChannelCount;
+			}
+			else if(is_linear)
+			{
+				track.translationMode = ChannelMode::Linear;
+				XMStoreFloat3(&track.translations[0], t0);
+				XMStoreFloat3(&track.translations[1], t1);
+				++mStatistics.linearChannelCount;
+			}
+			else
+			{
+				// 範囲を65535等分して，各成分を16ビットにする
+				const auto step = XMVectorMax(
+					XMVectorDivide(XMVectorSubtract(t_max, t_min), XMVectorReplicate(TranslationStepCount)),
+					XMVectorReplicate(1.0e-7f)
+				);
+
+				track.translationMode = ChannelMode::Keyed;
+				XMStoreFloat3(&track.translations[0], t_min);
+				XMStoreFloat3(&track.translations[1], step);
+
+				vector<uint16_t> quantized(static_cast<size_t>(frame_count) * 3);
+				vector<XMVECTOR> dequantized(frame_count);
+				for(uint32_t j = 0; j < frame_count; ++j)
+				{
+					XMFLOAT3 rounded;
+					XMStoreFloat3(
+						&rounded,
+						XMVectorRound(XMVectorDivide(XMVectorSubtract(get_pose(first + j).translation, t_min), step))
+					);
+					auto * p_quantized = &quantized[j * 3];
+					p_quantized[0] = static_cast<uint16_t>(clamp(rounded.x, 0.0f, TranslationStepCount));
+					p_quantized[1] = static_cast<uint16_t>(clamp(rounded.y, 0.0f, TranslationStepCount));
+					p_quantized[2] = static_cast<uint16_t>(clamp(rounded.z, 0.0f, TranslationStepCount));
+					dequantized[j] = XMVectorMultiplyAdd(XMVectorSet(p_quantized[0], p_quantized[1], p_quantized[2], 0.0f), step, t_min);
+				}
+
+				track.translationOffset = static_cast<uint32_t>(mTranslationKeyFrames.size());
+				reduceKeys(
+					frame_count,
+					[&](uint32_t begin, uint32_t end)
+					{
+						for(uint32_t j = begin + 1; j < end; ++j)
+						{
+							const auto translation = XMVectorLerp(dequantized[begin], dequantized[end], static_cast<float>(j - begin) / (end - begin));
+							if(getTranslationError(get_pose(first + j).translation, translation) > TranslationTolerance)
+							{
+								return false;
+							}
+						}
+						return true;
+					},
+					mTranslationKeyFrames
+				);
+				track.translationKeyCount = static_cast<uint32_t>(mTranslationKeyFrames.size()) - track.translationOffset;
+
+				for(uint32_t key = 0; key < track.translationKeyCount; ++key)
+				{
+					const auto * p_quantized = &quantized[mTranslationKeyFrames[track.translationOffset + key] * 3];
+					mTranslations.insert(mTranslations.end(), p_quantized, p_quantized + 3);
+				}
+				++mStatistics.keyedChannelCount;
+				mStatistics.keyCount += track.translationKeyCount;
+			}
+		}
+	}
+
+	for(auto & track : source_tracks)
+	{
+		mStatistics.rawBytes += track.keyFrames.size() * sizeof(VMDMotion::KeyFrame);
+	}
+	mStatistics.bakedBytes =
+		mTracks.size() * sizeof(Track) +
+		mRotationKeyFrames.size() * sizeof(mRotationKeyFrames[0]) +
+		mRotations.size() * sizeof(mRotations[0]) +
+		mTranslationKeyFrames.size() * sizeof(mTranslationKeyFrames[0]) +
+		mTranslations.size() * sizeof(mTranslations[0]);
+
+	// キーフレームが疎なモーションでは，焼き込む意味がない
+	return mStatistics.bakedBytes <= mStatistics.rawBytes;
+}
+
+void BakedMotion::sample(uint32_t frame, VMDMotion::TrackPose * p_poses) const
+{
+	frame = min(frame, mFrameCount - 1);
+
+	for(size_t i = 0; i < mTracks.size(); ++i)
+	{
+		auto & track = mTracks[i];
+		auto & pose = p_poses[i];
+
+		if(frame < track.firstFrame)
+		{
+			pose.isValid = false;
+			continue;
+		}
+		pose.isValid = true;
+
+		const uint32_t index = frame - track.firstFrame;
+		const float t = static_cast<float>(index) / static_cast<float>(max(mFrameCount - 1 - track.firstFrame, 1u));
+
+		switch(track.rotationMode)
+		{
+		case ChannelMode::Constant:
+			pose.rotation = XMLoadFloat4(&track.rotations[0]);
+			break;
+		case ChannelMode::Linear:
+			pose.rotation = XMQuaternionSlerp(XMLoadFloat4(&track.rotations[0]), XMLoadFloat4(&track.rotations[1]), t);
+			break;
+		case ChannelMode::Keyed:
+		{
+			float key_t;
+			const auto key = track.rotationOffset + findKey(&mRotationKeyFrames[track.rotationOffset], track.rotationKeyCount, index, key_t);
+			pose.rotation = nlerpQuaternion(decodeQuaternion(mRotations[key]), decodeQuaternion(mRotations[key + 1]), key_t);
+			break;
+		}
+		}
+
+		switch(track.translationMode)
+		{
+		case ChannelMode::Constant:
+			pose.translation = XMLoadFloat3(&track.translations[0]);
+			break;
+		case ChannelMode::Linear:
+			pose.translation = XMVectorLerp(XMLoadFloat3(&track.translations[0]), XMLoadFloat3(&track.translations[1]), t);
+			break;
+		case ChannelMode::Keyed:
+		{
+			float key_t;
+			const auto key = track.translationOffset + findKey(&mTranslationKeyFrames[track.translationOffset], track.translationKeyCount, index, key_t);
+			const auto * p_quantized = &mTranslations[key * 3];
+			const auto translation0 = XMVectorSet(p_quantized[0], p_quantized[1], p_quantized[2], 0.0f);
+			const auto translation1 = XMVectorSet(p_quantized[3], p_quantized[4], p_quantized[5], 0.0f);
+			pose.translation = XMVectorMultiplyAdd(
+				XMVectorLerp(translation0, translation1, key_t),
+				XMLoadFloat3(&track.translations[1]),
+				XMLoadFloat3(&track.translations[0])
+			);
+			break;
+		}
+		}
+	}
+}
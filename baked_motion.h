@@ -0,0 +1,94 @@
+﻿#pragma once
+#ifndef BAKED_MOTION_H_INCLUDED
+#define BAKED_MOTION_H_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <DirectXMath.h>
+#include "vmd_motion.h"
+
+// VMDMotionを30fpsの全フレームで補間し，圧縮して保持する
+// 回転はsmallest-threeで32ビット，移動はトラックごとの範囲で16ビットに量子化する．
+// 一定や直線で表せるチャンネルはキーを持たず，それ以外も間のフレームを許容誤差内で補間できるキーだけを残す
+// ベジェ曲線を解かずに展開するだけなので，背景のアクターに使う
+class BakedMotion
+{
+public:
+	static constexpr float RotationTolerance = 0.0005f;
+	static constexpr float TranslationTolerance = 0.001f;
+
+	// キーのフレームは16ビットで持つ
+	static constexpr uint32_t MaxFrameCount = 0x10000;
+
+	struct Statistics
+	{
+		uint32_t trackCount = 0;
+		uint32_t constantChannelCount = 0;
+		uint32_t linearChannelCount = 0;
+		uint32_t keyedChannelCount = 0;
+		uint32_t keyCount = 0;
+
+		// KeyFrameのままの大きさと，焼き込んだ後の大きさ
+		uint64_t rawBytes = 0;
+		uint64_t bakedBytes = 0;
+	};
+
+	// 焼き込んだ方がKeyFrameのままより大きくなるときもfalseを返す．統計はそのときも読める
+	bool bake(std::shared_ptr<const VMDMotion> p_motion);
+
+	// VMDMotion::sampleと同じく，トラックの順にp_posesへ書く
+	void sample(uint32_t frame, VMDMotion::TrackPose * p_poses) const;
+
+	const std::shared_ptr<const VMDMotion> & getSource() const { return mpSource; }
+	uint32_t getFrameCount() const { return mFrameCount; }
+	const Statistics & getStatistics() const { return mStatistics; }
+
+private:
+	enum class ChannelMode : uint8_t
+	{
+		Constant,
+		Linear,
+		Keyed,
+	};
+
+	struct Track
+	{
+		// これより前のフレームは最初のキーフレームより前なので無効
+		uint32_t firstFrame;
+
+		ChannelMode rotationMode;
+		ChannelMode translationMode;
+
+		// Constantは[0]だけ，Linearは[0]から[1]へ補間する
+		DirectX::XMFLOAT4 rotations[2];
+
+		// Keyedのときは[0]が最小値，[1]が量子化の刻み
+		DirectX::XMFLOAT3 translations[2];
+
+		// Keyedのときのキーの範囲．キーは最初と最後のフレームを含む
+		uint32_t rotationOffset;
+		uint32_t rotationKeyCount;
+		uint32_t translationOffset;
+		uint32_t translationKeyCount;
+	};
+
+	static uint32_t encodeQuaternion(DirectX::FXMVECTOR q);
+	static DirectX::XMVECTOR decodeQuaternion(uint32_t packed);
+
+private:
+	std::shared_ptr<const VMDMotion> mpSource;
+	uint32_t mFrameCount = 0;
+
+	std::vector<Track> mTracks;
+
+	// キーのフレームはfirstFrameからの相対
+	std::vector<uint16_t> mRotationKeyFrames;
+	std::vector<uint32_t> mRotations;
+	std::vector<uint16_t> mTranslationKeyFrames;
+	std::vector<uint16_t> mTranslations;
+
+	Statistics mStatistics;
+};
+
+#endif // BAKED_MOTION_H_INCLUDED
@@ -0,0 +1,129 @@
+﻿#include "blob_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include "hash.h"
+
+using namespace std;
+
+namespace
+{
+	struct BlobCacheHeader
+	{
+		char signature[4];
+		uint32_t version;
+		uint64_t key;
+		uint64_t size;
+		uint64_t checksum;
+	};
+
+	constexpr char BlobCacheSignature[4] { 'L', 'G', 'B', 'C' };
+}
+
+BlobCache::BlobCache(const std::filesystem::path & directory, const char * extension)
+	: mDirectory(directory)
+	, mExtension(extension)
+{
+}
+
+bool BlobCache::load(uint64_t key, std::vector<uint8_t> & blob)
+{
+	ifstream fin(getEntryPath(key), ios::in | ios::binary);
+	if(!fin)
+	{
+		++mMissCount;
+		return false;
+	}
+
+	fin.seekg(0, ios::end);
+	const auto file_size = static_cast<uint64_t>(fin.tellg());
+	fin.seekg(0, ios::beg);
+
+	BlobCacheHeader header;
+	fin.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+	// 壊れたものや古い形式のものは無かったことにする．途中で切れたものは確保する前に弾く
+	if(
+		!fin ||
+		!equal(begin(header.signature), end(header.signature), begin(BlobCacheSignature)) ||
+		header.version != FormatVersion ||
+		header.key != key ||
+		header.size != file_size - sizeof(header)
+	)
+	{
+		++mMissCount;
+		return false;
+	}
+
+	blob.resize(header.size);
+	fin.read(reinterpret_cast<char *>(blob.data()), blob.size());
+	if(!fin || hashing::fnv1a64(blob.data(), blob.size()) != header.checksum)
+	{
+		blob.clear();
+		++mMissCount;
+		return false;
+	}
+
+	++mHitCount;
+
+	return true;
+}
+
+bool BlobCache::store(uint64_t key, const void * p_blob, size_t size)
+{
+	error_code ec;
+	filesystem::create_directories(mDirectory, ec);
+	if(ec)
+	{
+		return false;
+	}
+
+	BlobCacheHeader header;
+	copy(begin(BlobCacheSignature), end(BlobCacheSignature), begin(header.signature));
+	header.version = FormatVersion;
+	header.key = key;
+	header.size = size;
+	header.checksum = hashing::fnv1a64(p_blob, size);
+
+	// 書きかけのファイルを読まないように一時ファイルから置き換える
+	auto entry_path = getEntryPath(key);
+	auto temporary_path = entry_path;
+	temporary_path += ".tmp";
+	{
+		ofstream fout(temporary_path, ios::out | ios::binary | ios::trunc);
+		if(!fout)
+		{
+			return false;
+		}
+
+		fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		fout.write(static_cast<const char *>(p_blob), size);
+		if(!fout)
+		{
+			return false;
+		}
+	}
+
+	filesystem::rename(temporary_path, entry_path, ec);
+	if(ec)
+	{
+		filesystem::remove(temporary_path, ec);
+		return false;
+	}
+
+	return true;
+}
+
+bool BlobCache::remove(uint64_t key)
+{
+	error_code ec;
+	return filesystem::remove(getEntryPath(key), ec);
+}
+
+std::filesystem::path BlobCache::getEntryPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+	return mDirectory / (name + mExtension);
+}
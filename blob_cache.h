@@ -0,0 +1,36 @@
+﻿#pragma once
+#ifndef BLOB_CACHE_H_INCLUDED
+#define BLOB_CACHE_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// 64bitのキーごとにバイト列を1ファイルとして保存する
+// ヘッダとチェックサムを持ち，壊れたものはミスとして扱う
+class BlobCache
+{
+public:
+	static constexpr uint32_t FormatVersion = 1;
+
+	BlobCache(const std::filesystem::path & directory, const char * extension);
+
+	bool load(uint64_t key, std::vector<uint8_t> & blob);
+	bool store(uint64_t key, const void * p_blob, size_t size);
+	bool remove(uint64_t key);
+
+	std::filesystem::path getEntryPath(uint64_t key) const;
+
+	uint32_t getHitCount() const { return mHitCount; }
+	uint32_t getMissCount() const { return mMissCount; }
+
+private:
+	std::filesystem::path mDirectory;
+	std::string mExtension;
+	std::atomic<uint32_t> mHitCount = 0;
+	std::atomic<uint32_t> mMissCount = 0;
+};
+
+#endif // BLOB_CACHE_H_INCLUDED
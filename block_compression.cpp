@@ -0,0 +1,674 @@
+﻿#include "block_compression.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+namespace block_compression
+{
+	namespace
+	{
+		constexpr uint32_t PixelCount = BlockWidth * BlockWidth;
+
+		// 平均と，分散が最大になる方向(べき乗法)を求める
+		template<uint32_t N>
+		void computePrincipalAxis(
+			const array<array<float, N>, PixelCount> & pixels,
+			const array<bool, PixelCount> & is_used,
+			array<float, N> & mean,
+			array<float, N> & axis
+		)
+		{
+			mean.fill(0.0f);
+			float used_count = 0.0f;
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				if(!is_used[i])
+				{
+					continue;
+				}
+
+				for(uint32_t c = 0; c < N; ++c)
+				{
+					mean[c] += pixels[i][c];
+				}
+				used_count += 1.0f;
+			}
+
+			for(uint32_t c = 0; c < N; ++c)
+			{
+				mean[c] /= max(used_count, 1.0f);
+			}
+
+			array<array<float, N>, N> covariance {};
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				if(!is_used[i])
+				{
+					continue;
+				}
+
+				for(uint32_t row = 0; row < N; ++row)
+				{
+					for(uint32_t column = 0; column < N; ++column)
+					{
+						covariance[row][column] += (pixels[i][row] - mean[row]) * (pixels[i][column] - mean[column]);
+					}
+				}
+			}
+
+			axis.fill(1.0f);
+			for(uint32_t iteration = 0; iteration < 8; ++iteration)
+			{
+				array<float, N> next {};
+				float length = 0.0f;
+				for(uint32_t row = 0; row < N; ++row)
+				{
+					for(uint32_t column = 0; column < N; ++column)
+					{
+						next[row] += covariance[row][column] * axis[column];
+					}
+					length = max(length, fabs(next[row]));
+				}
+
+				// 単色のブロック
+				if(length < 1e-6f)
+				{
+					break;
+				}
+
+				for(uint32_t c = 0; c < N; ++c)
+				{
+					axis[c] = next[c] / length;
+				}
+			}
+
+			float length = 0.0f;
+			for(uint32_t c = 0; c < N; ++c)
+			{
+				length += axis[c] * axis[c];
+			}
+
+			length = sqrt(length);
+			for(uint32_t c = 0; c < N; ++c)
+			{
+				axis[c] /= length;
+			}
+		}
+
+		// 主軸上で一番離れた2点を，量子化で端が外れないように少し内側へ寄せる
+		template<uint32_t N>
+		void computeEndpoints(
+			const array<array<float, N>, PixelCount> & pixels,
+			const array<bool, PixelCount> & is_used,
+			array<float, N> & endpoint0,
+			array<float, N> & endpoint1
+		)
+		{
+			array<float, N> mean;
+			array<float, N> axis;
+			computePrincipalAxis<N>(pixels, is_used, mean, axis);
+
+			float min_t = 0.0f;
+			float max_t = 0.0f;
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				if(!is_used[i])
+				{
+					continue;
+				}
+
+				float t = 0.0f;
+				for(uint32_t c = 0; c < N; ++c)
+				{
+					t += (pixels[i][c] - mean[c]) * axis[c];
+				}
+				min_t = min(min_t, t);
+				max_t = max(max_t, t);
+			}
+
+			const float inset = (max_t - min_t) / 32.0f;
+			min_t += inset;
+			max_t -= inset;
+
+			for(uint32_t c = 0; c < N; ++c)
+			{
+				endpoint0[c] = clamp(mean[c] + axis[c] * min_t, 0.0f, 255.0f);
+				endpoint1[c] = clamp(mean[c] + axis[c] * max_t, 0.0f, 255.0f);
+			}
+		}
+
+		uint16_t packRGB565(const array<float, 3> & color)
+		{
+			const auto r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+			const auto g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+			const auto b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+			return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+		}
+
+		array<int32_t, 3> unpackRGB565(uint16_t color)
+		{
+			const int32_t r = (color >> 11) & 0x1f;
+			const int32_t g = (color >> 5) & 0x3f;
+			const int32_t b = color & 0x1f;
+			return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+		}
+
+		// 2つの端点から4色(3色モードでは3色と透明)のパレットを作る
+		array<array<int32_t, 3>, 4> makeColorPalette(uint16_t color0, uint16_t color1, bool is_four_color)
+		{
+			const auto c0 = unpackRGB565(color0);
+			const auto c1 = unpackRGB565(color1);
+
+			array<array<int32_t, 3>, 4> palette;
+			palette[0] = c0;
+			palette[1] = c1;
+			for(uint32_t c = 0; c < 3; ++c)
+			{
+				if(is_four_color)
+				{
+					palette[2][c] = (2 * c0[c] + c1[c]) / 3;
+					palette[3][c] = (c0[c] + 2 * c1[c]) / 3;
+				}
+				else
+				{
+					palette[2][c] = (c0[c] + c1[c]) / 2;
+					palette[3][c] = 0;
+				}
+			}
+
+			return palette;
+		}
+
+		// インデックスを選んで誤差を返す．3色モードの透明な画素は3番にする
+		uint32_t selectColorIndices(
+			const array<array<float, 3>, PixelCount> & pixels,
+			const array<bool, PixelCount> & is_opaque,
+			const array<array<int32_t, 3>, 4> & palette,
+			bool is_four_color,
+			array<uint8_t, PixelCount> & indices
+		)
+		{
+			const uint32_t color_count = is_four_color ? 4 : 3;
+
+			uint32_t total_error = 0;
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				if(!is_opaque[i])
+				{
+					indices[i] = 3;
+					continue;
+				}
+
+				uint32_t best_error = UINT32_MAX;
+				for(uint32_t j = 0; j < color_count; ++j)
+				{
+					uint32_t error = 0;
+					for(uint32_t c = 0; c < 3; ++c)
+					{
+						const int32_t d = static_cast<int32_t>(pixels[i][c]) - palette[j][c];
+						error += static_cast<uint32_t>(d * d);
+					}
+
+					if(error < best_error)
+					{
+						best_error = error;
+						indices[i] = static_cast<uint8_t>(j);
+					}
+				}
+				total_error += best_error;
+			}
+
+			return total_error;
+		}
+
+		// インデックスを固定して，端点を最小二乗法で求め直す
+		bool refineColorEndpoints(
+			const array<array<float, 3>, PixelCount> & pixels,
+			const array<bool, PixelCount> & is_opaque,
+			const array<uint8_t, PixelCount> & indices,
+			bool is_four_color,
+			array<float, 3> & endpoint0,
+			array<float, 3> & endpoint1
+		)
+		{
+			const array<float, 4> four_color_weights = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+			const array<float, 4> three_color_weights = { 0.0f, 1.0f, 0.5f, 0.0f };
+			const auto & weights = is_four_color ? four_color_weights : three_color_weights;
+
+			float aa = 0.0f;
+			float ab = 0.0f;
+			float bb = 0.0f;
+			array<float, 3> ax {};
+			array<float, 3> bx {};
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				if(!is_opaque[i])
+				{
+					continue;
+				}
+
+				const float b = weights[indices[i]];
+				const float a = 1.0f - b;
+				aa += a * a;
+				ab += a * b;
+				bb += b * b;
+				for(uint32_t c = 0; c < 3; ++c)
+				{
+					ax[c] += a * pixels[i][c];
+					bx[c] += b * pixels[i][c];
+				}
+			}
+
+			const float determinant = aa * bb - ab * ab;
+			if(fabs(determinant) < 1e-6f)
+			{
+				return false;
+			}
+
+			for(uint32_t c = 0; c < 3; ++c)
+			{
+				endpoint0[c] = clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+				endpoint1[c] = clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+			}
+
+			return true;
+		}
+
+		uint32_t encodeColorCandidate(
+			const array<array<float, 3>, PixelCount> & pixels,
+			const array<bool, PixelCount> & is_opaque,
+			const array<float, 3> & endpoint0,
+			const array<float, 3> & endpoint1,
+			bool is_four_color,
+			uint16_t & color0,
+			uint16_t & color1,
+			array<uint8_t, PixelCount> & indices
+		)
+		{
+			color0 = packRGB565(endpoint0);
+			color1 = packRGB565(endpoint1);
+
+			// 4色モードはcolor0 > color1，3色モードはcolor0 <= color1で区別される
+			if(is_four_color ? color0 < color1 : color0 > color1)
+			{
+				swap(color0, color1);
+			}
+
+			// 4色モードで端点が同じになると3色モードとして解釈されるが，インデックス0だけを使えば同じ色になる
+			const bool is_degenerate = is_four_color && color0 == color1;
+			const auto palette = makeColorPalette(color0, color1, is_four_color && !is_degenerate);
+			if(is_degenerate)
+			{
+				uint32_t error = 0;
+				for(uint32_t i = 0; i < PixelCount; ++i)
+				{
+					indices[i] = 0;
+					for(uint32_t c = 0; c < 3; ++c)
+					{
+						const int32_t d = static_cast<int32_t>(pixels[i][c]) - palette[0][c];
+						error += static_cast<uint32_t>(d * d);
+					}
+				}
+				return error;
+			}
+
+			return selectColorIndices(pixels, is_opaque, palette, is_four_color, indices);
+		}
+
+		void encodeColorBlock(const uint8_t * p_rgba, uint8_t * p_block, bool allow_transparent)
+		{
+			array<array<float, 3>, PixelCount> pixels;
+			array<bool, PixelCount> is_opaque;
+			bool has_transparent = false;
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				for(uint32_t c = 0; c < 3; ++c)
+				{
+					pixels[i][c] = p_rgba[i * 4 + c];
+				}
+
+				is_opaque[i] = !allow_transparent || p_rgba[i * 4 + 3] >= 128;
+				has_transparent |= !is_opaque[i];
+			}
+
+			uint16_t color0 = 0;
+			uint16_t color1 = 0;
+			array<uint8_t, PixelCount> indices;
+			if(all_of(is_opaque.begin(), is_opaque.end(), [](bool b) { return !b; }))
+			{
+				indices.fill(3);
+			}
+			else
+			{
+				const bool is_four_color = !has_transparent;
+
+				array<float, 3> endpoint0;
+				array<float, 3> endpoint1;
+				computeEndpoints<3>(pixels, is_opaque, endpoint0, endpoint1);
+				auto error = encodeColorCandidate(pixels, is_opaque, endpoint0, endpoint1, is_four_color, color0, color1, indices);
+
+				if(error > 0 && refineColorEndpoints(pixels, is_opaque, indices, is_four_color, endpoint0, endpoint1))
+				{
+					uint16_t refined_color0;
+					uint16_t refined_color1;
+					array<uint8_t, PixelCount> refined_indices;
+					const auto refined_error = encodeColorCandidate(
+						pixels, is_opaque, endpoint0, endpoint1, is_four_color, refined_color0, refined_color1, refined_indices
+					);
+					if(refined_error < error)
+					{
+						color0 = refined_color0;
+						color1 = refined_color1;
+						indices = refined_indices;
+					}
+				}
+			}
+
+			uint32_t index_bits = 0;
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				index_bits |= static_cast<uint32_t>(indices[i]) << (i * 2);
+			}
+
+			p_block[0] = static_cast<uint8_t>(color0);
+			p_block[1] = static_cast<uint8_t>(color0 >> 8);
+			p_block[2] = static_cast<uint8_t>(color1);
+			p_block[3] = static_cast<uint8_t>(color1 >> 8);
+			for(uint32_t i = 0; i < 4; ++i)
+			{
+				p_block[4 + i] = static_cast<uint8_t>(index_bits >> (i * 8));
+			}
+		}
+
+		void decodeColorBlock(const uint8_t * p_block, uint8_t * p_rgba, bool allow_three_color)
+		{
+			const auto color0 = static_cast<uint16_t>(p_block[0] | (p_block[1] << 8));
+			const auto color1 = static_cast<uint16_t>(p_block[2] | (p_block[3] << 8));
+			const bool is_four_color = !allow_three_color || color0 > color1;
+			const auto palette = makeColorPalette(color0, color1, is_four_color);
+
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				const uint32_t index = (p_block[4 + i / 4] >> ((i % 4) * 2)) & 0x3;
+				for(uint32_t c = 0; c < 3; ++c)
+				{
+					p_rgba[i * 4 + c] = static_cast<uint8_t>(palette[index][c]);
+				}
+				p_rgba[i * 4 + 3] = !is_four_color && index == 3 ? 0 : 0xff;
+			}
+		}
+
+		// 128bitのブロックへ下位ビットから書く
+		void writeBits(uint8_t * p_block, uint32_t & bit_offset, uint32_t value, uint32_t bit_count)
+		{
+			for(uint32_t i = 0; i < bit_count; ++i, ++bit_offset)
+			{
+				if((value >> i) & 1)
+				{
+					p_block[bit_offset / 8] |= static_cast<uint8_t>(1u << (bit_offset % 8));
+				}
+			}
+		}
+
+		uint32_t readBits(const uint8_t * p_block, uint32_t & bit_offset, uint32_t bit_count)
+		{
+			uint32_t value = 0;
+			for(uint32_t i = 0; i < bit_count; ++i, ++bit_offset)
+			{
+				value |= ((p_block[bit_offset / 8] >> (bit_offset % 8)) & 1u) << i;
+			}
+
+			return value;
+		}
+
+		constexpr array<uint32_t, 16> BC7Weights4 = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	}
+
+	void encodeBC1(const uint8_t * p_rgba, uint8_t * p_block)
+	{
+		encodeColorBlock(p_rgba, p_block, true);
+	}
+
+	void encodeBC3(const uint8_t * p_rgba, uint8_t * p_block)
+	{
+		uint32_t max_alpha = 0;
+		uint32_t min_alpha = 255;
+		for(uint32_t i = 0; i < PixelCount; ++i)
+		{
+			max_alpha = max<uint32_t>(max_alpha, p_rgba[i * 4 + 3]);
+			min_alpha = min<uint32_t>(min_alpha, p_rgba[i * 4 + 3]);
+		}
+
+		// alpha0 > alpha1の8段階モードだけを使う
+		array<uint32_t, 8> palette;
+		palette[0] = max_alpha;
+		palette[1] = min_alpha;
+		for(uint32_t i = 1; i < 7; ++i)
+		{
+			palette[i + 1] = ((7 - i) * max_alpha + i * min_alpha) / 7;
+		}
+
+		uint64_t index_bits = 0;
+		if(max_alpha != min_alpha)
+		{
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				const uint32_t alpha = p_rgba[i * 4 + 3];
+
+				uint32_t best_index = 0;
+				uint32_t best_error = UINT32_MAX;
+				for(uint32_t j = 0; j < palette.size(); ++j)
+				{
+					const uint32_t error = alpha > palette[j] ? alpha - palette[j] : palette[j] - alpha;
+					if(error < best_error)
+					{
+						best_error = error;
+						best_index = j;
+					}
+				}
+
+				index_bits |= static_cast<uint64_t>(best_index) << (i * 3);
+			}
+		}
+
+		p_block[0] = static_cast<uint8_t>(max_alpha);
+		p_block[1] = static_cast<uint8_t>(min_alpha);
+		for(uint32_t i = 0; i < 6; ++i)
+		{
+			p_block[2 + i] = static_cast<uint8_t>(index_bits >> (i * 8));
+		}
+
+		encodeColorBlock(p_rgba, p_block + 8, false);
+	}
+
+	void encodeBC7(const uint8_t * p_rgba, uint8_t * p_block)
+	{
+		array<array<float, 4>, PixelCount> pixels;
+		array<bool, PixelCount> is_used;
+		is_used.fill(true);
+		for(uint32_t i = 0; i < PixelCount; ++i)
+		{
+			for(uint32_t c = 0; c < 4; ++c)
+			{
+				pixels[i][c] = p_rgba[i * 4 + c];
+			}
+		}
+
+		array<float, 4> endpoint0;
+		array<float, 4> endpoint1;
+		computeEndpoints<4>(pixels, is_used, endpoint0, endpoint1);
+
+		// 端点は7bitとPビットで8bitになるので，Pビットの組み合わせを全て試す
+		array<array<uint32_t, 4>, 2> best_endpoints {};
+		array<uint32_t, 2> best_p_bits {};
+		array<uint8_t, PixelCount> best_indices {};
+		uint32_t best_error = UINT32_MAX;
+		for(uint32_t p_bits = 0; p_bits < 4; ++p_bits)
+		{
+			const array<uint32_t, 2> p = { p_bits & 1, p_bits >> 1 };
+
+			array<array<uint32_t, 4>, 2> quantized;
+			array<array<int32_t, 4>, 2> values;
+			for(uint32_t c = 0; c < 4; ++c)
+			{
+				for(uint32_t e = 0; e < 2; ++e)
+				{
+					const float endpoint = e == 0 ? endpoint0[c] : endpoint1[c];
+					quantized[e][c] = static_cast<uint32_t>(clamp((endpoint - p[e]) / 2.0f + 0.5f, 0.0f, 127.0f));
+					values[e][c] = static_cast<int32_t>((quantized[e][c] << 1) | p[e]);
+				}
+			}
+
+			array<array<int32_t, 4>, 16> palette;
+			for(uint32_t i = 0; i < palette.size(); ++i)
+			{
+				for(uint32_t c = 0; c < 4; ++c)
+				{
+					palette[i][c] = ((64 - BC7Weights4[i]) * values[0][c] + BC7Weights4[i] * values[1][c] + 32) >> 6;
+				}
+			}
+
+			array<uint8_t, PixelCount> indices;
+			uint32_t total_error = 0;
+			for(uint32_t i = 0; i < PixelCount; ++i)
+			{
+				uint32_t pixel_best_error = UINT32_MAX;
+				for(uint32_t j = 0; j < palette.size(); ++j)
+				{
+					uint32_t error = 0;
+					for(uint32_t c = 0; c < 4; ++c)
+					{
+						const int32_t d = static_cast<int32_t>(p_rgba[i * 4 + c]) - palette[j][c];
+						error += static_cast<uint32_t>(d * d);
+					}
+
+					if(error < pixel_best_error)
+					{
+						pixel_best_error = error;
+						indices[i] = static_cast<uint8_t>(j);
+					}
+				}
+				total_error += pixel_best_error;
+			}
+
+			if(total_error < best_error)
+			{
+				best_error = total_error;
+				best_endpoints = quantized;
+				best_p_bits = p;
+				best_indices = indices;
+			}
+		}
+
+		// 最初の画素のインデックスは最上位ビットを省くので，0にならなければ端点を入れ替える
+		if(best_indices[0] & 0x8)
+		{
+			swap(best_endpoints[0], best_endpoints[1]);
+			swap(best_p_bits[0], best_p_bits[1]);
+			for(auto & index : best_indices)
+			{
+				index = static_cast<uint8_t>(15 - index);
+			}
+		}
+
+		memset(p_block, 0, BC7BlockSize);
+
+		uint32_t bit_offset = 0;
+		writeBits(p_block, bit_offset, 1u << 6, 7);
+		for(uint32_t c = 0; c < 4; ++c)
+		{
+			writeBits(p_block, bit_offset, best_endpoints[0][c], 7);
+			writeBits(p_block, bit_offset, best_endpoints[1][c], 7);
+		}
+		writeBits(p_block, bit_offset, best_p_bits[0], 1);
+		writeBits(p_block, bit_offset, best_p_bits[1], 1);
+		for(uint32_t i = 0; i < PixelCount; ++i)
+		{
+			writeBits(p_block, bit_offset, best_indices[i], i == 0 ? 3 : 4);
+		}
+	}
+
+	void decodeBC1(const uint8_t * p_block, uint8_t * p_rgba)
+	{
+		decodeColorBlock(p_block, p_rgba, true);
+	}
+
+	void decodeBC3(const uint8_t * p_block, uint8_t * p_rgba)
+	{
+		decodeColorBlock(p_block + 8, p_rgba, false);
+
+		const uint32_t alpha0 = p_block[0];
+		const uint32_t alpha1 = p_block[1];
+
+		array<uint32_t, 8> palette;
+		palette[0] = alpha0;
+		palette[1] = alpha1;
+		if(alpha0 > alpha1)
+		{
+			for(uint32_t i = 1; i < 7; ++i)
+			{
+				palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+			}
+		}
+		else
+		{
+			for(uint32_t i = 1; i < 5; ++i)
+			{
+				palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+
+		uint64_t index_bits = 0;
+		for(uint32_t i = 0; i < 6; ++i)
+		{
+			index_bits |= static_cast<uint64_t>(p_block[2 + i]) << (i * 8);
+		}
+
+		for(uint32_t i = 0; i < PixelCount; ++i)
+		{
+			p_rgba[i * 4 + 3] = static_cast<uint8_t>(palette[(index_bits >> (i * 3)) & 0x7]);
+		}
+	}
+
+	bool decodeBC7(const uint8_t * p_block, uint8_t * p_rgba)
+	{
+		uint32_t bit_offset = 0;
+		if(readBits(p_block, bit_offset, 7) != (1u << 6))
+		{
+			return false;
+		}
+
+		array<array<uint32_t, 4>, 2> values;
+		for(uint32_t c = 0; c < 4; ++c)
+		{
+			values[0][c] = readBits(p_block, bit_offset, 7) << 1;
+			values[1][c] = readBits(p_block, bit_offset, 7) << 1;
+		}
+
+		const uint32_t p0 = readBits(p_block, bit_offset, 1);
+		const uint32_t p1 = readBits(p_block, bit_offset, 1);
+		for(uint32_t c = 0; c < 4; ++c)
+		{
+			values[0][c] |= p0;
+			values[1][c] |= p1;
+		}
+
+		for(uint32_t i = 0; i < PixelCount; ++i)
+		{
+			const uint32_t index = readBits(p_block, bit_offset, i == 0 ? 3 : 4);
+			for(uint32_t c = 0; c < 4; ++c)
+			{
+				p_rgba[i * 4 + c] = static_cast<uint8_t>(
+					((64 - BC7Weights4[index]) * values[0][c] + BC7Weights4[index] * values[1][c] + 32) >> 6
+				);
+			}
+		}
+
+		return true;
+	}
+}
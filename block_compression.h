@@ -0,0 +1,27 @@
+﻿#pragma once
+#ifndef BLOCK_COMPRESSION_H_INCLUDED
+#define BLOCK_COMPRESSION_H_INCLUDED
+
+#include <cstdint>
+
+// 4x4画素(RGBA8を行順に64バイト)のブロック圧縮
+// BC7はモード6(1サブセット，RGBA各7bit+Pビット，4bitインデックス)だけで符号化する
+namespace block_compression
+{
+	constexpr uint32_t BlockWidth = 4;
+	constexpr uint32_t BC1BlockSize = 8;
+	constexpr uint32_t BC3BlockSize = 16;
+	constexpr uint32_t BC7BlockSize = 16;
+
+	// アルファが128未満の画素があれば，3色モードで透明にする
+	void encodeBC1(const uint8_t * p_rgba, uint8_t * p_block);
+	void encodeBC3(const uint8_t * p_rgba, uint8_t * p_block);
+	void encodeBC7(const uint8_t * p_rgba, uint8_t * p_block);
+
+	// 検証用．BC7はモード6だけを展開する
+	void decodeBC1(const uint8_t * p_block, uint8_t * p_rgba);
+	void decodeBC3(const uint8_t * p_block, uint8_t * p_rgba);
+	bool decodeBC7(const uint8_t * p_block, uint8_t * p_rgba);
+}
+
+#endif // BLOCK_COMPRESSION_H_INCLUDED
@@ -0,0 +1,79 @@
+﻿#pragma once
+#ifndef BYTE_READER_H_INCLUDED
+#define BYTE_READER_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// メモリ上のファイルを先頭から読む．ifstreamと同じく，一度読み損ねたら以降は全て失敗する
+class ByteReader
+{
+public:
+	ByteReader(const uint8_t * p_data, size_t size)
+		: mpData(p_data)
+		, mSize(size)
+	{
+	}
+
+	bool read(void * p_destination, size_t size)
+	{
+		if(!mIsGood || size > mSize - mPosition)
+		{
+			mIsGood = false;
+			return false;
+		}
+
+		if(size > 0)
+		{
+			memcpy(p_destination, mpData + mPosition, size);
+			mPosition += size;
+		}
+
+		return true;
+	}
+
+	template<typename T>
+	bool read(T & value)
+	{
+		return read(&value, sizeof(T));
+	}
+
+	template<typename T>
+	bool readArray(std::vector<T> & values, size_t count)
+	{
+		// 壊れた個数で巨大な確保をしないよう，残りの大きさを先に確かめる
+		if(!mIsGood || count > (mSize - mPosition) / sizeof(T))
+		{
+			mIsGood = false;
+			return false;
+		}
+
+		values.resize(count);
+
+		return read(values.data(), sizeof(T) * count);
+	}
+
+	bool seek(size_t position)
+	{
+		if(!mIsGood || position > mSize)
+		{
+			mIsGood = false;
+			return false;
+		}
+		mPosition = position;
+
+		return true;
+	}
+
+	bool isGood() const { return mIsGood; }
+
+private:
+	const uint8_t * mpData;
+	size_t mSize;
+	size_t mPosition = 0;
+	bool mIsGood = true;
+};
+
+#endif // BYTE_READER_H_INCLUDED
@@ -0,0 +1,476 @@
+﻿#include "cooked_texture.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include "block_compression.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace cooked_texture
+{
+	namespace
+	{
+		constexpr uint32_t DDSMagic = 0x20534444; // "DDS "
+		constexpr uint32_t DX10FourCC = 0x30315844; // "DX10"
+
+		constexpr uint32_t DDSFlagCaps = 0x1;
+		constexpr uint32_t DDSFlagHeight = 0x2;
+		constexpr uint32_t DDSFlagWidth = 0x4;
+		constexpr uint32_t DDSFlagPixelFormat = 0x1000;
+		constexpr uint32_t DDSFlagMipMapCount = 0x20000;
+		constexpr uint32_t DDSFlagLinearSize = 0x80000;
+		constexpr uint32_t DDSPixelFormatFourCC = 0x4;
+		constexpr uint32_t DDSCapsComplex = 0x8;
+		constexpr uint32_t DDSCapsTexture = 0x1000;
+		constexpr uint32_t DDSCapsMipMap = 0x400000;
+		constexpr uint32_t ResourceDimensionTexture2D = 3;
+
+#pragma pack(push, 1)
+		struct DDSPixelFormat
+		{
+			uint32_t size;
+			uint32_t flags;
+			uint32_t fourCC;
+			uint32_t rgbBitCount;
+			uint32_t rBitMask;
+			uint32_t gBitMask;
+			uint32_t bBitMask;
+			uint32_t aBitMask;
+		};
+
+		struct DDSHeader
+		{
+			uint32_t size;
+			uint32_t flags;
+			uint32_t height;
+			uint32_t width;
+			uint32_t pitchOrLinearSize;
+			uint32_t depth;
+			uint32_t mipMapCount;
+			uint32_t reserved1[11];
+			DDSPixelFormat pixelFormat;
+			uint32_t caps;
+			uint32_t caps2;
+			uint32_t caps3;
+			uint32_t caps4;
+			uint32_t reserved2;
+		};
+
+		struct DDSHeaderDX10
+		{
+			uint32_t dxgiFormat;
+			uint32_t resourceDimension;
+			uint32_t miscFlag;
+			uint32_t arraySize;
+			uint32_t miscFlags2;
+		};
+#pragma pack(pop)
+
+		static_assert(sizeof(DDSHeader) == 124, "DDS_HEADER must be 124 bytes.");
+
+		bool isBlockCompressed(Format format)
+		{
+			return format != Format::RGBA8;
+		}
+
+		size_t getBlockSize(Format format)
+		{
+			switch(format)
+			{
+			case Format::BC1: return block_compression::BC1BlockSize;
+			case Format::BC3: return block_compression::BC3BlockSize;
+			case Format::BC7: return block_compression::BC7BlockSize;
+			default: return 0;
+			}
+		}
+
+		// 2x2の平均で半分にする．奇数の端は同じ画素を繰り返す
+		image_decoder::Image downsample(const image_decoder::Image & source)
+		{
+			image_decoder::Image image;
+			image.width = max(source.width / 2, 1u);
+			image.height = max(source.height / 2, 1u);
+			image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
+
+			for(uint32_t y = 0; y < image.height; ++y)
+			{
+				const uint32_t y0 = min(y * 2, source.height - 1);
+				const uint32_t y1 = min(y * 2 + 1, source.height - 1);
+				for(uint32_t x = 0; x < image.width; ++x)
+				{
+					const uint32_t x0 = min(x * 2, source.width - 1);
+					const uint32_t x1 = min(x * 2 + 1, source.width - 1);
+					for(uint32_t c = 0; c < 4; ++c)
+					{
+						const uint32_t sum =
+							source.pixels[(static_cast<size_t>(y0) * source.width + x0) * 4 + c] +
+							source.pixels[(static_cast<size_t>(y0) * source.width + x1) * 4 + c] +
+							source.pixels[(static_cast<size_t>(y1) * source.width + x0) * 4 + c] +
+							source.pixels[(static_cast<size_t>(y1) * source.width + x1) * 4 + c];
+						image.pixels[(static_cast<size_t>(y) * image.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+				}
+			}
+
+			return image;
+		}
+
+		// ブロックの行[begin_row, end_row)を圧縮する．4画素に満たない端は最後の画素を繰り返す
+		void encodeBlockRows(const image_decoder::Image & image, Format format, uint32_t begin_row, uint32_t end_row, MipLevel & mip_level)
+		{
+			PROFILE_SCOPE("EncodeBlocks");
+
+			const auto block_size = getBlockSize(format);
+			const auto row_pitch = getRowPitch(format, image.width);
+			const uint32_t block_column_count = (image.width + 3) / 4;
+
+			uint8_t block_pixels[block_compression::BlockWidth * block_compression::BlockWidth * 4];
+			for(uint32_t block_y = begin_row; block_y < end_row; ++block_y)
+			{
+				for(uint32_t block_x = 0; block_x < block_column_count; ++block_x)
+				{
+					for(uint32_t y = 0; y < 4; ++y)
+					{
+						const uint32_t src_y = min(block_y * 4 + y, image.height - 1);
+						for(uint32_t x = 0; x < 4; ++x)
+						{
+							const uint32_t src_x = min(block_x * 4 + x, image.width - 1);
+							memcpy(
+								block_pixels + (y * 4 + x) * 4,
+								image.pixels.data() + (static_cast<size_t>(src_y) * image.width + src_x) * 4,
+								4
+							);
+						}
+					}
+
+					auto p_block = mip_level.data.data() + row_pitch * block_y + block_size * block_x;
+					switch(format)
+					{
+					case Format::BC1: block_compression::encodeBC1(block_pixels, p_block); break;
+					case Format::BC3: block_compression::encodeBC3(block_pixels, p_block); break;
+					case Format::BC7: block_compression::encodeBC7(block_pixels, p_block); break;
+					default: break;
+					}
+				}
+			}
+		}
+	}
+
+	const char * getFormatName(Format format)
+	{
+		switch(format)
+		{
+		case Format::RGBA8: return "RGBA8";
+		case Format::BC1: return "BC1";
+		case Format::BC3: return "BC3";
+		case Format::BC7: return "BC7";
+		default: return "Unknown";
+		}
+	}
+
+	uint32_t getDXGIFormat(Format format)
+	{
+		switch(format)
+		{
+		case Format::RGBA8: return 28; // DXGI_FORMAT_R8G8B8A8_UNORM
+		case Format::BC1: return 71; // DXGI_FORMAT_BC1_UNORM
+		case Format::BC3: return 77; // DXGI_FORMAT_BC3_UNORM
+		case Format::BC7: return 98; // DXGI_FORMAT_BC7_UNORM
+		default: return 0;
+		}
+	}
+
+	size_t getRowPitch(Format format, uint32_t width)
+	{
+		if(isBlockCompressed(format))
+		{
+			return static_cast<size_t>(max((width + 3) / 4, 1u)) * getBlockSize(format);
+		}
+
+		return static_cast<size_t>(width) * 4;
+	}
+
+	uint32_t getRowCount(Format format, uint32_t height)
+	{
+		return isBlockCompressed(format) ? max((height + 3) / 4, 1u) : height;
+	}
+
+	Format chooseFormat(const image_decoder::Image & image, bool is_toon, bool prefer_bc7)
+	{
+		if(is_toon || image.width % 4 != 0 || image.height % 4 != 0)
+		{
+			return Format::RGBA8;
+		}
+
+		if(prefer_bc7)
+		{
+			return Format::BC7;
+		}
+
+		bool has_alpha = false;
+		for(size_t i = 3; i < image.pixels.size(); i += 4)
+		{
+			if(image.pixels[i] != 0xff)
+			{
+				has_alpha = true;
+				break;
+			}
+		}
+
+		return has_alpha ? Format::BC3 : Format::BC1;
+	}
+
+	bool cook(
+		const image_decoder::Image & image,
+		Format format,
+		ThreadPool * p_thread_pool,
+		Texture & texture,
+		uint32_t max_mip_count
+	)
+	{
+		PROFILE_FUNCTION();
+
+		if(isBlockCompressed(format) && (image.width % 4 != 0 || image.height % 4 != 0))
+		{
+			return false;
+		}
+
+		texture.format = format;
+		texture.width = image.width;
+		texture.height = image.height;
+		texture.mipLevels.clear();
+
+		vector<image_decoder::Image> mip_images;
+		mip_images.push_back(image);
+		while(
+			(mip_images.back().width > 1 || mip_images.back().height > 1) &&
+			(max_mip_count == 0 || mip_images.size() < max_mip_count)
+		)
+		{
+			mip_images.push_back(downsample(mip_images.back()));
+		}
+
+		texture.mipLevels.resize(mip_images.size());
+
+		// タスクはおよそ同じ数のブロックになるよう，全ミップのブロック行を分ける
+		constexpr uint32_t BlocksPerTask = 256;
+
+		vector<future<void>> futures;
+		for(size_t i = 0; i < mip_images.size(); ++i)
+		{
+			const auto & mip_image = mip_images[i];
+			auto & mip_level = texture.mipLevels[i];
+			mip_level.width = mip_image.width;
+			mip_level.height = mip_image.height;
+
+			if(!isBlockCompressed(format))
+			{
+				mip_level.data = mip_image.pixels;
+				continue;
+			}
+
+			const uint32_t row_count = getRowCount(format, mip_image.height);
+			mip_level.data.resize(getRowPitch(format, mip_image.width) * row_count);
+
+			const uint32_t rows_per_task = max(BlocksPerTask / max((mip_image.width + 3) / 4, 1u), 1u);
+			for(uint32_t begin_row = 0; begin_row < row_count; begin_row += rows_per_task)
+			{
+				const uint32_t end_row = min(begin_row + rows_per_task, row_count);
+				if(p_thread_pool == nullptr)
+				{
+					encodeBlockRows(mip_image, format, begin_row, end_row, mip_level);
+					continue;
+				}
+
+				futures.push_back(p_thread_pool->submit([&mip_image, format, begin_row, end_row, &mip_level]()
+				{
+					encodeBlockRows(mip_image, format, begin_row, end_row, mip_level);
+				}));
+			}
+		}
+
+		for(auto & f : futures)
+		{
+			f.get();
+		}
+
+		return true;
+	}
+
+	bool writeDDS(const filesystem::path & path, const Texture & texture)
+	{
+		if(texture.mipLevels.empty())
+		{
+			return false;
+		}
+
+		DDSHeader header {};
+		header.size = sizeof(DDSHeader);
+		header.flags = DDSFlagCaps | DDSFlagHeight | DDSFlagWidth | DDSFlagPixelFormat | DDSFlagMipMapCount | DDSFlagLinearSize;
+		header.height = texture.height;
+		header.width = texture.width;
+		header.pitchOrLinearSize = static_cast<uint32_t>(texture.mipLevels[0].data.size());
+		header.mipMapCount = static_cast<uint32_t>(texture.mipLevels.size());
+		header.pixelFormat.size = sizeof(DDSPixelFormat);
+		header.pixelFormat.flags = DDSPixelFormatFourCC;
+		header.pixelFormat.fourCC = DX10FourCC;
+		header.caps = DDSCapsTexture | DDSCapsMipMap | DDSCapsComplex;
+
+		DDSHeaderDX10 header_dx10 {};
+		header_dx10.dxgiFormat = getDXGIFormat(texture.format);
+		header_dx10.resourceDimension = ResourceDimensionTexture2D;
+		header_dx10.arraySize = 1;
+
+		// 書き出しの途中で失敗しても壊れたファイルが残らないようにする
+		auto tmp_path = path;
+		tmp_path += ".tmp";
+
+		error_code error;
+		filesystem::create_directories(path.parent_path(), error);
+		{
+			ofstream fout(tmp_path, ios::binary);
+			if(!fout)
+			{
+				return false;
+			}
+
+			fout.write(reinterpret_cast<const char *>(&DDSMagic), sizeof(DDSMagic));
+			fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			fout.write(reinterpret_cast<const char *>(&header_dx10), sizeof(header_dx10));
+			for(const auto & mip_level : texture.mipLevels)
+			{
+				fout.write(reinterpret_cast<const char *>(mip_level.data.data()), mip_level.data.size());
+			}
+
+			if(!fout)
+			{
+				return false;
+			}
+		}
+
+		filesystem::rename(tmp_path, path, error);
+
+		return !error;
+	}
+
+	bool readDDS(const uint8_t * p_data, size_t size, Texture & texture)
+	{
+		constexpr size_t HeaderSize = sizeof(uint32_t) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10);
+		if(size < HeaderSize)
+		{
+			return false;
+		}
+
+		uint32_t magic;
+		DDSHeader header;
+		DDSHeaderDX10 header_dx10;
+		memcpy(&magic, p_data, sizeof(magic));
+		memcpy(&header, p_data + sizeof(magic), sizeof(header));
+		memcpy(&header_dx10, p_data + sizeof(magic) + sizeof(header), sizeof(header_dx10));
+		if(magic != DDSMagic || header.size != sizeof(DDSHeader) || header.pixelFormat.fourCC != DX10FourCC)
+		{
+			return false;
+		}
+
+		bool is_known_format = false;
+		for(auto format : { Format::RGBA8, Format::BC1, Format::BC3, Format::BC7 })
+		{
+			if(getDXGIFormat(format) == header_dx10.dxgiFormat)
+			{
+				texture.format = format;
+				is_known_format = true;
+			}
+		}
+
+		if(!is_known_format || header_dx10.arraySize != 1 || header.width == 0 || header.height == 0 || header.mipMapCount == 0 || header.mipMapCount > 32)
+		{
+			return false;
+		}
+
+		texture.width = header.width;
+		texture.height = header.height;
+		texture.mipLevels.resize(header.mipMapCount);
+
+		size_t offset = HeaderSize;
+		uint32_t width = header.width;
+		uint32_t height = header.height;
+		for(auto & mip_level : texture.mipLevels)
+		{
+			const size_t mip_size = getRowPitch(texture.format, width) * getRowCount(texture.format, height);
+			if(offset + mip_size > size)
+			{
+				return false;
+			}
+
+			mip_level.width = width;
+			mip_level.height = height;
+			mip_level.data.assign(p_data + offset, p_data + offset + mip_size);
+
+			offset += mip_size;
+			width = max(width / 2, 1u);
+			height = max(height / 2, 1u);
+		}
+
+		return true;
+	}
+
+	bool decompress(const Texture & texture, uint32_t mip_level_index, image_decoder::Image & image)
+	{
+		if(mip_level_index >= texture.mipLevels.size())
+		{
+			return false;
+		}
+
+		const auto & mip_level = texture.mipLevels[mip_level_index];
+		image.width = mip_level.width;
+		image.height = mip_level.height;
+
+		if(!isBlockCompressed(texture.format))
+		{
+			image.pixels = mip_level.data;
+			return true;
+		}
+
+		image.pixels.resize(static_cast<size_t>(image.width) * image.height * 4);
+
+		const auto block_size = getBlockSize(texture.format);
+		const auto row_pitch = getRowPitch(texture.format, image.width);
+		uint8_t block_pixels[block_compression::BlockWidth * block_compression::BlockWidth * 4];
+		for(uint32_t block_y = 0; block_y < getRowCount(texture.format, image.height); ++block_y)
+		{
+			for(uint32_t block_x = 0; block_x < (image.width + 3) / 4; ++block_x)
+			{
+				const auto p_block = mip_level.data.data() + row_pitch * block_y + block_size * block_x;
+				switch(texture.format)
+				{
+				case Format::BC1: block_compression::decodeBC1(p_block, block_pixels); break;
+				case Format::BC3: block_compression::decodeBC3(p_block, block_pixels); break;
+				case Format::BC7:
+					if(!block_compression::decodeBC7(p_block, block_pixels))
+					{
+						return false;
+					}
+					break;
+				default: break;
+				}
+
+				for(uint32_t y = 0; y < 4 && block_y * 4 + y < image.height; ++y)
+				{
+					for(uint32_t x = 0; x < 4 && block_x * 4 + x < image.width; ++x)
+					{
+						memcpy(
+							image.pixels.data() + ((static_cast<size_t>(block_y) * 4 + y) * image.width + block_x * 4 + x) * 4,
+							block_pixels + (y * 4 + x) * 4,
+							4
+						);
+					}
+				}
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,68 @@
+﻿#pragma once
+#ifndef COOKED_TEXTURE_H_INCLUDED
+#define COOKED_TEXTURE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include "image_decoder.h"
+
+class ThreadPool;
+
+// ミップマップを作ってブロック圧縮し，DX10拡張ヘッダ付きのDDSとして保存する
+// 実行時はDirectXTexのLoadFromDDSMemoryでそのまま読める
+namespace cooked_texture
+{
+	enum class Format : uint32_t
+	{
+		RGBA8,
+		BC1,
+		BC3,
+		BC7,
+	};
+
+	struct MipLevel
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<uint8_t> data;
+	};
+
+	struct Texture
+	{
+		Format format = Format::RGBA8;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<MipLevel> mipLevels;
+	};
+
+	const char * getFormatName(Format format);
+
+	// DXGI_FORMATの値
+	uint32_t getDXGIFormat(Format format);
+
+	size_t getRowPitch(Format format, uint32_t width);
+	uint32_t getRowCount(Format format, uint32_t height);
+
+	// トゥーンは階調が崩れないよう非圧縮にする．BCは幅と高さが4の倍数のときだけ使える
+	Format chooseFormat(const image_decoder::Image & image, bool is_toon, bool prefer_bc7);
+
+	// p_thread_poolがnullptrのときは呼び出したスレッドだけで圧縮する
+	// max_mip_countが0なら1x1まで作る．アトラスは縁の幅が足りるミップまでにする
+	bool cook(
+		const image_decoder::Image & image,
+		Format format,
+		ThreadPool * p_thread_pool,
+		Texture & texture,
+		uint32_t max_mip_count = 0
+	);
+
+	bool writeDDS(const std::filesystem::path & path, const Texture & texture);
+	bool readDDS(const uint8_t * p_data, size_t size, Texture & texture);
+
+	// 検証用にRGBA8へ戻す
+	bool decompress(const Texture & texture, uint32_t mip_level, image_decoder::Image & image);
+}
+
+#endif // COOKED_TEXTURE_H_INCLUDED
@@ -0,0 +1,210 @@
+﻿#include "copy_queue_dx12.h"
+#include <d3dx12.h>
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+CopyQueueDX12::~CopyQueueDX12()
+{
+	// コピー中にリングやコピー先を解放しないよう，全て終わらせる
+	if(mpFence != nullptr)
+	{
+		wait(mFenceValue);
+	}
+
+	if(mpRing != nullptr)
+	{
+		mpRing->Unmap(0, nullptr);
+	}
+
+	if(mhFenceEvent)
+	{
+		CloseHandle(mhFenceEvent);
+	}
+}
+
+bool CopyQueueDX12::initialize(ID3D12Device * p_device, uint64_t ring_size)
+{
+	mpDevice = p_device;
+
+	D3D12_COMMAND_QUEUE_DESC command_queue_desc;
+	command_queue_desc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	command_queue_desc.Priority = D3D12_COMMAND_QUEUE_PRIORITY_NORMAL;
+	command_queue_desc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	command_queue_desc.NodeMask = 0;
+
+	HRESULT hr = mpDevice->CreateCommandQueue(
+		&command_queue_desc,
+		IID_PPV_ARGS(&mpCommandQueue)
+	);
+	if(FAILED(hr))
+	{
+		return false;
+	}
+
+	hr = mpDevice->CreateFence(
+		mFenceValue,
+		D3D12_FENCE_FLAG_NONE,
+		IID_PPV_ARGS(&mpFence)
+	);
+	if(FAILED(hr))
+	{
+		return false;
+	}
+
+	mhFenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if(mhFenceEvent == nullptr)
+	{
+		return false;
+	}
+
+	ComPtr<ID3D12CommandAllocator> p_command_allocator;
+	if(!acquireCommandAllocator(p_command_allocator))
+	{
+		return false;
+	}
+
+	hr = mpDevice->CreateCommandList(
+		0,
+		D3D12_COMMAND_LIST_TYPE_COPY,
+		p_command_allocator.Get(),
+		nullptr,
+		IID_PPV_ARGS(&mpCommandList)
+	);
+	if(FAILED(hr))
+	{
+		return false;
+	}
+
+	mpCommandList->Close();
+	mCommandAllocators.push_back({ p_command_allocator, 0, {} });
+
+	hr = mpDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(ring_size),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&mpRing)
+	);
+	if(FAILED(hr))
+	{
+		return false;
+	}
+
+	// CPUからは書くだけなので，読み取り範囲は空にする
+	D3D12_RANGE read_range { 0, 0 };
+	hr = mpRing->Map(0, &read_range, reinterpret_cast<void **>(&mpMappedRing));
+	if(FAILED(hr))
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool CopyQueueDX12::acquireCommandAllocator(ComPtr<ID3D12CommandAllocator> & p_command_allocator)
+{
+	// 古い順に並んでいるので，先頭が終わっていなければ新しく作る
+	if(!mCommandAllocators.empty() && mCommandAllocators.front().fenceValue <= getCompletedValue())
+	{
+		p_command_allocator = mCommandAllocators.front().pCommandAllocator;
+		mCommandAllocators.pop_front();
+
+		return SUCCEEDED(p_command_allocator->Reset());
+	}
+
+	HRESULT hr = mpDevice->CreateCommandAllocator(
+		D3D12_COMMAND_LIST_TYPE_COPY,
+		IID_PPV_ARGS(&p_command_allocator)
+	);
+
+	return SUCCEEDED(hr);
+}
+
+uint64_t CopyQueueDX12::execute(const UploadCommand * p_commands, size_t command_count)
+{
+	ComPtr<ID3D12CommandAllocator> p_command_allocator;
+	if(!acquireCommandAllocator(p_command_allocator))
+	{
+		return mFenceValue;
+	}
+
+	mpCommandList->Reset(p_command_allocator.Get(), nullptr);
+
+	vector<ComPtr<ID3D12Resource>> p_destinations;
+	p_destinations.reserve(command_count);
+	for(size_t i = 0; i < command_count; ++i)
+	{
+		const auto & command = p_commands[i];
+		auto p_destination = static_cast<ID3D12Resource *>(command.pDestination);
+		p_destinations.push_back(p_destination);
+
+		if(command.subresource == UploadCommand::BufferSubresource)
+		{
+			mpCommandList->CopyBufferRegion(
+				p_destination,
+				command.destinationOffset,
+				mpRing.Get(),
+				command.sourceOffset,
+				command.size
+			);
+			continue;
+		}
+
+		D3D12_TEXTURE_COPY_LOCATION destination;
+		destination.pResource = p_destination;
+		destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+		destination.SubresourceIndex = command.subresource;
+
+		D3D12_TEXTURE_COPY_LOCATION source;
+		source.pResource = mpRing.Get();
+		source.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+		source.PlacedFootprint.Offset = command.sourceOffset;
+		source.PlacedFootprint.Footprint.Format = static_cast<DXGI_FORMAT>(command.format);
+		source.PlacedFootprint.Footprint.Width = command.width;
+		source.PlacedFootprint.Footprint.Height = command.height;
+		source.PlacedFootprint.Footprint.Depth = 1;
+		source.PlacedFootprint.Footprint.RowPitch = command.rowPitch;
+
+		mpCommandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+	}
+
+	mpCommandList->Close();
+
+	ID3D12CommandList * pp_command_lists[] { mpCommandList.Get() };
+	mpCommandQueue->ExecuteCommandLists(1, pp_command_lists);
+	mpCommandQueue->Signal(mpFence.Get(), ++mFenceValue);
+
+	mCommandAllocators.push_back({ p_command_allocator, mFenceValue, move(p_destinations) });
+
+	return mFenceValue;
+}
+
+uint64_t CopyQueueDX12::getCompletedValue()
+{
+	const auto completed_value = mpFence->GetCompletedValue();
+
+	// 終わったコピーの参照を外して，キャッシュが捨てられるようにする
+	for(auto & command_allocator : mCommandAllocators)
+	{
+		if(command_allocator.fenceValue > completed_value)
+		{
+			break;
+		}
+		command_allocator.pDestinations.clear();
+	}
+
+	return completed_value;
+}
+
+void CopyQueueDX12::wait(uint64_t fence_value)
+{
+	if(mpFence->GetCompletedValue() >= fence_value)
+	{
+		return;
+	}
+
+	mpFence->SetEventOnCompletion(fence_value, mhFenceEvent);
+	WaitForSingleObject(mhFenceEvent, INFINITE);
+}
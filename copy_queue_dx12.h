@@ -0,0 +1,55 @@
+﻿#pragma once
+#ifndef COPY_QUEUE_DX12_H_INCLUDED
+#define COPY_QUEUE_DX12_H_INCLUDED
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <d3d12.h>
+#include <wrl/client.h>
+#include "staging_uploader.h"
+
+// コピー専用のキューと，常にマップしたアップロードリング
+// コピー先はCOMMONで作っておけば，コピーキューでCOPY_DESTに，描画キューでシェーダリソースなどに暗黙に昇格する
+class CopyQueueDX12 : public UploadQueue
+{
+public:
+	~CopyQueueDX12() override;
+
+	bool initialize(ID3D12Device * p_device, uint64_t ring_size);
+
+	uint64_t execute(const UploadCommand * p_commands, size_t command_count) override;
+	uint64_t getCompletedValue() override;
+	void wait(uint64_t fence_value) override;
+
+	uint8_t * getMappedRing() const { return mpMappedRing; }
+
+	// 描画キューでコピーの完了を待つのに使う
+	ID3D12Fence * getFence() const { return mpFence.Get(); }
+
+private:
+	bool acquireCommandAllocator(Microsoft::WRL::ComPtr<ID3D12CommandAllocator> & p_command_allocator);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mpDevice;
+	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mpCommandQueue;
+	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mpCommandList;
+
+	// コピーが終わるまでアロケータはリセットできず，コピー先も解放できないので，フェンス値と一緒に持つ
+	struct CommandAllocator
+	{
+		Microsoft::WRL::ComPtr<ID3D12CommandAllocator> pCommandAllocator;
+		uint64_t fenceValue;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> pDestinations;
+	};
+	std::deque<CommandAllocator> mCommandAllocators;
+
+	Microsoft::WRL::ComPtr<ID3D12Resource> mpRing;
+	uint8_t * mpMappedRing = nullptr;
+
+	Microsoft::WRL::ComPtr<ID3D12Fence> mpFence;
+	uint64_t mFenceValue = 0;
+	HANDLE mhFenceEvent = nullptr;
+};
+
+#endif // COPY_QUEUE_DX12_H_INCLUDED
@@ -0,0 +1,189 @@
+﻿#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include "asset_archive.h"
+#include "async_file_reader.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	// ページキャッシュからファイルを追い出す．Windowsでは手段が無いのでfalse
+	bool evictFromPageCache(const filesystem::path & path)
+	{
+#if defined(_WIN32)
+		(void)path;
+		return false;
+#else
+		const int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			return false;
+		}
+
+		const bool is_evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		close(fd);
+
+		return is_evicted;
+#endif
+	}
+
+	bool evictFromPageCache(const vector<filesystem::path> & paths)
+	{
+		for(const auto & path : paths)
+		{
+			if(!evictFromPageCache(path))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// p_readerがnullptrのときは，ifstreamで1つずつ読む今までの読み方
+	bool readAll(const vector<filesystem::path> & paths, AsyncFileReader * p_reader, uint64_t & byte_count)
+	{
+		byte_count = 0;
+		if(p_reader == nullptr)
+		{
+			for(const auto & path : paths)
+			{
+				asset_archive::Data data;
+				if(!asset_archive::readFile(path, data))
+				{
+					return false;
+				}
+				byte_count += data.size;
+			}
+
+			return true;
+		}
+
+		auto futures = p_reader->read(paths);
+		for(auto & future : futures)
+		{
+			auto result = future.get();
+			if(!result.isSucceeded)
+			{
+				return false;
+			}
+			byte_count += result.data.size;
+		}
+
+		return true;
+	}
+}
+
+// file_read_benchmark <file or directory>... [--repeat <count>]
+// ifstreamで1つずつ読む場合と，AsyncFileReaderでまとめて読む場合の速さを，
+// ページキャッシュから追い出した後(cold)とキャッシュに載った後(warm)で比べる
+int main(int argc, char * argv[])
+{
+	vector<filesystem::path> paths;
+	uint32_t repeat_count = 3;
+	for(int i = 1; i < argc; ++i)
+	{
+		const string argument = argv[i];
+		if(argument == "--repeat" && i + 1 < argc)
+		{
+			repeat_count = static_cast<uint32_t>(atoi(argv[++i]));
+			continue;
+		}
+
+		if(filesystem::is_directory(argument))
+		{
+			for(const auto & entry : filesystem::recursive_directory_iterator(argument))
+			{
+				if(entry.is_regular_file())
+				{
+					paths.push_back(entry.path());
+				}
+			}
+		}
+		else
+		{
+			paths.push_back(argument);
+		}
+	}
+
+	if(paths.empty() || repeat_count == 0)
+	{
+		fprintf(stderr, "usage: %s <file or directory>... [--repeat <count>]\n", argv[0]);
+		return 1;
+	}
+
+	const bool can_evict = evictFromPageCache(paths);
+	if(!can_evict)
+	{
+		printf("note: cannot evict files from the page cache, cold reads are skipped.\n");
+	}
+
+	printf("%zu files\n", paths.size());
+	printf("    threads   cache       MB     ms/read     MB/s\n");
+
+	for(const uint32_t thread_count : { 0u, 1u, 2u, 4u, 8u, 16u })
+	{
+		// スレッドを作る時間は含めない
+		unique_ptr<AsyncFileReader> p_reader;
+		if(thread_count > 0)
+		{
+			p_reader.reset(new AsyncFileReader(thread_count));
+		}
+
+		for(const bool is_cold : { true, false })
+		{
+			if(is_cold && !can_evict)
+			{
+				continue;
+			}
+
+			// warmは1回読んでキャッシュに載せてから測る
+			uint64_t byte_count = 0;
+			if(!is_cold && !readAll(paths, p_reader.get(), byte_count))
+			{
+				fprintf(stderr, "error: failed to read files.\n");
+				return 1;
+			}
+
+			double seconds = 0.0;
+			for(uint32_t repeat = 0; repeat < repeat_count; ++repeat)
+			{
+				if(is_cold)
+				{
+					evictFromPageCache(paths);
+				}
+
+				const auto start = chrono::steady_clock::now();
+				if(!readAll(paths, p_reader.get(), byte_count))
+				{
+					fprintf(stderr, "error: failed to read files.\n");
+					return 1;
+				}
+				seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			}
+			seconds /= repeat_count;
+
+			const auto mega_bytes = byte_count / (1024.0 * 1024.0);
+			printf(
+				"  %9s  %6s  %7.1f  %10.3f  %7.1f\n",
+				thread_count == 0 ? "ifstream" : to_string(thread_count).c_str(),
+				is_cold ? "cold" : "warm",
+				mega_bytes,
+				seconds * 1000.0,
+				mega_bytes / seconds
+			);
+		}
+	}
+
+	return 0;
+}
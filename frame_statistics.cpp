@@ -0,0 +1,237 @@
+﻿#include "frame_statistics.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+using namespace std;
+
+namespace
+{
+	const char * MetricNames[]
+	{
+		"update",
+		"record",
+		"submit",
+		"fence_wait",
+		"present_interval",
+	};
+	static_assert(size(MetricNames) == FrameStatistics::MetricCount);
+
+	uint32_t getMostSignificantBit(uint64_t value)
+	{
+		uint32_t bit = 0;
+		while(value >>= 1)
+		{
+			++bit;
+		}
+		return bit;
+	}
+}
+
+uint32_t LatencyHistogram::getBucketIndex(uint64_t value)
+{
+	value = min(value, (uint64_t(1) << MaxValueBits) - 1);
+
+	// 2 * SubBucketCount未満はそのまま，それ以上は上位SubBucketBits + 1ビットで区切る
+	if(value < 2 * SubBucketCount)
+	{
+		return static_cast<uint32_t>(value);
+	}
+
+	const uint32_t shift = getMostSignificantBit(value) - SubBucketBits;
+	return SubBucketCount * shift + static_cast<uint32_t>(value >> shift);
+}
+
+uint64_t LatencyHistogram::getBucketValue(uint32_t index)
+{
+	if(index < 2 * SubBucketCount)
+	{
+		return index;
+	}
+
+	// バケツの中央の値
+	const uint32_t shift = index / SubBucketCount - 1;
+	const uint64_t sub_bucket = index - SubBucketCount * shift;
+	return (sub_bucket << shift) + (uint64_t(1) << shift) / 2;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+	++mCounts[getBucketIndex(nanoseconds)];
+	++mCount;
+	mSum += nanoseconds;
+	mMax = max(mMax, nanoseconds);
+}
+
+void LatencyHistogram::reset()
+{
+	mCounts.fill(0);
+	mCount = 0;
+	mSum = 0;
+	mMax = 0;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+	if(mCount == 0)
+	{
+		return 0;
+	}
+
+	const auto target = max(static_cast<uint64_t>(ceil(percentile / 100.0 * mCount)), uint64_t(1));
+
+	uint64_t count = 0;
+	for(uint32_t i = 0; i < BucketCount; ++i)
+	{
+		count += mCounts[i];
+		if(count >= target)
+		{
+			// バケツの中央が実際の最大値を超えないようにする
+			return min(getBucketValue(i), mMax);
+		}
+	}
+
+	return mMax;
+}
+
+FrameStatistics::FrameStatistics(uint32_t window_frame_count)
+	: mWindowFrameCount(max(window_frame_count, 1u))
+{
+}
+
+uint64_t FrameStatistics::now()
+{
+	return static_cast<uint64_t>(
+		chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count()
+	);
+}
+
+const char * FrameStatistics::getMetricName(Metric metric)
+{
+	return MetricNames[static_cast<uint32_t>(metric)];
+}
+
+void FrameStatistics::record(Metric metric, uint64_t nanoseconds)
+{
+	const auto index = static_cast<uint32_t>(metric);
+	mWindowHistograms[index].record(nanoseconds);
+	mTotalHistograms[index].record(nanoseconds);
+}
+
+bool FrameStatistics::endFrame()
+{
+	if(++mWindowFrame < mWindowFrameCount)
+	{
+		return false;
+	}
+
+	for(uint32_t i = 0; i < MetricCount; ++i)
+	{
+		mWindowSummaries[i] = summarize(mWindowHistograms[i]);
+		mWindowHistograms[i].reset();
+	}
+	mWindowFrame = 0;
+
+	return true;
+}
+
+FrameStatistics::Summary FrameStatistics::getTotalSummary(Metric metric) const
+{
+	return summarize(mTotalHistograms[static_cast<uint32_t>(metric)]);
+}
+
+FrameStatistics::Summary FrameStatistics::summarize(const LatencyHistogram & histogram)
+{
+	constexpr double to_milliseconds = 1.0 / 1000000.0;
+
+	Summary summary;
+	summary.count = histogram.getCount();
+	summary.meanMilliseconds = histogram.getMean() * to_milliseconds;
+	summary.p50Milliseconds = histogram.getPercentile(50.0) * to_milliseconds;
+	summary.p95Milliseconds = histogram.getPercentile(95.0) * to_milliseconds;
+	summary.p99Milliseconds = histogram.getPercentile(99.0) * to_milliseconds;
+	summary.maxMilliseconds = histogram.getMax() * to_milliseconds;
+
+	return summary;
+}
+
+bool FrameStatistics::writeCSV(const std::filesystem::path & path) const
+{
+	ofstream fout(path);
+	if(!fout)
+	{
+		return false;
+	}
+
+	fout << "metric,scope,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+
+	auto write_row = [&fout](const char * name, const char * scope, const Summary & summary)
+	{
+		char row[256];
+		snprintf(
+			row,
+			sizeof(row),
+			"%s,%s,%llu,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+			name,
+			scope,
+			static_cast<unsigned long long>(summary.count),
+			summary.meanMilliseconds,
+			summary.p50Milliseconds,
+			summary.p95Milliseconds,
+			summary.p99Milliseconds,
+			summary.maxMilliseconds
+		);
+		fout << row;
+	};
+
+	for(uint32_t i = 0; i < MetricCount; ++i)
+	{
+		const auto metric = static_cast<Metric>(i);
+		write_row(getMetricName(metric), "window", getWindowSummary(metric));
+		write_row(getMetricName(metric), "total", getTotalSummary(metric));
+	}
+
+	return static_cast<bool>(fout);
+}
+
+bool FrameStatistics::writeJSON(const std::filesystem::path & path) const
+{
+	ofstream fout(path);
+	if(!fout)
+	{
+		return false;
+	}
+
+	auto write_summary = [&fout](const Summary & summary)
+	{
+		char object[256];
+		snprintf(
+			object,
+			sizeof(object),
+			"{\"count\":%llu,\"mean_ms\":%.4f,\"p50_ms\":%.4f,\"p95_ms\":%.4f,\"p99_ms\":%.4f,\"max_ms\":%.4f}",
+			static_cast<unsigned long long>(summary.count),
+			summary.meanMilliseconds,
+			summary.p50Milliseconds,
+			summary.p95Milliseconds,
+			summary.p99Milliseconds,
+			summary.maxMilliseconds
+		);
+		fout << object;
+	};
+
+	fout << "{\"windowFrameCount\":" << mWindowFrameCount << ",\"metrics\":{\n";
+	for(uint32_t i = 0; i < MetricCount; ++i)
+	{
+		const auto metric = static_cast<Metric>(i);
+		fout << (i > 0 ? ",\n" : "") << "\"" << getMetricName(metric) << "\":{\"window\":";
+		write_summary(getWindowSummary(metric));
+		fout << ",\"total\":";
+		write_summary(getTotalSummary(metric));
+		fout << "}";
+	}
+	fout << "\n}}\n";
+
+	return static_cast<bool>(fout);
+}
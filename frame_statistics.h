@@ -0,0 +1,99 @@
+﻿#pragma once
+#ifndef FRAME_STATISTICS_H_INCLUDED
+#define FRAME_STATISTICS_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+
+// 対数で区切ったヒストグラム(HDR Histogramと同じ方式)に時間を記録する
+// 大きさは固定で，記録しても確保しない
+class LatencyHistogram
+{
+public:
+	// 2のべきごとに32分割する．誤差は約3%
+	static constexpr uint32_t SubBucketBits = 5;
+	static constexpr uint32_t SubBucketCount = 1 << SubBucketBits;
+
+	// 2^40ナノ秒(約18分)で打ち切る
+	static constexpr uint32_t MaxValueBits = 40;
+	static constexpr uint32_t BucketCount = SubBucketCount * (MaxValueBits - SubBucketBits + 1);
+
+	void record(uint64_t nanoseconds);
+	void reset();
+
+	uint64_t getCount() const { return mCount; }
+	uint64_t getMax() const { return mMax; }
+	double getMean() const { return mCount > 0 ? static_cast<double>(mSum) / mCount : 0.0; }
+
+	// percentileは0から100
+	uint64_t getPercentile(double percentile) const;
+
+private:
+	static uint32_t getBucketIndex(uint64_t value);
+	static uint64_t getBucketValue(uint32_t index);
+
+private:
+	std::array<uint32_t, BucketCount> mCounts {};
+	uint64_t mCount = 0;
+	uint64_t mSum = 0;
+	uint64_t mMax = 0;
+};
+
+// フレームの各段階の時間を記録し，一定フレームごとにパーセンタイルをまとめる
+class FrameStatistics
+{
+public:
+	enum class Metric : uint32_t
+	{
+		Update,
+		Record,
+		Submit,
+		FenceWait,
+		PresentInterval,
+		Count,
+	};
+
+	static constexpr uint32_t MetricCount = static_cast<uint32_t>(Metric::Count);
+
+	struct Summary
+	{
+		uint64_t count;
+		double meanMilliseconds;
+		double p50Milliseconds;
+		double p95Milliseconds;
+		double p99Milliseconds;
+		double maxMilliseconds;
+	};
+
+	explicit FrameStatistics(uint32_t window_frame_count = 600);
+
+	static uint64_t now();
+	static const char * getMetricName(Metric metric);
+
+	void record(Metric metric, uint64_t nanoseconds);
+
+	// WindowFrameCountフレームごとに，直近のウィンドウの集計を更新する
+	// 集計を更新したフレームではtrueを返す
+	bool endFrame();
+
+	const Summary & getWindowSummary(Metric metric) const { return mWindowSummaries[static_cast<uint32_t>(metric)]; }
+	Summary getTotalSummary(Metric metric) const;
+
+	// 直近のウィンドウと起動からの全体を書き出す
+	bool writeCSV(const std::filesystem::path & path) const;
+	bool writeJSON(const std::filesystem::path & path) const;
+
+private:
+	static Summary summarize(const LatencyHistogram & histogram);
+
+private:
+	uint32_t mWindowFrameCount;
+	uint32_t mWindowFrame = 0;
+
+	std::array<LatencyHistogram, MetricCount> mWindowHistograms;
+	std::array<LatencyHistogram, MetricCount> mTotalHistograms;
+	std::array<Summary, MetricCount> mWindowSummaries {};
+};
+
+#endif // FRAME_STATISTICS_H_INCLUDED
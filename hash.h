@@ -0,0 +1,153 @@
+﻿#pragma once
+#ifndef HASH_H_INCLUDED
+#define HASH_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace hashing
+{
+	constexpr uint64_t FNV1aOffsetBasis = 14695981039346656037ull;
+	constexpr uint64_t FNV1aPrime = 1099511628211ull;
+
+	inline uint64_t fnv1a64(const void * p_data, size_t size, uint64_t hash = FNV1aOffsetBasis)
+	{
+		auto p = static_cast<const uint8_t *>(p_data);
+		for(size_t i = 0; i < size; ++i)
+		{
+			hash ^= p[i];
+			hash *= FNV1aPrime;
+		}
+
+		return hash;
+	}
+
+	// 終端文字も混ぜて "ab" + "c" と "a" + "bc" を区別する
+	inline uint64_t fnv1a64(const char * str, uint64_t hash = FNV1aOffsetBasis)
+	{
+		for(; *str != '\0'; ++str)
+		{
+			hash ^= static_cast<uint8_t>(*str);
+			hash *= FNV1aPrime;
+		}
+
+		hash *= FNV1aPrime;
+
+		return hash;
+	}
+
+	namespace detail
+	{
+		constexpr uint64_t XXH64Prime1 = 11400714785074694791ull;
+		constexpr uint64_t XXH64Prime2 = 14029467366897019727ull;
+		constexpr uint64_t XXH64Prime3 = 1609587929392839161ull;
+		constexpr uint64_t XXH64Prime4 = 9650029242287828579ull;
+		constexpr uint64_t XXH64Prime5 = 2870177450012600261ull;
+
+		inline uint64_t rotateLeft(uint64_t value, uint32_t count)
+		{
+			return (value << count) | (value >> (64 - count));
+		}
+
+		inline uint64_t read64(const uint8_t * p)
+		{
+			uint64_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		inline uint32_t read32(const uint8_t * p)
+		{
+			uint32_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		inline uint64_t xxh64Round(uint64_t accumulator, uint64_t input)
+		{
+			accumulator += input * XXH64Prime2;
+			accumulator = rotateLeft(accumulator, 31);
+			return accumulator * XXH64Prime1;
+		}
+
+		inline uint64_t xxh64Merge(uint64_t hash, uint64_t accumulator)
+		{
+			hash ^= xxh64Round(0, accumulator);
+			return hash * XXH64Prime1 + XXH64Prime4;
+		}
+	}
+
+	// 画像などの大きなデータ用．fnv1a64より桁違いに速い(XXH64と同じ値)
+	inline uint64_t xxh64(const void * p_data, size_t size, uint64_t seed = 0)
+	{
+		using namespace detail;
+
+		auto p = static_cast<const uint8_t *>(p_data);
+		const auto p_end = p + size;
+
+		uint64_t hash;
+		if(size >= 32)
+		{
+			uint64_t v1 = seed + XXH64Prime1 + XXH64Prime2;
+			uint64_t v2 = seed + XXH64Prime2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - XXH64Prime1;
+
+			for(; p + 32 <= p_end; p += 32)
+			{
+				v1 = xxh64Round(v1, read64(p));
+				v2 = xxh64Round(v2, read64(p + 8));
+				v3 = xxh64Round(v3, read64(p + 16));
+				v4 = xxh64Round(v4, read64(p + 24));
+			}
+
+			hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+			hash = xxh64Merge(hash, v1);
+			hash = xxh64Merge(hash, v2);
+			hash = xxh64Merge(hash, v3);
+			hash = xxh64Merge(hash, v4);
+		}
+		else
+		{
+			hash = seed + XXH64Prime5;
+		}
+
+		hash += static_cast<uint64_t>(size);
+
+		for(; p + 8 <= p_end; p += 8)
+		{
+			hash ^= xxh64Round(0, read64(p));
+			hash = rotateLeft(hash, 27) * XXH64Prime1 + XXH64Prime4;
+		}
+
+		if(p + 4 <= p_end)
+		{
+			hash ^= static_cast<uint64_t>(read32(p)) * XXH64Prime1;
+			hash = rotateLeft(hash, 23) * XXH64Prime2 + XXH64Prime3;
+			p += 4;
+		}
+
+		for(; p < p_end; ++p)
+		{
+			hash ^= (*p) * XXH64Prime5;
+			hash = rotateLeft(hash, 11) * XXH64Prime1;
+		}
+
+		hash ^= hash >> 33;
+		hash *= XXH64Prime2;
+		hash ^= hash >> 29;
+		hash *= XXH64Prime3;
+		hash ^= hash >> 32;
+
+		return hash;
+	}
+
+	template<typename T>
+	inline uint64_t fnv1a64Value(const T & value, uint64_t hash = FNV1aOffsetBasis)
+	{
+		return fnv1a64(&value, sizeof(value), hash);
+	}
+}
+
+#endif // HASH_H_INCLUDED
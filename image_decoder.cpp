@@ -0,0 +1,1129 @@
+﻿#include "image_decoder.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+using namespace std;
+
+namespace image_decoder
+{
+	namespace
+	{
+		constexpr uint32_t MaxImageSize = 16384;
+
+		uint16_t readLE16(const uint8_t * p)
+		{
+			return static_cast<uint16_t>(p[0] | (p[1] << 8));
+		}
+
+		uint32_t readLE32(const uint8_t * p)
+		{
+			return
+				static_cast<uint32_t>(p[0]) |
+				(static_cast<uint32_t>(p[1]) << 8) |
+				(static_cast<uint32_t>(p[2]) << 16) |
+				(static_cast<uint32_t>(p[3]) << 24);
+		}
+
+		uint32_t readBE32(const uint8_t * p)
+		{
+			return
+				(static_cast<uint32_t>(p[0]) << 24) |
+				(static_cast<uint32_t>(p[1]) << 16) |
+				(static_cast<uint32_t>(p[2]) << 8) |
+				static_cast<uint32_t>(p[3]);
+		}
+
+		bool allocate(Image & image, uint32_t width, uint32_t height)
+		{
+			if(width == 0 || height == 0 || width > MaxImageSize || height > MaxImageSize)
+			{
+				return false;
+			}
+
+			image.width = width;
+			image.height = height;
+			image.pixels.resize(static_cast<size_t>(width) * height * 4);
+
+			return true;
+		}
+
+		// ビット列は下位ビットから詰められている．末尾を越えた分は0として読み，後で検出する
+		class BitReader
+		{
+		public:
+			BitReader(const uint8_t * p_data, size_t size)
+				: mpData(p_data), mpEnd(p_data + size)
+			{
+			}
+
+			uint32_t peek(uint32_t bit_count)
+			{
+				refill();
+				return static_cast<uint32_t>(mBits & ((1ull << bit_count) - 1));
+			}
+
+			void consume(uint32_t bit_count)
+			{
+				mBits >>= bit_count;
+				mBitCount -= bit_count;
+			}
+
+			uint32_t read(uint32_t bit_count)
+			{
+				const auto value = peek(bit_count);
+				consume(bit_count);
+				return value;
+			}
+
+			void alignToByte()
+			{
+				consume(mBitCount % 8);
+			}
+
+			bool isOverrun() const
+			{
+				return mPaddedByteCount * 8 > mBitCount;
+			}
+
+		private:
+			void refill()
+			{
+				while(mBitCount <= 56)
+				{
+					uint64_t byte = 0;
+					if(mpData < mpEnd)
+					{
+						byte = *mpData++;
+					}
+					else
+					{
+						++mPaddedByteCount;
+					}
+
+					mBits |= byte << mBitCount;
+					mBitCount += 8;
+				}
+			}
+
+		private:
+			const uint8_t * mpData;
+			const uint8_t * mpEnd;
+			uint64_t mBits = 0;
+			uint32_t mBitCount = 0;
+			uint32_t mPaddedByteCount = 0;
+		};
+
+		// 正規ハフマン符号．短い符号は表を1回引くだけで復号する
+		class Huffman
+		{
+		public:
+			static constexpr uint32_t MaxBits = 15;
+			static constexpr uint32_t FastBits = 10;
+			static constexpr uint32_t MaxSymbolCount = 288;
+
+			bool build(const uint8_t * p_lengths, uint32_t symbol_count)
+			{
+				mCounts.fill(0);
+				for(uint32_t i = 0; i < symbol_count; ++i)
+				{
+					++mCounts[p_lengths[i]];
+				}
+				mCounts[0] = 0;
+
+				// 符号が多すぎるものは不正．足りないもの(距離符号が1つだけなど)は許す
+				int32_t left = 1;
+				for(uint32_t length = 1; length <= MaxBits; ++length)
+				{
+					left = (left << 1) - mCounts[length];
+					if(left < 0)
+					{
+						return false;
+					}
+				}
+
+				array<uint16_t, MaxBits + 1> offsets;
+				offsets[1] = 0;
+				for(uint32_t length = 1; length < MaxBits; ++length)
+				{
+					offsets[length + 1] = offsets[length] + mCounts[length];
+				}
+
+				for(uint32_t i = 0; i < symbol_count; ++i)
+				{
+					if(p_lengths[i] != 0)
+					{
+						mSymbols[offsets[p_lengths[i]]++] = static_cast<uint16_t>(i);
+					}
+				}
+
+				mFastTable.fill(0);
+
+				array<uint32_t, MaxBits + 1> next_codes;
+				uint32_t code = 0;
+				next_codes[0] = 0;
+				for(uint32_t length = 1; length <= MaxBits; ++length)
+				{
+					code = (code + mCounts[length - 1]) << 1;
+					next_codes[length] = code;
+				}
+
+				for(uint32_t i = 0; i < symbol_count; ++i)
+				{
+					const uint32_t length = p_lengths[i];
+					if(length == 0)
+					{
+						continue;
+					}
+
+					const auto symbol_code = next_codes[length]++;
+					if(length > FastBits)
+					{
+						continue;
+					}
+
+					// ビット列は符号の上位ビットから並ぶので，反転して表を引く
+					uint32_t reversed = 0;
+					for(uint32_t bit = 0; bit < length; ++bit)
+					{
+						reversed |= ((symbol_code >> bit) & 1) << (length - 1 - bit);
+					}
+
+					for(uint32_t index = reversed; index < mFastTable.size(); index += 1u << length)
+					{
+						mFastTable[index] = static_cast<uint16_t>((i << 4) | length);
+					}
+				}
+
+				return true;
+			}
+
+			int32_t decode(BitReader & reader) const
+			{
+				const auto entry = mFastTable[reader.peek(FastBits)];
+				if(entry != 0)
+				{
+					reader.consume(entry & 0xf);
+					return entry >> 4;
+				}
+
+				// 長い符号は1ビットずつたどる
+				int32_t code = 0;
+				int32_t first = 0;
+				int32_t index = 0;
+				for(uint32_t length = 1; length <= MaxBits; ++length)
+				{
+					code |= reader.read(1);
+					const int32_t count = mCounts[length];
+					if(code - count < first)
+					{
+						return mSymbols[index + (code - first)];
+					}
+
+					index += count;
+					first = (first + count) << 1;
+					code <<= 1;
+				}
+
+				return -1;
+			}
+
+		private:
+			array<uint16_t, MaxBits + 1> mCounts;
+			array<uint16_t, MaxSymbolCount> mSymbols;
+			array<uint16_t, 1u << FastBits> mFastTable;
+		};
+
+		constexpr array<uint16_t, 29> LengthBases = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+		};
+		constexpr array<uint8_t, 29> LengthExtraBits = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+		};
+		constexpr array<uint16_t, 30> DistanceBases = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+		};
+		constexpr array<uint8_t, 30> DistanceExtraBits = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+		};
+
+		// max_sizeを超えて展開するデータは壊れているか，小さなファイルで大量のメモリを使わせるものなので失敗にする
+		bool inflateBlock(BitReader & reader, const Huffman & literals, const Huffman & distances, size_t max_size, vector<uint8_t> & output)
+		{
+			while(true)
+			{
+				const auto symbol = literals.decode(reader);
+				if(symbol < 0 || reader.isOverrun())
+				{
+					return false;
+				}
+
+				if(symbol < 256)
+				{
+					if(output.size() >= max_size)
+					{
+						return false;
+					}
+					output.push_back(static_cast<uint8_t>(symbol));
+					continue;
+				}
+
+				if(symbol == 256)
+				{
+					return true;
+				}
+
+				const uint32_t length_index = symbol - 257;
+				if(length_index >= LengthBases.size())
+				{
+					return false;
+				}
+				const uint32_t length = LengthBases[length_index] + reader.read(LengthExtraBits[length_index]);
+
+				const auto distance_index = distances.decode(reader);
+				if(distance_index < 0 || distance_index >= static_cast<int32_t>(DistanceBases.size()))
+				{
+					return false;
+				}
+				const uint32_t distance = DistanceBases[distance_index] + reader.read(DistanceExtraBits[distance_index]);
+				if(distance > output.size() || length > max_size - output.size())
+				{
+					return false;
+				}
+
+				// 距離が長さより短いときは書いたばかりのバイトを繰り返すので，1バイトずつコピーする
+				const auto begin = output.size();
+				output.resize(begin + length);
+				auto p_dst = output.data() + begin;
+				const auto p_src = p_dst - distance;
+				for(uint32_t i = 0; i < length; ++i)
+				{
+					p_dst[i] = p_src[i];
+				}
+			}
+		}
+
+		bool inflateDynamicTables(BitReader & reader, Huffman & literals, Huffman & distances)
+		{
+			constexpr array<uint8_t, 19> CodeLengthOrder = {
+				16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+			};
+
+			const uint32_t literal_count = reader.read(5) + 257;
+			const uint32_t distance_count = reader.read(5) + 1;
+			const uint32_t code_length_count = reader.read(4) + 4;
+			if(literal_count > 286 || distance_count > 30)
+			{
+				return false;
+			}
+
+			array<uint8_t, 19> code_length_lengths {};
+			for(uint32_t i = 0; i < code_length_count; ++i)
+			{
+				code_length_lengths[CodeLengthOrder[i]] = static_cast<uint8_t>(reader.read(3));
+			}
+
+			Huffman code_lengths;
+			if(!code_lengths.build(code_length_lengths.data(), static_cast<uint32_t>(code_length_lengths.size())))
+			{
+				return false;
+			}
+
+			array<uint8_t, 286 + 30> lengths {};
+			uint32_t index = 0;
+			while(index < literal_count + distance_count)
+			{
+				const auto symbol = code_lengths.decode(reader);
+				if(symbol < 0 || reader.isOverrun())
+				{
+					return false;
+				}
+
+				if(symbol < 16)
+				{
+					lengths[index++] = static_cast<uint8_t>(symbol);
+					continue;
+				}
+
+				uint8_t value = 0;
+				uint32_t repeat_count = 0;
+				if(symbol == 16)
+				{
+					if(index == 0)
+					{
+						return false;
+					}
+					value = lengths[index - 1];
+					repeat_count = 3 + reader.read(2);
+				}
+				else if(symbol == 17)
+				{
+					repeat_count = 3 + reader.read(3);
+				}
+				else
+				{
+					repeat_count = 11 + reader.read(7);
+				}
+
+				if(index + repeat_count > literal_count + distance_count)
+				{
+					return false;
+				}
+
+				fill_n(lengths.begin() + index, repeat_count, value);
+				index += repeat_count;
+			}
+
+			if(lengths[256] == 0)
+			{
+				return false;
+			}
+
+			return
+				literals.build(lengths.data(), literal_count) &&
+				distances.build(lengths.data() + literal_count, distance_count);
+		}
+
+		bool inflate(const uint8_t * p_data, size_t size, size_t max_size, vector<uint8_t> & output)
+		{
+			BitReader reader(p_data, size);
+
+			Huffman literals;
+			Huffman distances;
+
+			bool is_final = false;
+			while(!is_final)
+			{
+				is_final = reader.read(1) != 0;
+				const auto type = reader.read(2);
+
+				if(type == 0)
+				{
+					reader.alignToByte();
+					const auto length = reader.read(16);
+					const auto inverted_length = reader.read(16);
+					if((length ^ 0xffff) != inverted_length || length > max_size - output.size())
+					{
+						return false;
+					}
+
+					for(uint32_t i = 0; i < length; ++i)
+					{
+						output.push_back(static_cast<uint8_t>(reader.read(8)));
+					}
+				}
+				else if(type == 1)
+				{
+					array<uint8_t, 288 + 30> lengths;
+					fill_n(lengths.begin(), 144, 8);
+					fill_n(lengths.begin() + 144, 112, 9);
+					fill_n(lengths.begin() + 256, 24, 7);
+					fill_n(lengths.begin() + 280, 8, 8);
+					fill_n(lengths.begin() + 288, 30, 5);
+
+					literals.build(lengths.data(), 288);
+					distances.build(lengths.data() + 288, 30);
+
+					if(!inflateBlock(reader, literals, distances, max_size, output))
+					{
+						return false;
+					}
+				}
+				else if(type == 2)
+				{
+					if(!inflateDynamicTables(reader, literals, distances))
+					{
+						return false;
+					}
+
+					if(!inflateBlock(reader, literals, distances, max_size, output))
+					{
+						return false;
+					}
+				}
+				else
+				{
+					return false;
+				}
+
+				if(reader.isOverrun())
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+		{
+			const int32_t p = a + b - c;
+			const int32_t pa = abs(p - a);
+			const int32_t pb = abs(p - b);
+			const int32_t pc = abs(p - c);
+			if(pa <= pb && pa <= pc)
+			{
+				return a;
+			}
+
+			return pb <= pc ? b : c;
+		}
+
+		// 1画素のマスクで取り出した値を8bitに広げる
+		uint8_t extractMasked(uint32_t value, uint32_t mask)
+		{
+			if(mask == 0)
+			{
+				return 0;
+			}
+
+			uint32_t shift = 0;
+			while(((mask >> shift) & 1) == 0)
+			{
+				++shift;
+			}
+
+			uint32_t bit_count = 0;
+			while(shift + bit_count < 32 && ((mask >> (shift + bit_count)) & 1) != 0)
+			{
+				++bit_count;
+			}
+
+			const uint32_t component = (value & mask) >> shift;
+			const uint32_t max_value = bit_count >= 32 ? 0xffffffffu : (1u << bit_count) - 1;
+
+			return static_cast<uint8_t>((static_cast<uint64_t>(component) * 255 + max_value / 2) / max_value);
+		}
+	}
+
+	bool decode(const uint8_t * p_data, size_t size, Image & image)
+	{
+		if(size >= 8 && memcmp(p_data, "\x89PNG\r\n\x1a\n", 8) == 0)
+		{
+			return decodePNG(p_data, size, image);
+		}
+
+		if(size >= 2 && p_data[0] == 'B' && p_data[1] == 'M')
+		{
+			return decodeBMP(p_data, size, image);
+		}
+
+		// TGAには識別子が無いので，ヘッダが妥当なときだけ読む
+		return decodeTGA(p_data, size, image);
+	}
+
+	bool inflateZlib(const uint8_t * p_data, size_t size, size_t max_size, vector<uint8_t> & output)
+	{
+		if(size < 2)
+		{
+			return false;
+		}
+
+		const uint32_t cmf = p_data[0];
+		const uint32_t flags = p_data[1];
+		if((cmf & 0x0f) != 8 || (cmf * 256 + flags) % 31 != 0 || (flags & 0x20) != 0)
+		{
+			return false;
+		}
+
+		return inflate(p_data + 2, size - 2, max_size, output);
+	}
+
+	bool decodeBMP(const uint8_t * p_data, size_t size, Image & image)
+	{
+		constexpr size_t FileHeaderSize = 14;
+		if(size < FileHeaderSize + 40)
+		{
+			return false;
+		}
+
+		const uint32_t pixel_offset = readLE32(p_data + 10);
+		const uint32_t info_header_size = readLE32(p_data + 14);
+		if(info_header_size < 40 || FileHeaderSize + info_header_size > size)
+		{
+			return false;
+		}
+
+		const auto p_info = p_data + FileHeaderSize;
+		const int32_t width = static_cast<int32_t>(readLE32(p_info + 4));
+		const int32_t signed_height = static_cast<int32_t>(readLE32(p_info + 8));
+		const uint32_t bit_count = readLE16(p_info + 14);
+		const uint32_t compression = readLE32(p_info + 16);
+		const uint32_t used_color_count = readLE32(p_info + 32);
+
+		constexpr uint32_t CompressionRGB = 0;
+		constexpr uint32_t CompressionBitFields = 3;
+		constexpr uint32_t CompressionAlphaBitFields = 6;
+
+		// RLEは対応しない
+		if(compression != CompressionRGB && compression != CompressionBitFields && compression != CompressionAlphaBitFields)
+		{
+			return false;
+		}
+
+		const bool is_top_down = signed_height < 0;
+		const uint32_t height = static_cast<uint32_t>(is_top_down ? -signed_height : signed_height);
+		if(width <= 0 || !allocate(image, static_cast<uint32_t>(width), height))
+		{
+			return false;
+		}
+
+		// マスクは情報ヘッダの中(V3以降)か直後にある
+		uint32_t red_mask = 0x00ff0000;
+		uint32_t green_mask = 0x0000ff00;
+		uint32_t blue_mask = 0x000000ff;
+		uint32_t alpha_mask = 0;
+		size_t palette_offset = FileHeaderSize + info_header_size;
+		if(bit_count == 16)
+		{
+			red_mask = 0x7c00;
+			green_mask = 0x03e0;
+			blue_mask = 0x001f;
+		}
+
+		if(compression != CompressionRGB)
+		{
+			const size_t mask_count = compression == CompressionAlphaBitFields ? 4 : 3;
+			const size_t mask_offset = FileHeaderSize + 40;
+			if(mask_offset + mask_count * 4 > size)
+			{
+				return false;
+			}
+
+			red_mask = readLE32(p_data + mask_offset);
+			green_mask = readLE32(p_data + mask_offset + 4);
+			blue_mask = readLE32(p_data + mask_offset + 8);
+			if(mask_count == 4 || info_header_size >= 56)
+			{
+				alpha_mask = readLE32(p_data + mask_offset + 12);
+			}
+
+			if(info_header_size == 40)
+			{
+				palette_offset += mask_count * 4;
+			}
+		}
+		else if(bit_count == 32 && info_header_size >= 56)
+		{
+			// V4以降はBI_RGBでもアルファのマスクを持てる
+			alpha_mask = readLE32(p_data + FileHeaderSize + 52);
+		}
+
+		array<array<uint8_t, 4>, 256> palette {};
+		if(bit_count <= 8)
+		{
+			if(bit_count != 1 && bit_count != 4 && bit_count != 8)
+			{
+				return false;
+			}
+
+			uint32_t color_count = used_color_count != 0 ? used_color_count : 1u << bit_count;
+			color_count = min(color_count, 256u);
+			if(palette_offset + static_cast<size_t>(color_count) * 4 > size)
+			{
+				return false;
+			}
+
+			for(uint32_t i = 0; i < color_count; ++i)
+			{
+				const auto p_color = p_data + palette_offset + i * 4;
+				palette[i] = { p_color[2], p_color[1], p_color[0], 0xff };
+			}
+		}
+		else if(bit_count != 16 && bit_count != 24 && bit_count != 32)
+		{
+			return false;
+		}
+
+		const size_t row_pitch = ((static_cast<size_t>(width) * bit_count + 31) / 32) * 4;
+		if(pixel_offset > size || row_pitch * height > size - pixel_offset)
+		{
+			return false;
+		}
+
+		for(uint32_t y = 0; y < height; ++y)
+		{
+			const auto src_y = is_top_down ? y : height - 1 - y;
+			const auto p_src = p_data + pixel_offset + row_pitch * src_y;
+			auto p_dst = image.pixels.data() + static_cast<size_t>(y) * image.width * 4;
+
+			for(uint32_t x = 0; x < image.width; ++x, p_dst += 4)
+			{
+				if(bit_count <= 8)
+				{
+					const uint32_t pixels_per_byte = 8 / bit_count;
+					const uint32_t shift = (pixels_per_byte - 1 - x % pixels_per_byte) * bit_count;
+					const uint32_t index = (p_src[x / pixels_per_byte] >> shift) & ((1u << bit_count) - 1);
+					memcpy(p_dst, palette[index].data(), 4);
+				}
+				else if(bit_count == 24 && compression == CompressionRGB)
+				{
+					p_dst[0] = p_src[x * 3 + 2];
+					p_dst[1] = p_src[x * 3 + 1];
+					p_dst[2] = p_src[x * 3];
+					p_dst[3] = 0xff;
+				}
+				else
+				{
+					const uint32_t value = bit_count == 16 ? readLE16(p_src + x * 2) : readLE32(p_src + x * 4);
+					p_dst[0] = extractMasked(value, red_mask);
+					p_dst[1] = extractMasked(value, green_mask);
+					p_dst[2] = extractMasked(value, blue_mask);
+					p_dst[3] = alpha_mask != 0 ? extractMasked(value, alpha_mask) : 0xff;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	bool decodePNG(const uint8_t * p_data, size_t size, Image & image)
+	{
+		constexpr size_t SignatureSize = 8;
+		if(size < SignatureSize || memcmp(p_data, "\x89PNG\r\n\x1a\n", SignatureSize) != 0)
+		{
+			return false;
+		}
+
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t bit_depth = 0;
+		uint32_t color_type = 0;
+		array<array<uint8_t, 4>, 256> palette {};
+		uint32_t palette_size = 0;
+		array<uint16_t, 3> transparent_color {};
+		bool has_transparent_color = false;
+		vector<uint8_t> compressed;
+
+		size_t offset = SignatureSize;
+		bool is_header_found = false;
+		while(offset + 12 <= size)
+		{
+			const uint32_t length = readBE32(p_data + offset);
+			const auto p_type = p_data + offset + 4;
+			const auto p_chunk = p_data + offset + 8;
+			if(length > size - offset - 12)
+			{
+				return false;
+			}
+
+			if(memcmp(p_type, "IHDR", 4) == 0)
+			{
+				if(length < 13)
+				{
+					return false;
+				}
+
+				width = readBE32(p_chunk);
+				height = readBE32(p_chunk + 4);
+				bit_depth = p_chunk[8];
+				color_type = p_chunk[9];
+
+				// インタレースは対応しない
+				if(p_chunk[10] != 0 || p_chunk[11] != 0 || p_chunk[12] != 0)
+				{
+					return false;
+				}
+
+				is_header_found = true;
+			}
+			else if(memcmp(p_type, "PLTE", 4) == 0)
+			{
+				palette_size = min(length / 3, 256u);
+				for(uint32_t i = 0; i < palette_size; ++i)
+				{
+					palette[i] = { p_chunk[i * 3], p_chunk[i * 3 + 1], p_chunk[i * 3 + 2], 0xff };
+				}
+			}
+			else if(memcmp(p_type, "tRNS", 4) == 0)
+			{
+				if(color_type == 3)
+				{
+					for(uint32_t i = 0; i < min(length, 256u); ++i)
+					{
+						palette[i][3] = p_chunk[i];
+					}
+				}
+				else if(color_type == 0 && length >= 2)
+				{
+					transparent_color[0] = static_cast<uint16_t>((p_chunk[0] << 8) | p_chunk[1]);
+					has_transparent_color = true;
+				}
+				else if(color_type == 2 && length >= 6)
+				{
+					for(uint32_t i = 0; i < 3; ++i)
+					{
+						transparent_color[i] = static_cast<uint16_t>((p_chunk[i * 2] << 8) | p_chunk[i * 2 + 1]);
+					}
+					has_transparent_color = true;
+				}
+			}
+			else if(memcmp(p_type, "IDAT", 4) == 0)
+			{
+				compressed.insert(compressed.end(), p_chunk, p_chunk + length);
+			}
+			else if(memcmp(p_type, "IEND", 4) == 0)
+			{
+				break;
+			}
+
+			offset += 12 + static_cast<size_t>(length);
+		}
+
+		uint32_t channel_count = 0;
+		switch(color_type)
+		{
+		case 0: channel_count = 1; break;
+		case 2: channel_count = 3; break;
+		case 3: channel_count = 1; break;
+		case 4: channel_count = 2; break;
+		case 6: channel_count = 4; break;
+		default: return false;
+		}
+
+		const bool is_valid_depth =
+			bit_depth == 8 ||
+			(bit_depth == 16 && color_type != 3) ||
+			((bit_depth == 1 || bit_depth == 2 || bit_depth == 4) && (color_type == 0 || color_type == 3));
+		if(!is_header_found || !is_valid_depth || (color_type == 3 && palette_size == 0))
+		{
+			return false;
+		}
+
+		if(!allocate(image, width, height))
+		{
+			return false;
+		}
+
+		const uint32_t bits_per_pixel = channel_count * bit_depth;
+		const size_t row_size = (static_cast<size_t>(width) * bits_per_pixel + 7) / 8;
+		const size_t filter_stride = max(bits_per_pixel / 8, 1u);
+
+		const size_t filtered_size = (row_size + 1) * height;
+		vector<uint8_t> filtered;
+		filtered.reserve(filtered_size);
+		if(!inflateZlib(compressed.data(), compressed.size(), filtered_size, filtered) || filtered.size() < filtered_size)
+		{
+			return false;
+		}
+
+		const vector<uint8_t> zero_row(row_size, 0);
+		for(uint32_t y = 0; y < height; ++y)
+		{
+			const auto filter_type = filtered[y * (row_size + 1)];
+			auto p_row = filtered.data() + y * (row_size + 1) + 1;
+
+			// 最初の行は，前の行が0だったものとして扱う
+			const uint8_t * p_previous_row = y > 0 ? filtered.data() + (y - 1) * (row_size + 1) + 1 : zero_row.data();
+
+			switch(filter_type)
+			{
+			case 0:
+				break;
+			case 1:
+				for(size_t i = filter_stride; i < row_size; ++i)
+				{
+					p_row[i] += p_row[i - filter_stride];
+				}
+				break;
+			case 2:
+				for(size_t i = 0; i < row_size; ++i)
+				{
+					p_row[i] += p_previous_row[i];
+				}
+				break;
+			case 3:
+				for(size_t i = 0; i < filter_stride; ++i)
+				{
+					p_row[i] += static_cast<uint8_t>(p_previous_row[i] / 2);
+				}
+				for(size_t i = filter_stride; i < row_size; ++i)
+				{
+					p_row[i] += static_cast<uint8_t>((p_row[i - filter_stride] + p_previous_row[i]) / 2);
+				}
+				break;
+			case 4:
+				for(size_t i = 0; i < filter_stride; ++i)
+				{
+					p_row[i] += p_previous_row[i];
+				}
+				for(size_t i = filter_stride; i < row_size; ++i)
+				{
+					p_row[i] += paeth(p_row[i - filter_stride], p_previous_row[i], p_previous_row[i - filter_stride]);
+				}
+				break;
+			default:
+				return false;
+			}
+		}
+
+		const uint32_t max_sample = (1u << bit_depth) - 1;
+		for(uint32_t y = 0; y < height; ++y)
+		{
+			const auto p_row = filtered.data() + y * (row_size + 1) + 1;
+			auto p_dst = image.pixels.data() + static_cast<size_t>(y) * width * 4;
+
+			// よくある8bitのRGBAとRGBは画素ごとの変換を通さない
+			if(bit_depth == 8 && color_type == 6)
+			{
+				memcpy(p_dst, p_row, row_size);
+				continue;
+			}
+
+			if(bit_depth == 8 && color_type == 2 && !has_transparent_color)
+			{
+				for(uint32_t x = 0; x < width; ++x)
+				{
+					p_dst[x * 4] = p_row[x * 3];
+					p_dst[x * 4 + 1] = p_row[x * 3 + 1];
+					p_dst[x * 4 + 2] = p_row[x * 3 + 2];
+					p_dst[x * 4 + 3] = 0xff;
+				}
+				continue;
+			}
+
+			for(uint32_t x = 0; x < width; ++x, p_dst += 4)
+			{
+				array<uint16_t, 4> samples {};
+				for(uint32_t c = 0; c < channel_count; ++c)
+				{
+					const uint32_t sample_index = x * channel_count + c;
+					if(bit_depth == 16)
+					{
+						samples[c] = static_cast<uint16_t>((p_row[sample_index * 2] << 8) | p_row[sample_index * 2 + 1]);
+					}
+					else if(bit_depth == 8)
+					{
+						samples[c] = p_row[sample_index];
+					}
+					else
+					{
+						const uint32_t bit_offset = sample_index * bit_depth;
+						const uint32_t shift = 8 - bit_depth - bit_offset % 8;
+						samples[c] = static_cast<uint16_t>((p_row[bit_offset / 8] >> shift) & max_sample);
+					}
+				}
+
+				const auto to8 = [bit_depth, max_sample](uint32_t sample)
+				{
+					return static_cast<uint8_t>(bit_depth == 16 ? sample >> 8 : sample * 255 / max_sample);
+				};
+
+				switch(color_type)
+				{
+				case 0:
+					p_dst[0] = p_dst[1] = p_dst[2] = to8(samples[0]);
+					p_dst[3] = has_transparent_color && samples[0] == transparent_color[0] ? 0 : 0xff;
+					break;
+				case 2:
+					p_dst[0] = to8(samples[0]);
+					p_dst[1] = to8(samples[1]);
+					p_dst[2] = to8(samples[2]);
+					p_dst[3] =
+						has_transparent_color &&
+						samples[0] == transparent_color[0] &&
+						samples[1] == transparent_color[1] &&
+						samples[2] == transparent_color[2] ? 0 : 0xff;
+					break;
+				case 3:
+					memcpy(p_dst, palette[samples[0]].data(), 4);
+					break;
+				case 4:
+					p_dst[0] = p_dst[1] = p_dst[2] = to8(samples[0]);
+					p_dst[3] = to8(samples[1]);
+					break;
+				case 6:
+					p_dst[0] = to8(samples[0]);
+					p_dst[1] = to8(samples[1]);
+					p_dst[2] = to8(samples[2]);
+					p_dst[3] = to8(samples[3]);
+					break;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	bool decodeTGA(const uint8_t * p_data, size_t size, Image & image)
+	{
+		constexpr size_t HeaderSize = 18;
+		if(size < HeaderSize)
+		{
+			return false;
+		}
+
+		const uint32_t id_length = p_data[0];
+		const uint32_t color_map_type = p_data[1];
+		const uint32_t image_type = p_data[2];
+		const uint32_t color_map_first = readLE16(p_data + 3);
+		const uint32_t color_map_length = readLE16(p_data + 5);
+		const uint32_t color_map_depth = p_data[7];
+		const uint32_t width = readLE16(p_data + 12);
+		const uint32_t height = readLE16(p_data + 14);
+		const uint32_t pixel_depth = p_data[16];
+		const uint32_t descriptor = p_data[17];
+
+		const bool is_color_mapped = image_type == 1 || image_type == 9;
+		const bool is_gray = image_type == 3 || image_type == 11;
+		const bool is_rle = image_type >= 9;
+		if(color_map_type > 1 || (image_type != 1 && image_type != 2 && image_type != 3 && image_type != 9 && image_type != 10 && image_type != 11))
+		{
+			return false;
+		}
+
+		const bool is_valid_depth =
+			is_color_mapped ? color_map_type == 1 && pixel_depth == 8 :
+			is_gray ? pixel_depth == 8 :
+			pixel_depth == 15 || pixel_depth == 16 || pixel_depth == 24 || pixel_depth == 32;
+		if(!is_valid_depth)
+		{
+			return false;
+		}
+
+		if(!allocate(image, width, height))
+		{
+			return false;
+		}
+
+		size_t offset = HeaderSize + id_length;
+
+		const auto read_color = [](const uint8_t * p, uint32_t depth, uint8_t * p_dst)
+		{
+			if(depth == 15 || depth == 16)
+			{
+				const uint32_t value = readLE16(p);
+				p_dst[0] = static_cast<uint8_t>(((value >> 10) & 0x1f) * 255 / 31);
+				p_dst[1] = static_cast<uint8_t>(((value >> 5) & 0x1f) * 255 / 31);
+				p_dst[2] = static_cast<uint8_t>((value & 0x1f) * 255 / 31);
+				p_dst[3] = 0xff;
+			}
+			else
+			{
+				p_dst[0] = p[2];
+				p_dst[1] = p[1];
+				p_dst[2] = p[0];
+				p_dst[3] = depth == 32 ? p[3] : 0xff;
+			}
+		};
+
+		vector<array<uint8_t, 4>> color_map;
+		if(color_map_type == 1)
+		{
+			const uint32_t entry_size = (color_map_depth + 7) / 8;
+			if(color_map_depth != 15 && color_map_depth != 16 && color_map_depth != 24 && color_map_depth != 32)
+			{
+				return false;
+			}
+
+			if(offset + static_cast<size_t>(color_map_length) * entry_size > size)
+			{
+				return false;
+			}
+
+			color_map.resize(color_map_first + color_map_length);
+			for(uint32_t i = 0; i < color_map_length; ++i)
+			{
+				read_color(p_data + offset + i * entry_size, color_map_depth, color_map[color_map_first + i].data());
+			}
+			offset += static_cast<size_t>(color_map_length) * entry_size;
+		}
+
+		const uint32_t pixel_size = (pixel_depth + 7) / 8;
+		const auto read_pixel = [&](const uint8_t * p, uint8_t * p_dst)
+		{
+			if(is_color_mapped)
+			{
+				if(*p >= color_map.size())
+				{
+					return false;
+				}
+				memcpy(p_dst, color_map[*p].data(), 4);
+			}
+			else if(is_gray)
+			{
+				p_dst[0] = p_dst[1] = p_dst[2] = *p;
+				p_dst[3] = 0xff;
+			}
+			else
+			{
+				read_color(p, pixel_depth, p_dst);
+			}
+
+			return true;
+		};
+
+		// 格納順に展開してから，原点に合わせて並べ替える
+		const size_t pixel_count = static_cast<size_t>(width) * height;
+		size_t pixel_index = 0;
+		while(pixel_index < pixel_count)
+		{
+			uint32_t run_length = 1;
+			bool is_run = false;
+			if(is_rle)
+			{
+				if(offset >= size)
+				{
+					return false;
+				}
+
+				const uint32_t packet = p_data[offset++];
+				run_length = (packet & 0x7f) + 1;
+				is_run = (packet & 0x80) != 0;
+				run_length = static_cast<uint32_t>(min<size_t>(run_length, pixel_count - pixel_index));
+			}
+
+			auto p_dst = image.pixels.data() + pixel_index * 4;
+			for(uint32_t i = 0; i < run_length; ++i, p_dst += 4)
+			{
+				// 繰り返しのパケットは最初の画素だけを読む
+				if(is_run && i > 0)
+				{
+					memcpy(p_dst, p_dst - 4, 4);
+					continue;
+				}
+
+				if(offset + pixel_size > size || !read_pixel(p_data + offset, p_dst))
+				{
+					return false;
+				}
+				offset += pixel_size;
+			}
+
+			pixel_index += run_length;
+		}
+
+		const bool is_top_origin = (descriptor & 0x20) != 0;
+		const bool is_right_origin = (descriptor & 0x10) != 0;
+		if(!is_top_origin)
+		{
+			const size_t row_size = static_cast<size_t>(width) * 4;
+			for(uint32_t y = 0; y < height / 2; ++y)
+			{
+				swap_ranges(
+					image.pixels.begin() + y * row_size,
+					image.pixels.begin() + (y + 1) * row_size,
+					image.pixels.begin() + (height - 1 - y) * row_size
+				);
+			}
+		}
+
+		if(is_right_origin)
+		{
+			for(uint32_t y = 0; y < height; ++y)
+			{
+				auto p_row = image.pixels.data() + static_cast<size_t>(y) * width * 4;
+				for(uint32_t x = 0; x < width / 2; ++x)
+				{
+					swap_ranges(p_row + x * 4, p_row + x * 4 + 4, p_row + (width - 1 - x) * 4);
+				}
+			}
+		}
+
+		return true;
+	}
+}
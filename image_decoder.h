@@ -0,0 +1,33 @@
+﻿#pragma once
+#ifndef IMAGE_DECODER_H_INCLUDED
+#define IMAGE_DECODER_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// WICを使わずにBMP，PNG，TGAをRGBA8へ展開する
+// Windows以外でもビルドできるので，デコードだけを計測できる
+namespace image_decoder
+{
+	struct Image
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+
+		// 上の行から順に並んだRGBA8
+		std::vector<uint8_t> pixels;
+	};
+
+	// 対応していない形式(JPEGやインタレースPNGなど)はfalseを返すので，呼び出し側でWICを使う
+	bool decode(const uint8_t * p_data, size_t size, Image & image);
+
+	bool decodeBMP(const uint8_t * p_data, size_t size, Image & image);
+	bool decodePNG(const uint8_t * p_data, size_t size, Image & image);
+	bool decodeTGA(const uint8_t * p_data, size_t size, Image & image);
+
+	// zlib形式(RFC 1950)のデータを展開する．展開した大きさがmax_sizeを超えるならfalse
+	bool inflateZlib(const uint8_t * p_data, size_t size, size_t max_size, std::vector<uint8_t> & output);
+}
+
+#endif // IMAGE_DECODER_H_INCLUDED
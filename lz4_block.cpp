@@ -0,0 +1,247 @@
+﻿#include "lz4_block.h"
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace lz4
+{
+	namespace
+	{
+		constexpr uint32_t MinMatch = 4;
+		// 最後の5バイトはリテラルで，最後の一致は終端の12バイトより前から始める
+		constexpr size_t LastLiterals = 5;
+		constexpr size_t MatchFindLimit = 12;
+		constexpr size_t MaxOffset = 65535;
+		constexpr uint32_t HashLog = 16;
+
+		uint32_t read32(const uint8_t * p)
+		{
+			uint32_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		uint32_t hash(uint32_t sequence)
+		{
+			return (sequence * 2654435761u) >> (32 - HashLog);
+		}
+
+		// 15以上の長さは255ずつのバイトで続ける
+		bool writeLength(size_t length, uint8_t * p_destination, size_t capacity, size_t & position)
+		{
+			for(; length >= 255; length -= 255)
+			{
+				if(position >= capacity)
+				{
+					return false;
+				}
+				p_destination[position++] = 255;
+			}
+
+			if(position >= capacity)
+			{
+				return false;
+			}
+			p_destination[position++] = static_cast<uint8_t>(length);
+
+			return true;
+		}
+
+		bool readLength(const uint8_t * p_source, size_t source_size, size_t & position, size_t & length)
+		{
+			uint8_t value;
+			do
+			{
+				if(position >= source_size)
+				{
+					return false;
+				}
+				value = p_source[position++];
+				length += value;
+			}
+			while(value == 255);
+
+			return true;
+		}
+
+		bool writeSequence(
+			const uint8_t * p_literals,
+			size_t literal_length,
+			size_t offset,
+			size_t match_length,
+			uint8_t * p_destination,
+			size_t capacity,
+			size_t & position
+		)
+		{
+			if(position >= capacity)
+			{
+				return false;
+			}
+
+			const size_t match_code = match_length >= MinMatch ? match_length - MinMatch : 0;
+			auto & token = p_destination[position++];
+			token = static_cast<uint8_t>(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+			if(literal_length >= 15 && !writeLength(literal_length - 15, p_destination, capacity, position))
+			{
+				return false;
+			}
+
+			if(position + literal_length > capacity)
+			{
+				return false;
+			}
+			if(literal_length > 0)
+			{
+				memcpy(p_destination + position, p_literals, literal_length);
+				position += literal_length;
+			}
+
+			// 最後のリテラルだけの並びには一致が続かない
+			if(match_length == 0)
+			{
+				return true;
+			}
+
+			if(position + 2 > capacity)
+			{
+				return false;
+			}
+			p_destination[position++] = static_cast<uint8_t>(offset);
+			p_destination[position++] = static_cast<uint8_t>(offset >> 8);
+
+			if(match_code >= 15 && !writeLength(match_code - 15, p_destination, capacity, position))
+			{
+				return false;
+			}
+
+			return true;
+		}
+	}
+
+	size_t getCompressBound(size_t size)
+	{
+		return size + size / 255 + 16;
+	}
+
+	size_t compress(const uint8_t * p_source, size_t source_size, uint8_t * p_destination, size_t capacity)
+	{
+		// 位置+1を入れ，0は空とする
+		vector<uint32_t> table(size_t(1) << HashLog, 0);
+
+		size_t position = 0;
+		size_t anchor = 0;
+		if(source_size >= MatchFindLimit)
+		{
+			const size_t match_start_limit = source_size - MatchFindLimit;
+			const size_t match_end_limit = source_size - LastLiterals;
+
+			size_t i = 0;
+			while(i <= match_start_limit)
+			{
+				const auto sequence = read32(p_source + i);
+				auto & slot = table[hash(sequence)];
+				const size_t candidate = slot;
+				slot = static_cast<uint32_t>(i + 1);
+
+				if(candidate == 0 || i - (candidate - 1) > MaxOffset || read32(p_source + candidate - 1) != sequence)
+				{
+					++i;
+					continue;
+				}
+
+				const size_t reference = candidate - 1;
+				size_t match_length = MinMatch;
+				while(i + match_length < match_end_limit && p_source[reference + match_length] == p_source[i + match_length])
+				{
+					++match_length;
+				}
+
+				if(!writeSequence(p_source + anchor, i - anchor, i - reference, match_length, p_destination, capacity, position))
+				{
+					return 0;
+				}
+
+				i += match_length;
+				anchor = i;
+			}
+		}
+
+		if(!writeSequence(p_source + anchor, source_size - anchor, 0, 0, p_destination, capacity, position))
+		{
+			return 0;
+		}
+
+		return position;
+	}
+
+	bool decompress(const uint8_t * p_source, size_t source_size, uint8_t * p_destination, size_t destination_size)
+	{
+		size_t source_position = 0;
+		size_t destination_position = 0;
+		while(source_position < source_size)
+		{
+			const uint8_t token = p_source[source_position++];
+
+			size_t literal_length = token >> 4;
+			if(literal_length == 15 && !readLength(p_source, source_size, source_position, literal_length))
+			{
+				return false;
+			}
+
+			if(
+				literal_length > source_size - source_position ||
+				literal_length > destination_size - destination_position
+			)
+			{
+				return false;
+			}
+			if(literal_length > 0)
+			{
+				memcpy(p_destination + destination_position, p_source + source_position, literal_length);
+				source_position += literal_length;
+				destination_position += literal_length;
+			}
+
+			if(source_position == source_size)
+			{
+				break;
+			}
+
+			if(source_size - source_position < 2)
+			{
+				return false;
+			}
+			const size_t offset = p_source[source_position] | (p_source[source_position + 1] << 8);
+			source_position += 2;
+			if(offset == 0 || offset > destination_position)
+			{
+				return false;
+			}
+
+			size_t match_length = token & 15;
+			if(match_length == 15 && !readLength(p_source, source_size, source_position, match_length))
+			{
+				return false;
+			}
+			match_length += MinMatch;
+
+			if(match_length > destination_size - destination_position)
+			{
+				return false;
+			}
+
+			// 一致は自分自身と重なることがあるので，1バイトずつ写す
+			const auto p_match = p_destination + destination_position - offset;
+			for(size_t i = 0; i < match_length; ++i)
+			{
+				p_destination[destination_position + i] = p_match[i];
+			}
+			destination_position += match_length;
+		}
+
+		return destination_position == destination_size;
+	}
+}
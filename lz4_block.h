@@ -0,0 +1,22 @@
+﻿#pragma once
+#ifndef LZ4_BLOCK_H_INCLUDED
+#define LZ4_BLOCK_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+// LZ4のブロック形式(フレームのヘッダやチェックサムは持たない)
+// 圧縮は1つのハッシュ表で直前の一致を探すだけの貪欲法で，展開は不正な入力でも範囲外を読み書きしない
+namespace lz4
+{
+	// 圧縮できないデータでも収まる出力の大きさ
+	size_t getCompressBound(size_t size);
+
+	// 書き込んだ大きさを返す．capacityが足りなければ0
+	size_t compress(const uint8_t * p_source, size_t source_size, uint8_t * p_destination, size_t capacity);
+
+	// 展開した大きさがちょうどdestination_sizeのときだけtrue
+	bool decompress(const uint8_t * p_source, size_t source_size, uint8_t * p_destination, size_t destination_size);
+}
+
+#endif // LZ4_BLOCK_H_INCLUDED
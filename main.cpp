@@ -1,7 +1,11 @@
-#include <cstdint>
+﻿#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <Windows.h>
 #include "application.h"
 #include "renderer_dx12.h"
+#include "profiler.h"
+#include "allocation_tracker.h"
 
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 
@@ -14,6 +18,8 @@ int WINAPI WinMain(
 {
 	SetCurrentDirectory(WORKING_DIR);
 
+	PROFILE_THREAD_NAME("Main");
+
 	if(!application::initialize())
 	{
 		return 0;
@@ -79,13 +85,48 @@ int WINAPI WinMain(
 	}
 
 	RendererDX12 renderer;
+
+	// 最初のフレームまでの時間を比べるため，テクスチャを全て読み込んでから描き始める
+	if(strstr(lpCmdLine, "--sync-textures") != nullptr)
+	{
+		renderer.setTextureStreaming(false);
+	}
+
+	// アトラスの有無で記述子と描画を比べる
+	if(strstr(lpCmdLine, "--no-texture-atlas") != nullptr)
+	{
+		renderer.setTextureAtlas(false);
+	}
+
+	// アーカイブとファイルで読み込みの時間を比べる
+	if(strstr(lpCmdLine, "--no-asset-archive") != nullptr)
+	{
+		renderer.setAssetArchive(false);
+	}
+
 	if(!renderer.initialize(client_width, client_height, hWnd))
 	{
 		return 0;
 	}
 
+	// 計測やキャプチャでは，描画フレームごとにモーションを1フレームずつ進める
+	if(strstr(lpCmdLine, "--fixed-step") != nullptr)
+	{
+		renderer.getAnimationClock().setFixedStep();
+	}
+
+	// テクスチャキャッシュの予算をMB単位で指定する
+	if(auto p_option = strstr(lpCmdLine, "--texture-budget="); p_option != nullptr)
+	{
+		const auto budget_megabytes = strtoull(p_option + strlen("--texture-budget="), nullptr, 10);
+		renderer.getTextureCache().setBudget(budget_megabytes * 1024 * 1024);
+	}
+
 	ShowWindow(hWnd, nShowCmd);
 
+	// 初期化の時間を最初のフレームに含めない
+	PROFILE_BEGIN_FRAME();
+
 	MSG msg {};
 	while(true)
 	{
@@ -96,13 +137,28 @@ int WINAPI WinMain(
 				break;
 			}
 
+			// F12でその時点のフレーム統計を書き出す
+			if(msg.message == WM_KEYDOWN && msg.wParam == VK_F12)
+			{
+				renderer.getFrameStatistics().writeCSV("frame_statistics.csv");
+				renderer.getFrameStatistics().writeJSON("frame_statistics.json");
+			}
+
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 		}
 
 		renderer.render();
+
+		PROFILE_END_FRAME();
+		ALLOCATION_END_FRAME();
 	}
 
+	PROFILE_WRITE_TRACE("profile.json");
+
+	renderer.getFrameStatistics().writeCSV("frame_statistics.csv");
+	renderer.getFrameStatistics().writeJSON("frame_statistics.json");
+
 	application::finalize();
 
 	return static_cast<int>(msg.wParam);
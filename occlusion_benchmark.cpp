@@ -0,0 +1,522 @@
+﻿#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "occlusion_culler.h"
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t buffer_width = 320;
+	constexpr uint32_t buffer_height = 180;
+	constexpr uint32_t prism_sides = 8;
+	constexpr uint32_t face_samples = 5;
+
+	// 人の形に見立てた八角柱の部位．部位がボーン，部位の範囲がマテリアルの範囲の代わり
+	struct Part
+	{
+		float x;
+		float radius;
+		float bottom;
+		float top;
+		float tilt;
+	};
+
+	constexpr Part parts[]
+	{
+		{ 0.0f, 0.18f, 0.9f, 1.45f, 0.0f },
+		{ 0.0f, 0.11f, 1.45f, 1.7f, 0.0f },
+		{ -0.1f, 0.08f, 0.0f, 0.92f, 0.0f },
+		{ 0.1f, 0.08f, 0.0f, 0.92f, 0.0f },
+		{ -0.26f, 0.05f, 0.85f, 1.4f, 0.3f },
+		{ 0.26f, 0.05f, 0.85f, 1.4f, -0.3f },
+	};
+
+	struct Bounds
+	{
+		XMFLOAT3 min;
+		XMFLOAT3 max;
+	};
+
+	struct Model
+	{
+		vector<XMFLOAT3> positions;
+		vector<uint16_t> indices;
+		vector<Bounds> partBounds;
+		Bounds bounds;
+		vector<XMFLOAT3> occluderPositions;
+		vector<uint16_t> occluderIndices;
+	};
+
+	struct Actor
+	{
+		XMMATRIX world;
+		vector<array<XMFLOAT3, 3>> triangles;
+		Bounds bounds;
+	};
+
+	Bounds computeBounds(const XMFLOAT3 * p_positions, size_t count)
+	{
+		XMVECTOR bounds_min = XMLoadFloat3(&p_positions[0]);
+		XMVECTOR bounds_max = bounds_min;
+		for(size_t i = 1; i < count; ++i)
+		{
+			bounds_min = XMVectorMin(bounds_min, XMLoadFloat3(&p_positions[i]));
+			bounds_max = XMVectorMax(bounds_max, XMLoadFloat3(&p_positions[i]));
+		}
+
+		Bounds bounds;
+		XMStoreFloat3(&bounds.min, bounds_min);
+		XMStoreFloat3(&bounds.max, bounds_max);
+		return bounds;
+	}
+
+	// 閉じた八角柱を並べたモデルと，部位ごとのメッシュの内側の箱のオクルーダを作る
+	bool createModel(Model & model)
+	{
+		for(const auto & part : parts)
+		{
+			const auto base = static_cast<uint16_t>(model.positions.size());
+			const XMMATRIX transform =
+				XMMatrixTranslation(0.0f, -part.bottom, 0.0f) *
+				XMMatrixRotationAxis(XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), part.tilt) *
+				XMMatrixTranslation(part.x, part.bottom, 0.0f);
+			for(uint32_t ring = 0; ring < 2; ++ring)
+			{
+				for(uint32_t i = 0; i < prism_sides; ++i)
+				{
+					const float angle = 2.0f * XM_PI * i / prism_sides;
+					XMFLOAT3 p;
+					XMStoreFloat3(
+						&p,
+						XMVector3Transform(
+							XMVectorSet(part.radius * cos(angle), ring == 0 ? part.bottom : part.top, part.radius * sin(angle), 1.0f),
+							transform
+						)
+					);
+					model.positions.push_back(p);
+				}
+			}
+
+			for(uint32_t i = 0; i < prism_sides; ++i)
+			{
+				const uint16_t a = base + i;
+				const uint16_t b = base + (i + 1) % prism_sides;
+				const uint16_t c = a + prism_sides;
+				const uint16_t d = b + prism_sides;
+				model.indices.insert(model.indices.end(), { a, b, d, a, d, c });
+			}
+
+			for(uint32_t i = 1; i + 1 < prism_sides; ++i)
+			{
+				model.indices.insert(model.indices.end(), { base, static_cast<uint16_t>(base + i), static_cast<uint16_t>(base + i + 1) });
+				model.indices.insert(
+					model.indices.end(),
+					{
+						static_cast<uint16_t>(base + prism_sides),
+						static_cast<uint16_t>(base + prism_sides + i + 1),
+						static_cast<uint16_t>(base + prism_sides + i),
+					}
+				);
+			}
+
+			model.partBounds.push_back(computeBounds(&model.positions[base], prism_sides * 2));
+		}
+
+		model.bounds = computeBounds(model.positions.data(), model.positions.size());
+
+		for(const auto & part_bounds : model.partBounds)
+		{
+			auto box = part_bounds;
+			if(!OcclusionCuller::shrinkBoxInside(
+				model.positions.data(),
+				static_cast<uint32_t>(model.positions.size()),
+				model.indices.data(),
+				static_cast<uint32_t>(model.indices.size()),
+				box.min,
+				box.max
+			))
+			{
+				return false;
+			}
+
+			const auto base = static_cast<uint16_t>(model.occluderPositions.size());
+			for(uint32_t corner = 0; corner < 8; ++corner)
+			{
+				model.occluderPositions.push_back(
+					XMFLOAT3(
+						(corner & 1) ? box.max.x : box.min.x,
+						(corner & 2) ? box.max.y : box.min.y,
+						(corner & 4) ? box.max.z : box.min.z
+					)
+				);
+			}
+
+			for(auto index : OcclusionCuller::BoxIndices)
+			{
+				model.occluderIndices.push_back(base + index);
+			}
+		}
+
+		return true;
+	}
+
+	vector<Actor> createCrowd(const Model & model, uint32_t size, float spacing)
+	{
+		mt19937 engine(1);
+		uniform_real_distribution<float> yaw(0.0f, 2.0f * XM_PI);
+		uniform_real_distribution<float> jitter(-0.2f, 0.2f);
+
+		vector<Actor> actors(size * size);
+		for(uint32_t i = 0; i < actors.size(); ++i)
+		{
+			auto & actor = actors[i];
+			const float x = (i % size - (size - 1) * 0.5f) * spacing + jitter(engine);
+			const float z = (i / size - (size - 1) * 0.5f) * spacing + jitter(engine);
+			actor.world = XMMatrixRotationY(yaw(engine)) * XMMatrixTranslation(x, 0.0f, z);
+
+			vector<XMFLOAT3> positions(model.positions.size());
+			for(size_t j = 0; j < positions.size(); ++j)
+			{
+				XMStoreFloat3(&positions[j], XMVector3Transform(XMLoadFloat3(&model.positions[j]), actor.world));
+			}
+
+			for(size_t j = 0; j + 2 < model.indices.size(); j += 3)
+			{
+				actor.triangles.push_back({ positions[model.indices[j]], positions[model.indices[j + 1]], positions[model.indices[j + 2]] });
+			}
+
+			actor.bounds = computeBounds(positions.data(), positions.size());
+		}
+
+		return actors;
+	}
+
+	bool intersectSegmentBounds(const XMFLOAT3 & origin, const XMFLOAT3 & end, const Bounds & bounds)
+	{
+		const float o[] { origin.x, origin.y, origin.z };
+		const float d[] { end.x - origin.x, end.y - origin.y, end.z - origin.z };
+		const float b0[] { bounds.min.x, bounds.min.y, bounds.min.z };
+		const float b1[] { bounds.max.x, bounds.max.y, bounds.max.z };
+
+		float t0 = 0.0f;
+		float t1 = 1.0f;
+		for(uint32_t axis = 0; axis < 3; ++axis)
+		{
+			if(abs(d[axis]) < 1.0e-12f)
+			{
+				if(o[axis] < b0[axis] || o[axis] > b1[axis])
+				{
+					return false;
+				}
+				continue;
+			}
+
+			float near_t = (b0[axis] - o[axis]) / d[axis];
+			float far_t = (b1[axis] - o[axis]) / d[axis];
+			if(near_t > far_t)
+			{
+				swap(near_t, far_t);
+			}
+			t0 = max(t0, near_t);
+			t1 = min(t1, far_t);
+			if(t0 > t1)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// originからendまでの線分が，end自身を除いて三角形に当たるか
+	bool intersectSegmentTriangle(const XMFLOAT3 & origin, const XMFLOAT3 & end, const array<XMFLOAT3, 3> & triangle)
+	{
+		const XMVECTOR o = XMLoadFloat3(&origin);
+		const XMVECTOR d = XMVectorSubtract(XMLoadFloat3(&end), o);
+		const XMVECTOR v0 = XMLoadFloat3(&triangle[0]);
+		const XMVECTOR edge1 = XMVectorSubtract(XMLoadFloat3(&triangle[1]), v0);
+		const XMVECTOR edge2 = XMVectorSubtract(XMLoadFloat3(&triangle[2]), v0);
+		const XMVECTOR p = XMVector3Cross(d, edge2);
+		const float det = XMVectorGetX(XMVector3Dot(edge1, p));
+		if(abs(det) < 1.0e-12f)
+		{
+			return false;
+		}
+
+		const float inv_det = 1.0f / det;
+		const XMVECTOR s = XMVectorSubtract(o, v0);
+		const float u = XMVectorGetX(XMVector3Dot(s, p)) * inv_det;
+		if(u < 0.0f || u > 1.0f)
+		{
+			return false;
+		}
+
+		const XMVECTOR q = XMVector3Cross(s, edge1);
+		const float v = XMVectorGetX(XMVector3Dot(d, q)) * inv_det;
+		if(v < 0.0f || u + v > 1.0f)
+		{
+			return false;
+		}
+
+		const float t = XMVectorGetX(XMVector3Dot(edge2, q)) * inv_det;
+		return t > 0.0f && t < 1.0f - 1.0e-4f;
+	}
+
+	// 箱の面上の点を画素の中心に寄せ，そこへのレイが他の人に遮られなければ見えている．
+	// オクルーダはメッシュの内側にあるので，見えている点のある画素がオクルーダで隠れることはない
+	bool isActuallyVisible(
+		const Bounds & box,
+		const XMMATRIX & world,
+		uint32_t owner,
+		const vector<Actor> & actors,
+		const XMFLOAT3 & eye,
+		const XMMATRIX & view_projection,
+		const XMMATRIX & inverse_view_projection
+	)
+	{
+		const float b0[] { box.min.x, box.min.y, box.min.z };
+		const float b1[] { box.max.x, box.max.y, box.max.z };
+		const XMMATRIX world_view_projection = world * view_projection;
+		for(uint32_t axis = 0; axis < 3; ++axis)
+		{
+			for(uint32_t side = 0; side < 2; ++side)
+			{
+				for(uint32_t i = 0; i < face_samples * face_samples; ++i)
+				{
+					float p[3];
+					p[axis] = side == 0 ? b0[axis] : b1[axis];
+					const uint32_t u_axis = (axis + 1) % 3;
+					const uint32_t v_axis = (axis + 2) % 3;
+					p[u_axis] = b0[u_axis] + (b1[u_axis] - b0[u_axis]) * (i % face_samples) / (face_samples - 1);
+					p[v_axis] = b0[v_axis] + (b1[v_axis] - b0[v_axis]) * (i / face_samples) / (face_samples - 1);
+
+					XMFLOAT4 clip;
+					XMStoreFloat4(&clip, XMVector3Transform(XMVectorSet(p[0], p[1], p[2], 1.0f), world_view_projection));
+					if(clip.w <= 0.0f)
+					{
+						continue;
+					}
+
+					const float sx = (clip.x / clip.w * 0.5f + 0.5f) * buffer_width;
+					const float sy = (0.5f - clip.y / clip.w * 0.5f) * buffer_height;
+					const float sz = clip.z / clip.w;
+					if(sx < 0.0f || sy < 0.0f || sx >= buffer_width || sy >= buffer_height || sz < 0.0f || sz >= 1.0f)
+					{
+						continue;
+					}
+
+					const float ndc_x = (floor(sx) + 0.5f) / buffer_width * 2.0f - 1.0f;
+					const float ndc_y = 1.0f - (floor(sy) + 0.5f) / buffer_height * 2.0f;
+					XMFLOAT4 target;
+					XMStoreFloat4(&target, XMVector4Transform(XMVectorSet(ndc_x, ndc_y, sz, 1.0f), inverse_view_projection));
+					const XMFLOAT3 end(target.x / target.w, target.y / target.w, target.z / target.w);
+
+					bool blocked = false;
+					for(uint32_t a = 0; a < actors.size() && !blocked; ++a)
+					{
+						if(a == owner || !intersectSegmentBounds(eye, end, actors[a].bounds))
+						{
+							continue;
+						}
+
+						for(auto & triangle : actors[a].triangles)
+						{
+							if(intersectSegmentTriangle(eye, end, triangle))
+							{
+								blocked = true;
+								break;
+							}
+						}
+					}
+
+					if(!blocked)
+					{
+						return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+}
+
+// occlusion_benchmark [--size <actors per side>] [--frames <count>]
+// 群衆の周りを回るカメラで，オクルーダの描画と判定の時間，棄却率を測る．
+// 棄却した箱は全てレイで確かめ，実際には見えていたものがあれば失敗する
+int main(int argc, char * argv[])
+{
+	uint32_t crowd_size = 12;
+	uint32_t frame_count = 36;
+	for(int i = 1; i < argc; ++i)
+	{
+		const string argument = argv[i];
+		if(i + 1 >= argc)
+		{
+			fprintf(stderr, "usage: %s [--size <actors per side>] [--frames <count>]\n", argv[0]);
+			return 1;
+		}
+
+		const auto value = static_cast<uint32_t>(atoi(argv[++i]));
+		if(argument == "--size")
+		{
+			crowd_size = value;
+		}
+		else if(argument == "--frames")
+		{
+			frame_count = value;
+		}
+	}
+
+	if(crowd_size == 0 || frame_count == 0)
+	{
+		return 1;
+	}
+
+	Model model;
+	if(!createModel(model))
+	{
+		fprintf(stderr, "error: failed to build an occluder inside the mesh.\n");
+		return 1;
+	}
+
+	constexpr float spacing = 1.2f;
+	const auto actors = createCrowd(model, crowd_size, spacing);
+
+	const XMMATRIX projection = XMMatrixPerspectiveFovLH(XM_PIDIV4, static_cast<float>(buffer_width) / buffer_height, 0.1f, 200.0f);
+
+	// 胴の奥にある箱は，同じ持ち主としての判定では隠れず，別の持ち主としての判定では隠れる
+	{
+		OcclusionCuller owner_culler;
+		owner_culler.initialize(buffer_width, buffer_height);
+
+		const XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 1.175f, -5.0f, 0.0f), XMVectorSet(0.0f, 1.175f, 0.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		owner_culler.beginFrame(view * projection);
+		owner_culler.rasterizeOccluder(
+			model.occluderPositions.data(),
+			model.occluderIndices.data(),
+			static_cast<uint32_t>(model.occluderIndices.size()),
+			XMMatrixIdentity(),
+			0
+		);
+
+		const Bounds behind { XMFLOAT3(-0.03f, 1.15f, 0.3f), XMFLOAT3(0.03f, 1.2f, 0.35f) };
+		if(!owner_culler.isVisible(behind.min, behind.max, XMMatrixIdentity(), 0) ||
+			owner_culler.isVisible(behind.min, behind.max, XMMatrixIdentity(), 1) ||
+			owner_culler.isVisible(behind.min, behind.max, XMMatrixIdentity()))
+		{
+			fprintf(stderr, "error: the owner of an occluder is not excluded from its own test.\n");
+			return 1;
+		}
+	}
+
+	OcclusionCuller culler;
+	if(!culler.initialize(buffer_width, buffer_height))
+	{
+		return 1;
+	}
+
+	const float orbit_radius = crowd_size * spacing * 0.5f + 4.0f;
+
+	printf("%zu actors, %zu occluder triangles per actor, %ux%u buffer\n", actors.size(), model.occluderIndices.size() / 3, buffer_width, buffer_height);
+	printf("  frame     tests  frustum  occlusion  reject rate  ms/frame\n");
+
+	double total_seconds = 0.0;
+	uint64_t false_reject_count = 0;
+	vector<uint8_t> visible;
+	for(uint32_t frame = 0; frame < frame_count; ++frame)
+	{
+		const float angle = 2.0f * XM_PI * frame / frame_count;
+		const XMFLOAT3 eye(orbit_radius * cos(angle), 1.6f, orbit_radius * sin(angle));
+		const XMMATRIX view = XMMatrixLookAtLH(XMLoadFloat3(&eye), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		const XMMATRIX view_projection = view * projection;
+
+		// PMDRenderer::drawと同じく，全員のオクルーダを描いてから人と部位ごとに判定する
+		visible.clear();
+		const auto start = chrono::steady_clock::now();
+		culler.beginFrame(view_projection);
+		for(uint32_t i = 0; i < actors.size(); ++i)
+		{
+			culler.rasterizeOccluder(
+				model.occluderPositions.data(),
+				model.occluderIndices.data(),
+				static_cast<uint32_t>(model.occluderIndices.size()),
+				actors[i].world,
+				i
+			);
+		}
+
+		for(uint32_t i = 0; i < actors.size(); ++i)
+		{
+			visible.push_back(culler.isVisible(model.bounds.min, model.bounds.max, actors[i].world, i));
+			for(const auto & part_bounds : model.partBounds)
+			{
+				visible.push_back(visible[i * (model.partBounds.size() + 1)] && culler.isVisible(part_bounds.min, part_bounds.max, actors[i].world, i));
+			}
+		}
+		const auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		total_seconds += seconds;
+
+		const XMMATRIX inverse_view_projection = XMMatrixInverse(nullptr, view_projection);
+		for(uint32_t i = 0; i < actors.size(); ++i)
+		{
+			const auto offset = i * (model.partBounds.size() + 1);
+			for(size_t j = 0; j <= model.partBounds.size(); ++j)
+			{
+				if(visible[offset + j])
+				{
+					continue;
+				}
+
+				const auto & box = j == 0 ? model.bounds : model.partBounds[j - 1];
+				if(isActuallyVisible(box, actors[i].world, i, actors, eye, view_projection, inverse_view_projection))
+				{
+					fprintf(stderr, "error: frame %u rejected visible box %zu of actor %u.\n", frame, j, i);
+					++false_reject_count;
+				}
+			}
+		}
+
+		const auto & statistics = culler.getFrameStatistics();
+		printf(
+			"  %5u  %8llu  %7llu  %9llu  %10.1f%%  %8.3f\n",
+			frame,
+			static_cast<unsigned long long>(statistics.testCount),
+			static_cast<unsigned long long>(statistics.frustumRejectCount),
+			static_cast<unsigned long long>(statistics.occlusionRejectCount),
+			statistics.testCount > 0 ? 100.0 * (statistics.frustumRejectCount + statistics.occlusionRejectCount) / statistics.testCount : 0.0,
+			seconds * 1000.0
+		);
+	}
+
+	const auto & statistics = culler.getTotalStatistics();
+	printf(
+		"total: %llu tests, %.1f%% frustum rejects, %.1f%% occlusion rejects, %.3f ms/frame, %llu false rejects\n",
+		static_cast<unsigned long long>(statistics.testCount),
+		statistics.testCount > 0 ? 100.0 * statistics.frustumRejectCount / statistics.testCount : 0.0,
+		statistics.testCount > 0 ? 100.0 * statistics.occlusionRejectCount / statistics.testCount : 0.0,
+		total_seconds * 1000.0 / frame_count,
+		static_cast<unsigned long long>(false_reject_count)
+	);
+
+	if(false_reject_count > 0)
+	{
+		return 1;
+	}
+
+	// 群衆を横から見ればかなりの人が隠れるはず
+	if(statistics.occlusionRejectCount == 0)
+	{
+		fprintf(stderr, "error: no box was rejected by occlusion.\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,571 @@
+﻿#include "occlusion_culler.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+using namespace std;
+using namespace DirectX;
+
+// これより手前にある頂点はニアクリップをまたぐとみなす
+static constexpr float near_w = 1.0e-4f;
+
+// 内側の箱を求めるときの縮め方
+static constexpr float inner_box_initial_scale = 0.6f;
+static constexpr float inner_box_shrink_scale = 0.75f;
+static constexpr uint32_t inner_box_max_iteration = 6;
+
+const uint16_t OcclusionCuller::BoxIndices[BoxIndexCount]
+{
+	0, 2, 6, 0, 6, 4,
+	1, 5, 7, 1, 7, 3,
+	0, 4, 5, 0, 5, 1,
+	2, 3, 7, 2, 7, 6,
+	0, 1, 3, 0, 3, 2,
+	4, 6, 7, 4, 7, 5,
+};
+
+// 原点からdirectionへのレイが三角形に当たるか
+static bool intersectRayTriangle(
+	FXMVECTOR origin,
+	FXMVECTOR direction,
+	FXMVECTOR v0,
+	GXMVECTOR v1,
+	HXMVECTOR v2
+)
+{
+	const XMVECTOR edge1 = XMVectorSubtract(v1, v0);
+	const XMVECTOR edge2 = XMVectorSubtract(v2, v0);
+	const XMVECTOR p = XMVector3Cross(direction, edge2);
+	const float det = XMVectorGetX(XMVector3Dot(edge1, p));
+	if(abs(det) < 1.0e-12f)
+	{
+		return false;
+	}
+
+	const float inv_det = 1.0f / det;
+	const XMVECTOR s = XMVectorSubtract(origin, v0);
+	const float u = XMVectorGetX(XMVector3Dot(s, p)) * inv_det;
+	if(u < 0.0f || u > 1.0f)
+	{
+		return false;
+	}
+
+	const XMVECTOR q = XMVector3Cross(s, edge1);
+	const float v = XMVectorGetX(XMVector3Dot(direction, q)) * inv_det;
+	if(v < 0.0f || u + v > 1.0f)
+	{
+		return false;
+	}
+
+	return XMVectorGetX(XMVector3Dot(edge2, q)) * inv_det >= 0.0f;
+}
+
+// 原点を中心とする半分の大きさhalf_extentの箱と三角形が交わるか．分離軸で判定する
+static bool intersectBoxTriangle(const XMFLOAT3 & half_extent, const array<XMFLOAT3, 3> & v)
+{
+	const float h[] { half_extent.x, half_extent.y, half_extent.z };
+	const float p[3][3]
+	{
+		{ v[0].x, v[0].y, v[0].z },
+		{ v[1].x, v[1].y, v[1].z },
+		{ v[2].x, v[2].y, v[2].z },
+	};
+
+	// 箱の面の向き
+	for(uint32_t axis = 0; axis < 3; ++axis)
+	{
+		if(min({ p[0][axis], p[1][axis], p[2][axis] }) > h[axis] ||
+			max({ p[0][axis], p[1][axis], p[2][axis] }) < -h[axis])
+		{
+			return false;
+		}
+	}
+
+	float edges[3][3];
+	for(uint32_t i = 0; i < 3; ++i)
+	{
+		for(uint32_t axis = 0; axis < 3; ++axis)
+		{
+			edges[i][axis] = p[(i + 1) % 3][axis] - p[i][axis];
+		}
+	}
+
+	auto separated = [&](const float (&a)[3])
+	{
+		const float r = h[0] * abs(a[0]) + h[1] * abs(a[1]) + h[2] * abs(a[2]);
+		const float d0 = p[0][0] * a[0] + p[0][1] * a[1] + p[0][2] * a[2];
+		const float d1 = p[1][0] * a[0] + p[1][1] * a[1] + p[1][2] * a[2];
+		const float d2 = p[2][0] * a[0] + p[2][1] * a[1] + p[2][2] * a[2];
+		return min({ d0, d1, d2 }) > r || max({ d0, d1, d2 }) < -r;
+	};
+
+	// 三角形の面の向き
+	const float normal[]
+	{
+		edges[0][1] * edges[1][2] - edges[0][2] * edges[1][1],
+		edges[0][2] * edges[1][0] - edges[0][0] * edges[1][2],
+		edges[0][0] * edges[1][1] - edges[0][1] * edges[1][0],
+	};
+	if(separated(normal))
+	{
+		return false;
+	}
+
+	// 箱の辺と三角形の辺の外積の向き
+	for(uint32_t i = 0; i < 3; ++i)
+	{
+		const float (&e)[3] = edges[i];
+		const float axes[3][3]
+		{
+			{ 0.0f, -e[2], e[1] },
+			{ e[2], 0.0f, -e[0] },
+			{ -e[1], e[0], 0.0f },
+		};
+		for(auto & a : axes)
+		{
+			if(separated(a))
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool OcclusionCuller::shrinkBoxInside(
+	const DirectX::XMFLOAT3 * p_positions,
+	uint32_t vertex_count,
+	const uint16_t * p_indices,
+	uint32_t index_count,
+	DirectX::XMFLOAT3 & box_min,
+	DirectX::XMFLOAT3 & box_max
+)
+{
+	const XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&box_min), XMLoadFloat3(&box_max)), 0.5f);
+	XMVECTOR half_extent = XMVectorScale(XMVectorSubtract(XMLoadFloat3(&box_max), XMLoadFloat3(&box_min)), 0.5f);
+
+	// 中心から6方向のレイが全て三角形に当たれば，中心はメッシュに囲まれている
+	const XMVECTOR directions[]
+	{
+		XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f),
+		XMVectorSet(-1.0f, 0.0f, 0.0f, 0.0f),
+		XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f),
+		XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f),
+		XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f),
+		XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f),
+	};
+	for(auto & direction : directions)
+	{
+		bool hit = false;
+		for(uint32_t i = 0; i + 2 < index_count && !hit; i += 3)
+		{
+			if(p_indices[i] >= vertex_count || p_indices[i + 1] >= vertex_count || p_indices[i + 2] >= vertex_count)
+			{
+				continue;
+			}
+
+			hit = intersectRayTriangle(
+				center,
+				direction,
+				XMLoadFloat3(&p_positions[p_indices[i + 0]]),
+				XMLoadFloat3(&p_positions[p_indices[i + 1]]),
+				XMLoadFloat3(&p_positions[p_indices[i + 2]])
+			);
+		}
+
+		if(!hit)
+		{
+			return false;
+		}
+	}
+
+	// 箱と交わり得る三角形だけを残す
+	XMFLOAT3 initial_half_extent;
+	XMStoreFloat3(&initial_half_extent, half_extent);
+	vector<array<XMFLOAT3, 3>> triangles;
+	for(uint32_t i = 0; i + 2 < index_count; i += 3)
+	{
+		if(p_indices[i] >= vertex_count || p_indices[i + 1] >= vertex_count || p_indices[i + 2] >= vertex_count)
+		{
+			continue;
+		}
+
+		array<XMFLOAT3, 3> v;
+		for(uint32_t j = 0; j < 3; ++j)
+		{
+			XMStoreFloat3(&v[j], XMVectorSubtract(XMLoadFloat3(&p_positions[p_indices[i + j]]), center));
+		}
+
+		if(intersectBoxTriangle(initial_half_extent, v))
+		{
+			triangles.push_back(v);
+		}
+	}
+
+	half_extent = XMVectorScale(half_extent, inner_box_initial_scale);
+	for(uint32_t iteration = 0; iteration < inner_box_max_iteration; ++iteration)
+	{
+		XMFLOAT3 h;
+		XMStoreFloat3(&h, half_extent);
+
+		bool intersected = false;
+		for(auto & t : triangles)
+		{
+			if(intersectBoxTriangle(h, t))
+			{
+				intersected = true;
+				break;
+			}
+		}
+
+		if(!intersected)
+		{
+			XMStoreFloat3(&box_min, XMVectorSubtract(center, half_extent));
+			XMStoreFloat3(&box_max, XMVectorAdd(center, half_extent));
+			return true;
+		}
+
+		half_extent = XMVectorScale(half_extent, inner_box_shrink_scale);
+	}
+
+	return false;
+}
+
+bool OcclusionCuller::initialize(uint32_t width, uint32_t height)
+{
+	if(width == 0 || height == 0)
+	{
+		return false;
+	}
+
+	mWidth = (width + TileWidth - 1) / TileWidth * TileWidth;
+	mHeight = (height + TileHeight - 1) / TileHeight * TileHeight;
+	mTileCountX = mWidth / TileWidth;
+	mTileCountY = mHeight / TileHeight;
+
+	mDepthBuffer.resize(mWidth * mHeight);
+	mOwnerBuffer.resize(mWidth * mHeight);
+	mOtherDepthBuffer.resize(mWidth * mHeight);
+	mTileMaxDepth.resize(mTileCountX * mTileCountY);
+	mTileOwner.resize(mTileCountX * mTileCountY);
+	mTileMaxOtherDepth.resize(mTileCountX * mTileCountY);
+
+	mViewProjection = XMMatrixIdentity();
+
+	return true;
+}
+
+void OcclusionCuller::beginFrame(const DirectX::XMMATRIX & view_projection)
+{
+	mViewProjection = view_projection;
+
+	fill(mDepthBuffer.begin(), mDepthBuffer.end(), 1.0f);
+	fill(mOwnerBuffer.begin(), mOwnerBuffer.end(), NoOwner);
+	fill(mOtherDepthBuffer.begin(), mOtherDepthBuffer.end(), 1.0f);
+	fill(mTileMaxDepth.begin(), mTileMaxDepth.end(), 1.0f);
+	fill(mTileOwner.begin(), mTileOwner.end(), NoOwner);
+	fill(mTileMaxOtherDepth.begin(), mTileMaxOtherDepth.end(), 1.0f);
+	mTileDepthDirty = false;
+
+	mFrameStatistics = Statistics();
+}
+
+void OcclusionCuller::rasterizeOccluder(
+	const DirectX::XMFLOAT3 * p_positions,
+	const uint16_t * p_indices,
+	uint32_t index_count,
+	const DirectX::XMMATRIX & world,
+	uint32_t owner
+)
+{
+	const XMMATRIX world_view_projection = world * mViewProjection;
+
+	for(uint32_t i = 0; i + 2 < index_count; i += 3)
+	{
+		XMFLOAT4 clip[3];
+		bool clipped = false;
+		for(uint32_t j = 0; j < 3; ++j)
+		{
+			XMStoreFloat4(
+				&clip[j],
+				XMVector3Transform(XMLoadFloat3(&p_positions[p_indices[i + j]]), world_view_projection)
+			);
+
+			if(clip[j].w <= near_w)
+			{
+				clipped = true;
+			}
+		}
+
+		// ニアクリップをまたぐ三角形はオクルーダとして使わなくても保守的
+		if(clipped)
+		{
+			continue;
+		}
+
+		XMFLOAT4 screen[3];
+		for(uint32_t j = 0; j < 3; ++j)
+		{
+			const float inv_w = 1.0f / clip[j].w;
+			screen[j].x = (clip[j].x * inv_w * 0.5f + 0.5f) * mWidth;
+			screen[j].y = (0.5f - clip[j].y * inv_w * 0.5f) * mHeight;
+			screen[j].z = clip[j].z * inv_w;
+			screen[j].w = 1.0f;
+		}
+
+		rasterizeTriangle(screen[0], screen[1], screen[2], owner);
+	}
+}
+
+void OcclusionCuller::rasterizeTriangle(
+	const DirectX::XMFLOAT4 & v0,
+	const DirectX::XMFLOAT4 & v1_in,
+	const DirectX::XMFLOAT4 & v2_in,
+	uint32_t owner
+)
+{
+	float area = (v1_in.x - v0.x) * (v2_in.y - v0.y) - (v1_in.y - v0.y) * (v2_in.x - v0.x);
+	if(area == 0.0f)
+	{
+		return;
+	}
+
+	// カリングはしないので，面の向きを揃える
+	const XMFLOAT4 & v1 = area > 0.0f ? v1_in : v2_in;
+	const XMFLOAT4 & v2 = area > 0.0f ? v2_in : v1_in;
+	area = abs(area);
+
+	const float min_x = max(floor(min({ v0.x, v1.x, v2.x })), 0.0f);
+	const float min_y = max(floor(min({ v0.y, v1.y, v2.y })), 0.0f);
+	const float max_x = min(ceil(max({ v0.x, v1.x, v2.x })), static_cast<float>(mWidth) - 1.0f);
+	const float max_y = min(ceil(max({ v0.y, v1.y, v2.y })), static_cast<float>(mHeight) - 1.0f);
+	if(min_x > max_x || min_y > max_y)
+	{
+		return;
+	}
+
+	++mFrameStatistics.occluderTriangleCount;
+	++mTotalStatistics.occluderTriangleCount;
+
+	// 辺関数 E(p) = A * p.x + B * p.y + C
+	const XMFLOAT4 * edges[3][2]
+	{
+		{ &v1, &v2 },
+		{ &v2, &v0 },
+		{ &v0, &v1 },
+	};
+
+	XMVECTOR edge_a[3];
+	XMVECTOR edge_b[3];
+	XMVECTOR edge_c[3];
+	for(uint32_t i = 0; i < 3; ++i)
+	{
+		const XMFLOAT4 & a = *edges[i][0];
+		const XMFLOAT4 & b = *edges[i][1];
+		edge_a[i] = XMVectorReplicate(-(b.y - a.y));
+		edge_b[i] = XMVectorReplicate(b.x - a.x);
+		edge_c[i] = XMVectorReplicate((b.y - a.y) * a.x - (b.x - a.x) * a.y);
+	}
+
+	// 深度は画面空間で線形
+	const float inv_area = 1.0f / area;
+	const float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * inv_area;
+	const float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * inv_area;
+	const XMVECTOR z_dx = XMVectorReplicate(dzdx);
+	const XMVECTOR z_c = XMVectorReplicate(v0.z - dzdx * v0.x - dzdy * v0.y);
+
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR owner_vector = XMVectorReplicateInt(owner);
+	const XMVECTOR pixel_offset = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+
+	const uint32_t start_x = static_cast<uint32_t>(min_x) & ~3u;
+	const uint32_t end_x = static_cast<uint32_t>(max_x);
+	const uint32_t start_y = static_cast<uint32_t>(min_y);
+	const uint32_t end_y = static_cast<uint32_t>(max_y);
+
+	for(uint32_t y = start_y; y <= end_y; ++y)
+	{
+		const XMVECTOR py = XMVectorReplicate(y + 0.5f);
+		const XMVECTOR z_row = XMVectorMultiplyAdd(XMVectorReplicate(dzdy), py, z_c);
+
+		XMVECTOR edge_row[3];
+		for(uint32_t i = 0; i < 3; ++i)
+		{
+			edge_row[i] = XMVectorMultiplyAdd(edge_b[i], py, edge_c[i]);
+		}
+
+		float * p_row = &mDepthBuffer[y * mWidth];
+		uint32_t * p_owner_row = &mOwnerBuffer[y * mWidth];
+		float * p_other_row = &mOtherDepthBuffer[y * mWidth];
+		for(uint32_t x = start_x; x <= end_x; x += 4)
+		{
+			const XMVECTOR px = XMVectorAdd(XMVectorReplicate(static_cast<float>(x)), pixel_offset);
+
+			XMVECTOR inside = XMVectorGreaterOrEqual(XMVectorMultiplyAdd(edge_a[0], px, edge_row[0]), zero);
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(edge_a[1], px, edge_row[1]), zero));
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(edge_a[2], px, edge_row[2]), zero));
+
+			const XMVECTOR z = XMVectorMultiplyAdd(z_dx, px, z_row);
+			const XMVECTOR depth = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(p_row + x));
+			const XMVECTOR depth_owner = XMLoadUInt4(reinterpret_cast<const XMUINT4 *>(p_owner_row + x));
+			const XMVECTOR other_depth = XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(p_other_row + x));
+
+			// 別の持ち主が一番手前になったら，それまでの一番手前が別の持ち主の深度になる
+			const XMVECTOR same_owner = XMVectorEqualInt(depth_owner, owner_vector);
+			const XMVECTOR nearer = XMVectorAndInt(inside, XMVectorLess(z, depth));
+			const XMVECTOR new_other_depth = XMVectorSelect(XMVectorMin(other_depth, z), depth, nearer);
+			XMStoreFloat4(
+				reinterpret_cast<XMFLOAT4 *>(p_other_row + x),
+				XMVectorSelect(other_depth, new_other_depth, XMVectorAndCInt(inside, same_owner))
+			);
+			XMStoreUInt4(
+				reinterpret_cast<XMUINT4 *>(p_owner_row + x),
+				XMVectorSelect(depth_owner, owner_vector, nearer)
+			);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4 *>(p_row + x), XMVectorSelect(depth, z, nearer));
+		}
+	}
+
+	mTileDepthDirty = true;
+}
+
+void OcclusionCuller::updateTileDepth()
+{
+	for(uint32_t tile_y = 0; tile_y < mTileCountY; ++tile_y)
+	{
+		for(uint32_t tile_x = 0; tile_x < mTileCountX; ++tile_x)
+		{
+			const uint32_t tile_offset = tile_y * TileHeight * mWidth + tile_x * TileWidth;
+			const uint32_t tile_owner = mOwnerBuffer[tile_offset];
+			const XMVECTOR tile_owner_vector = XMVectorReplicateInt(tile_owner);
+
+			XMVECTOR max_depth = XMVectorZero();
+			XMVECTOR max_other_depth = XMVectorZero();
+			XMVECTOR same_owner = XMVectorTrueInt();
+			for(uint32_t y = 0; y < TileHeight; ++y)
+			{
+				const uint32_t offset = tile_offset + y * mWidth;
+				for(uint32_t x = 0; x < TileWidth; x += 4)
+				{
+					max_depth = XMVectorMax(max_depth, XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&mDepthBuffer[offset + x])));
+					max_other_depth = XMVectorMax(max_other_depth, XMLoadFloat4(reinterpret_cast<const XMFLOAT4 *>(&mOtherDepthBuffer[offset + x])));
+					same_owner = XMVectorAndInt(
+						same_owner,
+						XMVectorEqualInt(XMLoadUInt4(reinterpret_cast<const XMUINT4 *>(&mOwnerBuffer[offset + x])), tile_owner_vector)
+					);
+				}
+			}
+
+			XMFLOAT4 m;
+			XMStoreFloat4(&m, max_depth);
+			mTileMaxDepth[tile_y * mTileCountX + tile_x] = max({ m.x, m.y, m.z, m.w });
+			XMStoreFloat4(&m, max_other_depth);
+			mTileMaxOtherDepth[tile_y * mTileCountX + tile_x] = max({ m.x, m.y, m.z, m.w });
+			mTileOwner[tile_y * mTileCountX + tile_x] = XMVector4EqualInt(same_owner, XMVectorTrueInt()) ? tile_owner : MixedOwner;
+		}
+	}
+
+	mTileDepthDirty = false;
+}
+
+bool OcclusionCuller::isVisible(
+	const DirectX::XMFLOAT3 & aabb_min,
+	const DirectX::XMFLOAT3 & aabb_max,
+	const DirectX::XMMATRIX & world,
+	uint32_t owner
+)
+{
+	++mFrameStatistics.testCount;
+	++mTotalStatistics.testCount;
+
+	if(mTileDepthDirty)
+	{
+		updateTileDepth();
+	}
+
+	const XMMATRIX world_view_projection = world * mViewProjection;
+
+	float min_x = static_cast<float>(mWidth);
+	float min_y = static_cast<float>(mHeight);
+	float max_x = 0.0f;
+	float max_y = 0.0f;
+	float min_z = 1.0f;
+	for(uint32_t i = 0; i < 8; ++i)
+	{
+		const XMVECTOR corner = XMVectorSet(
+			(i & 1) ? aabb_max.x : aabb_min.x,
+			(i & 2) ? aabb_max.y : aabb_min.y,
+			(i & 4) ? aabb_max.z : aabb_min.z,
+			1.0f
+		);
+
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector3Transform(corner, world_view_projection));
+
+		// カメラをまたぐものは判定しない
+		if(clip.w <= near_w)
+		{
+			return true;
+		}
+
+		const float inv_w = 1.0f / clip.w;
+		const float sx = (clip.x * inv_w * 0.5f + 0.5f) * mWidth;
+		const float sy = (0.5f - clip.y * inv_w * 0.5f) * mHeight;
+		min_x = min(min_x, sx);
+		min_y = min(min_y, sy);
+		max_x = max(max_x, sx);
+		max_y = max(max_y, sy);
+		min_z = min(min_z, clip.z * inv_w);
+	}
+
+	if(max_x < 0.0f || max_y < 0.0f || min_x >= mWidth || min_y >= mHeight || min_z >= 1.0f)
+	{
+		++mFrameStatistics.frustumRejectCount;
+		++mTotalStatistics.frustumRejectCount;
+		return false;
+	}
+
+	const uint32_t x0 = static_cast<uint32_t>(max(min_x, 0.0f));
+	const uint32_t y0 = static_cast<uint32_t>(max(min_y, 0.0f));
+	const uint32_t x1 = static_cast<uint32_t>(min(max_x, mWidth - 1.0f));
+	const uint32_t y1 = static_cast<uint32_t>(min(max_y, mHeight - 1.0f));
+
+	for(uint32_t tile_y = y0 / TileHeight; tile_y <= y1 / TileHeight; ++tile_y)
+	{
+		for(uint32_t tile_x = x0 / TileWidth; tile_x <= x1 / TileWidth; ++tile_x)
+		{
+			// タイル内の一番手前が全て別の持ち主なら一番手前の深度，そうでなければ別の持ち主での深度で比べる
+			const uint32_t tile = tile_y * mTileCountX + tile_x;
+			const bool other_owner = owner == NoOwner || (mTileOwner[tile] != MixedOwner && mTileOwner[tile] != owner);
+			const float tile_max_depth = other_owner ? mTileMaxDepth[tile] : mTileMaxOtherDepth[tile];
+			if(tile_max_depth < min_z)
+			{
+				continue;
+			}
+
+			// タイル単位で隠れていなければ，矩形内の画素で確認する
+			const uint32_t py0 = max(y0, tile_y * TileHeight);
+			const uint32_t py1 = min(y1, tile_y * TileHeight + TileHeight - 1);
+			const uint32_t px0 = max(x0, tile_x * TileWidth);
+			const uint32_t px1 = min(x1, tile_x * TileWidth + TileWidth - 1);
+			for(uint32_t y = py0; y <= py1; ++y)
+			{
+				for(uint32_t x = px0; x <= px1; ++x)
+				{
+					const uint32_t i = y * mWidth + x;
+					const float depth = owner != NoOwner && mOwnerBuffer[i] == owner ? mOtherDepthBuffer[i] : mDepthBuffer[i];
+					if(depth >= min_z)
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
+
+	++mFrameStatistics.occlusionRejectCount;
+	++mTotalStatistics.occlusionRejectCount;
+
+	return false;
+}
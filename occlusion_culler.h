@@ -0,0 +1,102 @@
+﻿#pragma once
+#ifndef OCCLUSION_CULLER_H_INCLUDED
+#define OCCLUSION_CULLER_H_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+
+// CPUで簡易オクルーダを小さな深度バッファへラスタライズし，
+// AABBがそれより奥にあるかを判定する
+class OcclusionCuller
+{
+public:
+	static constexpr uint32_t TileWidth = 8;
+	static constexpr uint32_t TileHeight = 4;
+
+	// オクルーダとAABBの持ち主．同じ持ち主のオクルーダでは隠れたことにしない
+	static constexpr uint32_t NoOwner = UINT32_MAX;
+
+	// 角の番号のビット0，1，2がx，y，zの最大側を表す箱の三角形
+	static constexpr uint32_t BoxIndexCount = 36;
+	static const uint16_t BoxIndices[BoxIndexCount];
+
+	// box_min～box_maxを中心に向かって縮め，メッシュの内側に収まる箱を求める．
+	// 中心から6方向がメッシュに囲まれていて，箱がどの三角形とも交わらなければ内側にある．
+	// 内側に収まらなければfalse
+	static bool shrinkBoxInside(
+		const DirectX::XMFLOAT3 * p_positions,
+		uint32_t vertex_count,
+		const uint16_t * p_indices,
+		uint32_t index_count,
+		DirectX::XMFLOAT3 & box_min,
+		DirectX::XMFLOAT3 & box_max
+	);
+
+	struct Statistics
+	{
+		uint64_t occluderTriangleCount = 0;
+		uint64_t testCount = 0;
+		uint64_t frustumRejectCount = 0;
+		uint64_t occlusionRejectCount = 0;
+	};
+
+	bool initialize(uint32_t width, uint32_t height);
+
+	void beginFrame(const DirectX::XMMATRIX & view_projection);
+
+	void rasterizeOccluder(
+		const DirectX::XMFLOAT3 * p_positions,
+		const uint16_t * p_indices,
+		uint32_t index_count,
+		const DirectX::XMMATRIX & world,
+		uint32_t owner = NoOwner
+	);
+
+	bool isVisible(
+		const DirectX::XMFLOAT3 & aabb_min,
+		const DirectX::XMFLOAT3 & aabb_max,
+		const DirectX::XMMATRIX & world,
+		uint32_t owner = NoOwner
+	);
+
+	uint32_t getWidth() const { return mWidth; }
+	uint32_t getHeight() const { return mHeight; }
+	const float * getDepthBuffer() const { return mDepthBuffer.data(); }
+
+	const Statistics & getFrameStatistics() const { return mFrameStatistics; }
+	const Statistics & getTotalStatistics() const { return mTotalStatistics; }
+
+private:
+	void rasterizeTriangle(
+		const DirectX::XMFLOAT4 & v0,
+		const DirectX::XMFLOAT4 & v1,
+		const DirectX::XMFLOAT4 & v2,
+		uint32_t owner
+	);
+	void updateTileDepth();
+
+private:
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	uint32_t mTileCountX = 0;
+	uint32_t mTileCountY = 0;
+
+	DirectX::XMMATRIX mViewProjection;
+
+	// 一番手前の深度とその持ち主，それとは別の持ち主での一番手前の深度
+	std::vector<float> mDepthBuffer;
+	std::vector<uint32_t> mOwnerBuffer;
+	std::vector<float> mOtherDepthBuffer;
+	// タイル内の一番手前の持ち主が揃っていればその持ち主，揃っていなければMixedOwner
+	static constexpr uint32_t MixedOwner = NoOwner - 1;
+	std::vector<float> mTileMaxDepth;
+	std::vector<uint32_t> mTileOwner;
+	std::vector<float> mTileMaxOtherDepth;
+	bool mTileDepthDirty = false;
+
+	Statistics mFrameStatistics;
+	Statistics mTotalStatistics;
+};
+
+#endif // OCCLUSION_CULLER_H_INCLUDED
@@ -0,0 +1,390 @@
+﻿#include "pipeline_state_library.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include "hash.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+namespace
+{
+	class Hasher
+	{
+	public:
+		template<typename T>
+		void add(const T & value)
+		{
+			mHash = hashing::fnv1a64Value(value, mHash);
+		}
+
+		void addBytes(const void * p_data, size_t size)
+		{
+			add(size);
+			mHash = hashing::fnv1a64(p_data, size, mHash);
+		}
+
+		void addString(const char * str)
+		{
+			mHash = hashing::fnv1a64(str != nullptr ? str : "", mHash);
+		}
+
+		void addShader(const D3D12_SHADER_BYTECODE & shader)
+		{
+			addBytes(shader.pShaderBytecode, shader.pShaderBytecode != nullptr ? shader.BytecodeLength : 0);
+		}
+
+		uint64_t get() const { return mHash; }
+
+	private:
+		uint64_t mHash = hashing::FNV1aOffsetBasis;
+	};
+
+	void copyShader(D3D12_SHADER_BYTECODE & shader, vector<uint8_t> & storage)
+	{
+		if(shader.pShaderBytecode == nullptr || shader.BytecodeLength == 0)
+		{
+			shader.pShaderBytecode = nullptr;
+			shader.BytecodeLength = 0;
+			return;
+		}
+
+		auto p = static_cast<const uint8_t *>(shader.pShaderBytecode);
+		storage.assign(p, p + shader.BytecodeLength);
+		shader.pShaderBytecode = storage.data();
+	}
+}
+
+// ワーカスレッドで使い終わるまで，descが指す先を全て保持する
+struct PipelineStateLibrary::OwnedDesc
+{
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC desc;
+	ComPtr<ID3D12RootSignature> pRootSignature;
+	vector<uint8_t> shaders[5];
+	vector<D3D12_SO_DECLARATION_ENTRY> streamOutputEntries;
+	vector<string> streamOutputSemanticNames;
+	vector<UINT> streamOutputStrides;
+	vector<D3D12_INPUT_ELEMENT_DESC> inputElements;
+	vector<string> semanticNames;
+	uint64_t diskKey = 0;
+
+	explicit OwnedDesc(const D3D12_GRAPHICS_PIPELINE_STATE_DESC & src)
+		: desc(src)
+		, pRootSignature(src.pRootSignature)
+	{
+		copyShader(desc.VS, shaders[0]);
+		copyShader(desc.PS, shaders[1]);
+		copyShader(desc.DS, shaders[2]);
+		copyShader(desc.HS, shaders[3]);
+		copyShader(desc.GS, shaders[4]);
+
+		auto & so = desc.StreamOutput;
+		if(so.pSODeclaration != nullptr)
+		{
+			streamOutputEntries.assign(so.pSODeclaration, so.pSODeclaration + so.NumEntries);
+			streamOutputSemanticNames.reserve(streamOutputEntries.size());
+			for(auto & entry : streamOutputEntries)
+			{
+				streamOutputSemanticNames.emplace_back(entry.SemanticName != nullptr ? entry.SemanticName : "");
+				entry.SemanticName = entry.SemanticName != nullptr ? streamOutputSemanticNames.back().c_str() : nullptr;
+			}
+			so.pSODeclaration = streamOutputEntries.data();
+		}
+
+		if(so.pBufferStrides != nullptr)
+		{
+			streamOutputStrides.assign(so.pBufferStrides, so.pBufferStrides + so.NumStrides);
+			so.pBufferStrides = streamOutputStrides.data();
+		}
+
+		auto & input_layout = desc.InputLayout;
+		if(input_layout.pInputElementDescs != nullptr)
+		{
+			inputElements.assign(
+				input_layout.pInputElementDescs,
+				input_layout.pInputElementDescs + input_layout.NumElements
+			);
+			semanticNames.reserve(inputElements.size());
+			for(auto & element : inputElements)
+			{
+				semanticNames.emplace_back(element.SemanticName);
+				element.SemanticName = semanticNames.back().c_str();
+			}
+			input_layout.pInputElementDescs = inputElements.data();
+		}
+
+		desc.CachedPSO.pCachedBlob = nullptr;
+		desc.CachedPSO.CachedBlobSizeInBytes = 0;
+	}
+};
+
+PipelineStateLibrary::PipelineStateLibrary(const std::filesystem::path & directory)
+	: mBlobCache(directory, ".pso")
+{
+}
+
+bool PipelineStateLibrary::initialize(Microsoft::WRL::ComPtr<ID3D12Device> & p_device, ThreadPool * p_thread_pool)
+{
+	if(p_device == nullptr)
+	{
+		return false;
+	}
+
+	mpDevice = p_device;
+	mpThreadPool = p_thread_pool;
+
+	return true;
+}
+
+bool PipelineStateLibrary::create(
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc,
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> & p_pipeline_state
+)
+{
+	p_pipeline_state = request(desc, false).get();
+
+	return p_pipeline_state != nullptr;
+}
+
+PipelineStateLibrary::PipelineStateFuture PipelineStateLibrary::createAsync(
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc
+)
+{
+	return request(desc, true);
+}
+
+uint64_t PipelineStateLibrary::computeHash(
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc,
+	bool include_root_signature
+)
+{
+	// パディングが未初期化のことがあるので，メンバごとに混ぜる
+	Hasher hasher;
+
+	if(include_root_signature)
+	{
+		hasher.add(reinterpret_cast<uintptr_t>(desc.pRootSignature));
+	}
+
+	hasher.addShader(desc.VS);
+	hasher.addShader(desc.PS);
+	hasher.addShader(desc.DS);
+	hasher.addShader(desc.HS);
+	hasher.addShader(desc.GS);
+
+	const auto & so = desc.StreamOutput;
+	const auto so_entry_count = so.pSODeclaration != nullptr ? so.NumEntries : 0;
+	hasher.add(so_entry_count);
+	for(UINT i = 0; i < so_entry_count; ++i)
+	{
+		const auto & entry = so.pSODeclaration[i];
+		hasher.add(entry.Stream);
+		hasher.addString(entry.SemanticName);
+		hasher.add(entry.SemanticIndex);
+		hasher.add(entry.StartComponent);
+		hasher.add(entry.ComponentCount);
+		hasher.add(entry.OutputSlot);
+	}
+	const auto so_stride_count = so.pBufferStrides != nullptr ? so.NumStrides : 0;
+	hasher.add(so_stride_count);
+	for(UINT i = 0; i < so_stride_count; ++i)
+	{
+		hasher.add(so.pBufferStrides[i]);
+	}
+	hasher.add(so.RasterizedStream);
+
+	const auto & blend = desc.BlendState;
+	hasher.add(blend.AlphaToCoverageEnable);
+	hasher.add(blend.IndependentBlendEnable);
+	for(const auto & rt : blend.RenderTarget)
+	{
+		hasher.add(rt.BlendEnable);
+		hasher.add(rt.LogicOpEnable);
+		hasher.add(rt.SrcBlend);
+		hasher.add(rt.DestBlend);
+		hasher.add(rt.BlendOp);
+		hasher.add(rt.SrcBlendAlpha);
+		hasher.add(rt.DestBlendAlpha);
+		hasher.add(rt.BlendOpAlpha);
+		hasher.add(rt.LogicOp);
+		hasher.add(rt.RenderTargetWriteMask);
+	}
+
+	hasher.add(desc.SampleMask);
+
+	const auto & rasterizer = desc.RasterizerState;
+	hasher.add(rasterizer.FillMode);
+	hasher.add(rasterizer.CullMode);
+	hasher.add(rasterizer.FrontCounterClockwise);
+	hasher.add(rasterizer.DepthBias);
+	hasher.add(rasterizer.DepthBiasClamp);
+	hasher.add(rasterizer.SlopeScaledDepthBias);
+	hasher.add(rasterizer.DepthClipEnable);
+	hasher.add(rasterizer.MultisampleEnable);
+	hasher.add(rasterizer.AntialiasedLineEnable);
+	hasher.add(rasterizer.ForcedSampleCount);
+	hasher.add(rasterizer.ConservativeRaster);
+
+	const auto & depth_stencil = desc.DepthStencilState;
+	hasher.add(depth_stencil.DepthEnable);
+	hasher.add(depth_stencil.DepthWriteMask);
+	hasher.add(depth_stencil.DepthFunc);
+	hasher.add(depth_stencil.StencilEnable);
+	hasher.add(depth_stencil.StencilReadMask);
+	hasher.add(depth_stencil.StencilWriteMask);
+	for(const auto & face : { depth_stencil.FrontFace, depth_stencil.BackFace })
+	{
+		hasher.add(face.StencilFailOp);
+		hasher.add(face.StencilDepthFailOp);
+		hasher.add(face.StencilPassOp);
+		hasher.add(face.StencilFunc);
+	}
+
+	const auto & input_layout = desc.InputLayout;
+	const auto element_count = input_layout.pInputElementDescs != nullptr ? input_layout.NumElements : 0;
+	hasher.add(element_count);
+	for(UINT i = 0; i < element_count; ++i)
+	{
+		const auto & element = input_layout.pInputElementDescs[i];
+		hasher.addString(element.SemanticName);
+		hasher.add(element.SemanticIndex);
+		hasher.add(element.Format);
+		hasher.add(element.InputSlot);
+		hasher.add(element.AlignedByteOffset);
+		hasher.add(element.InputSlotClass);
+		hasher.add(element.InstanceDataStepRate);
+	}
+
+	hasher.add(desc.IBStripCutValue);
+	hasher.add(desc.PrimitiveTopologyType);
+	hasher.add(desc.NumRenderTargets);
+	for(UINT i = 0; i < desc.NumRenderTargets && i < _countof(desc.RTVFormats); ++i)
+	{
+		hasher.add(desc.RTVFormats[i]);
+	}
+	hasher.add(desc.DSVFormat);
+	hasher.add(desc.SampleDesc.Count);
+	hasher.add(desc.SampleDesc.Quality);
+	hasher.add(desc.NodeMask);
+	hasher.add(desc.Flags);
+
+	return hasher.get();
+}
+
+PipelineStateLibrary::Statistics PipelineStateLibrary::getStatistics() const
+{
+	Statistics statistics;
+	statistics.memoryHitCount = mMemoryHitCount;
+	statistics.diskHitCount = mDiskHitCount;
+	statistics.diskRejectCount = mDiskRejectCount;
+	statistics.missCount = mMissCount;
+	statistics.creationMilliseconds = mCreationMicroseconds / 1000.0;
+
+	return statistics;
+}
+
+PipelineStateLibrary::PipelineStateFuture PipelineStateLibrary::request(
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc,
+	bool async
+)
+{
+	const auto hash = computeHash(desc, true);
+
+	shared_ptr<packaged_task<ComPtr<ID3D12PipelineState>()>> p_task;
+	PipelineStateFuture future;
+	{
+		lock_guard<mutex> lock(mMutex);
+
+		auto it = mPipelineStates.find(hash);
+		if(it != mPipelineStates.end())
+		{
+			++mMemoryHitCount;
+			return it->second.future;
+		}
+
+		auto p_owned_desc = make_shared<OwnedDesc>(desc);
+		p_owned_desc->diskKey = computeHash(desc, false);
+
+		p_task = make_shared<packaged_task<ComPtr<ID3D12PipelineState>()>>(
+			[this, p_owned_desc]()
+			{
+				return createPipelineState(*p_owned_desc);
+			}
+		);
+		future = p_task->get_future().share();
+
+		mPipelineStates.emplace(hash, Entry { future, p_owned_desc });
+	}
+
+	if(async && mpThreadPool != nullptr)
+	{
+		mpThreadPool->submit([p_task]() { (*p_task)(); });
+	}
+	else
+	{
+		(*p_task)();
+	}
+
+	return future;
+}
+
+Microsoft::WRL::ComPtr<ID3D12PipelineState> PipelineStateLibrary::createPipelineState(OwnedDesc & owned_desc)
+{
+	PROFILE_FUNCTION();
+
+	auto start = chrono::steady_clock::now();
+
+	ComPtr<ID3D12PipelineState> p_pipeline_state;
+
+	vector<uint8_t> cached_blob;
+	if(mBlobCache.load(owned_desc.diskKey, cached_blob))
+	{
+		owned_desc.desc.CachedPSO.pCachedBlob = cached_blob.data();
+		owned_desc.desc.CachedPSO.CachedBlobSizeInBytes = cached_blob.size();
+
+		HRESULT hr = mpDevice->CreateGraphicsPipelineState(&owned_desc.desc, IID_PPV_ARGS(&p_pipeline_state));
+		if(SUCCEEDED(hr))
+		{
+			++mDiskHitCount;
+		}
+		else
+		{
+			// ドライバやルートシグネチャが変わったものは作り直す
+			++mDiskRejectCount;
+			p_pipeline_state.Reset();
+			mBlobCache.remove(owned_desc.diskKey);
+		}
+
+		owned_desc.desc.CachedPSO.pCachedBlob = nullptr;
+		owned_desc.desc.CachedPSO.CachedBlobSizeInBytes = 0;
+	}
+
+	if(p_pipeline_state == nullptr)
+	{
+		++mMissCount;
+
+		HRESULT hr = mpDevice->CreateGraphicsPipelineState(&owned_desc.desc, IID_PPV_ARGS(&p_pipeline_state));
+		if(FAILED(hr))
+		{
+			return nullptr;
+		}
+
+		ComPtr<ID3DBlob> p_cached_blob;
+		if(SUCCEEDED(p_pipeline_state->GetCachedBlob(&p_cached_blob)))
+		{
+			mBlobCache.store(
+				owned_desc.diskKey,
+				p_cached_blob->GetBufferPointer(),
+				p_cached_blob->GetBufferSize()
+			);
+		}
+	}
+
+	mCreationMicroseconds += chrono::duration_cast<chrono::microseconds>(
+		chrono::steady_clock::now() - start
+	).count();
+
+	return p_pipeline_state;
+}
@@ -0,0 +1,84 @@
+﻿#pragma once
+#ifndef PIPELINE_STATE_LIBRARY_H_INCLUDED
+#define PIPELINE_STATE_LIBRARY_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <d3d12.h>
+#include <wrl/client.h>
+#include "blob_cache.h"
+
+class ThreadPool;
+
+// D3D12_GRAPHICS_PIPELINE_STATE_DESCの内容でPSOを共有し，
+// ドライバのキャッシュ(CachedPSO)をディスクに保存する
+class PipelineStateLibrary
+{
+public:
+	using PipelineStateFuture = std::shared_future<Microsoft::WRL::ComPtr<ID3D12PipelineState>>;
+
+	struct Statistics
+	{
+		uint32_t memoryHitCount = 0;
+		uint32_t diskHitCount = 0;
+		uint32_t diskRejectCount = 0;
+		uint32_t missCount = 0;
+		double creationMilliseconds = 0.0;
+	};
+
+	explicit PipelineStateLibrary(const std::filesystem::path & directory);
+
+	bool initialize(Microsoft::WRL::ComPtr<ID3D12Device> & p_device, ThreadPool * p_thread_pool);
+
+	bool create(
+		const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc,
+		Microsoft::WRL::ComPtr<ID3D12PipelineState> & p_pipeline_state
+	);
+
+	// ワーカスレッドで作成する．同じ内容の要求は同じfutureを返す
+	PipelineStateFuture createAsync(const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc);
+
+	// ルートシグネチャはポインタでしか区別できないので，ディスク用のキーには含めない
+	static uint64_t computeHash(
+		const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc,
+		bool include_root_signature
+	);
+
+	Statistics getStatistics() const;
+
+private:
+	struct OwnedDesc;
+
+	PipelineStateFuture request(const D3D12_GRAPHICS_PIPELINE_STATE_DESC & desc, bool async);
+	Microsoft::WRL::ComPtr<ID3D12PipelineState> createPipelineState(OwnedDesc & owned_desc);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D12Device> mpDevice;
+	ThreadPool * mpThreadPool = nullptr;
+
+	BlobCache mBlobCache;
+
+	struct Entry
+	{
+		PipelineStateFuture future;
+
+		// ルートシグネチャを保持して，アドレスが再利用されないようにする
+		std::shared_ptr<OwnedDesc> pOwnedDesc;
+	};
+
+	std::mutex mMutex;
+	std::unordered_map<uint64_t, Entry> mPipelineStates;
+
+	std::atomic<uint32_t> mMemoryHitCount = 0;
+	std::atomic<uint32_t> mDiskHitCount = 0;
+	std::atomic<uint32_t> mDiskRejectCount = 0;
+	std::atomic<uint32_t> mMissCount = 0;
+	std::atomic<uint64_t> mCreationMicroseconds = 0;
+};
+
+#endif // PIPELINE_STATE_LIBRARY_H_INCLUDED
@@ -1,17 +1,23 @@
 ﻿#include "pmd_actor.h"
 #include "renderer_dx12.h"
+#include "async_file_reader.h"
+#include "occlusion_culler.h"
+#include "animation_clock.h"
+#include "baked_motion.h"
 #include "pmd.h"
+#include "pmd_file.h"
+#include "profiler.h"
 #include <algorithm>
 #include <cassert>
+#include <limits>
 #include <sstream>
+#include <unordered_map>
 #include <d3dx12.h>
 
 using namespace std;
 using namespace DirectX;
 using namespace Microsoft::WRL;
 
-static constexpr float epsilon = 0.0005f;
-
 PMDActor::PMDActor(const char * path_str, RendererDX12 & renderer)
 {
 	if(!load(path_str, renderer))
@@ -40,170 +46,151 @@ PMDActor::PMDActor(const char * path_str, RendererDX12 & renderer)
 	}
 }
 
-bool PMDActor::loadVMD(const char * path_str)
+void PMDActor::setMotion(std::shared_ptr<const VMDMotion> p_motion)
 {
-	ifstream fin(path_str, ios::in | ios::binary);
-	if(!fin)
-	{
-		return false;
-	}
-
-	// ヘッダをスキップ
-	fin.seekg(50, ios::beg);
+	mpMotion = move(p_motion);
+	mpBakedMotion = nullptr;
+	mPoseFrame = InvalidPoseFrame;
+	resetLODPoses();
+}
 
-	uint32_t key_frame_count = 0;
-	fin.read(reinterpret_cast<char *>(&key_frame_count), sizeof(key_frame_count));
+void PMDActor::setBakedMotion(std::shared_ptr<const BakedMotion> p_baked_motion)
+{
+	mpMotion = p_baked_motion != nullptr ? p_baked_motion->getSource() : nullptr;
+	mpBakedMotion = move(p_baked_motion);
+	mPoseFrame = InvalidPoseFrame;
+	resetLODPoses();
+}
 
-#pragma pack(push, 1)
-	struct VMDKeyFrame
-	{
-		char boneName[15];
-		uint32_t frameNo;
-		XMFLOAT3 location;
-		XMFLOAT4 quaternion;
-		uint8_t bezier[64];
-	};
-#pragma pack(pop)
-	vector<VMDKeyFrame> vmd_key_frames(key_frame_count);
-	fin.read(
-		reinterpret_cast<char *>(vmd_key_frames.data()),
-		sizeof(vmd_key_frames[0]) * vmd_key_frames.size()
-	);
+void PMDActor::setMotionTimeOffset(uint32_t frame_offset)
+{
+	mMotionTimeOffset = frame_offset;
+	mPoseFrame = InvalidPoseFrame;
+}
 
-	for(auto & vmd_key_frame : vmd_key_frames)
+void PMDActor::updateWorld()
+{
+	if(!mIsWorldDirty)
 	{
-		mNameToKeyFrameMap[vmd_key_frame.boneName].emplace_back(
-			vmd_key_frame.frameNo,
-			XMLoadFloat4(&vmd_key_frame.quaternion),
-			vmd_key_frame.location,
-			XMFLOAT2(vmd_key_frame.bezier[3] / 127.0f, vmd_key_frame.bezier[7] / 127.0f),
-			XMFLOAT2(vmd_key_frame.bezier[11] / 127.0f, vmd_key_frame.bezier[15] / 127.0f)
-		);
+		return;
 	}
 
-	mMaxFrame = 0;
-	for(auto & kv : mNameToKeyFrameMap)
-	{
-		std::sort(
-			kv.second.begin(),
-			kv.second.end(),
-			[](const KeyFrame & lhs, const KeyFrame & rhs)
-			{
-				return lhs.frameNo < rhs.frameNo;
-			}
-		);
+	mWorld =
+		XMMatrixRotationRollPitchYaw(mEulerAngle.x, mEulerAngle.y, mEulerAngle.z) *
+		XMMatrixTranslation(mPosition.x, mPosition.y, mPosition.z);
+	*mpMappedTransform = XMMatrixTranspose(mWorld);
+	mIsWorldDirty = false;
+}
 
-		mMaxFrame = max(mMaxFrame, kv.second[kv.second.size() - 1].frameNo);
+bool PMDActor::getPoseFrame(const AnimationClock & clock, uint32_t & frame) const
+{
+	if(mpMotion == nullptr || mpMotion->getMaxFrame() == 0)
+	{
+		return false;
 	}
 
-#if 0
-	uint32_t morph_count = 0;
-	fin.read(reinterpret_cast<char *>(&morph_count), sizeof(morph_count));
-
-#pragma pack(push, 1)
-	struct VMDMorph
-	{
-		char name[15];
-		uint32_t frameNo;
-		float weight;
-	};
-#pragma pack(pop)
+	frame = static_cast<uint32_t>(
+		(static_cast<uint64_t>(floor(max(clock.getFrame() - mStartFrame, 0.0))) + mMotionTimeOffset) % mpMotion->getMaxFrame()
+	);
 
-	vector<VMDMorph> morphs(morph_count);
-	fin.read(reinterpret_cast<char *>(morphs.data()), sizeof(morphs[0]) * morphs.size());
+	return true;
+}
 
-	uint32_t camera_count = 0;
-	fin.read(reinterpret_cast<char *>(&camera_count), sizeof(camera_count));
+void PMDActor::applyPose(const VMDMotion::TrackPose * p_poses, uint32_t frame, uint32_t lod, uint32_t skipped_leaf_height, bool solve_ik)
+{
+	PROFILE_FUNCTION();
 
-#pragma pack(push, 1)
-	struct VMDCamera
-	{
-		uint32_t frameNo;
-		float distance;
-		XMFLOAT3 position;
-		XMFLOAT3 eulerAngle;
-		uint8_t interpolation[24];
-		uint32_t fov;
-		uint8_t perspective;
-	};
-#pragma pack(pop)
+	mPoseFrame = frame;
+	mPoseLOD = lod;
 
-	vector<VMDCamera> cameras(camera_count);
-	fin.read(reinterpret_cast<char *>(cameras.data()), sizeof(cameras[0]) * cameras.size());
+	mSkeleton.applyPose(*mpMotion, p_poses, skipped_leaf_height);
 
-	uint32_t light_count = 0;
-	struct VMDLight
+	if(solve_ik)
 	{
-		uint32_t frameNo;
-		XMFLOAT3 rgb;
-		XMFLOAT3 position;
-	};
+		mSkeleton.solveIK();
+	}
 
-	vector<VMDLight> lights(light_count);
-	fin.read(reinterpret_cast<char *>(lights.data()), sizeof(lights[0]) * lights.size());
+	const auto & bone_matrices = mSkeleton.getBoneMatrices();
+	copy(bone_matrices.begin(), bone_matrices.end(), mpMappedTransform + 1);
 
-	uint32_t self_shadow_count = 0;
-	fin.read(reinterpret_cast<char *>(&self_shadow_count), sizeof(self_shadow_count));
+	updateBounds();
+}
 
-#pragma pack(push, 1)
-	struct VMDSelfShadow
+VMDMotion::TrackPose * PMDActor::getLODPose(uint32_t frame, uint32_t kept_frame, bool & is_cached)
+{
+	for(auto & lod_pose : mLODPoses)
 	{
-		uint32_t frameNo;
-		uint8_t mode;
-		float distance;
-	};
-#pragma pack(pop)
-	
-	vector<VMDSelfShadow> self_shadows(self_shadow_count);
-	fin.read(reinterpret_cast<char *>(self_shadows.data()), sizeof(self_shadows[0]) * self_shadows.size());
+		if(lod_pose.frame == frame)
+		{
+			is_cached = true;
+			return lod_pose.trackPoses.data();
+		}
+	}
 
-	uint32_t ik_switch_count = 0;
-	fin.read(reinterpret_cast<char *>(&ik_switch_count), sizeof(ik_switch_count));
+	// 区切りが1つ進んだときは，前の終わりのポーズが次の始まりになる
+	auto & lod_pose = mLODPoses[0].frame != kept_frame ? mLODPoses[0] : mLODPoses[1];
+	lod_pose.frame = frame;
+	is_cached = false;
+	return lod_pose.trackPoses.data();
+}
 
-	mIKEnables.resize(ik_switch_count);
-	for(auto & ik_enable : mIKEnables)
-	{
-		ik_enable.enables.resize(mBones.size());
+void PMDActor::getBoundingSphere(DirectX::XMVECTOR & center, float & radius) const
+{
+	const auto bounds_min = XMLoadFloat3(&mBoundsMin);
+	const auto bounds_max = XMLoadFloat3(&mBoundsMax);
 
-		fin.read(reinterpret_cast<char *>(&ik_enable.frameNo), sizeof(ik_enable.frameNo));
+	center = XMVector3Transform(XMVectorScale(XMVectorAdd(bounds_min, bounds_max), 0.5f), mWorld);
+	radius = XMVectorGetX(XMVector3Length(XMVectorSubtract(bounds_max, bounds_min))) * 0.5f;
+}
 
-		// visibleフラグをスキップ
-		fin.seekg(1, ios::cur);
+void PMDActor::rasterizeOccluder(OcclusionCuller & culler, uint32_t owner)
+{
+	PROFILE_FUNCTION();
 
-		uint32_t ik_bone_count = 0;
-		fin.read(reinterpret_cast<char *>(&ik_bone_count), sizeof(ik_bone_count));
+	if(mOccluderIndices.empty())
+	{
+		return;
+	}
 
-		for(uint32_t i = 0; i < ik_bone_count; ++i)
+	// 箱はボーンだけに従う頂点の内側にあるので，ボーン行列で動かしてもはみ出さない
+	const auto & bone_matrices = mSkeleton.getBoneMatrices();
+	for(size_t i = 0; i < mOccluderBoxes.size(); ++i)
+	{
+		const auto & box = mOccluderBoxes[i];
+		for(uint32_t corner = 0; corner < 8; ++corner)
 		{
-			char ik_bone_name[20];
-			fin.read(ik_bone_name, sizeof(ik_bone_name));
-
-			uint8_t enable = 0;
-			fin.read(reinterpret_cast<char *>(&enable), sizeof(enable));
-
-			auto it = mNameToBoneIndex.find(ik_bone_name);
-			if(it != mNameToBoneIndex.end())
-			{
-				ik_enable.enables[it->second] = enable;
-			}
+			const auto p = XMVector3Transform(
+				XMVectorSet(
+					(corner & 1) ? box.max.x : box.min.x,
+					(corner & 2) ? box.max.y : box.min.y,
+					(corner & 4) ? box.max.z : box.min.z,
+					1.0f
+				),
+				bone_matrices[box.bone]
+			);
+			XMStoreFloat3(&mOccluderPositions[i * 8 + corner], p);
 		}
 	}
-#endif
-
-	return true;
-}
 
-void PMDActor::update()
-{
-	*mpMappedTransform = XMMatrixTranspose(
-		XMMatrixRotationRollPitchYaw(mEulerAngle.x, mEulerAngle.y, mEulerAngle.z) *
-		XMMatrixTranslation(mPosition.x, mPosition.y, mPosition.z)
+	culler.rasterizeOccluder(
+		mOccluderPositions.data(),
+		mOccluderIndices.data(),
+		static_cast<uint32_t>(mOccluderIndices.size()),
+		mWorld,
+		owner
 	);
-	updateMotion();
 }
 
-void PMDActor::draw(RendererDX12 & renderer)
+void PMDActor::draw(RendererDX12 & renderer, OcclusionCuller & culler, uint32_t owner)
 {
+	PROFILE_FUNCTION();
+
+	// 自分のオクルーダは自分を隠さない
+	if(!culler.isVisible(mBoundsMin, mBoundsMax, mWorld, owner))
+	{
+		return;
+	}
+
 	renderer.setVertexBuffers(0, 1, &mVertexBufferView);
 	renderer.setIndexBuffer(mIndexBufferView);
 
@@ -215,32 +202,56 @@ void PMDActor::draw(RendererDX12 & renderer)
 
 	renderer.setDescriptorHeap(mpMaterialDescriptorHeap);
 
-	auto material_handle = mpMaterialDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
-	auto material_handle_size = renderer.getDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	const auto heap_start = mpMaterialDescriptorHeap->GetGPUDescriptorHandleForHeapStart();
+	const auto handle_size = renderer.getDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+	auto toon_handle = heap_start;
+	toon_handle.ptr += handle_size * MaterialTextureCount * mTextureSets.size();
+	renderer.setGraphicsRootDescriptorTable(4, toon_handle);
+
+	const auto material_buffer_size = (sizeof(MaterialConstantBuffer) + 0xff) & ~0xff;
+	auto material_buffer_location = mpMaterialConstantBuffer->GetGPUVirtualAddress();
+
+	// 同じテクスチャの組が続くマテリアルでは記述子テーブルを設定し直さない
+	uint32_t bound_texture_set_index = UINT32_MAX;
 	uint32_t index_offset = 0;
 	for(auto & m : mMaterials)
 	{
-		renderer.setGraphicsRootDescriptorTable(2, material_handle);
-		renderer.drawIndexedInstanced(m.indexCount, 1, index_offset, 0, 0);
+		if(culler.isVisible(m.boundsMin, m.boundsMax, mWorld, owner))
+		{
+			if(m.textureSetIndex != bound_texture_set_index)
+			{
+				auto texture_handle = heap_start;
+				texture_handle.ptr += handle_size * MaterialTextureCount * m.textureSetIndex;
+				renderer.setGraphicsRootDescriptorTable(3, texture_handle);
+				bound_texture_set_index = m.textureSetIndex;
+			}
 
-		material_handle.ptr += material_handle_size * 5;
+			renderer.setGraphicsRootConstantBufferView(2, material_buffer_location);
+			renderer.drawIndexedInstanced(m.indexCount, 1, index_offset, 0, 0);
+		}
+
+		material_buffer_location += material_buffer_size;
 		index_offset += m.indexCount;
 	}
 }
 
-void PMDActor::startAnimation()
+void PMDActor::startAnimation(const AnimationClock & clock)
 {
-	mStartTime = chrono::high_resolution_clock::now();
+	mStartFrame = clock.getFrame();
+	mPoseFrame = InvalidPoseFrame;
 }
 
 void PMDActor::setPosition(float x, float y, float z)
 {
 	mPosition = XMFLOAT3(x, y, z);
+	mIsWorldDirty = true;
 }
 
 void PMDActor::setEulerAngle(float x, float y, float z)
 {
 	mEulerAngle = XMFLOAT3(x, y, z);
+	mIsWorldDirty = true;
 }
 
 bool PMDActor::createTransformDescriptorHeap(RendererDX12 & renderer)
@@ -261,7 +272,8 @@ bool PMDActor::createTransformDescriptorHeap(RendererDX12 & renderer)
 
 bool PMDActor::createTransformConstantBuffer(RendererDX12 & renderer)
 {
-	auto buffer_size = (sizeof(XMMATRIX) * (1 + mBoneMatrices.size()) + 0xff) & ~0xff;
+	const auto & bone_matrices = mSkeleton.getBoneMatrices();
+	auto buffer_size = (sizeof(XMMATRIX) * (1 + bone_matrices.size()) + 0xff) & ~0xff;
 	if(!renderer.createBuffer(mpTransformConstantBuffer, buffer_size))
 	{
 		return false;
@@ -277,24 +289,11 @@ bool PMDActor::createTransformConstantBuffer(RendererDX12 & renderer)
 		return false;
 	}
 
-	for(auto & kv : mNameToKeyFrameMap)
-	{
-		auto boneIndex = mNameToBoneIndex[kv.first];
-		auto & bone = mBones[boneIndex];
-		auto & bone_position = bone.startPosition;
-		mBoneMatrices[boneIndex] =
-			XMMatrixTranslation(-bone_position.x, -bone_position.y, -bone_position.z) *
-			XMMatrixRotationQuaternion(kv.second[0].quaternion) *
-			XMMatrixTranslation(bone_position.x, bone_position.y, bone_position.z);
-	}
-
-	multiplyMatrixRecursively(mNameToBoneIndex["センター"], XMMatrixIdentity());
-
 	*mpMappedTransform = XMMatrixTranspose(
 		XMMatrixRotationRollPitchYaw(mEulerAngle.x, mEulerAngle.y, mEulerAngle.z) *
 		XMMatrixTranslation(mPosition.x, mPosition.y, mPosition.z)
 	);
-	copy(mBoneMatrices.begin(), mBoneMatrices.end(), mpMappedTransform + 1);
+	copy(bone_matrices.begin(), bone_matrices.end(), mpMappedTransform + 1);
 
 	renderer.createConstantBufferView(
 		mpTransformConstantBuffer->GetGPUVirtualAddress(),
@@ -307,100 +306,89 @@ bool PMDActor::createTransformConstantBuffer(RendererDX12 & renderer)
 
 bool PMDActor::load(const char * pathStr, RendererDX12 & renderer)
 {
+	PROFILE_FUNCTION();
+
 	filesystem::path root_path = filesystem::path(pathStr).parent_path();
-	ifstream fin(pathStr, ios::in | ios::binary);
-	if(!fin)
-	{
-		return false;
-	}
 
-	if(!loadHeader(fin))
+	asset_archive::Data file_data;
+	if(!renderer.getFileReader().take(pathStr, file_data))
 	{
 		return false;
 	}
 
-	if(!loadVertices(fin, renderer))
+	pmd::File file;
+	if(!pmd::loadFile(file_data.pData, file_data.size, file))
 	{
 		return false;
 	}
 
-	if(!loadIndices(fin, renderer))
+	if(!loadVertices(file, renderer))
 	{
 		return false;
 	}
 
-	if(!loadMaterials(fin, renderer, root_path))
+	if(!loadIndices(file, renderer))
 	{
 		return false;
 	}
 
-	if(!loadBones(fin, renderer))
+	if(!loadMaterials(file, renderer, root_path))
 	{
 		return false;
 	}
 
-	if(!loadIK(fin))
+	if(!mSkeleton.initialize(file))
 	{
 		return false;
 	}
 
-	return true;
-}
-
-bool PMDActor::loadHeader(std::ifstream & fin)
-{
-#pragma pack(push, 1)
-	struct PMDHeader
+#if defined(_DEBUG)
+	for(auto & ik : file.iks)
 	{
-		char signature[3];
-		float version;
-		char modelName[20];
-		char comment[256];
-	};
-#pragma pack(pop)
-
-	PMDHeader header;
-	fin.read(reinterpret_cast<char *>(&header), sizeof(header));
+		ostringstream oss;
+		oss << "IKボーン番号:" << ik.boneIndex << "(" << file.bones[ik.boneIndex].boneName << ")" << endl;
+		for(auto & node : ik.nodeIndices)
+		{
+			oss << "\tノードボーン:" << node << "(" << file.bones[node].boneName << ")" << endl;
+		}
 
-	if(strncmp(header.signature, "Pmd", 3) != 0)
-	{
-		return false;
+		OutputDebugStringA(oss.str().c_str());
 	}
+#endif
+
+	// モーションが無いか1フレームだけのアクターはポーズを求めないので，初期姿勢の範囲をここで求める
+	buildBoneBounds();
+	updateBounds();
+	buildOccluder();
+
+	mSkinVertices.clear();
+	mSkinVertices.shrink_to_fit();
+	mIndices.clear();
+	mIndices.shrink_to_fit();
 
 	return true;
 }
 
-bool PMDActor::loadVertices(std::ifstream & fin, RendererDX12 & renderer)
+bool PMDActor::loadVertices(const pmd::File & file, RendererDX12 & renderer)
 {
-	uint32_t vertex_count = 0;
-	fin.read(reinterpret_cast<char *>(&vertex_count), sizeof(vertex_count));
-
-#pragma pack(push, 1)
-	struct PMDVertex
-	{
-		XMFLOAT3 position;
-		XMFLOAT3 normal;
-		XMFLOAT2 uv;
-		uint16_t boneNo[2];
-		uint8_t boneWeight;
-		uint8_t edgeFlag;
-	};
-#pragma pack(pop)
-
-	vector<PMDVertex> pmd_vertices(vertex_count);
-	fin.read(
-		reinterpret_cast<char *>(pmd_vertices.data()),
-		sizeof(pmd_vertices[0]) * pmd_vertices.size()
-	);
+	const auto & pmd_vertices = file.vertices;
+	const auto vertex_count = static_cast<uint32_t>(pmd_vertices.size());
 
 	using Vertex = pmd::Vertex;
 
 	vector<Vertex> vertices(vertex_count);
+	mSkinVertices.resize(vertex_count);
 	for(uint32_t i = 0; i < vertex_count; ++i)
 	{
-		const PMDVertex & src = pmd_vertices[i];
+		const pmd::FileVertex & src = pmd_vertices[i];
 		Vertex & dst = vertices[i];
 
+		auto & skin_vertex = mSkinVertices[i];
+		skin_vertex.position = src.position;
+		skin_vertex.bones[0] = src.boneNo[0];
+		skin_vertex.bones[1] = src.boneNo[1];
+		skin_vertex.weight = src.boneWeight;
+
 		dst.position = XMVectorSet(src.position.x, src.position.y, src.position.z, 1.0f);
 		dst.normal = XMLoadFloat3(&src.normal);
 		dst.uv = src.uv;
@@ -411,22 +399,11 @@ bool PMDActor::loadVertices(std::ifstream & fin, RendererDX12 & renderer)
 	}
 
 	auto buffer_size = sizeof(vertices[0]) * vertices.size();
-	if(!renderer.createBuffer(mpVertexBuffer, buffer_size))
-	{
-		return false;
-	}
-
-	void * p_dst = nullptr;
-	HRESULT hr = mpVertexBuffer->Map(0, nullptr, &p_dst);
-	if(FAILED(hr))
+	if(!renderer.createStaticBuffer(mpVertexBuffer, vertices.data(), buffer_size))
 	{
 		return false;
 	}
 
-	memcpy(p_dst, vertices.data(), buffer_size);
-
-	mpVertexBuffer->Unmap(0, nullptr);
-
 	mVertexBufferView.BufferLocation = mpVertexBuffer->GetGPUVirtualAddress();
 	mVertexBufferView.SizeInBytes = buffer_size;
 	mVertexBufferView.StrideInBytes = sizeof(vertices[0]);
@@ -434,34 +411,17 @@ bool PMDActor::loadVertices(std::ifstream & fin, RendererDX12 & renderer)
 	return true;
 }
 
-bool PMDActor::loadIndices(std::ifstream & fin, RendererDX12 & renderer)
+bool PMDActor::loadIndices(const pmd::File & file, RendererDX12 & renderer)
 {
-	uint32_t index_count = 0;
-	fin.read(reinterpret_cast<char *>(&index_count), sizeof(index_count));
-
-	vector<uint16_t> indices(index_count);
-	fin.read(
-		reinterpret_cast<char *>(indices.data()),
-		sizeof(indices[0]) * indices.size()
-	);
+	auto & indices = mIndices;
+	indices = file.indices;
 
 	auto buffer_size = sizeof(indices[0]) * indices.size();
-	if(!renderer.createBuffer(mpIndexBuffer, buffer_size))
+	if(!renderer.createStaticBuffer(mpIndexBuffer, indices.data(), buffer_size))
 	{
 		return false;
 	}
 
-	void * p_dst = nullptr;
-	HRESULT hr = mpIndexBuffer->Map(0, nullptr, &p_dst);
-	if(FAILED(hr))
-	{
-		return false;
-	}
-
-	memcpy(p_dst, indices.data(), buffer_size);
-
-	mpIndexBuffer->Unmap(0, nullptr);
-
 	mIndexBufferView.BufferLocation = mpIndexBuffer->GetGPUVirtualAddress();
 	mIndexBufferView.SizeInBytes = buffer_size;
 	mIndexBufferView.Format = DXGI_FORMAT_R16_UINT;
@@ -469,66 +429,110 @@ bool PMDActor::loadIndices(std::ifstream & fin, RendererDX12 & renderer)
 	return true;
 }
 
-bool PMDActor::loadTexture(
-	Material & material,
-	const std::filesystem::path & texture_path,
-	RendererDX12 & renderer
-)
+bool PMDActor::getMaterialTexture(const std::filesystem::path & texture_path, MaterialTexture & texture)
 {
-	ComPtr<ID3D12Resource> p_texture;
-	if(!renderer.loadTexture(p_texture, texture_path))
+	auto extension = texture_path.extension();
+	if(extension == ".bmp" || extension == ".png" || extension == ".tga" || extension == ".jpg")
 	{
-		return false;
+		texture = MaterialTexture::Base;
+		return true;
 	}
 
-	auto extension = texture_path.extension();
-	if(extension == ".bmp" || extension == ".png")
+	if(extension == ".sph")
 	{
-		material.pTexture = p_texture;
+		texture = MaterialTexture::MultipleSphereMap;
+		return true;
 	}
-	else if(extension == ".sph")
+
+	if(extension == ".spa")
 	{
-		material.pMultipleSphereMap = p_texture;
+		texture = MaterialTexture::AdditiveSphereMap;
+		return true;
 	}
-	else if(extension == ".spa")
+
+	return false;
+}
+
+bool PMDActor::isUVInUnitRange(const pmd::File & file, uint32_t index_offset, uint32_t index_count) const
+{
+	// 境目がわずかにはみ出すのは縁の画素で補える
+	constexpr float Tolerance = 1.0e-3f;
+
+	const auto end = min<size_t>(index_offset + index_count, mIndices.size());
+	for(size_t i = index_offset; i < end; ++i)
 	{
-		material.pAdditiveSphereMap = p_texture;
+		if(mIndices[i] >= file.vertices.size())
+		{
+			return false;
+		}
+
+		const auto & uv = file.vertices[mIndices[i]].uv;
+		if(uv.x < -Tolerance || uv.x > 1.0f + Tolerance || uv.y < -Tolerance || uv.y > 1.0f + Tolerance)
+		{
+			return false;
+		}
 	}
 
 	return true;
 }
 
-bool PMDActor::loadMaterials(
-	std::ifstream & fin,
-	RendererDX12 & renderer,
-	const std::filesystem::path & root_path
+void PMDActor::requestMaterialTexture(
+	uint32_t texture_set_index,
+	MaterialTexture texture,
+	const std::filesystem::path & texture_path,
+	RendererDX12 & renderer
 )
 {
-	uint32_t material_count = 0;
-	fin.read(reinterpret_cast<char *>(&material_count), sizeof(material_count));
+	renderer.requestTexture(
+		this,
+		texture_path,
+		[this, texture_set_index, texture, &renderer](const ComPtr<ID3D12Resource> & p_texture)
+		{
+			setMaterialTexture(texture_set_index, texture, p_texture, renderer);
+		}
+	);
+}
 
-#include <pshpack1.h>
-	struct PMDMaterial
+void PMDActor::setMaterialTexture(
+	uint32_t texture_set_index,
+	MaterialTexture texture,
+	const ComPtr<ID3D12Resource> & p_texture,
+	RendererDX12 & renderer
+)
+{
+	auto & p_material_texture = mTextureSets[texture_set_index][static_cast<uint32_t>(texture)];
+	p_material_texture = p_texture;
+
+	// 記述子ヒープを作る前なら，createMaterialResourceViewsでまとめて作る
+	if(mpMaterialDescriptorHeap == nullptr)
 	{
-		XMFLOAT3 diffuse;
-		float diffuseAlpha;
-		float specularity;
-		XMFLOAT3 specular;
-		XMFLOAT3 ambient;
-		unsigned char toonIndex;
-		unsigned char edgeFlag;
-		unsigned int indexCount;
-		char textureFilePath[20];
-	};
-#include <poppack.h>
+		return;
+	}
 
-	vector<PMDMaterial> pmd_materials(material_count);
-	fin.read(
-		reinterpret_cast<char *>(pmd_materials.data()),
-		sizeof(pmd_materials[0]) * pmd_materials.size()
-	);
+	// GPUが参照していないときに呼ばれるので，その場で書き換えてよい
+	const auto descriptor_index = texture_set_index * MaterialTextureCount + static_cast<uint32_t>(texture);
+	auto handle = mpMaterialDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+	handle.ptr += descriptor_index * renderer.getDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+	renderer.createTextureResourceView(p_material_texture, handle);
+}
+
+bool PMDActor::loadMaterials(
+	const pmd::File & file,
+	RendererDX12 & renderer,
+	const std::filesystem::path & root_path
+)
+{
+	auto pmd_materials = file.materials;
+	const auto material_count = static_cast<uint32_t>(pmd_materials.size());
 
 	mMaterials.resize(material_count);
+	mTextureSets.clear();
+
+	// パスの組からテクスチャの組の番号を引く
+	unordered_map<string, uint32_t> texture_set_indices;
+	uint32_t atlas_texture_count = 0;
+	uint32_t index_offset = 0;
 	for(uint32_t i = 0; i < material_count; ++i)
 	{
 		auto & src = pmd_materials[i];
@@ -557,126 +561,86 @@ bool PMDActor::loadMaterials(
 			1.0f
 		);
 
-		dst.pTexture = renderer.getNullWhite();
-		dst.pMultipleSphereMap = renderer.getNullWhite();
-		dst.pAdditiveSphereMap = renderer.getNullBlack();
+		dst.constantBuffer.toonIndex = RendererDX12::getToonRampLayer(src.toonIndex);
 
-		unsigned char toon_index = src.toonIndex + 1;
-		char toon_path[256];
-		snprintf(toon_path, sizeof(toon_path), "toon/toon%02d.bmp", toon_index);
-		if(!renderer.loadTexture(dst.pToon, toon_path))
+		// "テクスチャ*スフィアマップ"のように2つ書かれていることがある
+		array<filesystem::path, MaterialTextureCount> texture_paths;
+		if(src.textureFilePath[0] != '\0')
 		{
-			dst.pToon = renderer.getNullGradation();
-		}
-
-		if(src.textureFilePath[0] == '\0')
-		{
-			continue;
-		}
+			MaterialTexture texture;
+			auto asterisk = find(begin(src.textureFilePath), end(src.textureFilePath), '*');
+			if(asterisk != end(src.textureFilePath))
+			{
+				*asterisk = '\0';
+				const auto texture_path = root_path / (asterisk + 1);
+				if(getMaterialTexture(texture_path, texture))
+				{
+					texture_paths[static_cast<uint32_t>(texture)] = texture_path;
+				}
+			}
 
-		auto asterisk = find(begin(src.textureFilePath), end(src.textureFilePath), '*');
-		if(asterisk != end(src.textureFilePath))
-		{
-			*asterisk = '\0';
-			loadTexture(dst, root_path / (asterisk + 1), renderer);
+			const auto texture_path = root_path / src.textureFilePath;
+			if(getMaterialTexture(texture_path, texture))
+			{
+				texture_paths[static_cast<uint32_t>(texture)] = texture_path;
+			}
 		}
 
-		loadTexture(dst, root_path / src.textureFilePath, renderer);
+		// スフィアマップのUVは法線から求めるので，常に0～1に収まる
+		const bool is_uv_in_unit_range = isUVInUnitRange(file, index_offset, src.indexCount);
+		index_offset += src.indexCount;
 
-	}
-
-	return true;
-}
-
-bool PMDActor::loadBones(std::ifstream & fin, RendererDX12 & renderer)
-{
-	uint16_t bone_count = 0;
-	fin.read(reinterpret_cast<char *>(&bone_count), sizeof(bone_count));
-
-#pragma pack(push, 1)
-	struct PMDBone
-	{
-		char boneName[20];
-		uint16_t parentNo;
-		uint16_t nextNo;
-		uint8_t type;
-		uint16_t ikBoneNo;
-		XMFLOAT3 pos;
-	};
-#pragma pack(pop)
-
-	vector<PMDBone> pmd_bones(bone_count);
-	fin.read(reinterpret_cast<char *>(pmd_bones.data()), sizeof(pmd_bones[0]) * pmd_bones.size());
-
-	mBones.resize(bone_count);
-	for(uint32_t i = 0; i < pmd_bones.size(); ++i)
-	{
-		auto & pmd_bone = pmd_bones[i];
-		auto & bone = mBones[i];
-
-		bone.boneType = static_cast<BoneType>(pmd_bone.type);
-		bone.boneName = pmd_bone.boneName;
-		bone.startPosition = pmd_bone.pos;
-
-		mNameToBoneIndex[bone.boneName] = i;
-	}
-
-	for(auto & pmd_bone : pmd_bones)
-	{
-		if(pmd_bone.parentNo >= pmd_bones.size())
+		string texture_set_key;
+		for(uint32_t t = 0; t < MaterialTextureCount; ++t)
 		{
-			continue;
-		}
-
-		auto boneIndex = mNameToBoneIndex[pmd_bone.boneName];
-		mBones[pmd_bone.parentNo].children.emplace_back(boneIndex);
-	}
-
-	mBoneMatrices.resize(bone_count);
-	fill(mBoneMatrices.begin(), mBoneMatrices.end(), XMMatrixIdentity());
-
-	return true;
-}
-
-bool PMDActor::loadIK(std::ifstream & fin)
-{
-	uint16_t ik_count = 0;
-	fin.read(reinterpret_cast<char *>(&ik_count), sizeof(ik_count));
-
-	mIKs.resize(ik_count);
-	for(auto & ik : mIKs)
-	{
-		fin.read(reinterpret_cast<char *>(&ik.boneIndex), sizeof(ik.boneIndex));
-		fin.read(reinterpret_cast<char *>(&ik.targetIndex), sizeof(ik.targetIndex));
+			auto & transform = dst.constantBuffer.textureTransforms[t];
+			transform = XMFLOAT4(1.0f, 1.0f, 0.0f, 0.0f);
+
+			auto & texture_path = texture_paths[t];
+			filesystem::path atlas_path;
+			if(
+				!texture_path.empty() &&
+				(t != static_cast<uint32_t>(MaterialTexture::Base) || is_uv_in_unit_range) &&
+				renderer.findAtlasTexture(root_path, texture_path, atlas_path, transform)
+			)
+			{
+				texture_path = atlas_path;
+				++atlas_texture_count;
+			}
 
-		uint8_t chain_length = 0;
-		fin.read(reinterpret_cast<char *>(&chain_length), sizeof(chain_length));
-		fin.read(reinterpret_cast<char *>(&ik.iterations), sizeof(ik.iterations));
-		fin.read(reinterpret_cast<char *>(&ik.limit), sizeof(ik.limit));
+			texture_set_key += texture_path.generic_u8string();
+			texture_set_key += '\n';
+		}
 
-		if(chain_length == 0)
+		const auto inserted = texture_set_indices.emplace(texture_set_key, static_cast<uint32_t>(mTextureSets.size()));
+		dst.textureSetIndex = inserted.first->second;
+		if(!inserted.second)
 		{
 			continue;
 		}
 
-		ik.nodeIndices.resize(chain_length);
-		fin.read(
-			reinterpret_cast<char *>(ik.nodeIndices.data()),
-			sizeof(ik.nodeIndices[0]) * ik.nodeIndices.size()
-		);
-
-#if defined(_DEBUG)
-		ostringstream oss;
-		oss << "IKボーン番号:" << ik.boneIndex << "(" << mBones[ik.boneIndex].boneName << ")" << endl;
-		for(auto & node : ik.nodeIndices)
+		mTextureSets.push_back({ renderer.getNullWhite(), renderer.getNullWhite(), renderer.getNullBlack() });
+		for(uint32_t t = 0; t < MaterialTextureCount; ++t)
 		{
-			oss << "\tノードボーン:" << node << "(" << mBones[node].boneName << ")" << endl;
+			if(!texture_paths[t].empty())
+			{
+				requestMaterialTexture(dst.textureSetIndex, static_cast<MaterialTexture>(t), texture_paths[t], renderer);
+			}
 		}
-
-		OutputDebugStringA(oss.str().c_str());
-#endif
 	}
 
+	char message[256];
+	snprintf(
+		message,
+		sizeof(message),
+		"Materials : %u materials, %zu texture sets, %zu descriptors, %u textures in atlases\n",
+		material_count,
+		mTextureSets.size(),
+		mTextureSets.size() * MaterialTextureCount + 1,
+		atlas_texture_count
+	);
+	OutputDebugStringA(message);
+
 	return true;
 }
 
@@ -684,7 +648,7 @@ bool PMDActor::createMaterialDescriptorHeap(RendererDX12 & renderer)
 {
 	D3D12_DESCRIPTOR_HEAP_DESC descriptor_heap_desc;
 	descriptor_heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	descriptor_heap_desc.NumDescriptors = mMaterials.size() * 5;
+	descriptor_heap_desc.NumDescriptors = mTextureSets.size() * MaterialTextureCount + 1;
 	descriptor_heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 	descriptor_heap_desc.NodeMask = 0;
 
@@ -715,350 +679,230 @@ bool PMDActor::createMaterialResourceViews(RendererDX12 & renderer)
 		return false;
 	}
 
-	D3D12_GPU_VIRTUAL_ADDRESS buffer_location = mpMaterialConstantBuffer->GetGPUVirtualAddress();
-
-	auto handle = mpMaterialDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
-	auto handle_size = renderer.getDescriptorHandleIncrementSize(
-		D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV
-	);
-
 	for(auto & m : mMaterials)
 	{
 		*reinterpret_cast<MaterialConstantBuffer *>(p_material_constant) = m.constantBuffer;
 		p_material_constant += material_buffer_size;
-
-		renderer.createConstantBufferView(buffer_location, material_buffer_size, handle);
-		buffer_location += material_buffer_size;
-		handle.ptr += handle_size;
-
-		renderer.createTextureResourceView(m.pTexture, handle);
-		handle.ptr += handle_size;
-
-		renderer.createTextureResourceView(m.pMultipleSphereMap, handle);
-		handle.ptr += handle_size;
-
-		renderer.createTextureResourceView(m.pAdditiveSphereMap, handle);
-		handle.ptr += handle_size;
-
-		renderer.createTextureResourceView(m.pToon, handle);
-		handle.ptr += handle_size;
 	}
 
 	mpMaterialConstantBuffer->Unmap(0, nullptr);
 
-	return true;
-}
-
-void PMDActor::multiplyMatrixRecursively(
-	const uint32_t boneIndex,
-	const DirectX::XMMATRIX & parent_matrix
-)
-{
-	auto & local_matrix = mBoneMatrices[boneIndex];
-	local_matrix *= parent_matrix;
-
-	for(const auto child : mBones[boneIndex].children)
-	{
-		multiplyMatrixRecursively(child, local_matrix);
-	}
-}
-
-static XMMATRIX lookAt(const XMVECTOR & dir, const XMVECTOR & up, const XMVECTOR & right)
-{
-	XMVECTOR z = dir;
-	XMVECTOR y = XMVector3Normalize(up);
-	XMVECTOR x = XMVector3Normalize(XMVector3Cross(y, z));
-	y = XMVector3Cross(x, z);
+	auto handle = mpMaterialDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
+	auto handle_size = renderer.getDescriptorHandleIncrementSize(
+		D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV
+	);
 
-	if(abs(XMVectorGetX(XMVector3Dot(y, z))) == 1.0f)
+	for(auto & texture_set : mTextureSets)
 	{
-		x = XMVector3Normalize(right);
-		y = XMVector3Normalize(XMVector3Cross(z, x));
-		x = XMVector3Cross(y, z);
+		for(auto & p_texture : texture_set)
+		{
+			renderer.createTextureResourceView(p_texture, handle);
+			handle.ptr += handle_size;
+		}
 	}
 
-	XMMATRIX result = XMMatrixIdentity();
-	result.r[0] = x;
-	result.r[1] = y;
-	result.r[2] = z;
-
-	return result;
-}
-
-static XMMATRIX lookAt(const XMVECTOR & eye, const XMVECTOR & at, const XMVECTOR & up, const XMVECTOR & right)
-{
-	return XMMatrixTranspose(lookAt(eye, up, right)) * lookAt(at, up, right);
-}
+	renderer.createTextureResourceView(renderer.getToonRamps(), handle);
 
-void PMDActor::solveLookAt(const IK & ik)
-{
-	auto & root_bone = mBones[ik.nodeIndices[0]];
-	auto & target_bone = mBones[ik.targetIndex];
-
-	auto opos1 = XMLoadFloat3(&root_bone.startPosition);
-	auto tpos1 = XMLoadFloat3(&target_bone.startPosition);
-
-	auto opos2 = XMVector3Transform(opos1, mBoneMatrices[ik.nodeIndices[0]]);
-	auto tpos2 = XMVector3Transform(tpos1, mBoneMatrices[ik.boneIndex]);
-
-	auto originVec = XMVector3Normalize(tpos1 - opos1);
-	auto targetVec = XMVector3Normalize(tpos2 - opos2);
-
-	mBoneMatrices[ik.nodeIndices[0]] =
-		XMMatrixTranslationFromVector(-opos2) *
-		lookAt(originVec, targetVec, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f)) *
-		XMMatrixTranslationFromVector(opos2);
+	return true;
 }
 
-void PMDActor::solveCosineIK(const IK & ik)
+void PMDActor::buildBoneBounds()
 {
-	auto & ik_bone = mBones[ik.boneIndex];
-	auto ik_position = XMVector3Transform(XMLoadFloat3(&ik_bone.startPosition), mBoneMatrices[ik.boneIndex]);
+	constexpr float float_max = numeric_limits<float>::max();
 
-	auto target_bone = mBones[ik.targetIndex];
-	XMVECTOR positions[]
-	{
-		XMLoadFloat3(&mBones[ik.nodeIndices[1]].startPosition),
-		XMLoadFloat3(&mBones[ik.nodeIndices[0]].startPosition),
-		XMLoadFloat3(&target_bone.startPosition),
-	};
-
-	float edge_lengths[]
+	uint32_t index_offset = 0;
+	for(auto & m : mMaterials)
 	{
-		XMVectorGetX(XMVector3Length(positions[1] - positions[0])),
-		XMVectorGetX(XMVector3Length(positions[2] - positions[1])),
-	};
-
-	positions[0] = XMVector3Transform(positions[0], mBoneMatrices[ik.nodeIndices[1]]);
-	positions[2] = XMVector3Transform(positions[2], mBoneMatrices[ik.boneIndex]);
+		m.boneBoundsOffset = static_cast<uint32_t>(mBoneBounds.size());
 
-	auto linearVec = positions[2] - positions[0];
-	float A = XMVectorGetX(XMVector3Length(linearVec));
-	float B = edge_lengths[0];
-	float C = edge_lengths[1];
-
-	linearVec = XMVector3Normalize(linearVec);
+		const auto end = min<size_t>(index_offset + m.indexCount, mIndices.size());
+		for(auto i = index_offset; i < end; ++i)
+		{
+			if(mIndices[i] >= mSkinVertices.size())
+			{
+				continue;
+			}
 
-	float theta1 = acos((A * A + B * B - C * C) / (2.0f * A * B));
-	float theta2 = acos((B * B + C * C - A * A) / (2.0f * B * C));
+			const auto & v = mSkinVertices[mIndices[i]];
+			for(auto bone : v.bones)
+			{
+				if(bone >= mSkeleton.getBoneCount())
+				{
+					continue;
+				}
+
+				auto it = find_if(
+					mBoneBounds.begin() + m.boneBoundsOffset,
+					mBoneBounds.end(),
+					[bone](const BoneBounds & bounds)
+					{
+						return bounds.bone == bone;
+					}
+				);
+				if(it == mBoneBounds.end())
+				{
+					mBoneBounds.push_back({
+						bone,
+						XMFLOAT3(float_max, float_max, float_max),
+						XMFLOAT3(-float_max, -float_max, -float_max)
+					});
+					it = mBoneBounds.end() - 1;
+				}
+
+				XMStoreFloat3(&it->min, XMVectorMin(XMLoadFloat3(&it->min), XMLoadFloat3(&v.position)));
+				XMStoreFloat3(&it->max, XMVectorMax(XMLoadFloat3(&it->max), XMLoadFloat3(&v.position)));
+			}
+		}
 
-	XMVECTOR axis;
-	if(mBones[ik.nodeIndices[0]].boneName.find("ひざ") != string::npos)
-	{
-		axis = XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
-	}
-	else
-	{
-		auto vm = XMVector3Normalize(positions[2] - positions[0]);
-		auto vt = XMVector3Normalize(ik_position - positions[0]);
-		axis = XMVector3Cross(vt, vm);
+		m.boneBoundsCount = static_cast<uint32_t>(mBoneBounds.size()) - m.boneBoundsOffset;
+		index_offset += m.indexCount;
 	}
-
-	auto r0 =
-		XMMatrixTranslationFromVector(-positions[0]) *
-		XMMatrixRotationAxis(axis, theta1) *
-		XMMatrixTranslationFromVector(positions[0]);
-
-	auto r1 =
-		XMMatrixTranslationFromVector(-positions[1]) *
-		XMMatrixRotationAxis(axis, theta2 - XM_PI) *
-		XMMatrixTranslationFromVector(positions[1]);
-
-	mBoneMatrices[ik.nodeIndices[1]] *= r0;
-	mBoneMatrices[ik.nodeIndices[0]] = r1 * mBoneMatrices[ik.nodeIndices[1]];
-	mBoneMatrices[ik.targetIndex] = mBoneMatrices[ik.nodeIndices[0]];
 }
 
-void PMDActor::solveCCDIK(const IK & ik)
+void PMDActor::buildOccluder()
 {
-	auto & ik_bone = mBones[ik.boneIndex];
-	auto ik_position = XMLoadFloat3(&ik_bone.startPosition);
-
-	auto & parent_matrix = mBoneMatrices[ik_bone.ikParentBone];
-	XMVECTOR determinant;
-	auto inverse_parent_matrix = XMMatrixInverse(&determinant, parent_matrix);
-	auto target_next_position = XMVector3Transform(ik_position, mBoneMatrices[ik.boneIndex] * inverse_parent_matrix);
+	constexpr float float_max = numeric_limits<float>::max();
 
-	vector<XMVECTOR> bone_positions;
-	auto target_position = XMLoadFloat3(&mBones[ik.targetIndex].startPosition);
-	for(auto node_index : ik.nodeIndices)
+	const auto bone_count = mSkeleton.getBoneCount();
+	if(mSkinVertices.empty() || bone_count == 0)
 	{
-		bone_positions.push_back(XMLoadFloat3(&mBones[node_index].startPosition));
+		return;
 	}
 
-	vector<XMMATRIX> matrices(bone_positions.size(), XMMatrixIdentity());
+	vector<XMFLOAT3> positions(mSkinVertices.size());
+	for(size_t i = 0; i < mSkinVertices.size(); ++i)
+	{
+		positions[i] = mSkinVertices[i].position;
+	}
 
-	auto ik_limit = ik.limit * XM_PI;
-	for(auto c = 0; c < ik.iterations; ++c)
+	// ボーンごとに，そのボーンだけに従う頂点の範囲を求める
+	struct RigidBounds
+	{
+		uint32_t vertexCount = 0;
+		XMFLOAT3 min = XMFLOAT3(float_max, float_max, float_max);
+		XMFLOAT3 max = XMFLOAT3(-float_max, -float_max, -float_max);
+	};
+	vector<RigidBounds> rigid_bounds(bone_count);
+	for(const auto & v : mSkinVertices)
 	{
-		if(XMVectorGetX(XMVector3Length(target_position - target_next_position)) <= epsilon)
+		uint16_t bone = UINT16_MAX;
+		if(v.weight == 100 || v.bones[0] == v.bones[1])
 		{
-			break;
+			bone = v.bones[0];
 		}
-
-		for(int bone_index = 0; bone_index < bone_positions.size(); ++bone_index)
+		else if(v.weight == 0)
 		{
-			const auto & position = bone_positions[bone_index];
-			auto vec_to_target = XMVector3Normalize(target_position - position);
-			auto vec_to_next_target = XMVector3Normalize(target_next_position - position);
-
-			if(XMVectorGetX(XMVector3Length(vec_to_target - vec_to_next_target)) <= epsilon)
-			{
-				continue;
-			}
-
-			auto cross = XMVector3Normalize(XMVector3Cross(vec_to_target, vec_to_next_target));
-			float angle = min(XMVectorGetX(XMVector3AngleBetweenVectors(vec_to_target, vec_to_next_target)), ik_limit);
-			XMMATRIX m =
-				XMMatrixTranslationFromVector(-position) *
-				XMMatrixRotationAxis(cross, angle) *
-				XMMatrixTranslationFromVector(position);
-
-			matrices[bone_index] *= m;
-
-			for(auto index = bone_index - 1; index >= 0; --index)
-			{
-				bone_positions[index] = XMVector3Transform(bone_positions[index], m);
-			}
+			bone = v.bones[1];
+		}
 
-			target_position = XMVector3Transform(target_position, m);
-			if(XMVectorGetX(XMVector3Length(target_position - target_next_position)) <= epsilon)
-			{
-				break;
-			}
+		if(bone >= bone_count)
+		{
+			continue;
 		}
-	}
 
-	for(auto i = 0; i < matrices.size(); ++i)
-	{
-		mBoneMatrices[ik.nodeIndices[i]] = matrices[i];
+		auto & bounds = rigid_bounds[bone];
+		++bounds.vertexCount;
+		XMStoreFloat3(&bounds.min, XMVectorMin(XMLoadFloat3(&bounds.min), XMLoadFloat3(&v.position)));
+		XMStoreFloat3(&bounds.max, XMVectorMax(XMLoadFloat3(&bounds.max), XMLoadFloat3(&v.position)));
 	}
 
-	multiplyMatrixRecursively(ik.nodeIndices.back(), parent_matrix);
-}
-
-void PMDActor::solveIK()
-{
-	for(const auto & ik : mIKs)
+	// 範囲をメッシュの内側まで縮めた箱をオクルーダにする．薄い箱はほとんど隠さないので使わない
+	for(uint16_t bone = 0; bone < bone_count; ++bone)
 	{
-		switch(ik.nodeIndices.size())
+		auto & bounds = rigid_bounds[bone];
+		if(bounds.vertexCount < OccluderMinVertexCount)
 		{
-		case 0:
 			continue;
-		case 1:
-			solveLookAt(ik);
-			break;
-		case 2:
-			solveCosineIK(ik);
-			break;
-		default:
-			solveCCDIK(ik);
-			break;
 		}
-	}
-}
 
-static float getYFromXOnBezier(float x, const XMFLOAT2 & a, const XMFLOAT2 & b, int32_t n)
-{
-	if(a.x == a.y && b.x == b.y)
-	{
-		return x;
-	}
-
-	float t = x;
-	const float k0 = 1.0f + 3.0f * a.x - 3.0f * b.x;
-	const float k1 = 3.0f * b.x - 6.0f * a.x;
-	const float k2 = 3.0f * a.x;
-
-	constexpr float epsilon = 0.0005f;
+		if(!OcclusionCuller::shrinkBoxInside(
+			positions.data(),
+			static_cast<uint32_t>(positions.size()),
+			mIndices.data(),
+			static_cast<uint32_t>(mIndices.size()),
+			bounds.min,
+			bounds.max
+		))
+		{
+			continue;
+		}
 
-	for(int32_t i = 0; i < n; ++i)
-	{
-		auto ft = k0 * t + k1;
-		ft = ft * t + k2;
-		ft = ft * t - x;
+		const float extent[]
+		{
+			bounds.max.x - bounds.min.x,
+			bounds.max.y - bounds.min.y,
+			bounds.max.z - bounds.min.z,
+		};
+		if(*min_element(begin(extent), end(extent)) < *max_element(begin(extent), end(extent)) * OccluderMinThickness)
+		{
+			continue;
+		}
 
-		if(-epsilon <= ft && ft <= epsilon)
+		if((mOccluderBoxes.size() + 1) * 8 > UINT16_MAX)
 		{
 			break;
 		}
 
-		t -= ft * 0.5f;
+		const auto base = static_cast<uint16_t>(mOccluderBoxes.size() * 8);
+		for(auto index : OcclusionCuller::BoxIndices)
+		{
+			mOccluderIndices.push_back(base + index);
+		}
 
+		mOccluderBoxes.push_back({ bone, bounds.min, bounds.max });
 	}
 
-	auto r = 1.0f - t;
-	return t * t * t + 3.0f * t * t * r * b.y + 3.0f * t * r * r * a.y;
+	mOccluderPositions.resize(mOccluderBoxes.size() * 8);
 }
 
-void PMDActor::updateMotion()
+void PMDActor::updateBounds()
 {
-	auto elapsed_milliseconds = chrono::duration_cast<chrono::milliseconds>(
-		chrono::high_resolution_clock::now() - mStartTime
-	).count();
-	auto frame_per_sec = 30.0f;
-	auto frame = static_cast<uint64_t>(
-		floor((elapsed_milliseconds / 1000.0) / (1.0 / frame_per_sec))
-	);
-
-	frame %= mMaxFrame;
+	constexpr float float_max = numeric_limits<float>::max();
 
-	// frame = frame_value;
-
-	fill(mBoneMatrices.begin(), mBoneMatrices.end(), XMMatrixIdentity());
-
-	for(auto & kv : mNameToKeyFrameMap)
+	const auto & bone_matrices = mSkeleton.getBoneMatrices();
+	XMVECTOR actor_min = XMVectorReplicate(float_max);
+	XMVECTOR actor_max = XMVectorReplicate(-float_max);
+	for(auto & m : mMaterials)
 	{
-		auto it_bone = mNameToBoneIndex.find(kv.first);
-		if(it_bone == mNameToBoneIndex.end())
+		XMVECTOR material_min = XMVectorReplicate(float_max);
+		XMVECTOR material_max = XMVectorReplicate(-float_max);
+		for(uint32_t i = 0; i < m.boneBoundsCount; ++i)
 		{
-			continue;
-		}
-
-		auto boneIndex = it_bone->second;
-		auto & motions = kv.second;
-
-		auto it = find_if(
-			motions.rbegin(),
-			motions.rend(),
-			[frame](const KeyFrame & key_frame)
+			const auto & bounds = mBoneBounds[m.boneBoundsOffset + i];
+			const auto & bone_matrix = bone_matrices[bounds.bone];
+			for(uint32_t corner = 0; corner < 8; ++corner)
 			{
-				return key_frame.frameNo <= frame;
+				auto p = XMVector3Transform(
+					XMVectorSet(
+						(corner & 1) ? bounds.max.x : bounds.min.x,
+						(corner & 2) ? bounds.max.y : bounds.min.y,
+						(corner & 4) ? bounds.max.z : bounds.min.z,
+						1.0f
+					),
+					bone_matrix
+				);
+				material_min = XMVectorMin(material_min, p);
+				material_max = XMVectorMax(material_max, p);
 			}
-		);
-
-		if(it == motions.rend())
-		{
-			continue ;
 		}
-		auto & bone_position = mBones[boneIndex].startPosition;
-
-		XMVECTOR rotation = it->quaternion;
-		XMVECTOR translation = XMLoadFloat3(&it->offset);
 
-		auto next = it.base();
-		if(next != motions.end())
-		{
-			auto t = 
-				static_cast<float>(frame - it->frameNo) /
-				static_cast<float>(next->frameNo - it->frameNo);
-
-			t = getYFromXOnBezier(t, next->p1, next->p2, 12);
-
-			rotation = XMQuaternionSlerp(it->quaternion, next->quaternion, t);
-			translation = XMVectorLerp(translation, XMLoadFloat3(&next->offset), t);
-		}
-
-		mBoneMatrices[boneIndex] =
-			XMMatrixTranslation(-bone_position.x, -bone_position.y, -bone_position.z) *
-			XMMatrixRotationQuaternion(rotation) *
-			XMMatrixTranslation(bone_position.x, bone_position.y, bone_position.z) *
-			XMMatrixTranslationFromVector(translation);
+		XMStoreFloat3(&m.boundsMin, material_min);
+		XMStoreFloat3(&m.boundsMax, material_max);
+		actor_min = XMVectorMin(actor_min, material_min);
+		actor_max = XMVectorMax(actor_max, material_max);
 	}
 
-	multiplyMatrixRecursively(mNameToBoneIndex["センター"], XMMatrixIdentity());
-
-	// solveIK();
+	XMStoreFloat3(&mBoundsMin, actor_min);
+	XMStoreFloat3(&mBoundsMax, actor_max);
+}
 
-	copy(mBoneMatrices.begin(), mBoneMatrices.end(), mpMappedTransform + 1);
+void PMDActor::resetLODPoses()
+{
+	// 更新中に確保しないよう，ここでトラックの数だけ確保しておく
+	const auto track_count = mpMotion != nullptr ? mpMotion->getTrackCount() : 0;
+	for(auto & lod_pose : mLODPoses)
+	{
+		lod_pose.frame = InvalidPoseFrame;
+		lod_pose.trackPoses.resize(track_count);
+	}
 }
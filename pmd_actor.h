@@ -2,32 +2,66 @@
 #ifndef PMD_ACTOR_H_INCLUDED
 #define PMD_ACTOR_H_INCLUDED
 
+#include <array>
 #include <cstdint>
-#include <chrono>
 #include <filesystem>
-#include <fstream>
-#include <map>
-#include <unordered_map>
-#include <string>
+#include <memory>
 #include <vector>
 #include <d3d12.h>
 #include <DirectXMath.h>
 #include <wrl/client.h>
+#include "pmd_skeleton.h"
+#include "vmd_motion.h"
 
 class RendererDX12;
+class OcclusionCuller;
+class AnimationClock;
+class BakedMotion;
+
+namespace pmd
+{
+	struct File;
+}
 
 class PMDActor
 {
 public:
 	PMDActor(const char * path_str, RendererDX12 & renderer);
 
-	bool loadVMD(const char * path_str);
+	// 同じモーションを複数のアクターで共有する
+	void setMotion(std::shared_ptr<const VMDMotion> p_motion);
+	const VMDMotion * getMotion() const { return mpMotion.get(); }
+
+	// 焼き込んだモーションで再生する．元のモーションも設定される
+	void setBakedMotion(std::shared_ptr<const BakedMotion> p_baked_motion);
+	const BakedMotion * getBakedMotion() const { return mpBakedMotion.get(); }
+
+	// 群衆が揃って動かないよう，アクターごとに再生位置をずらす
+	void setMotionTimeOffset(uint32_t frame_offset);
+
+	void updateWorld();
+
+	// clockの時刻のモーションのフレーム．モーションがなければfalse
+	bool getPoseFrame(const AnimationClock & clock, uint32_t & frame) const;
+
+	// frameのポーズをlodの設定でapplyPoseしてあるか．描画が30fpsより速いと，同じフレームが続く
+	bool isPoseApplied(uint32_t frame, uint32_t lod) const { return frame == mPoseFrame && lod == mPoseLOD; }
+
+	// getMotion()->sampleかgetBakedMotion()->sampleで求めたポーズを使う
+	void applyPose(const VMDMotion::TrackPose * p_poses, uint32_t frame, uint32_t lod, uint32_t skipped_leaf_height, bool solve_ik);
 
-	void update();
+	// 低いLODで補間する区切りのフレームのポーズ．frameがなければkept_frame以外の方を空けて返し，is_cachedをfalseにする
+	VMDMotion::TrackPose * getLODPose(uint32_t frame, uint32_t kept_frame, bool & is_cached);
 
-	void draw(RendererDX12 & renderer);
+	// ワールド座標での境界球
+	void getBoundingSphere(DirectX::XMVECTOR & center, float & radius) const;
 
-	void startAnimation();
+	// ownerはカリングで自分のオクルーダを除くための番号
+	void rasterizeOccluder(OcclusionCuller & culler, uint32_t owner);
+
+	void draw(RendererDX12 & renderer, OcclusionCuller & culler, uint32_t owner);
+
+	void startAnimation(const AnimationClock & clock);
 
 	void setPosition(float x, float y, float z);
 	void setEulerAngle(float x, float y, float z);
@@ -36,44 +70,61 @@ private:
 	bool createTransformDescriptorHeap(RendererDX12 & renderer);
 	bool createTransformConstantBuffer(RendererDX12 & renderer);
 	bool load(const char * pathStr, RendererDX12 & renderer);
-	bool loadHeader(std::ifstream & fin);
-	bool loadVertices(std::ifstream & fin, RendererDX12 & renderer);
-	bool loadIndices(std::ifstream & fin, RendererDX12 & renderer);
+	bool loadVertices(const pmd::File & file, RendererDX12 & renderer);
+	bool loadIndices(const pmd::File & file, RendererDX12 & renderer);
+
+	// テクスチャの組の記述子の並び．同じパスの組を使うマテリアルは記述子を共有する
+	// 定数バッファはルートCBVで渡し，トゥーンはレンダラーの配列を全ての組の後に1つだけ置く
+	enum class MaterialTexture : uint32_t
+	{
+		Base,
+		MultipleSphereMap,
+		AdditiveSphereMap,
+	};
+	static constexpr uint32_t MaterialTextureCount = 3;
+
+	// 拡張子でテクスチャかスフィアマップかを決める
+	static bool getMaterialTexture(const std::filesystem::path & texture_path, MaterialTexture & texture);
+
+	// アトラスは繰り返せないので，UVが0～1に収まるマテリアルだけが使える
+	bool isUVInUnitRange(const pmd::File & file, uint32_t index_offset, uint32_t index_count) const;
 
-	struct Material;
-	static bool loadTexture(
-		Material & material,
+	// 読み込みが終わるまでは仮のテクスチャのまま描く
+	void requestMaterialTexture(
+		uint32_t texture_set_index,
+		MaterialTexture texture,
 		const std::filesystem::path & texture_path,
 		RendererDX12 & renderer
 	);
 
+	void setMaterialTexture(
+		uint32_t texture_set_index,
+		MaterialTexture texture,
+		const Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture,
+		RendererDX12 & renderer
+	);
+
 	bool loadMaterials(
-		std::ifstream & fin,
+		const pmd::File & file,
 		RendererDX12 & renderer,
 		const std::filesystem::path & root_path
 	);
 
-	bool loadBones(std::ifstream & fin, RendererDX12 & renderer);
-
-	bool loadIK(std::ifstream & fin);
-
 	bool createMaterialDescriptorHeap(RendererDX12 & renderer);
 	bool createMaterialResourceViews(RendererDX12 & renderer);
 
-	struct BoneNode;
-	void multiplyMatrixRecursively(const uint32_t boneIndex, const DirectX::XMMATRIX & parent_matrix);
-
-	struct IK;
-	void solveLookAt(const IK & ik);
-	void solveCosineIK(const IK & ik);
-	void solveCCDIK(const IK & ik);
-	void solveIK();
+	void buildBoneBounds();
+	void buildOccluder();
+	void updateBounds();
 
-	void updateMotion();
+	// モーションが変わったら，トラックの数に合わせて作り直す
+	void resetLODPoses();
 
 private:
 	DirectX::XMFLOAT3 mPosition = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
 	DirectX::XMFLOAT3 mEulerAngle = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	DirectX::XMMATRIX mWorld = DirectX::XMMatrixIdentity();
+	bool mIsWorldDirty = true;
 
 	Microsoft::WRL::ComPtr<ID3D12Resource> mpVertexBuffer;
 	D3D12_VERTEX_BUFFER_VIEW mVertexBufferView;
@@ -90,101 +141,86 @@ private:
 		DirectX::XMVECTOR diffuse;
 		DirectX::XMVECTOR specular;
 		DirectX::XMVECTOR ambient;
+		// テクスチャごとにUVを写すscale(xy)とoffset(zw)．アトラスでなければ(1, 1, 0, 0)
+		DirectX::XMFLOAT4 textureTransforms[MaterialTextureCount];
+		// トゥーンの配列の番号
+		uint32_t toonIndex;
 	};
 
 	struct Material
 	{
 		uint32_t indexCount;
 		MaterialConstantBuffer constantBuffer;
-		Microsoft::WRL::ComPtr<ID3D12Resource> pTexture;
-		Microsoft::WRL::ComPtr<ID3D12Resource> pMultipleSphereMap;
-		Microsoft::WRL::ComPtr<ID3D12Resource> pAdditiveSphereMap;
-		Microsoft::WRL::ComPtr<ID3D12Resource> pToon;
+		uint32_t textureSetIndex;
+		uint32_t boneBoundsOffset;
+		uint32_t boneBoundsCount;
+		DirectX::XMFLOAT3 boundsMin;
+		DirectX::XMFLOAT3 boundsMax;
 	};
 
 	std::vector<Material> mMaterials;
 
-	std::vector<DirectX::XMMATRIX> mBoneMatrices;
+	using TextureSet = std::array<Microsoft::WRL::ComPtr<ID3D12Resource>, MaterialTextureCount>;
+	std::vector<TextureSet> mTextureSets;
 
-	enum class BoneType : uint32_t
+	// 読み込み中だけ保持するCPU側の頂点とインデックス
+	struct SkinVertex
 	{
-		Rotation,
-		RotAndMove,
-		IK,
-		Undefined,
-		IKChild,
-		RotationChild,
-		IKDestination,
-		Invisible,
+		DirectX::XMFLOAT3 position;
+		uint16_t bones[2];
+		uint8_t weight;
 	};
+	std::vector<SkinVertex> mSkinVertices;
+	std::vector<uint16_t> mIndices;
 
-	struct BoneNode
+	// ボーンごとの頂点範囲．ボーン行列で変換した和集合がマテリアルの範囲になる
+	struct BoneBounds
 	{
-		BoneType boneType;
-		int32_t ikParentBone;
-		DirectX::XMFLOAT3 startPosition;
-		std::string boneName;
-		std::vector<uint32_t> children;
+		uint16_t bone;
+		DirectX::XMFLOAT3 min;
+		DirectX::XMFLOAT3 max;
 	};
-	std::vector<BoneNode> mBones;
-	std::map<std::string, uint32_t> mNameToBoneIndex;
-
-	struct IK
+	std::vector<BoneBounds> mBoneBounds;
+	DirectX::XMFLOAT3 mBoundsMin = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	DirectX::XMFLOAT3 mBoundsMax = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+	// ボーンごとの，メッシュの内側に収まる箱のオクルーダ
+	static constexpr uint32_t OccluderMinVertexCount = 16;
+	static constexpr float OccluderMinThickness = 0.1f;
+	struct OccluderBox
 	{
-		uint16_t boneIndex;
-		uint16_t targetIndex;
-		uint16_t iterations;
-		float limit;
-		std::vector<uint16_t> nodeIndices;
+		uint16_t bone;
+		DirectX::XMFLOAT3 min;
+		DirectX::XMFLOAT3 max;
 	};
-	std::vector<IK> mIKs;
+	std::vector<OccluderBox> mOccluderBoxes;
+	std::vector<uint16_t> mOccluderIndices;
+	std::vector<DirectX::XMFLOAT3> mOccluderPositions;
+
+	PMDSkeleton mSkeleton;
 
 	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mpMaterialDescriptorHeap;
 	Microsoft::WRL::ComPtr<ID3D12Resource> mpMaterialConstantBuffer;
 
-	struct KeyFrame
-	{
-		uint32_t frameNo;
-		DirectX::XMVECTOR quaternion;
-		DirectX::XMFLOAT3 offset;
-		DirectX::XMFLOAT2 p1;
-		DirectX::XMFLOAT2 p2;
-
-		KeyFrame(
-			const uint32_t frame_no,
-			const DirectX::XMVECTOR & q,
-			const DirectX::XMFLOAT3 & ofs,
-			const DirectX::XMFLOAT2 & vp1,
-			const DirectX::XMFLOAT2 & vp2
-		)
-			: frameNo(frame_no)
-			, quaternion(q)
-			, offset(ofs)
-			, p1(vp1)
-			, p2(vp2)
-		{}
-
-		KeyFrame(const KeyFrame & key_frame)
-			: frameNo(key_frame.frameNo)
-			, quaternion(key_frame.quaternion)
-			, offset(key_frame.offset)
-			, p1(key_frame.p1)
-			, p2(key_frame.p2)
-		{}
-	};
+	std::shared_ptr<const VMDMotion> mpMotion;
+	std::shared_ptr<const BakedMotion> mpBakedMotion;
+	uint32_t mMotionTimeOffset = 0;
 
-	struct IKEnable
-	{
-		uint32_t frameNo;
-		std::vector<bool> enables;
-	};
-	std::vector<IKEnable> mIKEnables;
+	// startAnimationを呼んだときのclockの時刻
+	double mStartFrame = 0.0;
 
-	std::unordered_map<std::string, std::vector<KeyFrame>> mNameToKeyFrameMap;
+	// mpMappedTransformに書き込んであるポーズのフレームとLOD
+	static constexpr uint32_t InvalidPoseFrame = UINT32_MAX;
+	uint32_t mPoseFrame = InvalidPoseFrame;
+	uint32_t mPoseLOD = 0;
 
-	std::chrono::high_resolution_clock::time_point mStartTime;
-
-	uint32_t mMaxFrame = 0;
+	// 低いLODの補間の両端のポーズ．区切りが進んだときだけ求め直す
+	struct LODPose
+	{
+		uint32_t frame = InvalidPoseFrame;
+		std::vector<VMDMotion::TrackPose> trackPoses;
+	};
+	std::array<LODPose, 2> mLODPoses;
 };
 
 #endif // PMD_ACTOR_H_INCLUDED
@@ -0,0 +1,145 @@
+﻿#include "pmd_file.h"
+#include <cstring>
+#include <fstream>
+#include "byte_reader.h"
+
+using namespace std;
+
+namespace
+{
+	template<typename Count, typename T>
+	void writeArray(ofstream & fout, const vector<T> & src)
+	{
+		auto count = static_cast<Count>(src.size());
+		fout.write(reinterpret_cast<const char *>(&count), sizeof(count));
+		fout.write(reinterpret_cast<const char *>(src.data()), sizeof(T) * src.size());
+	}
+}
+
+bool pmd::loadFile(const std::filesystem::path & path, File & file)
+{
+	ifstream fin(path, ios::in | ios::binary | ios::ate);
+	if(!fin)
+	{
+		return false;
+	}
+
+	vector<uint8_t> data(static_cast<size_t>(fin.tellg()));
+	fin.seekg(0, ios::beg);
+	fin.read(reinterpret_cast<char *>(data.data()), data.size());
+	if(!fin)
+	{
+		return false;
+	}
+
+	return loadFile(data.data(), data.size(), file);
+}
+
+bool pmd::loadFile(const uint8_t * p_data, size_t size, File & file)
+{
+	ByteReader reader(p_data, size);
+
+	reader.read(file.header);
+	if(!reader.isGood() || strncmp(file.header.signature, "Pmd", 3) != 0)
+	{
+		return false;
+	}
+
+	uint32_t vertex_count = 0;
+	reader.read(vertex_count);
+	if(!reader.readArray(file.vertices, vertex_count))
+	{
+		return false;
+	}
+
+	uint32_t index_count = 0;
+	reader.read(index_count);
+	if(!reader.readArray(file.indices, index_count))
+	{
+		return false;
+	}
+
+	uint32_t material_count = 0;
+	reader.read(material_count);
+	if(!reader.readArray(file.materials, material_count))
+	{
+		return false;
+	}
+
+	uint16_t bone_count = 0;
+	reader.read(bone_count);
+	if(!reader.readArray(file.bones, bone_count))
+	{
+		return false;
+	}
+
+	uint16_t ik_count = 0;
+	if(!reader.read(ik_count))
+	{
+		return false;
+	}
+
+	file.iks.resize(ik_count);
+	for(auto & ik : file.iks)
+	{
+		reader.read(ik.boneIndex);
+		reader.read(ik.targetIndex);
+
+		uint8_t chain_length = 0;
+		reader.read(chain_length);
+		reader.read(ik.iterations);
+		reader.read(ik.limit);
+
+		if(!reader.readArray(ik.nodeIndices, chain_length))
+		{
+			return false;
+		}
+	}
+
+	return reader.isGood();
+}
+
+bool pmd::saveFile(const std::filesystem::path & path, const File & file)
+{
+	ofstream fout(path, ios::out | ios::binary);
+	if(!fout)
+	{
+		return false;
+	}
+
+	fout.write(reinterpret_cast<const char *>(&file.header), sizeof(file.header));
+
+	writeArray<uint32_t>(fout, file.vertices);
+	writeArray<uint32_t>(fout, file.indices);
+	writeArray<uint32_t>(fout, file.materials);
+	writeArray<uint16_t>(fout, file.bones);
+
+	auto ik_count = static_cast<uint16_t>(file.iks.size());
+	fout.write(reinterpret_cast<const char *>(&ik_count), sizeof(ik_count));
+	for(auto & ik : file.iks)
+	{
+		fout.write(reinterpret_cast<const char *>(&ik.boneIndex), sizeof(ik.boneIndex));
+		fout.write(reinterpret_cast<const char *>(&ik.targetIndex), sizeof(ik.targetIndex));
+
+		auto chain_length = static_cast<uint8_t>(ik.nodeIndices.size());
+		fout.write(reinterpret_cast<const char *>(&chain_length), sizeof(chain_length));
+		fout.write(reinterpret_cast<const char *>(&ik.iterations), sizeof(ik.iterations));
+		fout.write(reinterpret_cast<const char *>(&ik.limit), sizeof(ik.limit));
+		fout.write(
+			reinterpret_cast<const char *>(ik.nodeIndices.data()),
+			sizeof(ik.nodeIndices[0]) * ik.nodeIndices.size()
+		);
+	}
+
+	// 表情，表情枠，ボーン枠，表示ボーンは空にする
+	const uint16_t skin_count = 0;
+	const uint8_t skin_display_count = 0;
+	const uint8_t bone_display_name_count = 0;
+	const uint32_t bone_display_count = 0;
+	fout.write(reinterpret_cast<const char *>(&skin_count), sizeof(skin_count));
+	fout.write(reinterpret_cast<const char *>(&skin_display_count), sizeof(skin_display_count));
+	fout.write(reinterpret_cast<const char *>(&bone_display_name_count), sizeof(bone_display_name_count));
+	fout.write(reinterpret_cast<const char *>(&bone_display_count), sizeof(bone_display_count));
+
+	return static_cast<bool>(fout);
+}
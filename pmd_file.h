@@ -0,0 +1,81 @@
+﻿#pragma once
+#ifndef PMD_FILE_H_INCLUDED
+#define PMD_FILE_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <DirectXMath.h>
+
+// PMDファイルの読み書き．GPUのリソースは作らない
+namespace pmd
+{
+#pragma pack(push, 1)
+	struct FileHeader
+	{
+		char signature[3];
+		float version;
+		char modelName[20];
+		char comment[256];
+	};
+
+	struct FileVertex
+	{
+		DirectX::XMFLOAT3 position;
+		DirectX::XMFLOAT3 normal;
+		DirectX::XMFLOAT2 uv;
+		uint16_t boneNo[2];
+		uint8_t boneWeight;
+		uint8_t edgeFlag;
+	};
+
+	struct FileMaterial
+	{
+		DirectX::XMFLOAT3 diffuse;
+		float diffuseAlpha;
+		float specularity;
+		DirectX::XMFLOAT3 specular;
+		DirectX::XMFLOAT3 ambient;
+		uint8_t toonIndex;
+		uint8_t edgeFlag;
+		uint32_t indexCount;
+		char textureFilePath[20];
+	};
+
+	struct FileBone
+	{
+		char boneName[20];
+		uint16_t parentNo;
+		uint16_t nextNo;
+		uint8_t type;
+		uint16_t ikBoneNo;
+		DirectX::XMFLOAT3 pos;
+	};
+#pragma pack(pop)
+
+	struct FileIK
+	{
+		uint16_t boneIndex;
+		uint16_t targetIndex;
+		uint16_t iterations;
+		float limit;
+		std::vector<uint16_t> nodeIndices;
+	};
+
+	struct File
+	{
+		FileHeader header;
+		std::vector<FileVertex> vertices;
+		std::vector<uint16_t> indices;
+		std::vector<FileMaterial> materials;
+		std::vector<FileBone> bones;
+		std::vector<FileIK> iks;
+	};
+
+	bool loadFile(const std::filesystem::path & path, File & file);
+	// アーカイブなど，メモリ上にあるファイルを読む
+	bool loadFile(const uint8_t * p_data, size_t size, File & file);
+	bool saveFile(const std::filesystem::path & path, const File & file);
+}
+
+#endif // PMD_FILE_H_INCLUDED
@@ -1,12 +1,19 @@
 ﻿#include "pmd_renderer.h"
 #include "renderer_dx12.h"
+#include "async_file_reader.h"
 #include <d3dx12.h>
 #include "pmd.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 
 using namespace Microsoft::WRL;
 
 bool PMDRenderer::initialize(RendererDX12 & renderer)
 {
+	mpFileReader = &renderer.getFileReader();
+
 	if(!createRootSignature(renderer))
 	{
 		return false;
@@ -17,28 +24,235 @@ bool PMDRenderer::initialize(RendererDX12 & renderer)
 		return false;
 	}
 
+	if(!mOcclusionCuller.initialize(OcclusionBufferWidth, OcclusionBufferHeight))
+	{
+		return false;
+	}
+
 	return true;
 }
 
+bool PMDRenderer::resolvePipelineState()
+{
+	mpGraphicsPipelineState = mGraphicsPipelineStateFuture.get();
+
+	return mpGraphicsPipelineState != nullptr;
+}
+
 void PMDRenderer::setup(RendererDX12 & renderer)
 {
 	renderer.setPipelineState(mpGraphicsPipelineState);
 	renderer.setGraphicsRootSignature(mpRootSignature);
 }
 
-void PMDRenderer::update()
+void PMDRenderer::update(const RendererDX12 & renderer)
 {
+	PROFILE_FUNCTION();
+
+	mAnimationClock.tick();
+
+	mSampledPoses.clear();
+	mSharedTrackPoses.clear();
+
+	const auto view = renderer.getView();
+	const auto projection = renderer.getProjection();
+
 	for(auto & p_actor : mpActors)
 	{
-		p_actor->update();
+		const auto begin = std::chrono::steady_clock::now();
+
+		p_actor->updateWorld();
+
+		uint32_t frame = 0;
+		if(!p_actor->getPoseFrame(mAnimationClock, frame))
+		{
+			continue;
+		}
+
+		// 最初のポーズを求めるまでは初期姿勢の範囲で選ぶ．範囲が無ければ最も詳細にする
+		DirectX::XMVECTOR center;
+		float radius;
+		p_actor->getBoundingSphere(center, radius);
+		const float screen_height = radius > 0.0f ?
+			AnimationLODPolicy::computeScreenHeight(center, radius, view, projection) :
+			1.0f;
+
+		const auto lod = mAnimationLODPolicy.select(screen_height);
+		const auto & lod_settings = mAnimationLODPolicy.getLOD(lod);
+
+		// LODが上がったときは，同じフレームでも省いたボーンとIKを求め直す
+		if(!p_actor->isPoseApplied(frame, lod))
+		{
+			const VMDMotion::TrackPose * p_poses = nullptr;
+			if(lod_settings.frameStep <= 1)
+			{
+				// 補間するとmSharedTrackPosesが伸びるので，先にオフセットを求める
+				const auto offset = findOrSamplePose(*p_actor, frame);
+				p_poses = mSharedTrackPoses.data() + offset;
+			}
+			else
+			{
+				p_poses = interpolateLODPose(*p_actor, frame, lod_settings.frameStep);
+			}
+
+			p_actor->applyPose(p_poses, frame, lod, lod_settings.skippedLeafHeight, lod_settings.solveIK);
+
+			++mPosedActorCount;
+		}
+
+		auto & lod_statistics = mAnimationLODStatistics[lod];
+		++lod_statistics.actorCount;
+		lod_statistics.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
 	}
 }
 
+uint32_t PMDRenderer::findOrSamplePose(const PMDActor & actor, uint32_t frame)
+{
+	auto p_motion = actor.getMotion();
+	auto p_baked_motion = actor.getBakedMotion();
+	auto it = std::find_if(
+		mSampledPoses.begin(),
+		mSampledPoses.end(),
+		[p_motion, p_baked_motion, frame](const SampledPose & sampled_pose)
+		{
+			return
+				sampled_pose.pMotion == p_motion &&
+				sampled_pose.pBakedMotion == p_baked_motion &&
+				sampled_pose.frame == frame;
+		}
+	);
+
+	if(it != mSampledPoses.end())
+	{
+		return it->offset;
+	}
+
+	const auto offset = static_cast<uint32_t>(mSharedTrackPoses.size());
+	mSharedTrackPoses.resize(offset + p_motion->getTrackCount());
+	if(p_baked_motion != nullptr)
+	{
+		p_baked_motion->sample(frame, mSharedTrackPoses.data() + offset);
+	}
+	else
+	{
+		p_motion->sample(frame, mSharedTrackPoses.data() + offset);
+	}
+
+	mSampledPoses.push_back({ p_motion, p_baked_motion, frame, offset });
+
+	++mSampleCount;
+
+	return offset;
+}
+
+const VMDMotion::TrackPose * PMDRenderer::interpolateLODPose(PMDActor & actor, uint32_t frame, uint32_t frame_step)
+{
+	// frameStepごとのフレームだけをサンプリングしてアクターに覚えておき，間は2つのポーズを補間する
+	const auto max_frame = actor.getMotion()->getMaxFrame();
+	const uint32_t frame0 = frame - frame % frame_step;
+	const uint32_t frame1 = frame0 + frame_step < max_frame ? frame0 + frame_step : max_frame;
+	const float t = static_cast<float>(frame - frame0) / static_cast<float>(frame1 - frame0);
+
+	const auto track_count = actor.getMotion()->getTrackCount();
+	const VMDMotion::TrackPose * p_lod_poses[2];
+	const uint32_t lod_frames[2] = { frame0, frame1 % max_frame };
+	for(uint32_t i = 0; i < 2; ++i)
+	{
+		bool is_cached = false;
+		auto p_lod_pose = actor.getLODPose(lod_frames[i], lod_frames[1 - i], is_cached);
+		if(!is_cached)
+		{
+			const auto offset = findOrSamplePose(actor, lod_frames[i]);
+			std::copy(
+				mSharedTrackPoses.begin() + offset,
+				mSharedTrackPoses.begin() + offset + track_count,
+				p_lod_pose
+			);
+		}
+		p_lod_poses[i] = p_lod_pose;
+	}
+
+	mLODTrackPoses.resize(track_count);
+	for(uint32_t i = 0; i < track_count; ++i)
+	{
+		const auto & pose0 = p_lod_poses[0][i];
+		const auto & pose1 = p_lod_poses[1][i];
+		auto & pose = mLODTrackPoses[i];
+
+		pose = pose0;
+		if(pose0.isValid && pose1.isValid)
+		{
+			// 短い方の弧で線形補間して正規化する．区切りの間は短いのでslerpとの差は小さい
+			const auto is_far = DirectX::XMVectorLess(DirectX::XMQuaternionDot(pose0.rotation, pose1.rotation), DirectX::XMVectorZero());
+			const auto near_rotation1 = DirectX::XMVectorSelect(pose1.rotation, DirectX::XMVectorNegate(pose1.rotation), is_far);
+			pose.rotation = DirectX::XMQuaternionNormalize(DirectX::XMVectorLerp(pose0.rotation, near_rotation1, t));
+			pose.translation = DirectX::XMVectorLerp(pose0.translation, pose1.translation, t);
+		}
+	}
+
+	return mLODTrackPoses.data();
+}
+
 void PMDRenderer::draw(RendererDX12 & renderer)
 {
-	for(auto & p_actor : mpActors)
+	PROFILE_FUNCTION();
+
+	mOcclusionCuller.beginFrame(renderer.getViewProjection());
+
+	for(uint32_t i = 0; i < mpActors.size(); ++i)
+	{
+		mpActors[i]->rasterizeOccluder(mOcclusionCuller, i);
+	}
+
+	for(uint32_t i = 0; i < mpActors.size(); ++i)
+	{
+		mpActors[i]->draw(renderer, mOcclusionCuller, i);
+	}
+
+	if(++mFrameCount % OcclusionReportInterval == 0)
 	{
-		p_actor->draw(renderer);
+		const auto & statistics = mOcclusionCuller.getTotalStatistics();
+		const auto rejects = statistics.frustumRejectCount + statistics.occlusionRejectCount;
+
+		char message[256];
+		snprintf(
+			message,
+			sizeof(message),
+			"Occlusion : tests %llu, frustum rejects %llu, occlusion rejects %llu (%.1f%%)\n",
+			static_cast<unsigned long long>(statistics.testCount),
+			static_cast<unsigned long long>(statistics.frustumRejectCount),
+			static_cast<unsigned long long>(statistics.occlusionRejectCount),
+			statistics.testCount > 0 ? 100.0 * rejects / statistics.testCount : 0.0
+		);
+		OutputDebugStringA(message);
+
+		snprintf(
+			message,
+			sizeof(message),
+			"Animation : %u poses sampled for %u posed actors\n",
+			mSampleCount,
+			mPosedActorCount
+		);
+		OutputDebugStringA(message);
+
+		for(uint32_t i = 0; i < mAnimationLODPolicy.getLODCount(); ++i)
+		{
+			auto & lod_statistics = mAnimationLODStatistics[i];
+			snprintf(
+				message,
+				sizeof(message),
+				"Animation : LOD%u %6.1f actors/frame, %8.3f ms/frame\n",
+				i,
+				static_cast<double>(lod_statistics.actorCount) / OcclusionReportInterval,
+				lod_statistics.nanoseconds / 1000000.0 / OcclusionReportInterval
+			);
+			OutputDebugStringA(message);
+
+			lod_statistics = AnimationLODStatistics();
+		}
+
+		mSampleCount = 0;
+		mPosedActorCount = 0;
 	}
 }
 
@@ -49,11 +263,93 @@ PMDActor & PMDRenderer::addActor(const char * path_str, RendererDX12 & renderer)
 	return *mpActors.back();
 }
 
+void PMDRenderer::removeActor(const PMDActor & actor, RendererDX12 & renderer)
+{
+	renderer.cancelTextureRequests(&actor);
+
+	auto it = std::find_if(
+		mpActors.begin(),
+		mpActors.end(),
+		[&actor](const std::unique_ptr<PMDActor> & p_actor) { return p_actor.get() == &actor; }
+	);
+	if(it != mpActors.end())
+	{
+		mpActors.erase(it);
+	}
+}
+
+std::shared_ptr<const VMDMotion> PMDRenderer::loadMotion(const char * path_str)
+{
+	PROFILE_FUNCTION();
+
+	auto & p_motion = mMotions[path_str];
+	if(p_motion == nullptr)
+	{
+		asset_archive::Data file_data;
+		auto p_new_motion = std::make_shared<VMDMotion>();
+		if(
+			!mpFileReader->take(path_str, file_data) ||
+			!p_new_motion->load(file_data.pData, file_data.size)
+		)
+		{
+			mMotions.erase(path_str);
+			return nullptr;
+		}
+
+		p_motion = p_new_motion;
+	}
+
+	return p_motion;
+}
+
+std::shared_ptr<const BakedMotion> PMDRenderer::loadBakedMotion(const char * path_str)
+{
+	PROFILE_FUNCTION();
+
+	auto & p_baked_motion = mBakedMotions[path_str];
+	if(p_baked_motion == nullptr)
+	{
+		auto p_new_baked_motion = std::make_shared<BakedMotion>();
+		const bool is_baked = p_new_baked_motion->bake(loadMotion(path_str));
+
+		const auto & statistics = p_new_baked_motion->getStatistics();
+
+		char message[256];
+		snprintf(
+			message,
+			sizeof(message),
+			"BakedMotion : %s %u tracks, %u constant / %u linear / %u keyed channels, %u keys, %llu -> %llu bytes%s\n",
+			path_str,
+			statistics.trackCount,
+			statistics.constantChannelCount,
+			statistics.linearChannelCount,
+			statistics.keyedChannelCount,
+			statistics.keyCount,
+			static_cast<unsigned long long>(statistics.rawBytes),
+			static_cast<unsigned long long>(statistics.bakedBytes),
+			is_baked ? "" : ", not baked"
+		);
+		OutputDebugStringA(message);
+
+		if(!is_baked)
+		{
+			mBakedMotions.erase(path_str);
+			return nullptr;
+		}
+
+		p_baked_motion = p_new_baked_motion;
+	}
+
+	return p_baked_motion;
+}
+
 void PMDRenderer::startActorAnimation()
 {
+	mAnimationClock.reset();
+
 	for(auto & p_actor : mpActors)
 	{
-		p_actor->startAnimation();
+		p_actor->startAnimation(mAnimationClock);
 	}
 }
 
@@ -62,10 +358,12 @@ bool PMDRenderer::createRootSignature(RendererDX12 & renderer)
 	CD3DX12_DESCRIPTOR_RANGE descriptor_ranges[4];
 	descriptor_ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
 	descriptor_ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);
-	descriptor_ranges[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
-	descriptor_ranges[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 4, 0);
+	// テクスチャの組は同じパスのマテリアルで共有する
+	descriptor_ranges[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 0);
+	// トゥーンは全マテリアルで共有の配列なので，アクターごとに1回だけ設定する
+	descriptor_ranges[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 3);
 
-	CD3DX12_ROOT_PARAMETER root_parameters[3];
+	CD3DX12_ROOT_PARAMETER root_parameters[5];
 	root_parameters[0].InitAsDescriptorTable(
 		1,
 		&descriptor_ranges[0],
@@ -76,11 +374,22 @@ bool PMDRenderer::createRootSignature(RendererDX12 & renderer)
 		&descriptor_ranges[1],
 		D3D12_SHADER_VISIBILITY_VERTEX
 	);
-	root_parameters[2].InitAsDescriptorTable(
-		2,
+	// マテリアルの定数はルートCBVにして，記述子を使わない
+	root_parameters[2].InitAsConstantBufferView(
+		0,
+		0,
+		D3D12_SHADER_VISIBILITY_PIXEL
+	);
+	root_parameters[3].InitAsDescriptorTable(
+		1,
 		&descriptor_ranges[2],
 		D3D12_SHADER_VISIBILITY_PIXEL
 	);
+	root_parameters[4].InitAsDescriptorTable(
+		1,
+		&descriptor_ranges[3],
+		D3D12_SHADER_VISIBILITY_PIXEL
+	);
 
 	CD3DX12_STATIC_SAMPLER_DESC static_sampler_descs[2];
 	static_sampler_descs[0].Init(0);
@@ -272,13 +581,7 @@ bool PMDRenderer::createGraphicsPipelineState(RendererDX12 & renderer)
 	graphics_pipeline_state_desc.CachedPSO.CachedBlobSizeInBytes = 0;
 	graphics_pipeline_state_desc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
 
-	if(!renderer.createGraphicsPipelineState(
-		mpGraphicsPipelineState,
-		graphics_pipeline_state_desc
-	))
-	{
-		return false;
-	}
+	mGraphicsPipelineStateFuture = renderer.createGraphicsPipelineStateAsync(graphics_pipeline_state_desc);
 
 	return true;
 }
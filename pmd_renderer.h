@@ -2,34 +2,105 @@
 #ifndef PMD_RENDERER_H_INCLUDED
 #define PMD_RENDERER_H_INCLUDED
 
+#include <array>
 #include <vector>
+#include <filesystem>
+#include <future>
+#include <map>
 #include <memory>
 #include <d3d12.h>
 #include <wrl/client.h>
+#include "animation_clock.h"
+#include "animation_lod.h"
+#include "baked_motion.h"
 #include "pmd_actor.h"
+#include "occlusion_culler.h"
 
 class RendererDX12;
+class AsyncFileReader;
 
 class PMDRenderer
 {
 public:
 	bool initialize(RendererDX12 & renderer);
+	bool resolvePipelineState();
 	void setup(RendererDX12 & renderer);
-	void update();
+	void update(const RendererDX12 & renderer);
 	void draw(RendererDX12 & renderer);
 
 	[[nodiscard]]
 	PMDActor & addActor(const char * path_str, RendererDX12 & renderer);
 
+	// GPUが描画していないときに呼ぶ．テクスチャはキャッシュのtrimで解放される
+	// 読み込み中のテクスチャは，アクターに渡さずにキャッシュにだけ入る
+	void removeActor(const PMDActor & actor, RendererDX12 & renderer);
+
 	void startActorAnimation();
 
+	// 同じパスのモーションは一度だけ読み込む
+	std::shared_ptr<const VMDMotion> loadMotion(const char * path_str);
+
+	// 背景のアクター用に，読み込んだモーションを焼き込む．焼き込んでも小さくならなければnullptr
+	std::shared_ptr<const BakedMotion> loadBakedMotion(const char * path_str);
+
+	// モーションの時刻．固定ステップやスクリプトに切り替えると実行ごとに同じフレームを描く
+	AnimationClock & getAnimationClock() { return mAnimationClock; }
+
+	// 画面上の大きさで選ぶアニメーションのLOD．閾値を変えられる
+	AnimationLODPolicy & getAnimationLODPolicy() { return mAnimationLODPolicy; }
+
+	const OcclusionCuller & getOcclusionCuller() const { return mOcclusionCuller; }
+
 private:
 	bool createRootSignature(RendererDX12 & renderer);
 	bool createGraphicsPipelineState(RendererDX12 & renderer);
+
+	// 共有のポーズバッファでのオフセットを返す
+	uint32_t findOrSamplePose(const PMDActor & actor, uint32_t frame);
+
+	// 低いLODの区切りのポーズをアクターに覚えさせて，その間を補間したポーズを返す
+	const VMDMotion::TrackPose * interpolateLODPose(PMDActor & actor, uint32_t frame, uint32_t frame_step);
 private:
 	Microsoft::WRL::ComPtr<ID3D12RootSignature> mpRootSignature;
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> mpGraphicsPipelineState;
+	std::shared_future<Microsoft::WRL::ComPtr<ID3D12PipelineState>> mGraphicsPipelineStateFuture;
 	std::vector<std::unique_ptr<PMDActor>> mpActors;
+	AnimationClock mAnimationClock;
+
+	// 先読みしたモーションを受け取る
+	AsyncFileReader * mpFileReader = nullptr;
+	std::map<std::filesystem::path, std::shared_ptr<const VMDMotion>> mMotions;
+	std::map<std::filesystem::path, std::shared_ptr<const BakedMotion>> mBakedMotions;
+
+	// 同じモーションの同じフレームは一度だけ補間して，アクター間で共有する
+	struct SampledPose
+	{
+		const VMDMotion * pMotion;
+		const BakedMotion * pBakedMotion;
+		uint32_t frame;
+		uint32_t offset;
+	};
+	std::vector<SampledPose> mSampledPoses;
+	std::vector<VMDMotion::TrackPose> mSharedTrackPoses;
+
+	uint32_t mPosedActorCount = 0;
+	uint32_t mSampleCount = 0;
+
+	AnimationLODPolicy mAnimationLODPolicy;
+	std::vector<VMDMotion::TrackPose> mLODTrackPoses;
+
+	struct AnimationLODStatistics
+	{
+		uint32_t actorCount = 0;
+		uint64_t nanoseconds = 0;
+	};
+	std::array<AnimationLODStatistics, AnimationLODPolicy::MaxLODCount> mAnimationLODStatistics;
+
+	static constexpr uint32_t OcclusionBufferWidth = 320;
+	static constexpr uint32_t OcclusionBufferHeight = 180;
+	static constexpr uint32_t OcclusionReportInterval = 600;
+	OcclusionCuller mOcclusionCuller;
+	uint32_t mFrameCount = 0;
 };
 
 #endif // PMD_RENDERER_H_INCLUDED
@@ -0,0 +1,376 @@
+﻿#include "pmd_skeleton.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "pmd_file.h"
+#include "profiler.h"
+#include "vmd_motion.h"
+
+using namespace std;
+using namespace DirectX;
+
+static constexpr float epsilon = 0.0005f;
+
+// ボーン名はShift-JISなので，ソースの文字コードに依存しないようにバイト列で書く
+static constexpr const char * CenterBoneName = "\x83\x5a\x83\x93\x83\x5e\x81\x5b"; // センター
+static constexpr const char * KneeBoneName = "\x82\xd0\x82\xb4"; // ひざ
+
+bool PMDSkeleton::initialize(const pmd::File & file)
+{
+	const auto & pmd_bones = file.bones;
+
+	mBones.resize(pmd_bones.size());
+	for(uint32_t i = 0; i < pmd_bones.size(); ++i)
+	{
+		auto & pmd_bone = pmd_bones[i];
+		auto & bone = mBones[i];
+
+		bone.boneType = static_cast<BoneType>(pmd_bone.type);
+		bone.ikParentBone = 0;
+		bone.boneName = string(pmd_bone.boneName, strnlen(pmd_bone.boneName, sizeof(pmd_bone.boneName)));
+		bone.startPosition = pmd_bone.pos;
+
+		mNameToBoneIndex[bone.boneName] = i;
+	}
+
+	for(uint32_t i = 0; i < pmd_bones.size(); ++i)
+	{
+		auto & pmd_bone = pmd_bones[i];
+		if(pmd_bone.parentNo >= pmd_bones.size())
+		{
+			continue;
+		}
+
+		mBones[pmd_bone.parentNo].children.emplace_back(i);
+	}
+
+	// 末端からの高さ．子より親のインデックスが小さいとは限らないので，変化がなくなるまで繰り返す
+	mBoneHeights.assign(mBones.size(), 0);
+	for(bool is_changed = true; is_changed; )
+	{
+		is_changed = false;
+		for(uint32_t i = 0; i < mBones.size(); ++i)
+		{
+			for(const auto child : mBones[i].children)
+			{
+				if(mBoneHeights[i] < mBoneHeights[child] + 1)
+				{
+					mBoneHeights[i] = mBoneHeights[child] + 1;
+					is_changed = true;
+				}
+			}
+		}
+	}
+
+	auto it_center = mNameToBoneIndex.find(CenterBoneName);
+	mCenterBoneIndex = it_center != mNameToBoneIndex.end() ? it_center->second : 0;
+
+	mIKs.resize(file.iks.size());
+	for(size_t i = 0; i < file.iks.size(); ++i)
+	{
+		auto & src = file.iks[i];
+		auto & dst = mIKs[i];
+
+		dst.boneIndex = src.boneIndex;
+		dst.targetIndex = src.targetIndex;
+		dst.iterations = src.iterations;
+		dst.limit = src.limit;
+		dst.nodeIndices = src.nodeIndices;
+
+		mCCDBonePositions.reserve(max(mCCDBonePositions.capacity(), src.nodeIndices.size()));
+		mCCDMatrices.reserve(max(mCCDMatrices.capacity(), src.nodeIndices.size()));
+	}
+
+	mBoneMatrices.resize(mBones.size());
+	fill(mBoneMatrices.begin(), mBoneMatrices.end(), XMMatrixIdentity());
+
+	return true;
+}
+
+void PMDSkeleton::multiplyMatrixRecursively(
+	const uint32_t boneIndex,
+	const DirectX::XMMATRIX & parent_matrix,
+	uint32_t skipped_leaf_height
+)
+{
+	// 動かさない末端のボーンは掛けても親の行列のままなので，写すだけにする．その子も同じく写す
+	auto & local_matrix = mBoneMatrices[boneIndex];
+	if(mBoneHeights[boneIndex] < skipped_leaf_height)
+	{
+		local_matrix = parent_matrix;
+	}
+	else
+	{
+		local_matrix *= parent_matrix;
+	}
+
+	for(const auto child : mBones[boneIndex].children)
+	{
+		multiplyMatrixRecursively(child, local_matrix, skipped_leaf_height);
+	}
+}
+
+static XMMATRIX lookAt(const XMVECTOR & dir, const XMVECTOR & up, const XMVECTOR & right)
+{
+	XMVECTOR z = dir;
+	XMVECTOR y = XMVector3Normalize(up);
+	XMVECTOR x = XMVector3Normalize(XMVector3Cross(y, z));
+	y = XMVector3Cross(x, z);
+
+	if(abs(XMVectorGetX(XMVector3Dot(y, z))) == 1.0f)
+	{
+		x = XMVector3Normalize(right);
+		y = XMVector3Normalize(XMVector3Cross(z, x));
+		x = XMVector3Cross(y, z);
+	}
+
+	XMMATRIX result = XMMatrixIdentity();
+	result.r[0] = x;
+	result.r[1] = y;
+	result.r[2] = z;
+
+	return result;
+}
+
+static XMMATRIX lookAt(const XMVECTOR & eye, const XMVECTOR & at, const XMVECTOR & up, const XMVECTOR & right)
+{
+	return XMMatrixTranspose(lookAt(eye, up, right)) * lookAt(at, up, right);
+}
+
+void PMDSkeleton::solveLookAt(const IK & ik)
+{
+	auto & root_bone = mBones[ik.nodeIndices[0]];
+	auto & target_bone = mBones[ik.targetIndex];
+
+	auto opos1 = XMLoadFloat3(&root_bone.startPosition);
+	auto tpos1 = XMLoadFloat3(&target_bone.startPosition);
+
+	auto opos2 = XMVector3Transform(opos1, mBoneMatrices[ik.nodeIndices[0]]);
+	auto tpos2 = XMVector3Transform(tpos1, mBoneMatrices[ik.boneIndex]);
+
+	auto originVec = XMVector3Normalize(tpos1 - opos1);
+	auto targetVec = XMVector3Normalize(tpos2 - opos2);
+
+	mBoneMatrices[ik.nodeIndices[0]] =
+		XMMatrixTranslationFromVector(-opos2) *
+		lookAt(originVec, targetVec, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f)) *
+		XMMatrixTranslationFromVector(opos2);
+}
+
+void PMDSkeleton::solveCosineIK(const IK & ik)
+{
+	auto & ik_bone = mBones[ik.boneIndex];
+	auto ik_position = XMVector3Transform(XMLoadFloat3(&ik_bone.startPosition), mBoneMatrices[ik.boneIndex]);
+
+	auto & target_bone = mBones[ik.targetIndex];
+	XMVECTOR positions[]
+	{
+		XMLoadFloat3(&mBones[ik.nodeIndices[1]].startPosition),
+		XMLoadFloat3(&mBones[ik.nodeIndices[0]].startPosition),
+		XMLoadFloat3(&target_bone.startPosition),
+	};
+
+	float edge_lengths[]
+	{
+		XMVectorGetX(XMVector3Length(positions[1] - positions[0])),
+		XMVectorGetX(XMVector3Length(positions[2] - positions[1])),
+	};
+
+	positions[0] = XMVector3Transform(positions[0], mBoneMatrices[ik.nodeIndices[1]]);
+	positions[2] = XMVector3Transform(positions[2], mBoneMatrices[ik.boneIndex]);
+
+	auto linearVec = positions[2] - positions[0];
+	float A = XMVectorGetX(XMVector3Length(linearVec));
+	float B = edge_lengths[0];
+	float C = edge_lengths[1];
+
+	linearVec = XMVector3Normalize(linearVec);
+
+	float theta1 = acos((A * A + B * B - C * C) / (2.0f * A * B));
+	float theta2 = acos((B * B + C * C - A * A) / (2.0f * B * C));
+
+	XMVECTOR axis;
+	if(mBones[ik.nodeIndices[0]].boneName.find(KneeBoneName) != string::npos)
+	{
+		axis = XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+	}
+	else
+	{
+		auto vm = XMVector3Normalize(positions[2] - positions[0]);
+		auto vt = XMVector3Normalize(ik_position - positions[0]);
+		axis = XMVector3Cross(vt, vm);
+	}
+
+	auto r0 =
+		XMMatrixTranslationFromVector(-positions[0]) *
+		XMMatrixRotationAxis(axis, theta1) *
+		XMMatrixTranslationFromVector(positions[0]);
+
+	auto r1 =
+		XMMatrixTranslationFromVector(-positions[1]) *
+		XMMatrixRotationAxis(axis, theta2 - XM_PI) *
+		XMMatrixTranslationFromVector(positions[1]);
+
+	mBoneMatrices[ik.nodeIndices[1]] *= r0;
+	mBoneMatrices[ik.nodeIndices[0]] = r1 * mBoneMatrices[ik.nodeIndices[1]];
+	mBoneMatrices[ik.targetIndex] = mBoneMatrices[ik.nodeIndices[0]];
+}
+
+void PMDSkeleton::solveCCDIK(const IK & ik)
+{
+	auto & ik_bone = mBones[ik.boneIndex];
+	auto ik_position = XMLoadFloat3(&ik_bone.startPosition);
+
+	auto & parent_matrix = mBoneMatrices[ik_bone.ikParentBone];
+	XMVECTOR determinant;
+	auto inverse_parent_matrix = XMMatrixInverse(&determinant, parent_matrix);
+	auto target_next_position = XMVector3Transform(ik_position, mBoneMatrices[ik.boneIndex] * inverse_parent_matrix);
+
+	// 毎フレーム確保しないよう，作業用の配列は使い回す
+	auto & bone_positions = mCCDBonePositions;
+	auto & matrices = mCCDMatrices;
+	bone_positions.clear();
+	matrices.clear();
+
+	auto target_position = XMLoadFloat3(&mBones[ik.targetIndex].startPosition);
+	for(auto node_index : ik.nodeIndices)
+	{
+		bone_positions.push_back(XMLoadFloat3(&mBones[node_index].startPosition));
+		matrices.push_back(XMMatrixIdentity());
+	}
+
+	auto ik_limit = ik.limit * XM_PI;
+	for(auto c = 0; c < ik.iterations; ++c)
+	{
+		if(XMVectorGetX(XMVector3Length(target_position - target_next_position)) <= epsilon)
+		{
+			break;
+		}
+
+		for(size_t bone_index = 0; bone_index < bone_positions.size(); ++bone_index)
+		{
+			const auto & position = bone_positions[bone_index];
+			auto vec_to_target = XMVector3Normalize(target_position - position);
+			auto vec_to_next_target = XMVector3Normalize(target_next_position - position);
+
+			if(XMVectorGetX(XMVector3Length(vec_to_target - vec_to_next_target)) <= epsilon)
+			{
+				continue;
+			}
+
+			auto cross = XMVector3Normalize(XMVector3Cross(vec_to_target, vec_to_next_target));
+			float angle = min(XMVectorGetX(XMVector3AngleBetweenVectors(vec_to_target, vec_to_next_target)), ik_limit);
+			XMMATRIX m =
+				XMMatrixTranslationFromVector(-position) *
+				XMMatrixRotationAxis(cross, angle) *
+				XMMatrixTranslationFromVector(position);
+
+			matrices[bone_index] *= m;
+
+			for(size_t index = 0; index < bone_index; ++index)
+			{
+				bone_positions[index] = XMVector3Transform(bone_positions[index], m);
+			}
+
+			target_position = XMVector3Transform(target_position, m);
+			if(XMVectorGetX(XMVector3Length(target_position - target_next_position)) <= epsilon)
+			{
+				break;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < matrices.size(); ++i)
+	{
+		mBoneMatrices[ik.nodeIndices[i]] = matrices[i];
+	}
+
+	multiplyMatrixRecursively(ik.nodeIndices.back(), parent_matrix);
+}
+
+void PMDSkeleton::solveIK()
+{
+	PROFILE_FUNCTION();
+
+	for(const auto & ik : mIKs)
+	{
+		switch(ik.nodeIndices.size())
+		{
+		case 0:
+			continue;
+		case 1:
+			solveLookAt(ik);
+			break;
+		case 2:
+			solveCosineIK(ik);
+			break;
+		default:
+			solveCCDIK(ik);
+			break;
+		}
+	}
+}
+
+void PMDSkeleton::bindMotion(const VMDMotion & motion)
+{
+	mpBoundMotion = &motion;
+
+	auto & tracks = motion.getTracks();
+	mTrackBoneIndices.resize(tracks.size());
+	for(size_t i = 0; i < tracks.size(); ++i)
+	{
+		auto it_bone = mNameToBoneIndex.find(tracks[i].boneName);
+		mTrackBoneIndices[i] = it_bone != mNameToBoneIndex.end() ? static_cast<int32_t>(it_bone->second) : -1;
+	}
+
+	mTrackPoses.resize(tracks.size());
+}
+
+void PMDSkeleton::update(const VMDMotion & motion, uint32_t frame)
+{
+	PROFILE_FUNCTION();
+
+	if(mpBoundMotion != &motion)
+	{
+		bindMotion(motion);
+	}
+
+	motion.sample(frame, mTrackPoses.data());
+	applyPose(motion, mTrackPoses.data());
+}
+
+void PMDSkeleton::applyPose(
+	const VMDMotion & motion,
+	const VMDMotion::TrackPose * p_poses,
+	uint32_t skipped_leaf_height
+)
+{
+	PROFILE_FUNCTION();
+
+	if(mpBoundMotion != &motion)
+	{
+		bindMotion(motion);
+	}
+
+	fill(mBoneMatrices.begin(), mBoneMatrices.end(), XMMatrixIdentity());
+
+	for(size_t i = 0; i < mTrackBoneIndices.size(); ++i)
+	{
+		auto bone_index = mTrackBoneIndices[i];
+		auto & pose = p_poses[i];
+		if(bone_index < 0 || !pose.isValid || mBoneHeights[bone_index] < skipped_leaf_height)
+		{
+			continue;
+		}
+
+		auto & bone_position = mBones[bone_index].startPosition;
+
+		mBoneMatrices[bone_index] =
+			XMMatrixTranslation(-bone_position.x, -bone_position.y, -bone_position.z) *
+			XMMatrixRotationQuaternion(pose.rotation) *
+			XMMatrixTranslation(bone_position.x, bone_position.y, bone_position.z) *
+			XMMatrixTranslationFromVector(pose.translation);
+	}
+
+	multiplyMatrixRecursively(mCenterBoneIndex, XMMatrixIdentity(), skipped_leaf_height);
+}
@@ -0,0 +1,94 @@
+﻿#pragma once
+#ifndef PMD_SKELETON_H_INCLUDED
+#define PMD_SKELETON_H_INCLUDED
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+#include "vmd_motion.h"
+
+namespace pmd
+{
+	struct File;
+}
+
+// PMDのボーン階層とIK．モーションからボーン行列を求める
+class PMDSkeleton
+{
+public:
+	bool initialize(const pmd::File & file);
+
+	// frameのポーズを求めて，親の行列を掛けたボーン行列にする
+	void update(const VMDMotion & motion, uint32_t frame);
+
+	// motion.sampleで求めたポーズからボーン行列を求める．同じポーズを複数のスケルトンで共有できる
+	// 末端からの高さがskipped_leaf_height未満のボーンは動かさず，親のボーン行列をそのまま使う
+	void applyPose(
+		const VMDMotion & motion,
+		const VMDMotion::TrackPose * p_poses,
+		uint32_t skipped_leaf_height = 0
+	);
+	void solveIK();
+
+	uint32_t getBoneCount() const { return static_cast<uint32_t>(mBones.size()); }
+	const std::vector<DirectX::XMMATRIX> & getBoneMatrices() const { return mBoneMatrices; }
+
+private:
+	void bindMotion(const VMDMotion & motion);
+	void multiplyMatrixRecursively(const uint32_t boneIndex, const DirectX::XMMATRIX & parent_matrix, uint32_t skipped_leaf_height = 0);
+
+	struct IK;
+	void solveLookAt(const IK & ik);
+	void solveCosineIK(const IK & ik);
+	void solveCCDIK(const IK & ik);
+
+private:
+	enum class BoneType : uint32_t
+	{
+		Rotation,
+		RotAndMove,
+		IK,
+		Undefined,
+		IKChild,
+		RotationChild,
+		IKDestination,
+		Invisible,
+	};
+
+	struct BoneNode
+	{
+		BoneType boneType;
+		int32_t ikParentBone;
+		DirectX::XMFLOAT3 startPosition;
+		std::string boneName;
+		std::vector<uint32_t> children;
+	};
+	std::vector<BoneNode> mBones;
+	std::vector<uint32_t> mBoneHeights;
+	std::map<std::string, uint32_t> mNameToBoneIndex;
+	uint32_t mCenterBoneIndex = 0;
+
+	struct IK
+	{
+		uint16_t boneIndex;
+		uint16_t targetIndex;
+		uint16_t iterations;
+		float limit;
+		std::vector<uint16_t> nodeIndices;
+	};
+	std::vector<IK> mIKs;
+
+	std::vector<DirectX::XMMATRIX> mBoneMatrices;
+
+	// トラックからボーンへの対応．モーションが変わったときだけ作り直す
+	const VMDMotion * mpBoundMotion = nullptr;
+	std::vector<int32_t> mTrackBoneIndices;
+	std::vector<VMDMotion::TrackPose> mTrackPoses;
+
+	std::vector<DirectX::XMVECTOR> mCCDBonePositions;
+	std::vector<DirectX::XMMATRIX> mCCDMatrices;
+};
+
+#endif // PMD_SKELETON_H_INCLUDED
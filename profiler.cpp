@@ -0,0 +1,295 @@
+﻿#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+namespace
+{
+	struct Event
+	{
+		const char * name;
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	// 読み手が書き込み中の区画を読んでも未定義にならないよう，中身もアトミックにする
+	struct EventSlot
+	{
+		atomic<const char *> name;
+		atomic<uint64_t> begin;
+		atomic<uint64_t> end;
+	};
+
+	// 書き込むのは持ち主のスレッドだけなので，ロックなしで記録できる．
+	// writeCountより前の区画だけが書き終わっていて，読み手はそこまでを読む
+	struct ThreadBuffer
+	{
+		static constexpr uint64_t Capacity = 1 << 16;
+
+		unique_ptr<EventSlot[]> events { new EventSlot[Capacity] };
+		atomic<uint64_t> writeCount { 0 };
+		uint64_t summaryCount = 0;
+		uint32_t threadId = 0;
+		string name;
+	};
+
+	struct ZoneAccumulator
+	{
+		const char * name;
+		uint64_t frameNanoseconds;
+		uint64_t totalNanoseconds;
+		uint64_t maxNanoseconds;
+		uint64_t callCount;
+	};
+
+	const chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+
+	// スレッドのバッファは終了後も書き出せるように残しておく
+	mutex threadBufferMutex;
+	vector<unique_ptr<ThreadBuffer>> threadBuffers;
+
+	thread_local ThreadBuffer * pThreadBuffer = nullptr;
+
+	mutex summaryMutex;
+	vector<ZoneAccumulator> zoneAccumulators;
+	vector<profiler::ZoneSummary> frameSummary;
+	uint32_t summaryFrame = 0;
+
+	// 計測中のフレームの始まり．最初のbeginFrameかendFrameまでは無い
+	constexpr uint64_t InvalidTime = UINT64_MAX;
+	uint64_t frameBegin = InvalidTime;
+
+	ThreadBuffer & getThreadBuffer()
+	{
+		if(pThreadBuffer == nullptr)
+		{
+			lock_guard<mutex> lock(threadBufferMutex);
+			threadBuffers.emplace_back(new ThreadBuffer);
+			pThreadBuffer = threadBuffers.back().get();
+			pThreadBuffer->threadId = static_cast<uint32_t>(threadBuffers.size());
+		}
+
+		return *pThreadBuffer;
+	}
+
+	// 読んでいる間に上書きされにくいよう，容量の半分より古いものは読まない
+	uint64_t getReadableBegin(uint64_t read_count, uint64_t write_count)
+	{
+		constexpr uint64_t readable = ThreadBuffer::Capacity / 2;
+
+		return write_count > readable ? max(read_count, write_count - readable) : read_count;
+	}
+
+	// indexはwriteCountをacquireで読んだ値より前のもの．
+	// 読んでいる間に書き手が一周して同じ区画を書き始めていたらfalse
+	bool readEvent(const ThreadBuffer & buffer, uint64_t index, Event & event)
+	{
+		auto & slot = buffer.events[index & (ThreadBuffer::Capacity - 1)];
+		event.name = slot.name.load(memory_order_relaxed);
+		event.begin = slot.begin.load(memory_order_relaxed);
+		event.end = slot.end.load(memory_order_relaxed);
+
+		atomic_thread_fence(memory_order_acquire);
+
+		return buffer.writeCount.load(memory_order_relaxed) < index + ThreadBuffer::Capacity;
+	}
+
+	ZoneAccumulator & findAccumulator(const char * name)
+	{
+		for(auto & accumulator : zoneAccumulators)
+		{
+			if(accumulator.name == name || strcmp(accumulator.name, name) == 0)
+			{
+				return accumulator;
+			}
+		}
+
+		zoneAccumulators.push_back({ name, 0, 0, 0, 0 });
+
+		return zoneAccumulators.back();
+	}
+
+	void writeJsonString(ofstream & fout, const char * str)
+	{
+		fout << '"';
+		for(; *str != '\0'; ++str)
+		{
+			if(*str == '"' || *str == '\\')
+			{
+				fout << '\\';
+			}
+			fout << *str;
+		}
+		fout << '"';
+	}
+}
+
+uint64_t profiler::now()
+{
+	return static_cast<uint64_t>(
+		chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - startTime).count()
+	);
+}
+
+void profiler::recordZone(const char * name, uint64_t begin, uint64_t end)
+{
+	auto & buffer = getThreadBuffer();
+
+	auto count = buffer.writeCount.load(memory_order_relaxed);
+
+	// 前回のwriteCountの更新より後に区画を書いたことを，readEventの読み手から見えるようにする
+	atomic_thread_fence(memory_order_release);
+
+	auto & slot = buffer.events[count & (ThreadBuffer::Capacity - 1)];
+	slot.name.store(name, memory_order_relaxed);
+	slot.begin.store(begin, memory_order_relaxed);
+	slot.end.store(end, memory_order_relaxed);
+	buffer.writeCount.store(count + 1, memory_order_release);
+}
+
+void profiler::setThreadName(const char * name)
+{
+	auto & buffer = getThreadBuffer();
+
+	lock_guard<mutex> lock(threadBufferMutex);
+	buffer.name = name;
+}
+
+void profiler::beginFrame()
+{
+	frameBegin = now();
+}
+
+void profiler::endFrame()
+{
+	// beginFrameを呼ばなければ，前のフレームの終わりから次のフレームが始まる
+	auto frame_end = now();
+	if(frameBegin != InvalidTime)
+	{
+		recordZone("Frame", frameBegin, frame_end);
+	}
+	frameBegin = frame_end;
+
+	lock_guard<mutex> summary_lock(summaryMutex);
+	{
+		lock_guard<mutex> lock(threadBufferMutex);
+		for(auto & p_buffer : threadBuffers)
+		{
+			auto write_count = p_buffer->writeCount.load(memory_order_acquire);
+			for(auto i = getReadableBegin(p_buffer->summaryCount, write_count); i < write_count; ++i)
+			{
+				Event event;
+				if(!readEvent(*p_buffer, i, event))
+				{
+					continue;
+				}
+
+				auto & accumulator = findAccumulator(event.name);
+				accumulator.frameNanoseconds += event.end - event.begin;
+				++accumulator.callCount;
+			}
+			p_buffer->summaryCount = write_count;
+		}
+	}
+
+	for(auto & accumulator : zoneAccumulators)
+	{
+		accumulator.totalNanoseconds += accumulator.frameNanoseconds;
+		accumulator.maxNanoseconds = max(accumulator.maxNanoseconds, accumulator.frameNanoseconds);
+		accumulator.frameNanoseconds = 0;
+	}
+
+	if(++summaryFrame < SummaryFrameCount)
+	{
+		return;
+	}
+
+	frameSummary.clear();
+	for(auto & accumulator : zoneAccumulators)
+	{
+		frameSummary.push_back({
+			accumulator.name,
+			accumulator.totalNanoseconds / 1000000.0 / summaryFrame,
+			accumulator.maxNanoseconds / 1000000.0,
+			static_cast<double>(accumulator.callCount) / summaryFrame
+		});
+
+		accumulator.totalNanoseconds = 0;
+		accumulator.maxNanoseconds = 0;
+		accumulator.callCount = 0;
+	}
+	summaryFrame = 0;
+
+	sort(
+		frameSummary.begin(),
+		frameSummary.end(),
+		[](const ZoneSummary & lhs, const ZoneSummary & rhs)
+		{
+			return lhs.averageMilliseconds > rhs.averageMilliseconds;
+		}
+	);
+}
+
+std::vector<profiler::ZoneSummary> profiler::getFrameSummary()
+{
+	lock_guard<mutex> lock(summaryMutex);
+
+	return frameSummary;
+}
+
+bool profiler::writeChromeTrace(const std::filesystem::path & path)
+{
+	ofstream fout(path);
+	if(!fout)
+	{
+		return false;
+	}
+
+	fout << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	fout.setf(ios::fixed);
+	fout.precision(3);
+
+	lock_guard<mutex> lock(threadBufferMutex);
+
+	bool first = true;
+	for(auto & p_buffer : threadBuffers)
+	{
+		if(!p_buffer->name.empty())
+		{
+			fout << (first ? "" : ",\n");
+			fout << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << p_buffer->threadId << ",\"args\":{\"name\":";
+			writeJsonString(fout, p_buffer->name.c_str());
+			fout << "}}";
+			first = false;
+		}
+
+		auto write_count = p_buffer->writeCount.load(memory_order_acquire);
+		for(auto i = getReadableBegin(0, write_count); i < write_count; ++i)
+		{
+			Event event;
+			if(!readEvent(*p_buffer, i, event))
+			{
+				continue;
+			}
+
+			fout << (first ? "" : ",\n");
+			fout << "{\"ph\":\"X\",\"name\":";
+			writeJsonString(fout, event.name);
+			fout << ",\"pid\":1,\"tid\":" << p_buffer->threadId;
+			fout << ",\"ts\":" << event.begin / 1000.0;
+			fout << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+			first = false;
+		}
+	}
+
+	fout << "\n]}\n";
+
+	return static_cast<bool>(fout);
+}
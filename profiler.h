@@ -0,0 +1,72 @@
+﻿#pragma once
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// スコープ単位の区間計測
+// ENABLE_PROFILERを定義しないときはマクロが空になり，計測のコストは残らない
+namespace profiler
+{
+	struct ZoneSummary
+	{
+		const char * name;
+		double averageMilliseconds;
+		double maxMilliseconds;
+		double callsPerFrame;
+	};
+
+	// プロセス開始からのナノ秒
+	uint64_t now();
+
+	// nameは文字列リテラルなど，プロセスの終了まで有効なもの
+	void recordZone(const char * name, uint64_t begin, uint64_t end);
+	void setThreadName(const char * name);
+
+	// 直近SummaryFrameCountフレームの区間ごとの平均を更新する．
+	// "Frame"の区間はbeginFrameか前回のendFrameから始まり，最初のendFrameだけでは記録しない
+	static constexpr uint32_t SummaryFrameCount = 120;
+	void beginFrame();
+	void endFrame();
+	std::vector<ZoneSummary> getFrameSummary();
+
+	// Chrome (chrome://tracing) やPerfettoで読めるJSONを書き出す
+	bool writeChromeTrace(const std::filesystem::path & path);
+
+	class Scope
+	{
+	public:
+		explicit Scope(const char * name) : mName(name), mBegin(now()) {}
+		~Scope() { recordZone(mName, mBegin, now()); }
+
+		Scope(const Scope &) = delete;
+		Scope & operator=(const Scope &) = delete;
+
+	private:
+		const char * mName;
+		uint64_t mBegin;
+	};
+}
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#ifdef ENABLE_PROFILER
+#define PROFILE_SCOPE(name) profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#define PROFILE_THREAD_NAME(name) profiler::setThreadName(name)
+#define PROFILE_BEGIN_FRAME() profiler::beginFrame()
+#define PROFILE_END_FRAME() profiler::endFrame()
+#define PROFILE_WRITE_TRACE(path) profiler::writeChromeTrace(path)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_THREAD_NAME(name)
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_END_FRAME()
+#define PROFILE_WRITE_TRACE(path)
+#endif
+
+#endif // PROFILER_H_INCLUDED
@@ -0,0 +1,138 @@
+﻿#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#include "profiler.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	constexpr uint64_t worker_duration = 1000;
+
+	const profiler::ZoneSummary * findZone(const vector<profiler::ZoneSummary> & summary, const char * name)
+	{
+		for(auto & zone : summary)
+		{
+			if(strcmp(zone.name, name) == 0)
+			{
+				return &zone;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// 起動から最初のbeginFrameまでの時間は"Frame"に含めない
+	void testFirstFrame()
+	{
+		this_thread::sleep_for(chrono::milliseconds(100));
+
+		profiler::beginFrame();
+		for(uint32_t frame = 0; frame < profiler::SummaryFrameCount; ++frame)
+		{
+			profiler::Scope scope("Update");
+			profiler::endFrame();
+		}
+
+		auto summary = profiler::getFrameSummary();
+		auto p_frame = findZone(summary, "Frame");
+		expect(p_frame != nullptr, "no Frame zone was recorded.");
+		expect(p_frame != nullptr && p_frame->maxMilliseconds < 50.0, "the first Frame zone includes the time before beginFrame.");
+		expect(p_frame != nullptr && abs(p_frame->callsPerFrame - 1.0) < 1.0e-9, "Frame was not recorded once per frame.");
+	}
+
+	// 他のスレッドが一周以上書き込む間に集計と書き出しをしても，壊れたイベントを読まない
+	void testConcurrentWriters()
+	{
+		atomic<bool> running { true };
+		atomic<uint64_t> written_count { 0 };
+
+		vector<thread> workers;
+		for(uint32_t i = 0; i < 3; ++i)
+		{
+			workers.emplace_back(
+				[&running, &written_count]()
+				{
+					profiler::setThreadName("Worker");
+
+					// 区間の長さは常にworker_durationなので，始まりと終わりが別のイベントのものなら分かる
+					uint64_t count = 0;
+					for(uint64_t begin = 0; running.load(memory_order_relaxed); begin += 7)
+					{
+						profiler::recordZone("Worker", begin, begin + worker_duration);
+						++count;
+					}
+
+					written_count += count;
+				}
+			);
+		}
+
+		const auto trace_path = filesystem::temp_directory_path() / "profiler_test.json";
+		for(uint32_t frame = 0; frame < profiler::SummaryFrameCount; ++frame)
+		{
+			profiler::endFrame();
+
+			if(frame % 40 == 0)
+			{
+				expect(profiler::writeChromeTrace(trace_path), "failed to write the trace.");
+			}
+		}
+
+		running = false;
+		for(auto & worker : workers)
+		{
+			worker.join();
+		}
+
+		auto summary = profiler::getFrameSummary();
+		auto p_worker = findZone(summary, "Worker");
+		expect(p_worker != nullptr && p_worker->callsPerFrame > 0.0, "no Worker zone was summarized.");
+		if(p_worker != nullptr && p_worker->callsPerFrame > 0.0)
+		{
+			const double nanoseconds_per_call = p_worker->averageMilliseconds * 1000000.0 / p_worker->callsPerFrame;
+			expect(abs(nanoseconds_per_call - worker_duration) < 1.0e-3, "a torn event was summarized.");
+		}
+
+		printf("%llu events written by workers\n", static_cast<unsigned long long>(written_count.load()));
+
+		error_code ec;
+		filesystem::remove(trace_path, ec);
+	}
+}
+
+// profiler_test
+// 最初のフレームの区間と，書き込み中のスレッドのバッファを読む集計を確かめる
+int main()
+{
+	profiler::setThreadName("Main");
+
+	testFirstFrame();
+	testConcurrentWriters();
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
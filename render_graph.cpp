@@ -0,0 +1,403 @@
+﻿#include "render_graph.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+	// D3D12_RESOURCE_STATE_GENERIC_READに含まれる読み込み専用の状態
+	constexpr uint32_t ReadOnlyStateMask =
+		0x1 | 0x2 | 0x20 | 0x40 | 0x80 | 0x200 | 0x800;
+}
+
+RenderGraph::ResourceHandle RenderGraph::importResource(const char * name, uint32_t initial_state, uint32_t final_state)
+{
+	Resource resource;
+	resource.name = name;
+	resource.imported = true;
+	resource.initialState = initial_state;
+	resource.finalState = final_state;
+	mResources.emplace_back(move(resource));
+
+	return static_cast<ResourceHandle>(mResources.size() - 1);
+}
+
+RenderGraph::ResourceHandle RenderGraph::createTexture(const char * name, const TextureDesc & desc)
+{
+	Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	mResources.emplace_back(move(resource));
+
+	return static_cast<ResourceHandle>(mResources.size() - 1);
+}
+
+RenderGraph::PassHandle RenderGraph::addPass(const char * name, std::function<void()> execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = move(execute);
+	mPasses.emplace_back(move(pass));
+
+	return static_cast<PassHandle>(mPasses.size() - 1);
+}
+
+void RenderGraph::read(PassHandle pass, ResourceHandle resource, uint32_t state)
+{
+	mPasses[pass].accesses.push_back({ resource, state, false });
+}
+
+void RenderGraph::write(PassHandle pass, ResourceHandle resource, uint32_t state)
+{
+	mPasses[pass].accesses.push_back({ resource, state, true });
+}
+
+bool RenderGraph::compile()
+{
+	if(!validatePasses())
+	{
+		return false;
+	}
+
+	cullPasses();
+	computeLifetimes();
+
+	// 一時リソースは書き込みから始まらなければ内容が不定になる
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mExecutionOrder.size()); ++i)
+	{
+		for(auto & access : mPasses[mExecutionOrder[i]].accesses)
+		{
+			auto & resource = mResources[access.resource];
+			if(!resource.imported && resource.firstUse == i && !access.write)
+			{
+				return false;
+			}
+		}
+	}
+
+	assignPhysicalResources();
+	buildBarriers();
+
+	mStatistics.passCount = static_cast<uint32_t>(mPasses.size());
+	mStatistics.culledPassCount = static_cast<uint32_t>(mPasses.size() - mExecutionOrder.size());
+	mStatistics.resourceCount = static_cast<uint32_t>(mResources.size());
+	mStatistics.physicalResourceCount = static_cast<uint32_t>(mPhysicalResources.size());
+	mStatistics.barrierCount = static_cast<uint32_t>(mBarriers.size());
+
+	return true;
+}
+
+void RenderGraph::execute(const SubmitBarriers & submit_barriers) const
+{
+	for(auto & pass_handle : mExecutionOrder)
+	{
+		auto & pass = mPasses[pass_handle];
+		if(pass.barrierCount > 0)
+		{
+			submit_barriers(&mBarriers[pass.barrierOffset], pass.barrierCount);
+		}
+
+		if(pass.execute)
+		{
+			pass.execute();
+		}
+	}
+
+	if(mFinalBarrierCount > 0)
+	{
+		submit_barriers(&mBarriers[mFinalBarrierOffset], mFinalBarrierCount);
+	}
+}
+
+void RenderGraph::clear()
+{
+	mPasses.clear();
+	mResources.clear();
+	mPhysicalResources.clear();
+	mExecutionOrder.clear();
+	mBarriers.clear();
+	mFinalBarrierOffset = 0;
+	mFinalBarrierCount = 0;
+	mMaxBarrierBatchSize = 0;
+	mStatistics = Statistics();
+}
+
+bool RenderGraph::validatePasses() const
+{
+	for(auto & pass : mPasses)
+	{
+		for(auto & access : pass.accesses)
+		{
+			if(access.resource >= mResources.size())
+			{
+				return false;
+			}
+
+			// 同じパスで書き込むリソースを別の状態で使うことはできない
+			for(auto & other : pass.accesses)
+			{
+				if(other.resource == access.resource && (access.write || other.write) && other.state != access.state)
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+void RenderGraph::cullPasses()
+{
+	// 後ろから辿り，外部リソースか後で読まれるリソースに書き込むパスだけを残す
+	vector<bool> required(mResources.size(), false);
+	for(auto it = mPasses.rbegin(); it != mPasses.rend(); ++it)
+	{
+		auto & pass = *it;
+
+		bool has_write = false;
+		bool needed = false;
+		for(auto & access : pass.accesses)
+		{
+			if(access.write)
+			{
+				has_write = true;
+				needed = needed || mResources[access.resource].imported || required[access.resource];
+			}
+		}
+
+		// 書き込みのないパスは副作用のために残す
+		pass.culled = has_write && !needed;
+		if(pass.culled)
+		{
+			continue;
+		}
+
+		for(auto & access : pass.accesses)
+		{
+			if(!access.write)
+			{
+				required[access.resource] = true;
+			}
+		}
+	}
+
+	// 宣言順は依存関係を満たしているので，そのまま実行順にする
+	mExecutionOrder.clear();
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mPasses.size()); ++i)
+	{
+		if(!mPasses[i].culled)
+		{
+			mExecutionOrder.push_back(i);
+		}
+	}
+}
+
+void RenderGraph::computeLifetimes()
+{
+	for(auto & resource : mResources)
+	{
+		resource.firstUse = InvalidIndex;
+		resource.lastUse = InvalidIndex;
+	}
+
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mExecutionOrder.size()); ++i)
+	{
+		for(auto & access : mPasses[mExecutionOrder[i]].accesses)
+		{
+			auto & resource = mResources[access.resource];
+			if(resource.firstUse == InvalidIndex)
+			{
+				resource.firstUse = i;
+			}
+			resource.lastUse = i;
+		}
+	}
+}
+
+void RenderGraph::assignPhysicalResources()
+{
+	mPhysicalResources.clear();
+
+	vector<ResourceHandle> transients;
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mResources.size()); ++i)
+	{
+		auto & resource = mResources[i];
+		resource.physicalIndex = InvalidIndex;
+
+		if(resource.imported)
+		{
+			PhysicalResource physical;
+			physical.imported = true;
+			physical.initialState = resource.initialState;
+			resource.physicalIndex = static_cast<uint32_t>(mPhysicalResources.size());
+			mPhysicalResources.push_back(physical);
+		}
+		else if(resource.firstUse != InvalidIndex)
+		{
+			transients.push_back(i);
+		}
+	}
+
+	// 使い始めの順に，寿命の重ならない同じ内容の物理リソースを再利用する
+	stable_sort(
+		transients.begin(),
+		transients.end(),
+		[this](ResourceHandle lhs, ResourceHandle rhs)
+		{
+			return mResources[lhs].firstUse < mResources[rhs].firstUse;
+		}
+	);
+
+	for(auto & handle : transients)
+	{
+		auto & resource = mResources[handle];
+
+		for(uint32_t i = 0; i < static_cast<uint32_t>(mPhysicalResources.size()); ++i)
+		{
+			auto & physical = mPhysicalResources[i];
+			if(!physical.imported && physical.desc == resource.desc && physical.lastUse < resource.firstUse)
+			{
+				resource.physicalIndex = i;
+				physical.lastUse = resource.lastUse;
+				break;
+			}
+		}
+
+		if(resource.physicalIndex == InvalidIndex)
+		{
+			PhysicalResource physical;
+			physical.desc = resource.desc;
+			physical.lastUse = resource.lastUse;
+			resource.physicalIndex = static_cast<uint32_t>(mPhysicalResources.size());
+			mPhysicalResources.push_back(physical);
+		}
+	}
+}
+
+void RenderGraph::buildBarriers()
+{
+	mBarriers.clear();
+	mMaxBarrierBatchSize = 0;
+	mStatistics.barrierBatchCount = 0;
+
+	// 一時リソースの最初の状態は最初に使うときの状態にする
+	vector<uint32_t> current_states(mPhysicalResources.size(), InvalidIndex);
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mPhysicalResources.size()); ++i)
+	{
+		if(mPhysicalResources[i].imported)
+		{
+			current_states[i] = mPhysicalResources[i].initialState;
+		}
+	}
+
+	auto end_batch = [this](uint32_t offset) -> uint32_t
+	{
+		auto count = static_cast<uint32_t>(mBarriers.size()) - offset;
+		if(count > 0)
+		{
+			++mStatistics.barrierBatchCount;
+			mMaxBarrierBatchSize = max(mMaxBarrierBatchSize, count);
+		}
+
+		return count;
+	};
+
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mExecutionOrder.size()); ++i)
+	{
+		auto & pass = mPasses[mExecutionOrder[i]];
+		pass.barrierOffset = static_cast<uint32_t>(mBarriers.size());
+
+		for(auto & access : pass.accesses)
+		{
+			auto physical_index = mResources[access.resource].physicalIndex;
+			auto & current_state = current_states[physical_index];
+
+			uint32_t state = access.write ? access.state : mergeReadStates(i, access.resource, access.state);
+
+			if(current_state == InvalidIndex)
+			{
+				mPhysicalResources[physical_index].initialState = state;
+				current_state = state;
+				continue;
+			}
+
+			// 既に必要な読み込み状態を含んでいればバリアは不要
+			if(current_state == state || (isReadOnlyState(current_state) && isReadOnlyState(state) && (current_state & state) == state))
+			{
+				continue;
+			}
+
+			mBarriers.push_back({ physical_index, current_state, state });
+			current_state = state;
+		}
+
+		pass.barrierCount = end_batch(pass.barrierOffset);
+	}
+
+	// 外部リソースは指定された状態に，一時リソースは次のフレームのために最初の状態に戻す
+	mFinalBarrierOffset = static_cast<uint32_t>(mBarriers.size());
+	for(uint32_t i = 0; i < static_cast<uint32_t>(mPhysicalResources.size()); ++i)
+	{
+		auto & physical = mPhysicalResources[i];
+		auto current_state = current_states[i];
+		if(current_state == InvalidIndex)
+		{
+			continue;
+		}
+
+		uint32_t final_state = physical.initialState;
+		if(physical.imported)
+		{
+			for(auto & resource : mResources)
+			{
+				if(resource.physicalIndex == i)
+				{
+					final_state = resource.finalState;
+					break;
+				}
+			}
+		}
+
+		if(current_state != final_state)
+		{
+			mBarriers.push_back({ i, current_state, final_state });
+		}
+	}
+	mFinalBarrierCount = end_batch(mFinalBarrierOffset);
+}
+
+uint32_t RenderGraph::mergeReadStates(uint32_t order_index, ResourceHandle resource, uint32_t state) const
+{
+	if(!isReadOnlyState(state))
+	{
+		return state;
+	}
+
+	// 次に書き込まれるまでの読み込みをまとめて，パスの間のバリアを省く
+	auto physical_index = mResources[resource].physicalIndex;
+	for(uint32_t i = order_index; i < static_cast<uint32_t>(mExecutionOrder.size()); ++i)
+	{
+		for(auto & access : mPasses[mExecutionOrder[i]].accesses)
+		{
+			if(mResources[access.resource].physicalIndex != physical_index)
+			{
+				continue;
+			}
+
+			if(access.write || !isReadOnlyState(access.state))
+			{
+				return state;
+			}
+
+			state |= access.state;
+		}
+	}
+
+	return state;
+}
+
+bool RenderGraph::isReadOnlyState(uint32_t state)
+{
+	return state != 0 && (state & ~ReadOnlyStateMask) == 0;
+}
@@ -0,0 +1,155 @@
+﻿#pragma once
+#ifndef RENDER_GRAPH_H_INCLUDED
+#define RENDER_GRAPH_H_INCLUDED
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// パスが読み書きするリソースを宣言し，実行順，状態遷移のバリア，
+// 一時リソースの割り当てを求める
+// D3D12には依存せず，状態の値はD3D12_RESOURCE_STATESと同じものを使う
+class RenderGraph
+{
+public:
+	using ResourceHandle = uint32_t;
+	using PassHandle = uint32_t;
+
+	static constexpr uint32_t InvalidIndex = UINT32_MAX;
+
+	enum ResourceState : uint32_t
+	{
+		StateCommon = 0,
+		StatePresent = 0,
+		StateRenderTarget = 0x4,
+		StateUnorderedAccess = 0x8,
+		StateDepthWrite = 0x10,
+		StateDepthRead = 0x20,
+		StateNonPixelShaderResource = 0x40,
+		StatePixelShaderResource = 0x80,
+		StateCopyDest = 0x400,
+		StateCopySource = 0x800,
+	};
+
+	// 同じ内容の一時リソースだけがメモリを共有できる
+	struct TextureDesc
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t format = 0;
+		uint32_t flags = 0;
+
+		bool operator==(const TextureDesc & rhs) const
+		{
+			return width == rhs.width && height == rhs.height && format == rhs.format && flags == rhs.flags;
+		}
+	};
+
+	// resourceは物理リソースのインデックス
+	struct Barrier
+	{
+		uint32_t resource;
+		uint32_t before;
+		uint32_t after;
+	};
+
+	struct Statistics
+	{
+		uint32_t passCount = 0;
+		uint32_t culledPassCount = 0;
+		uint32_t resourceCount = 0;
+		uint32_t physicalResourceCount = 0;
+		uint32_t barrierCount = 0;
+		uint32_t barrierBatchCount = 0;
+	};
+
+	using SubmitBarriers = std::function<void(const Barrier * p_barriers, uint32_t barrier_count)>;
+
+	// 外部で作ったリソース．フレームの最初と最後の状態を指定する
+	ResourceHandle importResource(const char * name, uint32_t initial_state, uint32_t final_state);
+	ResourceHandle createTexture(const char * name, const TextureDesc & desc);
+
+	PassHandle addPass(const char * name, std::function<void()> execute);
+	void read(PassHandle pass, ResourceHandle resource, uint32_t state);
+	void write(PassHandle pass, ResourceHandle resource, uint32_t state);
+
+	bool compile();
+
+	// コンパイル後は何度でも実行でき，実行中にメモリを確保しない
+	void execute(const SubmitBarriers & submit_barriers) const;
+
+	void clear();
+
+	uint32_t getPhysicalResourceIndex(ResourceHandle resource) const { return mResources[resource].physicalIndex; }
+	uint32_t getPhysicalResourceCount() const { return static_cast<uint32_t>(mPhysicalResources.size()); }
+	bool isPhysicalResourceImported(uint32_t physical_index) const { return mPhysicalResources[physical_index].imported; }
+	const TextureDesc & getPhysicalResourceDesc(uint32_t physical_index) const { return mPhysicalResources[physical_index].desc; }
+
+	// 一時リソースはこの状態で作成する
+	uint32_t getPhysicalResourceInitialState(uint32_t physical_index) const { return mPhysicalResources[physical_index].initialState; }
+
+	uint32_t getMaxBarrierBatchSize() const { return mMaxBarrierBatchSize; }
+	const std::vector<Barrier> & getBarriers() const { return mBarriers; }
+	const std::vector<PassHandle> & getExecutionOrder() const { return mExecutionOrder; }
+	const Statistics & getStatistics() const { return mStatistics; }
+
+private:
+	struct Access
+	{
+		ResourceHandle resource;
+		uint32_t state;
+		bool write;
+	};
+
+	struct Pass
+	{
+		std::string name;
+		std::function<void()> execute;
+		std::vector<Access> accesses;
+		bool culled = false;
+		uint32_t barrierOffset = 0;
+		uint32_t barrierCount = 0;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		TextureDesc desc;
+		bool imported = false;
+		uint32_t initialState = StateCommon;
+		uint32_t finalState = StateCommon;
+		uint32_t firstUse = InvalidIndex;
+		uint32_t lastUse = InvalidIndex;
+		uint32_t physicalIndex = InvalidIndex;
+	};
+
+	struct PhysicalResource
+	{
+		TextureDesc desc;
+		bool imported = false;
+		uint32_t initialState = StateCommon;
+		uint32_t lastUse = InvalidIndex;
+	};
+
+	bool validatePasses() const;
+	void cullPasses();
+	void computeLifetimes();
+	void assignPhysicalResources();
+	void buildBarriers();
+	uint32_t mergeReadStates(uint32_t order_index, ResourceHandle resource, uint32_t state) const;
+	static bool isReadOnlyState(uint32_t state);
+
+private:
+	std::vector<Pass> mPasses;
+	std::vector<Resource> mResources;
+	std::vector<PhysicalResource> mPhysicalResources;
+	std::vector<PassHandle> mExecutionOrder;
+	std::vector<Barrier> mBarriers;
+	uint32_t mFinalBarrierOffset = 0;
+	uint32_t mFinalBarrierCount = 0;
+	uint32_t mMaxBarrierBatchSize = 0;
+	Statistics mStatistics;
+};
+
+#endif // RENDER_GRAPH_H_INCLUDED
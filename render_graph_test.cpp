@@ -0,0 +1,268 @@
+﻿#include <cstdio>
+#include <string>
+#include <vector>
+#include "render_graph.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	// DXGI_FORMAT_R8G8B8A8_UNORMとD3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET
+	constexpr uint32_t format_r8g8b8a8_unorm = 28;
+	constexpr uint32_t flag_allow_render_target = 0x1;
+
+	string formatBarrier(const RenderGraph::Barrier & barrier)
+	{
+		char text[64];
+		snprintf(text, sizeof(text), "barrier %u 0x%x -> 0x%x", barrier.resource, barrier.before, barrier.after);
+		return text;
+	}
+
+	// パスの実行とバリアの発行を順に記録する
+	void execute(const RenderGraph & graph, vector<string> & stream)
+	{
+		graph.execute(
+			[&stream](const RenderGraph::Barrier * p_barriers, uint32_t barrier_count)
+			{
+				stream.push_back("batch " + to_string(barrier_count));
+				for(uint32_t i = 0; i < barrier_count; ++i)
+				{
+					stream.push_back(formatBarrier(p_barriers[i]));
+				}
+			}
+		);
+	}
+
+	bool compareStream(const vector<string> & actual, const vector<string> & expected)
+	{
+		if(actual == expected)
+		{
+			return true;
+		}
+
+		fprintf(stderr, "  expected:\n");
+		for(auto & line : expected)
+		{
+			fprintf(stderr, "    %s\n", line.c_str());
+		}
+		fprintf(stderr, "  actual:\n");
+		for(auto & line : actual)
+		{
+			fprintf(stderr, "    %s\n", line.c_str());
+		}
+
+		return false;
+	}
+
+	// バリアのbeforeが直前の状態と一致し，フレームの最後に最初の状態へ戻ることを確かめる
+	bool validateStates(const RenderGraph & graph, uint32_t frame_count, const vector<uint32_t> & final_states)
+	{
+		vector<uint32_t> states(graph.getPhysicalResourceCount());
+		for(uint32_t i = 0; i < graph.getPhysicalResourceCount(); ++i)
+		{
+			states[i] = graph.getPhysicalResourceInitialState(i);
+		}
+
+		bool valid = true;
+		for(uint32_t frame = 0; frame < frame_count; ++frame)
+		{
+			graph.execute(
+				[&](const RenderGraph::Barrier * p_barriers, uint32_t barrier_count)
+				{
+					for(uint32_t i = 0; i < barrier_count; ++i)
+					{
+						auto & barrier = p_barriers[i];
+						valid = valid && barrier.before == states[barrier.resource] && barrier.before != barrier.after;
+						states[barrier.resource] = barrier.after;
+					}
+				}
+			);
+
+			valid = valid && states == final_states;
+		}
+
+		return valid;
+	}
+
+	// RendererDX12::createRenderGraphと同じ，シーンをペラポリゴンに描いてからバックバッファに描く構成
+	void testScenePera()
+	{
+		RenderGraph graph;
+		vector<string> stream;
+
+		auto back_buffer = graph.importResource("BackBuffer", RenderGraph::StatePresent, RenderGraph::StatePresent);
+		auto depth_buffer = graph.importResource("DepthBuffer", RenderGraph::StateDepthWrite, RenderGraph::StateDepthWrite);
+
+		RenderGraph::TextureDesc pera_desc;
+		pera_desc.width = 1280;
+		pera_desc.height = 720;
+		pera_desc.format = format_r8g8b8a8_unorm;
+		pera_desc.flags = flag_allow_render_target;
+		auto pera = graph.createTexture("Pera", pera_desc);
+
+		auto scene_pass = graph.addPass("Scene", [&stream]() { stream.push_back("pass Scene"); });
+		graph.write(scene_pass, pera, RenderGraph::StateRenderTarget);
+		graph.write(scene_pass, depth_buffer, RenderGraph::StateDepthWrite);
+
+		auto pera_pass = graph.addPass("Pera", [&stream]() { stream.push_back("pass Pera"); });
+		graph.read(pera_pass, pera, RenderGraph::StatePixelShaderResource);
+		graph.write(pera_pass, back_buffer, RenderGraph::StateRenderTarget);
+		graph.write(pera_pass, depth_buffer, RenderGraph::StateDepthWrite);
+
+		expect(graph.compile(), "failed to compile the Scene -> Pera graph.");
+
+		expect(graph.getPhysicalResourceCount() == 3, "the Scene -> Pera graph has a wrong physical resource count.");
+		expect(graph.getPhysicalResourceIndex(back_buffer) == 0, "BackBuffer is not physical resource 0.");
+		expect(graph.getPhysicalResourceIndex(depth_buffer) == 1, "DepthBuffer is not physical resource 1.");
+		expect(graph.getPhysicalResourceIndex(pera) == 2, "Pera is not physical resource 2.");
+		expect(!graph.isPhysicalResourceImported(2), "Pera is treated as imported.");
+		expect(graph.getPhysicalResourceDesc(2) == pera_desc, "Pera has a wrong desc.");
+
+		// Peraはレンダーターゲットとして作り，最初の書き込みにバリアは要らない
+		expect(graph.getPhysicalResourceInitialState(2) == RenderGraph::StateRenderTarget, "Pera is not created as a render target.");
+
+		// フレームの最後にバックバッファをPresentに，Peraを作成時の状態に戻す
+		const vector<string> expected
+		{
+			"pass Scene",
+			"batch 2",
+			"barrier 2 0x4 -> 0x80",
+			"barrier 0 0x0 -> 0x4",
+			"pass Pera",
+			"batch 2",
+			"barrier 0 0x4 -> 0x0",
+			"barrier 2 0x80 -> 0x4",
+		};
+
+		execute(graph, stream);
+		expect(compareStream(stream, expected), "the Scene -> Pera barrier stream does not match.");
+
+		// 2フレーム目も同じものを発行する
+		stream.clear();
+		execute(graph, stream);
+		expect(compareStream(stream, expected), "the second frame of the Scene -> Pera graph does not match.");
+
+		expect(
+			validateStates(graph, 3, { RenderGraph::StatePresent, RenderGraph::StateDepthWrite, RenderGraph::StateRenderTarget }),
+			"the Scene -> Pera graph does not return every resource to its initial state."
+		);
+
+		const auto & statistics = graph.getStatistics();
+		expect(statistics.passCount == 2 && statistics.culledPassCount == 0, "the Scene -> Pera graph has wrong pass counts.");
+		expect(statistics.barrierCount == 4 && statistics.barrierBatchCount == 2, "the Scene -> Pera graph has wrong barrier counts.");
+		expect(graph.getMaxBarrierBatchSize() == 2, "the Scene -> Pera graph has a wrong max batch size.");
+	}
+
+	// 読まれない一時リソースに書くパスは除かれ，寿命の重ならない同じ内容の一時リソースはメモリを共有する
+	void testCullingAndAliasing()
+	{
+		RenderGraph graph;
+		vector<string> stream;
+
+		auto back_buffer = graph.importResource("BackBuffer", RenderGraph::StatePresent, RenderGraph::StatePresent);
+
+		RenderGraph::TextureDesc desc;
+		desc.width = 256;
+		desc.height = 256;
+		desc.format = format_r8g8b8a8_unorm;
+		desc.flags = flag_allow_render_target;
+		auto first = graph.createTexture("First", desc);
+		auto second = graph.createTexture("Second", desc);
+		auto third = graph.createTexture("Third", desc);
+		auto unused = graph.createTexture("Unused", desc);
+
+		auto first_pass = graph.addPass("First", [&stream]() { stream.push_back("pass First"); });
+		graph.write(first_pass, first, RenderGraph::StateRenderTarget);
+
+		auto unused_pass = graph.addPass("Unused", [&stream]() { stream.push_back("pass Unused"); });
+		graph.write(unused_pass, unused, RenderGraph::StateRenderTarget);
+
+		auto second_pass = graph.addPass("Second", [&stream]() { stream.push_back("pass Second"); });
+		graph.read(second_pass, first, RenderGraph::StatePixelShaderResource);
+		graph.write(second_pass, second, RenderGraph::StateRenderTarget);
+
+		auto third_pass = graph.addPass("Third", [&stream]() { stream.push_back("pass Third"); });
+		graph.read(third_pass, second, RenderGraph::StatePixelShaderResource);
+		graph.write(third_pass, third, RenderGraph::StateRenderTarget);
+
+		auto final_pass = graph.addPass("Final", [&stream]() { stream.push_back("pass Final"); });
+		graph.read(final_pass, third, RenderGraph::StatePixelShaderResource);
+		graph.write(final_pass, back_buffer, RenderGraph::StateRenderTarget);
+
+		expect(graph.compile(), "failed to compile the aliasing graph.");
+		expect(graph.getStatistics().culledPassCount == 1, "the pass writing an unused texture was not culled.");
+		expect(graph.getPhysicalResourceIndex(unused) == RenderGraph::InvalidIndex, "the unused texture got memory.");
+		expect(graph.getPhysicalResourceCount() == 3, "the textures were not aliased.");
+		expect(graph.getPhysicalResourceIndex(third) == graph.getPhysicalResourceIndex(first), "Third does not reuse the memory of First.");
+		expect(graph.getPhysicalResourceIndex(second) != graph.getPhysicalResourceIndex(first), "textures with overlapping lifetimes were aliased.");
+
+		// Thirdは読み終えたFirstのメモリに書くので，書き込みの前にレンダーターゲットへ戻す
+		execute(graph, stream);
+		expect(
+			compareStream(
+				stream,
+				{
+					"pass First",
+					"batch 1",
+					"barrier 1 0x4 -> 0x80",
+					"pass Second",
+					"batch 2",
+					"barrier 2 0x4 -> 0x80",
+					"barrier 1 0x80 -> 0x4",
+					"pass Third",
+					"batch 2",
+					"barrier 1 0x4 -> 0x80",
+					"barrier 0 0x0 -> 0x4",
+					"pass Final",
+					"batch 3",
+					"barrier 0 0x4 -> 0x0",
+					"barrier 1 0x80 -> 0x4",
+					"barrier 2 0x80 -> 0x4",
+				}
+			),
+			"the aliasing graph barrier stream does not match."
+		);
+		expect(
+			validateStates(graph, 2, { RenderGraph::StatePresent, RenderGraph::StateRenderTarget, RenderGraph::StateRenderTarget }),
+			"the aliasing graph does not return every resource to its initial state."
+		);
+
+		// 書き込みから始まらない一時リソースはコンパイルできない
+		RenderGraph invalid_graph;
+		auto texture = invalid_graph.createTexture("Texture", desc);
+		auto output = invalid_graph.importResource("Output", RenderGraph::StatePresent, RenderGraph::StatePresent);
+		auto pass = invalid_graph.addPass("Read", nullptr);
+		invalid_graph.read(pass, texture, RenderGraph::StatePixelShaderResource);
+		invalid_graph.write(pass, output, RenderGraph::StateRenderTarget);
+		expect(!invalid_graph.compile(), "a transient texture read before it was written compiled.");
+	}
+}
+
+// render_graph_test
+// レンダーグラフが発行するバリアの並びを，記録しておいた並びと比べる
+int main()
+{
+	testScenePera();
+	testCullingAndAliasing();
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
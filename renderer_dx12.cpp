@@ -1,18 +1,47 @@
-#include "renderer_dx12.h"
+﻿#include "renderer_dx12.h"
 #include <algorithm>
-#include <fstream>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
 #include <regex>
 #include <d3dcompiler.h>
 #include <DirectXTex.h>
 #include <d3dx12.h>
 #include "pmd.h"
+#include "hash.h"
+#include "image_decoder.h"
+#include "shader_cache.h"
+#include "shader_loader.h"
+#include "pipeline_state_library.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "allocation_tracker.h"
+#include "copy_queue_dx12.h"
+#include "async_file_reader.h"
 
 using namespace std;
 using namespace Microsoft::WRL;
 using namespace DirectX;
 
+static_assert(RenderGraph::StatePresent == D3D12_RESOURCE_STATE_PRESENT);
+static_assert(RenderGraph::StateRenderTarget == D3D12_RESOURCE_STATE_RENDER_TARGET);
+static_assert(RenderGraph::StateDepthWrite == D3D12_RESOURCE_STATE_DEPTH_WRITE);
+static_assert(RenderGraph::StatePixelShaderResource == D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+static_assert(RenderGraph::StateNonPixelShaderResource == D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+static_assert(RenderGraph::StateCopySource == D3D12_RESOURCE_STATE_COPY_SOURCE);
+static_assert(RenderGraph::StateCopyDest == D3D12_RESOURCE_STATE_COPY_DEST);
+
 RendererDX12::~RendererDX12()
 {
+	// ワーカが読み込み中のテクスチャを書き換えていることがある
+	for(auto & p_load : mpTextureLoads)
+	{
+		if(p_load->task.valid())
+		{
+			p_load->task.wait();
+		}
+	}
+
 	if(mhFenceEvent)
 	{
 		CloseHandle(mhFenceEvent);
@@ -21,9 +50,16 @@ RendererDX12::~RendererDX12()
 
 bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 {
+	PROFILE_FUNCTION();
+
+	mInitializeTime = FrameStatistics::now();
+
 	mWidth = width;
 	mHeight = height;
 
+	openAssetArchive();
+	mpFileReader.reset(new AsyncFileReader(AsyncFileReader::DefaultThreadCount, getAssetArchive()));
+
 	if(!enableDebugLayer())
 	{
 		return false;
@@ -39,6 +75,11 @@ bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 		return false;
 	}
 
+	if(!createPipelineStateLibrary())
+	{
+		return false;
+	}
+
 	if(!createCommandAllocator())
 	{
 		return false;
@@ -69,27 +110,27 @@ bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 		return false;
 	}
 
-	if(!createPeraResource())
+	if(!createDSVDescriptorHeap())
 	{
 		return false;
 	}
 
-	if(!createPeraRTV())
+	if(!createDSV())
 	{
 		return false;
 	}
 
-	if(!createPeraSRV())
+	if(!createRenderGraph())
 	{
 		return false;
 	}
 
-	if(!createDSVDescriptorHeap())
+	if(!createPeraRTV())
 	{
 		return false;
 	}
 
-	if(!createDSV())
+	if(!createPeraSRV())
 	{
 		return false;
 	}
@@ -99,6 +140,11 @@ bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 		return false;
 	}
 
+	if(!createCopyQueue())
+	{
+		return false;
+	}
+
 	if(!createNullWhite())
 	{
 		return false;
@@ -109,7 +155,7 @@ bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 		return false;
 	}
 
-	if(!createNullGradation())
+	if(!createToonRamps())
 	{
 		return false;
 	}
@@ -125,22 +171,28 @@ bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 		return false;
 	}
 
-	if(!loadModel())
+	if(!createPeraRootSignature())
 	{
 		return false;
 	}
 
-	if(!createPeraVertexBuffer())
+	if(!createPeraGraphicsPipelineState())
 	{
 		return false;
 	}
 
-	if(!createPeraRootSignature())
+	// PSOはワーカスレッドで作りながらモデルを読み込む
+	if(!loadModel())
 	{
 		return false;
 	}
 
-	if(!createPeraGraphicsPipelineState())
+	if(!createPeraVertexBuffer())
+	{
+		return false;
+	}
+
+	if(!resolvePipelineStates())
 	{
 		return false;
 	}
@@ -172,41 +224,71 @@ bool RendererDX12::initialize(uint32_t width, uint32_t height, HWND hWnd)
 
 bool RendererDX12::render()
 {
-	static float angle = 0.0f;
+	PROFILE_FUNCTION();
 
-	mpPMDRenderer->update();
+	static float angle = 0.0f;
 
-	*reinterpret_cast<SceneData *>(mpMappedSceneConstantBuffer) = mSceneData;
+	mResourceStateTracker.beginFrame();
 
-	beginPeraDraw();
+	// 読み込みが終わったテクスチャを仮のテクスチャと差し替える
+	updateTextureRequests();
 
-	mpPMDRenderer->setup(*this);
+	const auto update_begin = FrameStatistics::now();
+	{
+		NO_ALLOCATION_SCOPE("Update");
 
-	mpGraphicsCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		mpPMDRenderer->update(*this);
+	}
+	const auto record_begin = FrameStatistics::now();
+	mFrameStatistics.record(FrameStatistics::Metric::Update, record_begin - update_begin);
 
-	setScene();
+	*reinterpret_cast<SceneData *>(mpMappedSceneConstantBuffer) = mSceneData;
 
-	mpPMDRenderer->draw(*this);
+	auto back_buffer_index = mpSwapChain->GetCurrentBackBufferIndex();
+	mRenderGraphResources[mBackBufferPhysicalIndex] = mpBackBuffers[back_buffer_index].Get();
 
-	endPeraDraw();
+	{
+		NO_ALLOCATION_SCOPE("Draw");
 
-	beginDraw();
+		mRenderGraph.execute(mSubmitBarriers);
+	}
 
-	setGraphicsRootSignature(mpPeraRootSignature);
-	setPipelineState(mpPeraGraphicsPipelineState);
-	mpGraphicsCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
-	setDescriptorHeap(mpPeraSRVDescriptorHeap);
-	setGraphicsRootDescriptorTable(
-		0,
-		mpPeraSRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart()
-	);
-	setVertexBuffers(0, 1, &mPeraVertexBufferView);
-	mpGraphicsCommandList->DrawInstanced(4, 1, 0, 0);
+#ifdef ENABLE_ALLOCATION_TRACKER
+	// 最初のレポートまでをウォームアップとし，その後の更新と描画で確保したらデバッグビルドでは止める
+	assert(mFrameCount < StatisticsReportInterval || allocation_tracker::getViolationCount() == 0);
+#endif
+	mFrameStatistics.record(FrameStatistics::Metric::Record, FrameStatistics::now() - record_begin);
 
 	endDraw();
 
+	mFrameStatistics.endFrame();
+	reportStatistics();
+
 	mpSwapChain->Present(1, 0);
 
+	const auto present_time = FrameStatistics::now();
+	if(mLastPresentTime != 0)
+	{
+		mFrameStatistics.record(FrameStatistics::Metric::PresentInterval, present_time - mLastPresentTime);
+	}
+	mLastPresentTime = present_time;
+
+	if(!mIsFirstFramePresented)
+	{
+		mIsFirstFramePresented = true;
+
+		char message[256];
+		snprintf(
+			message,
+			sizeof(message),
+			"Time to first frame : %.3f ms, %s, %zu textures loading\n",
+			(present_time - mInitializeTime) / 1000000.0,
+			mIsTextureStreaming ? "streaming" : "synchronous",
+			mpTextureLoads.size()
+		);
+		OutputDebugStringA(message);
+	}
+
 	return true;
 }
 
@@ -265,18 +347,61 @@ bool RendererDX12::createBuffer(Microsoft::WRL::ComPtr<ID3D12Resource> & p_dst,
 	return true;
 }
 
+bool RendererDX12::createStaticBuffer(
+	Microsoft::WRL::ComPtr<ID3D12Resource> & p_dst,
+	const void * p_data,
+	size_t buffer_size
+)
+{
+	// リングに収まらない大きさは，これまで通りUPLOADヒープに置く
+	uint64_t ring_offset = 0;
+	auto p_staging = mStagingUploader.allocate(buffer_size, 16, ring_offset);
+	if(p_staging == nullptr)
+	{
+		if(!createBuffer(p_dst, buffer_size))
+		{
+			return false;
+		}
+
+		void * p_mapped = nullptr;
+		HRESULT hr = p_dst->Map(0, nullptr, &p_mapped);
+		if(FAILED(hr))
+		{
+			return false;
+		}
+
+		memcpy(p_mapped, p_data, buffer_size);
+		p_dst->Unmap(0, nullptr);
+
+		return true;
+	}
+
+	// COMMONで作れば，コピーキューでも描画キューでも暗黙に遷移する
+	HRESULT hr = mpDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(buffer_size),
+		D3D12_RESOURCE_STATE_COMMON,
+		nullptr,
+		IID_PPV_ARGS(&p_dst)
+	);
+	if(FAILED(hr))
+	{
+		return false;
+	}
+
+	memcpy(p_staging, p_data, buffer_size);
+	mStagingUploader.copyBuffer(p_dst.Get(), 0, ring_offset, buffer_size);
+	mpStagedResources.push_back(p_dst);
+
+	return true;
+}
+
 void RendererDX12::beginDraw()
 {
 	auto back_buffer_index = mpSwapChain->GetCurrentBackBufferIndex();
 
-	mpGraphicsCommandList->ResourceBarrier(
-		1,
-		&CD3DX12_RESOURCE_BARRIER::Transition(
-			mpBackBuffers[back_buffer_index].Get(),
-			D3D12_RESOURCE_STATE_PRESENT,
-			D3D12_RESOURCE_STATE_RENDER_TARGET
-		)
-	);
+	flushBarriers();
 
 	auto rtv_handle = mpRTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
 	rtv_handle.ptr += back_buffer_index * mRTVDescriptorSize;
@@ -325,16 +450,9 @@ void RendererDX12::setIndexBuffer(const D3D12_INDEX_BUFFER_VIEW & index_buffer_v
 
 void RendererDX12::endDraw()
 {
-	auto back_buffer_index = mpSwapChain->GetCurrentBackBufferIndex();
+	const auto submit_begin = FrameStatistics::now();
 
-	mpGraphicsCommandList->ResourceBarrier(
-		1,
-		&CD3DX12_RESOURCE_BARRIER::Transition(
-			mpBackBuffers[back_buffer_index].Get(),
-			D3D12_RESOURCE_STATE_RENDER_TARGET,
-			D3D12_RESOURCE_STATE_PRESENT
-		)
-	);
+	flushBarriers();
 
 	HRESULT hr = mpGraphicsCommandList->Close();
 	if(FAILED(hr))
@@ -342,20 +460,50 @@ void RendererDX12::endDraw()
 		return ;
 	}
 
+	// このフレームまでに溜めたアップロードをまとめて送り，描画の前にGPU側で完了を待つ
+	const auto upload_fence_value = mStagingUploader.flush();
+	if(upload_fence_value != 0)
+	{
+		mpCommandQueue->Wait(mpCopyQueue->getFence(), upload_fence_value);
+	}
+
+	if(!mpStagedResources.empty())
+	{
+		mSubmittedStagedResources.push_back({ upload_fence_value, move(mpStagedResources) });
+		mpStagedResources.clear();
+	}
+
+	const auto completed_upload_fence_value = mpCopyQueue->getCompletedValue();
+	while(!mSubmittedStagedResources.empty() && mSubmittedStagedResources.front().fenceValue <= completed_upload_fence_value)
+	{
+		mSubmittedStagedResources.pop_front();
+	}
+
 	ID3D12CommandList * pp_command_lists[]{ mpGraphicsCommandList.Get() };
 	mpCommandQueue->ExecuteCommandLists(1, pp_command_lists);
 	mpCommandQueue->Signal(mpFence.Get(), ++mFenceValue);
 
+	const auto wait_begin = FrameStatistics::now();
+	mFrameStatistics.record(FrameStatistics::Metric::Submit, wait_begin - submit_begin);
+
 	if(mpFence->GetCompletedValue() < mFenceValue)
 	{
+		PROFILE_SCOPE("WaitForGPU");
+
 		mpFence->SetEventOnCompletion(mFenceValue, mhFenceEvent);
 		WaitForSingleObject(mhFenceEvent, INFINITE);
 	}
+	mFrameStatistics.record(FrameStatistics::Metric::FenceWait, FrameStatistics::now() - wait_begin);
 
 	mpCommandAllocator->Reset();
 	mpGraphicsCommandList->Reset(mpCommandAllocator.Get(), nullptr);
 }
 
+DirectX::XMMATRIX RendererDX12::getViewProjection() const
+{
+	return XMMatrixTranspose(mSceneData.view) * XMMatrixTranspose(mSceneData.projection);
+}
+
 bool RendererDX12::enableDebugLayer()
 {
 #ifdef _DEBUG
@@ -400,6 +548,21 @@ bool RendererDX12::createDevice()
 	return true;
 }
 
+bool RendererDX12::createPipelineStateLibrary()
+{
+	OutputDebugStringA("createPipelineStateLibrary\n");
+
+	mpThreadPool.reset(new ThreadPool);
+	mpPipelineStateLibrary.reset(new PipelineStateLibrary(PipelineStateCacheDirectory));
+
+	if(!mpPipelineStateLibrary->initialize(mpDevice, mpThreadPool.get()))
+	{
+		return false;
+	}
+
+	return true;
+}
+
 bool RendererDX12::createCommandAllocator()
 {
 	OutputDebugStringA("createCommandAllocator\n");
@@ -639,6 +802,50 @@ bool RendererDX12::createFence()
 	return true;
 }
 
+bool RendererDX12::createCopyQueue()
+{
+	mpCopyQueue.reset(new CopyQueueDX12);
+	if(!mpCopyQueue->initialize(mpDevice.Get(), UploadRingSize))
+	{
+		return false;
+	}
+
+	mStagingUploader.initialize(mpCopyQueue.get(), mpCopyQueue->getMappedRing(), UploadRingSize);
+
+	return true;
+}
+
+void RendererDX12::openAssetArchive()
+{
+	if(!mIsAssetArchive || !filesystem::exists(AssetArchiveFileName))
+	{
+		return;
+	}
+
+	const auto start = FrameStatistics::now();
+	const bool is_opened = mAssetArchive.open(AssetArchiveFileName);
+	const auto end = FrameStatistics::now();
+
+	char message[256];
+	if(is_opened)
+	{
+		snprintf(
+			message,
+			sizeof(message),
+			"Asset archive : %s, %u entries, %.1f MB, opened in %.3f ms\n",
+			AssetArchiveFileName,
+			mAssetArchive.getEntryCount(),
+			mAssetArchive.getFileSize() / (1024.0 * 1024.0),
+			(end - start) / 1000000.0
+		);
+	}
+	else
+	{
+		snprintf(message, sizeof(message), "Asset archive : %s is broken. Reading loose files.\n", AssetArchiveFileName);
+	}
+	OutputDebugStringA(message);
+}
+
 bool RendererDX12::createTexture(uint32_t width, uint32_t height, Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture)
 {
 	HRESULT hr = mpDevice->CreateCommittedResource(
@@ -665,40 +872,466 @@ bool RendererDX12::loadTexture(
 	const filesystem::path & texture_path
 )
 {
-	OutputDebugStringA("Load Texture : ");
-	OutputDebugStringW(texture_path.c_str());
+	ComPtr<ID3D12Resource> p_loaded_texture;
+	requestTexture(
+		&p_loaded_texture,
+		texture_path,
+		[&p_loaded_texture](const ComPtr<ID3D12Resource> & p_result) { p_loaded_texture = p_result; }
+	);
+	flushTextureRequests();
 
-	auto cache = mTextureCache.find(texture_path);
-	if(cache != mTextureCache.end())
+	if(p_loaded_texture == nullptr)
 	{
-		p_texture = cache->second;
+		return false;
+	}
 
-		OutputDebugStringA(" succeeded. (cache)\n");
+	p_texture = p_loaded_texture;
 
-		return true;
+	return true;
+}
+
+namespace
+{
+	// 自前のデコーダで読めない形式(JPEGなど)はWICで読む
+	// ワーカスレッドはCOMを初期化していないが，メインスレッドのMTAに暗黙に属する
+	bool decodeTexture(const uint8_t * p_data, size_t size, bool is_cooked, ScratchImage & scratch_image)
+	{
+		// クック済みはミップとブロック圧縮を含むので，そのまま使う
+		if(is_cooked)
+		{
+			HRESULT hr = LoadFromDDSMemory(
+				p_data,
+				size,
+				DDS_FLAGS_NONE,
+				nullptr,
+				scratch_image
+			);
+
+			return SUCCEEDED(hr);
+		}
+
+		image_decoder::Image image;
+		if(image_decoder::decode(p_data, size, image))
+		{
+			HRESULT hr = scratch_image.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, image.width, image.height, 1, 1);
+			if(FAILED(hr))
+			{
+				return false;
+			}
+
+			auto p_image = scratch_image.GetImage(0, 0, 0);
+			const size_t row_size = static_cast<size_t>(image.width) * 4;
+			for(uint32_t y = 0; y < image.height; ++y)
+			{
+				memcpy(p_image->pixels + p_image->rowPitch * y, image.pixels.data() + row_size * y, row_size);
+			}
+
+			return true;
+		}
+
+		HRESULT hr = LoadFromWICMemory(
+			p_data,
+			size,
+			WIC_FLAGS_NONE,
+			nullptr,
+			scratch_image
+		);
+
+		return SUCCEEDED(hr);
 	}
+}
 
-	TexMetadata meta_data;
-	ScratchImage scratch_image;
+// 1つのパスの読み込み．ワーカでファイルを読み，メインスレッドで同じファイルを探してからデコードを頼む
+struct RendererDX12::TextureLoad
+{
+	enum class Stage
+	{
+		Read,
+		Decode,
+		Ready,
+	};
 
-	HRESULT hr = LoadFromWICFile(
-		texture_path.wstring().c_str(),
-		WIC_FLAGS_NONE,
-		&meta_data,
-		scratch_image
-	);
-	if(FAILED(hr))
+	TextureCache::PathID pathID;
+	filesystem::path path;
+	Stage stage = Stage::Read;
+	future<void> task;
+
+	const asset_archive::Archive * pAssetArchive = nullptr;
+	asset_archive::Data file;
+	uint64_t fileHash = 0;
+	ScratchImage scratchImage;
+	uint64_t pixelHash = 0;
+	bool isCooked = false;
+	bool isRead = false;
+	bool isDecoded = false;
+	ComPtr<ID3D12Resource> pTexture;
+	const char * pResult = " failed.\n";
+};
+
+void RendererDX12::readTextureFile(TextureLoad & load)
+{
+	PROFILE_SCOPE("ReadTexture");
+
+	// 元の画像が更新されていれば，古いクック済みは使わない
+	auto cooked_path = CookedTextureDirectory / load.path.relative_path();
+	cooked_path += ".dds";
+
+	// アーカイブの中身は一緒に作ったものなので，クック済みがあればそれを使う
+	if(load.pAssetArchive != nullptr)
+	{
+		load.isCooked = load.pAssetArchive->read(cooked_path, load.file);
+		load.isRead = load.isCooked || load.pAssetArchive->read(load.path, load.file);
+	}
+
+	if(!load.isRead)
+	{
+		error_code error;
+		const auto cooked_time = filesystem::last_write_time(cooked_path, error);
+		if(!error)
+		{
+			const auto source_time = filesystem::last_write_time(load.path, error);
+			load.isCooked = error || source_time <= cooked_time;
+		}
+
+		load.isRead = asset_archive::readFile(load.isCooked ? cooked_path : load.path, load.file);
+	}
+
+	if(!load.isRead)
+	{
+		return;
+	}
+
+	load.fileHash = hashing::xxh64(load.file.pData, load.file.size);
+}
+
+void RendererDX12::decodeTextureFile(TextureLoad & load)
+{
+	PROFILE_SCOPE("DecodeTexture");
+
+	if(!decodeTexture(load.file.pData, load.file.size, load.isCooked, load.scratchImage))
+	{
+		return;
+	}
+
+	// 形式を変えて保存し直しただけの画像も，画素が同じなら共有する
+	const auto & meta_data = load.scratchImage.GetMetadata();
+	auto pixel_hash = hashing::xxh64(&meta_data.format, sizeof(meta_data.format));
+	pixel_hash = hashing::xxh64(&meta_data.width, sizeof(meta_data.width), pixel_hash);
+	pixel_hash = hashing::xxh64(&meta_data.height, sizeof(meta_data.height), pixel_hash);
+	load.pixelHash = hashing::xxh64(load.scratchImage.GetPixels(), load.scratchImage.GetPixelsSize(), pixel_hash);
+
+	load.file = {};
+	load.isDecoded = true;
+}
+
+void RendererDX12::requestTexture(
+	const void * p_owner,
+	const filesystem::path & texture_path,
+	TextureCallback callback
+)
+{
+	const auto path_id = mTextureCache.internPath(texture_path);
+
+	ComPtr<ID3D12Resource> p_texture;
+	if(mTextureCache.find(path_id, p_texture))
+	{
+		callback(p_texture);
+		return;
+	}
+
+	mTextureRequests.push_back({ p_owner, path_id, move(callback) });
+
+	// 同じパスの読み込みが進んでいれば，終わったときにまとめて渡す
+	for(const auto & p_load : mpTextureLoads)
+	{
+		if(p_load->pathID == path_id)
+		{
+			return;
+		}
+	}
+
+	if(mpTextureLoads.empty())
+	{
+		mTextureLoadStatistics = {};
+		mTextureLoadStatistics.beginTime = FrameStatistics::now();
+	}
+
+	mpTextureLoads.emplace_back(new TextureLoad);
+	auto & load = *mpTextureLoads.back();
+	load.pathID = path_id;
+	load.path = texture_path;
+	load.pAssetArchive = getAssetArchive();
+	load.task = mpFileReader->submit([&load]() { readTextureFile(load); });
+}
+
+bool RendererDX12::findAtlasTexture(
+	const filesystem::path & root_path,
+	const filesystem::path & texture_path,
+	filesystem::path & atlas_path,
+	XMFLOAT4 & transform
+)
+{
+	if(!mIsTextureAtlas)
 	{
-		OutputDebugStringA(" failed.\n");
 		return false;
 	}
 
-	D3D12_HEAP_PROPERTIES heap_properties;
-	heap_properties.Type = D3D12_HEAP_TYPE_CUSTOM;
-	heap_properties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
-	heap_properties.MemoryPoolPreference = D3D12_MEMORY_POOL_L0;
-	heap_properties.CreationNodeMask = 0;
-	heap_properties.VisibleNodeMask = 0;
+	const auto cooked_directory = CookedTextureDirectory / root_path.relative_path();
+	const auto manifest_path = cooked_directory / texture_atlas::ManifestFileName;
+
+	// アーカイブに対応表があれば，アトラスもアーカイブにある
+	const auto p_archive_manifest = mAssetArchive.find(manifest_path);
+
+	const auto key = cooked_directory.generic_u8string();
+	auto it = mTextureAtlasManifests.find(key);
+	if(it == mTextureAtlasManifests.end())
+	{
+		texture_atlas::Manifest manifest;
+		asset_archive::Data manifest_data;
+		if(p_archive_manifest != nullptr && mAssetArchive.read(*p_archive_manifest, manifest_data))
+		{
+			texture_atlas::readManifest(manifest_data.pData, manifest_data.size, manifest);
+		}
+		else
+		{
+			texture_atlas::readManifest(manifest_path, manifest);
+		}
+		it = mTextureAtlasManifests.emplace(key, move(manifest)).first;
+	}
+
+	const auto & manifest = it->second;
+	const auto p_entry = manifest.find(texture_path.lexically_relative(root_path).generic_u8string());
+	if(p_entry == nullptr)
+	{
+		return false;
+	}
+
+	// 元の画像が対応表より新しければ，アトラスは古い
+	if(p_archive_manifest == nullptr)
+	{
+		error_code error;
+		const auto manifest_time = filesystem::last_write_time(manifest_path, error);
+		if(error)
+		{
+			return false;
+		}
+
+		const auto source_time = filesystem::last_write_time(texture_path, error);
+		if(!error && source_time > manifest_time)
+		{
+			return false;
+		}
+	}
+
+	const auto & atlas = manifest.atlases[p_entry->placement.atlas];
+	const auto & rect = p_entry->placement.rect;
+	transform = XMFLOAT4(
+		static_cast<float>(rect.width) / atlas.width,
+		static_cast<float>(rect.height) / atlas.height,
+		static_cast<float>(rect.x) / atlas.width,
+		static_cast<float>(rect.y) / atlas.height
+	);
+
+	// 元の画像が無いパスなので，readTextureFileはクック済みの<アトラスの名前>.ddsを読む
+	atlas_path = root_path / texture_atlas::getAtlasName(p_entry->placement.atlas);
+
+	return true;
+}
+
+void RendererDX12::cancelTextureRequests(const void * p_owner)
+{
+	mTextureRequests.erase(
+		remove_if(
+			mTextureRequests.begin(),
+			mTextureRequests.end(),
+			[p_owner](const TextureRequest & request) { return request.pOwner == p_owner; }
+		),
+		mTextureRequests.end()
+	);
+}
+
+void RendererDX12::updateTextureRequests()
+{
+	processTextureLoads(false);
+}
+
+void RendererDX12::flushTextureRequests()
+{
+	PROFILE_FUNCTION();
+
+	// 描画中に呼ばれたときは，記述子を書き換えられるようGPUを待つ
+	if(mpFence->GetCompletedValue() < mFenceValue)
+	{
+		mpFence->SetEventOnCompletion(mFenceValue, mhFenceEvent);
+		WaitForSingleObject(mhFenceEvent, INFINITE);
+	}
+
+	while(!mpTextureLoads.empty())
+	{
+		processTextureLoads(true);
+	}
+}
+
+void RendererDX12::processTextureLoads(bool wait)
+{
+	if(mpTextureLoads.empty())
+	{
+		return;
+	}
+
+	// 前のフレームがまだ記述子を参照していれば，書き換えは次に回す
+	const bool is_gpu_idle = mpFence->GetCompletedValue() >= mFenceValue;
+
+	for(size_t i = 0; i < mpTextureLoads.size();)
+	{
+		auto & load = *mpTextureLoads[i];
+
+		if(load.task.valid())
+		{
+			if(!wait && load.task.wait_for(chrono::seconds(0)) != future_status::ready)
+			{
+				++i;
+				continue;
+			}
+
+			load.task.get();
+
+			if(load.stage == TextureLoad::Stage::Read)
+			{
+				// 別のフォルダにある同じファイルは，デコードせずに共有する
+				if(load.isRead && mTextureCache.findByFileHash(load.pathID, load.fileHash, load.pTexture))
+				{
+					load.pResult = " succeeded. (same file)\n";
+					++mTextureLoadStatistics.sameFileCount;
+					load.file = {};
+				}
+				else if(load.isRead)
+				{
+					load.stage = TextureLoad::Stage::Decode;
+					load.task = mpThreadPool->submit([&load]() { decodeTextureFile(load); });
+					++i;
+					continue;
+				}
+			}
+			else if(load.isDecoded)
+			{
+				if(mTextureCache.findByPixelHash(load.pathID, load.fileHash, load.pixelHash, load.pTexture))
+				{
+					load.pResult = " succeeded. (same pixels)\n";
+					++mTextureLoadStatistics.samePixelsCount;
+				}
+				else
+				{
+					uint64_t size_in_bytes = 0;
+					if(createTextureResource(load.scratchImage, load.pTexture, size_in_bytes))
+					{
+						mTextureCache.insert(load.pathID, load.pTexture, size_in_bytes, load.fileHash, load.pixelHash);
+						load.pResult = " succeeded.\n";
+						++mTextureLoadStatistics.createdCount;
+						if(load.isCooked)
+						{
+							++mTextureLoadStatistics.cookedCount;
+						}
+					}
+				}
+
+				load.scratchImage.Release();
+			}
+
+			load.stage = TextureLoad::Stage::Ready;
+		}
+
+		if(!is_gpu_idle)
+		{
+			++i;
+			continue;
+		}
+
+		// 要求の中でさらに要求されても壊れないよう，先に取り出してから呼ぶ
+		vector<TextureCallback> callbacks;
+		for(auto it = mTextureRequests.begin(); it != mTextureRequests.end();)
+		{
+			if(it->pathID == load.pathID)
+			{
+				callbacks.push_back(move(it->callback));
+				it = mTextureRequests.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		if(load.pTexture != nullptr)
+		{
+			for(auto & callback : callbacks)
+			{
+				callback(load.pTexture);
+			}
+		}
+		else
+		{
+			++mTextureLoadStatistics.failedCount;
+		}
+		++mTextureLoadStatistics.loadCount;
+
+		OutputDebugStringA("Load Texture : ");
+		OutputDebugStringW(load.path.c_str());
+		OutputDebugStringA(load.pResult);
+
+		mpTextureLoads.erase(mpTextureLoads.begin() + i);
+	}
+
+	if(!mpTextureLoads.empty())
+	{
+		return;
+	}
+
+	const auto end_time = FrameStatistics::now();
+
+	char message[256];
+	snprintf(
+		message,
+		sizeof(message),
+		"Texture loads : %u loaded, %u created, %u cooked, %u same file, %u same pixels, %u failed in %.3f ms (%.3f ms after initialize)\n",
+		mTextureLoadStatistics.loadCount,
+		mTextureLoadStatistics.createdCount,
+		mTextureLoadStatistics.cookedCount,
+		mTextureLoadStatistics.sameFileCount,
+		mTextureLoadStatistics.samePixelsCount,
+		mTextureLoadStatistics.failedCount,
+		(end_time - mTextureLoadStatistics.beginTime) / 1000000.0,
+		(end_time - mInitializeTime) / 1000000.0
+	);
+	OutputDebugStringA(message);
+
+	const auto texture_statistics = mTextureCache.getStatistics();
+	const auto texture_load_count =
+		texture_statistics.missCount + texture_statistics.hitCount;
+	const auto deduplicated_count =
+		texture_statistics.sameFileCount + texture_statistics.samePixelsCount;
+
+	snprintf(
+		message,
+		sizeof(message),
+		"Texture dedup : %u loads, %u textures, %u same file, %u same pixels (%.1f%% of misses), %.1f MB saved\n",
+		texture_load_count,
+		texture_statistics.textureCount,
+		texture_statistics.sameFileCount,
+		texture_statistics.samePixelsCount,
+		texture_statistics.missCount != 0 ? 100.0 * deduplicated_count / texture_statistics.missCount : 0.0,
+		texture_statistics.deduplicatedBytes / (1024.0 * 1024.0)
+	);
+	OutputDebugStringA(message);
+}
+
+bool RendererDX12::createTextureResource(
+	const ScratchImage & scratch_image,
+	ComPtr<ID3D12Resource> & p_texture,
+	uint64_t & size_in_bytes
+)
+{
+	const auto & meta_data = scratch_image.GetMetadata();
 
 	D3D12_RESOURCE_DESC resource_desc;
 	resource_desc.Dimension = static_cast<D3D12_RESOURCE_DIMENSION>(meta_data.dimension);
@@ -713,40 +1346,126 @@ bool RendererDX12::loadTexture(
 	resource_desc.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
 	resource_desc.Flags = D3D12_RESOURCE_FLAG_NONE;
 
+	// サブリソースの番号はミップが内側
+	const auto subresource_count = static_cast<UINT>(meta_data.mipLevels * meta_data.arraySize);
+	vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> footprints(subresource_count);
+	vector<UINT> row_counts(subresource_count);
+	vector<UINT64> row_sizes(subresource_count);
+	mpDevice->GetCopyableFootprints(
+		&resource_desc,
+		0,
+		subresource_count,
+		0,
+		footprints.data(),
+		row_counts.data(),
+		row_sizes.data(),
+		nullptr
+	);
+
+	// 1つのサブリソースがリングに収まれば，DEFAULTヒープに作ってコピーキューで転送する
+	bool is_staged = true;
+	for(UINT i = 0; i < subresource_count; ++i)
+	{
+		if(static_cast<uint64_t>(footprints[i].Footprint.RowPitch) * row_counts[i] > mStagingUploader.getRingCapacity())
+		{
+			is_staged = false;
+		}
+	}
+
+	D3D12_HEAP_PROPERTIES heap_properties;
+	heap_properties.Type = D3D12_HEAP_TYPE_CUSTOM;
+	heap_properties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_WRITE_BACK;
+	heap_properties.MemoryPoolPreference = D3D12_MEMORY_POOL_L0;
+	heap_properties.CreationNodeMask = 0;
+	heap_properties.VisibleNodeMask = 0;
+	if(is_staged)
+	{
+		heap_properties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+	}
+
 	ComPtr<ID3D12Resource> p_tmp_texture;
-	hr = mpDevice->CreateCommittedResource(
+	HRESULT hr = mpDevice->CreateCommittedResource(
 		&heap_properties,
 		D3D12_HEAP_FLAG_NONE,
 		&resource_desc,
-		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		is_staged ? D3D12_RESOURCE_STATE_COMMON : D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
 		nullptr,
 		IID_PPV_ARGS(&p_tmp_texture)
 	);
 	if(FAILED(hr))
 	{
-		OutputDebugStringA(" failed.\n");
 		return false;
 	}
 
-	auto * p = new XMMATRIX;
-
-	auto p_image = scratch_image.GetImage(0, 0, 0);
-	hr = p_tmp_texture->WriteToSubresource(
-		0,
-		nullptr,
-		p_image->pixels,
-		p_image->rowPitch,
-		p_image->slicePitch
-	);
-	if(FAILED(hr))
+	// allocateは途中で溜めたコピーを送るので，失敗して戻ってもコピー先が残るよう最初に持っておく
+	if(is_staged)
 	{
-		return false;
+		mpStagedResources.push_back(p_tmp_texture);
 	}
 
-	OutputDebugStringA(" succeeded.\n");
+	for(size_t item = 0; item < meta_data.arraySize; ++item)
+	{
+		for(size_t mip = 0; mip < meta_data.mipLevels; ++mip)
+		{
+			const auto subresource = static_cast<UINT>(mip + item * meta_data.mipLevels);
+			auto p_image = scratch_image.GetImage(mip, item, 0);
+
+			if(!is_staged)
+			{
+				hr = p_tmp_texture->WriteToSubresource(
+					subresource,
+					nullptr,
+					p_image->pixels,
+					static_cast<UINT>(p_image->rowPitch),
+					static_cast<UINT>(p_image->slicePitch)
+				);
+				if(FAILED(hr))
+				{
+					return false;
+				}
+				continue;
+			}
+
+			const auto & footprint = footprints[subresource].Footprint;
+			const uint64_t staging_size = static_cast<uint64_t>(footprint.RowPitch) * row_counts[subresource];
+
+			uint64_t ring_offset = 0;
+			auto p_staging = mStagingUploader.allocate(
+				staging_size,
+				D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT,
+				ring_offset
+			);
+			if(p_staging == nullptr)
+			{
+				return false;
+			}
+
+			// 行のピッチはD3D12_TEXTURE_DATA_PITCH_ALIGNMENTに揃える
+			const auto row_size = static_cast<size_t>(min<uint64_t>(row_sizes[subresource], p_image->rowPitch));
+			for(UINT row = 0; row < row_counts[subresource]; ++row)
+			{
+				memcpy(
+					p_staging + static_cast<size_t>(footprint.RowPitch) * row,
+					p_image->pixels + p_image->rowPitch * row,
+					row_size
+				);
+			}
+
+			mStagingUploader.copyTexture(
+				p_tmp_texture.Get(),
+				subresource,
+				ring_offset,
+				footprint.Format,
+				footprint.Width,
+				footprint.Height,
+				footprint.RowPitch,
+				staging_size
+			);
+		}
+	}
 
 	p_texture = p_tmp_texture;
-	mTextureCache[texture_path] = p_tmp_texture;
+	size_in_bytes = mpDevice->GetResourceAllocationInfo(0, 1, &resource_desc).SizeInBytes;
 
 	return true;
 }
@@ -766,14 +1485,29 @@ void RendererDX12::createConstantBufferView(
 
 void RendererDX12::createTextureResourceView(Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture, const D3D12_CPU_DESCRIPTOR_HANDLE cpu_desciptor_handle)
 {
+	const auto resource_desc = p_texture->GetDesc();
+
 	D3D12_SHADER_RESOURCE_VIEW_DESC shader_resource_view_desc;
-	shader_resource_view_desc.Format = p_texture->GetDesc().Format;
-	shader_resource_view_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	shader_resource_view_desc.Format = resource_desc.Format;
 	shader_resource_view_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	shader_resource_view_desc.Texture2D.MostDetailedMip = 0;
-	shader_resource_view_desc.Texture2D.MipLevels = 1;
-	shader_resource_view_desc.Texture2D.PlaneSlice = 0;
-	shader_resource_view_desc.Texture2D.ResourceMinLODClamp = 0.0f;
+	if(resource_desc.DepthOrArraySize > 1)
+	{
+		shader_resource_view_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+		shader_resource_view_desc.Texture2DArray.MostDetailedMip = 0;
+		shader_resource_view_desc.Texture2DArray.MipLevels = resource_desc.MipLevels;
+		shader_resource_view_desc.Texture2DArray.FirstArraySlice = 0;
+		shader_resource_view_desc.Texture2DArray.ArraySize = resource_desc.DepthOrArraySize;
+		shader_resource_view_desc.Texture2DArray.PlaneSlice = 0;
+		shader_resource_view_desc.Texture2DArray.ResourceMinLODClamp = 0.0f;
+	}
+	else
+	{
+		shader_resource_view_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		shader_resource_view_desc.Texture2D.MostDetailedMip = 0;
+		shader_resource_view_desc.Texture2D.MipLevels = resource_desc.MipLevels;
+		shader_resource_view_desc.Texture2D.PlaneSlice = 0;
+		shader_resource_view_desc.Texture2D.ResourceMinLODClamp = 0.0f;
+	}
 
 	mpDevice->CreateShaderResourceView(
 		p_texture.Get(),
@@ -797,6 +1531,11 @@ void RendererDX12::setGraphicsRootDescriptorTable(const uint32_t root_parameter_
 	mpGraphicsCommandList->SetGraphicsRootDescriptorTable(root_parameter_index, base_descriptor);
 }
 
+void RendererDX12::setGraphicsRootConstantBufferView(const uint32_t root_parameter_index, D3D12_GPU_VIRTUAL_ADDRESS buffer_location)
+{
+	mpGraphicsCommandList->SetGraphicsRootConstantBufferView(root_parameter_index, buffer_location);
+}
+
 void RendererDX12::drawIndexedInstanced(
 	uint32_t index_count_per_instance,
 	uint32_t instance_count,
@@ -805,6 +1544,8 @@ void RendererDX12::drawIndexedInstanced(
 	uint32_t start_instance_location
 )
 {
+	flushBarriers();
+
 	mpGraphicsCommandList->DrawIndexedInstanced(
 		index_count_per_instance,
 		instance_count,
@@ -816,43 +1557,86 @@ void RendererDX12::drawIndexedInstanced(
 
 bool RendererDX12::loadModel()
 {
+	PROFILE_FUNCTION();
+
+	// 全て先に要求し，前のモデルのバッファを作っている間に次のモデルを読む
+	mpFileReader->prefetch({
+		"model/miku.pmd",
+		"model/ruka.pmd",
+		"model/haku.pmd",
+		"model/rin.pmd",
+		"model/meiko.pmd",
+		"model/kaito.pmd",
+		"motion/yagokoro.vmd",
+	});
+
 	{
 		auto & actor = mpPMDRenderer->addActor("model/miku.pmd", *this);
-		actor.loadVMD("motion/yagokoro.vmd");
+		actor.setMotion(mpPMDRenderer->loadMotion("motion/yagokoro.vmd"));
 		actor.setPosition(-10.0f, 0.0f, 0.0f);
 	}
 
 	{
 		auto & actor = mpPMDRenderer->addActor("model/ruka.pmd", *this);
-		actor.loadVMD("motion/yagokoro.vmd");
+		actor.setMotion(mpPMDRenderer->loadMotion("motion/yagokoro.vmd"));
 	}
 
+	// 後ろの4体は焼き込んだモーションで動かす．焼き込めなければキーフレームのまま動かす
+	auto set_background_motion = [this](PMDActor & actor, const char * path)
+	{
+		if(auto p_baked_motion = mpPMDRenderer->loadBakedMotion(path))
+		{
+			actor.setBakedMotion(p_baked_motion);
+		}
+		else
+		{
+			actor.setMotion(mpPMDRenderer->loadMotion(path));
+		}
+	};
+
 	{
 		auto & actor = mpPMDRenderer->addActor("model/haku.pmd", *this);
-		actor.loadVMD("motion/yagokoro.vmd");
+		set_background_motion(actor, "motion/yagokoro.vmd");
 		actor.setPosition(-5.0f, 0.0f, 5.0f);
 	}
 
 	{
 		auto & actor = mpPMDRenderer->addActor("model/rin.pmd", *this);
-		actor.loadVMD("motion/yagokoro.vmd");
+		set_background_motion(actor, "motion/yagokoro.vmd");
 		actor.setPosition(10.0f, 0.0f, 10.0f);
 	}
 
 	{
 		auto & actor = mpPMDRenderer->addActor("model/meiko.pmd", *this);
-		actor.loadVMD("motion/yagokoro.vmd");
+		set_background_motion(actor, "motion/yagokoro.vmd");
 		actor.setPosition(-10.0f, 0.0f, 10.0f);
 	}
 
 	{
 		auto & actor = mpPMDRenderer->addActor("model/kaito.pmd", *this);
-		actor.loadVMD("motion/yagokoro.vmd");
+		set_background_motion(actor, "motion/yagokoro.vmd");
 		actor.setPosition(10.0f, 0.0f, 0.0f);
 	}
 
+	// ストリーミングしないときは，全てのテクスチャを読み込んでから描き始める
+	if(!mIsTextureStreaming)
+	{
+		flushTextureRequests();
+	}
+
 	mpPMDRenderer->startActorAnimation();
 
+	char message[256];
+	snprintf(
+		message,
+		sizeof(message),
+		"File reader : %u threads, %u prefetched, %u read on demand\n",
+		mpFileReader->getThreadCount(),
+		mpFileReader->getPrefetchHitCount(),
+		mpFileReader->getPrefetchMissCount()
+	);
+	OutputDebugStringA(message);
+
 	return true;
 }
 
@@ -860,34 +1644,15 @@ bool RendererDX12::loadShader(
 	LPCWSTR path,
 	const char * entry_point,
 	const char * target,
-	ComPtr<ID3DBlob> & p_shader_blob
+	ComPtr<ID3DBlob> & p_shader_blob,
+	const D3D_SHADER_MACRO * p_defines
 )
 {
-	uint32_t flags = 0;
-#ifdef _DEBUG
-	flags |= D3DCOMPILE_DEBUG;
-	flags |= D3DCOMPILE_SKIP_OPTIMIZATION;
-#endif
+	PROFILE_FUNCTION();
 
-	ComPtr<ID3DBlob> p_error_blob;
-	HRESULT hr = D3DCompileFromFile(
-		path,
-		nullptr, 
-		D3D_COMPILE_STANDARD_FILE_INCLUDE,
-		entry_point,
-		target,
-		flags,
-		0,
-		&p_shader_blob,
-		&p_error_blob
-	);
-	if(FAILED(hr))
-	{
-		OutputDebugStringA(reinterpret_cast<LPCSTR>(p_error_blob->GetBufferPointer()));
-		return false;
-	}
+	static ShaderCache shader_cache(ShaderCacheDirectory);
 
-	return true;
+	return shader::load(shader_cache, path, entry_point, target, p_defines, p_shader_blob);
 }
 
 bool RendererDX12::createGraphicsPipelineState(
@@ -895,15 +1660,44 @@ bool RendererDX12::createGraphicsPipelineState(
 	const D3D12_GRAPHICS_PIPELINE_STATE_DESC & graphics_pipeline_state_desc
 )
 {
-	HRESULT hr = mpDevice->CreateGraphicsPipelineState(
-		&graphics_pipeline_state_desc,
-		IID_PPV_ARGS(&p_graphics_pipeline_state)
-	);
-	if(FAILED(hr))
+	return mpPipelineStateLibrary->create(graphics_pipeline_state_desc, p_graphics_pipeline_state);
+}
+
+std::shared_future<Microsoft::WRL::ComPtr<ID3D12PipelineState>> RendererDX12::createGraphicsPipelineStateAsync(
+	const D3D12_GRAPHICS_PIPELINE_STATE_DESC & graphics_pipeline_state_desc
+)
+{
+	return mpPipelineStateLibrary->createAsync(graphics_pipeline_state_desc);
+}
+
+bool RendererDX12::resolvePipelineStates()
+{
+	if(!mpPMDRenderer->resolvePipelineState())
 	{
 		return false;
 	}
 
+	mpPeraGraphicsPipelineState = mPeraGraphicsPipelineStateFuture.get();
+	if(mpPeraGraphicsPipelineState == nullptr)
+	{
+		return false;
+	}
+
+	auto statistics = mpPipelineStateLibrary->getStatistics();
+
+	char message[256];
+	snprintf(
+		message,
+		sizeof(message),
+		"PSO : memory hits %u, disk hits %u, disk rejects %u, misses %u, %.2f ms\n",
+		statistics.memoryHitCount,
+		statistics.diskHitCount,
+		statistics.diskRejectCount,
+		statistics.missCount,
+		statistics.creationMilliseconds
+	);
+	OutputDebugStringA(message);
+
 	return true;
 }
 
@@ -1011,59 +1805,374 @@ bool RendererDX12::createNullBlack()
 	return true;
 }
 
-bool RendererDX12::createNullGradation()
+uint32_t RendererDX12::getToonRampLayer(uint8_t toon_index)
+{
+	// 0xffは1を足して0番になる
+	const uint32_t layer = static_cast<uint8_t>(toon_index + 1);
+
+	return layer < ToonRampCount ? layer : 0;
+}
+
+bool RendererDX12::createToonRamps()
 {
-	if(!createTexture(4, 256, mpNullGradation))
+	PROFILE_FUNCTION();
+
+	ScratchImage scratch_image;
+	HRESULT hr = scratch_image.Initialize2D(
+		DXGI_FORMAT_R8G8B8A8_UNORM,
+		ToonRampWidth,
+		ToonRampHeight,
+		ToonRampCount,
+		1
+	);
+	if(FAILED(hr))
 	{
 		return false;
 	}
 
-	array<uint32_t, 4 * 256> buffer;
-	uint32_t c = 0xff;
-	for(auto it = buffer.begin(); it != buffer.end(); it += 4)
+	// 全て先に要求し，前の層をデコードしている間に次の層を読む
+	vector<filesystem::path> toon_paths;
+	for(uint32_t layer = 1; layer < ToonRampCount; ++layer)
 	{
-		auto col = (c << 24) | (c << 16) | (c << 8) | c;
-		fill(it, it + 4, col);
-		--c;
+		char toon_path[256];
+		snprintf(toon_path, sizeof(toon_path), "toon/toon%02u.bmp", layer);
+		toon_paths.push_back(toon_path);
 	}
+	auto toon_files = mpFileReader->read(toon_paths);
 
-	HRESULT hr = mpNullGradation->WriteToSubresource(
-		0,
-		nullptr,
-		buffer.data(),
-		4 * sizeof(buffer[0]),
-		sizeof(buffer[0]) * buffer.size()
+	for(uint32_t layer = 0; layer < ToonRampCount; ++layer)
+	{
+		// 大きさが違うものは最近傍で揃える．読めなければ既定の階調にする
+		image_decoder::Image image;
+		bool is_loaded = false;
+		if(layer != 0)
+		{
+			const auto file = toon_files[layer - 1].get();
+			is_loaded = file.isSucceeded && image_decoder::decode(file.data.pData, file.data.size, image);
+		}
+
+		auto p_image = scratch_image.GetImage(0, layer, 0);
+		for(uint32_t y = 0; y < ToonRampHeight; ++y)
+		{
+			for(uint32_t x = 0; x < ToonRampWidth; ++x)
+			{
+				auto p_dst = p_image->pixels + p_image->rowPitch * y + x * 4;
+				if(is_loaded)
+				{
+					const auto src_x = x * image.width / ToonRampWidth;
+					const auto src_y = y * image.height / ToonRampHeight;
+					memcpy(p_dst, image.pixels.data() + (static_cast<size_t>(src_y) * image.width + src_x) * 4, 4);
+				}
+				else
+				{
+					memset(p_dst, 0xff - static_cast<int>(y), 4);
+				}
+			}
+		}
+
+		char message[256];
+		snprintf(message, sizeof(message), "Toon ramp %u : %s\n", layer, is_loaded ? "loaded" : "default gradation");
+		OutputDebugStringA(message);
+	}
+
+	uint64_t size_in_bytes = 0;
+
+	return createTextureResource(scratch_image, mpToonRamps, size_in_bytes);
+}
+
+bool RendererDX12::createRenderGraph()
+{
+	auto back_buffer_desc = mpBackBuffers[0]->GetDesc();
+
+	auto back_buffer = mRenderGraph.importResource(
+		"BackBuffer",
+		RenderGraph::StatePresent,
+		RenderGraph::StatePresent
 	);
-	if(FAILED(hr))
+	auto depth_buffer = mRenderGraph.importResource(
+		"DepthBuffer",
+		RenderGraph::StateDepthWrite,
+		RenderGraph::StateDepthWrite
+	);
+
+	RenderGraph::TextureDesc pera_desc;
+	pera_desc.width = static_cast<uint32_t>(back_buffer_desc.Width);
+	pera_desc.height = back_buffer_desc.Height;
+	pera_desc.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	pera_desc.flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+	auto pera = mRenderGraph.createTexture("Pera", pera_desc);
+
+	auto scene_pass = mRenderGraph.addPass(
+		"Scene",
+		[this]()
+		{
+			PROFILE_SCOPE("ScenePass");
+
+			beginPeraDraw();
+
+			mpPMDRenderer->setup(*this);
+
+			mpGraphicsCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+			setScene();
+
+			mpPMDRenderer->draw(*this);
+		}
+	);
+	mRenderGraph.write(scene_pass, pera, RenderGraph::StateRenderTarget);
+	mRenderGraph.write(scene_pass, depth_buffer, RenderGraph::StateDepthWrite);
+
+	auto pera_pass = mRenderGraph.addPass(
+		"Pera",
+		[this]()
+		{
+			PROFILE_SCOPE("PeraPass");
+
+			beginDraw();
+
+			setGraphicsRootSignature(mpPeraRootSignature);
+			setPipelineState(mpPeraGraphicsPipelineState);
+			mpGraphicsCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+			setDescriptorHeap(mpPeraSRVDescriptorHeap);
+			setGraphicsRootDescriptorTable(
+				0,
+				mpPeraSRVDescriptorHeap->GetGPUDescriptorHandleForHeapStart()
+			);
+			setVertexBuffers(0, 1, &mPeraVertexBufferView);
+			flushBarriers();
+			mpGraphicsCommandList->DrawInstanced(4, 1, 0, 0);
+		}
+	);
+	mRenderGraph.read(pera_pass, pera, RenderGraph::StatePixelShaderResource);
+	mRenderGraph.write(pera_pass, back_buffer, RenderGraph::StateRenderTarget);
+	mRenderGraph.write(pera_pass, depth_buffer, RenderGraph::StateDepthWrite);
+
+	if(!mRenderGraph.compile())
 	{
 		return false;
 	}
 
+	auto physical_resource_count = mRenderGraph.getPhysicalResourceCount();
+	mpRenderGraphTransientResources.resize(physical_resource_count);
+	mRenderGraphResources.resize(physical_resource_count, nullptr);
+
+	// 一時リソースはクリアカラーを灰色に揃えて作る
+	CD3DX12_HEAP_PROPERTIES heap_properties(D3D12_HEAP_TYPE_DEFAULT);
+	float clear_color[] { 0.5f, 0.5f, 0.5f, 1.0f };
+
+	for(uint32_t i = 0; i < physical_resource_count; ++i)
+	{
+		if(mRenderGraph.isPhysicalResourceImported(i))
+		{
+			continue;
+		}
+
+		auto & desc = mRenderGraph.getPhysicalResourceDesc(i);
+		auto format = static_cast<DXGI_FORMAT>(desc.format);
+		auto resource_desc = CD3DX12_RESOURCE_DESC::Tex2D(
+			format,
+			desc.width,
+			desc.height,
+			1,
+			1,
+			1,
+			0,
+			static_cast<D3D12_RESOURCE_FLAGS>(desc.flags)
+		);
+		CD3DX12_CLEAR_VALUE clear_value(format, clear_color);
+
+		HRESULT hr = mpDevice->CreateCommittedResource(
+			&heap_properties,
+			D3D12_HEAP_FLAG_NONE,
+			&resource_desc,
+			static_cast<D3D12_RESOURCE_STATES>(mRenderGraph.getPhysicalResourceInitialState(i)),
+			(desc.flags & D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET) ? &clear_value : nullptr,
+			IID_PPV_ARGS(&mpRenderGraphTransientResources[i])
+		);
+		if(FAILED(hr))
+		{
+			return false;
+		}
+
+		mRenderGraphResources[i] = mpRenderGraphTransientResources[i].Get();
+		mResourceStateTracker.setState(mRenderGraphResources[i], mRenderGraph.getPhysicalResourceInitialState(i));
+	}
+
+	mBackBufferPhysicalIndex = mRenderGraph.getPhysicalResourceIndex(back_buffer);
+	mRenderGraphResources[mRenderGraph.getPhysicalResourceIndex(depth_buffer)] = mpDepthBuffer.Get();
+
+	for(auto & p_back_buffer : mpBackBuffers)
+	{
+		mResourceStateTracker.setState(p_back_buffer.Get(), D3D12_RESOURCE_STATE_PRESENT);
+	}
+	mResourceStateTracker.setState(mpDepthBuffer.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	mpPeraResource = mpRenderGraphTransientResources[mRenderGraph.getPhysicalResourceIndex(pera)];
+
+	mBarrierScratch.reserve(mRenderGraph.getMaxBarrierBatchSize());
+	mSubmitBarriers = [this](const RenderGraph::Barrier * p_barriers, uint32_t barrier_count)
+	{
+		submitBarriers(p_barriers, barrier_count);
+	};
+
+	auto & statistics = mRenderGraph.getStatistics();
+
+	char message[256];
+	snprintf(
+		message,
+		sizeof(message),
+		"RenderGraph : %u passes (%u culled), %u resources -> %u physical, %u barriers in %u batches\n",
+		statistics.passCount,
+		statistics.culledPassCount,
+		statistics.resourceCount,
+		statistics.physicalResourceCount,
+		statistics.barrierCount,
+		statistics.barrierBatchCount
+	);
+	OutputDebugStringA(message);
+
 	return true;
 }
 
-bool RendererDX12::createPeraResource()
+void RendererDX12::submitBarriers(const RenderGraph::Barrier * p_barriers, uint32_t barrier_count)
 {
-	auto & p_back_buffer = mpBackBuffers[0];
-	auto resource_desc = p_back_buffer->GetDesc();
-	CD3DX12_HEAP_PROPERTIES heap_properties(D3D12_HEAP_TYPE_DEFAULT);
-	float clear_color[] { 0.5f, 0.5f, 0.5f, 1.0f };
-	CD3DX12_CLEAR_VALUE clear_value(DXGI_FORMAT_R8G8B8A8_UNORM, clear_color);
+	// 発行は次の描画の直前まで遅らせる
+	for(uint32_t i = 0; i < barrier_count; ++i)
+	{
+		auto & barrier = p_barriers[i];
+		mResourceStateTracker.transition(
+			mRenderGraphResources[barrier.resource],
+			barrier.before,
+			barrier.after
+		);
+	}
+}
 
-	HRESULT hr = mpDevice->CreateCommittedResource(
-		&heap_properties,
-		D3D12_HEAP_FLAG_NONE,
-		&resource_desc,
-		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-		&clear_value,
-		IID_PPV_ARGS(&mpPeraResource)
+void RendererDX12::flushBarriers()
+{
+	mResourceStateTracker.flush(
+		[this](const ResourceStateTracker::Barrier * p_barriers, uint32_t barrier_count)
+		{
+			mBarrierScratch.clear();
+			for(uint32_t i = 0; i < barrier_count; ++i)
+			{
+				auto & barrier = p_barriers[i];
+				mBarrierScratch.push_back(
+					CD3DX12_RESOURCE_BARRIER::Transition(
+						static_cast<ID3D12Resource *>(barrier.resource),
+						static_cast<D3D12_RESOURCE_STATES>(barrier.before),
+						static_cast<D3D12_RESOURCE_STATES>(barrier.after)
+					)
+				);
+			}
+
+			mpGraphicsCommandList->ResourceBarrier(
+				static_cast<uint32_t>(mBarrierScratch.size()),
+				mBarrierScratch.data()
+			);
+		}
 	);
-	if(FAILED(hr))
+}
+
+void RendererDX12::reportStatistics()
+{
+	if(++mFrameCount % StatisticsReportInterval != 0)
 	{
-		return false;
+		return;
 	}
 
-	return true;
+	const auto & statistics = mResourceStateTracker.getFrameStatistics();
+
+	char message[256];
+	for(uint32_t i = 0; i < FrameStatistics::MetricCount; ++i)
+	{
+		const auto metric = static_cast<FrameStatistics::Metric>(i);
+		const auto & summary = mFrameStatistics.getWindowSummary(metric);
+		snprintf(
+			message,
+			sizeof(message),
+			"Frame : %-16s p50 %7.3f ms, p95 %7.3f ms, p99 %7.3f ms, max %7.3f ms\n",
+			FrameStatistics::getMetricName(metric),
+			summary.p50Milliseconds,
+			summary.p95Milliseconds,
+			summary.p99Milliseconds,
+			summary.maxMilliseconds
+		);
+		OutputDebugStringA(message);
+	}
+
+	snprintf(
+		message,
+		sizeof(message),
+		"Barriers : %u ResourceBarrier calls, %u barriers, %u redundant, %u merged\n",
+		statistics.barrierCallCount,
+		statistics.barrierCount,
+		statistics.redundantCount,
+		statistics.mergedCount
+	);
+	OutputDebugStringA(message);
+
+	const auto & upload_statistics = mStagingUploader.getStatistics();
+	snprintf(
+		message,
+		sizeof(message),
+		"Uploads : %u submissions, %u copies, %.1f MB, %u stalls, ring peak %.1f / %.1f MB\n",
+		upload_statistics.submissionCount,
+		upload_statistics.commandCount,
+		upload_statistics.uploadedBytes / (1024.0 * 1024.0),
+		upload_statistics.stallCount,
+		upload_statistics.peakUsedBytes / (1024.0 * 1024.0),
+		mStagingUploader.getRingCapacity() / (1024.0 * 1024.0)
+	);
+	OutputDebugStringA(message);
+
+	const auto texture_statistics = mTextureCache.getStatistics();
+	snprintf(
+		message,
+		sizeof(message),
+		"Textures : %u textures, %.1f / %.1f MB (peak %.1f MB), %u hits, %u misses, %u evictions\n",
+		texture_statistics.textureCount,
+		texture_statistics.residentBytes / (1024.0 * 1024.0),
+		texture_statistics.budgetBytes / (1024.0 * 1024.0),
+		texture_statistics.peakBytes / (1024.0 * 1024.0),
+		texture_statistics.hitCount,
+		texture_statistics.missCount,
+		texture_statistics.evictionCount
+	);
+	OutputDebugStringA(message);
+
+#ifdef ENABLE_PROFILER
+	for(const auto & zone : profiler::getFrameSummary())
+	{
+		snprintf(
+			message,
+			sizeof(message),
+			"Profile : %-40s avg %8.3f ms, max %8.3f ms, %6.1f calls/frame\n",
+			zone.name,
+			zone.averageMilliseconds,
+			zone.maxMilliseconds,
+			zone.callsPerFrame
+		);
+		OutputDebugStringA(message);
+	}
+#endif
+
+#ifdef ENABLE_ALLOCATION_TRACKER
+	const auto allocations = allocation_tracker::getLastFrameCounters();
+	const auto violation_name = allocation_tracker::getLastViolationName();
+	snprintf(
+		message,
+		sizeof(message),
+		"Allocations : %llu allocations, %llu bytes, %llu frees in last frame, %llu in no-allocation scopes (%s)\n",
+		static_cast<unsigned long long>(allocations.allocationCount),
+		static_cast<unsigned long long>(allocations.allocatedBytes),
+		static_cast<unsigned long long>(allocations.deallocationCount),
+		static_cast<unsigned long long>(allocation_tracker::getViolationCount()),
+		violation_name != nullptr ? violation_name : "-"
+	);
+	OutputDebugStringA(message);
+
+	allocation_tracker::resetViolations();
+#endif
 }
 
 bool RendererDX12::createPeraRTV()
@@ -1143,21 +2252,11 @@ bool RendererDX12::createPeraVertexBuffer()
 		{ {  1.0f, -1.0f, 0.1f }, { 1.0f, 1.0f } },
 		{ {  1.0f,  1.0f, 0.1f }, { 1.0f, 0.0f } },
 	};
-	if(!createBuffer(mpPeraVertexBuffer, sizeof(vertices)))
+	if(!createStaticBuffer(mpPeraVertexBuffer, vertices, sizeof(vertices)))
 	{
 		return false;
 	}
 
-	void * p_dst = nullptr;
-	HRESULT hr = mpPeraVertexBuffer->Map(0, nullptr, &p_dst);
-	if(FAILED(hr))
-	{
-		return false;
-	}
-
-	memcpy(p_dst, vertices, sizeof(vertices));
-
-	mpPeraVertexBuffer->Unmap(0, nullptr);
 	mPeraVertexBufferView.BufferLocation = mpPeraVertexBuffer->GetGPUVirtualAddress();
 	mPeraVertexBufferView.SizeInBytes = sizeof(vertices);
 	mPeraVertexBufferView.StrideInBytes = sizeof(vertices[0]);
@@ -1336,27 +2435,14 @@ bool RendererDX12::createPeraGraphicsPipelineState()
 	graphics_pipeline_state_desc.CachedPSO.CachedBlobSizeInBytes = 0;
 	graphics_pipeline_state_desc.Flags = D3D12_PIPELINE_STATE_FLAG_NONE;
 
-	if(!createGraphicsPipelineState(
-		mpPeraGraphicsPipelineState,
-		graphics_pipeline_state_desc
-	))
-	{
-		return false;
-	}
+	mPeraGraphicsPipelineStateFuture = createGraphicsPipelineStateAsync(graphics_pipeline_state_desc);
 
 	return true;
 }
 
 void RendererDX12::beginPeraDraw()
 {
-	mpGraphicsCommandList->ResourceBarrier(
-		1,
-		&CD3DX12_RESOURCE_BARRIER::Transition(
-			mpPeraResource.Get(),
-			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
-			D3D12_RESOURCE_STATE_RENDER_TARGET
-		)
-	);
+	flushBarriers();
 
 	auto rtv_handle = mpPeraRTVDescriptorHeap->GetCPUDescriptorHandleForHeapStart();
 
@@ -1371,15 +2457,3 @@ void RendererDX12::beginPeraDraw()
 	mpGraphicsCommandList->RSSetViewports(1, &mViewport);
 	mpGraphicsCommandList->RSSetScissorRects(1, &mScissorRect);
 }
-
-void RendererDX12::endPeraDraw()
-{
-	mpGraphicsCommandList->ResourceBarrier(
-		1,
-		&CD3DX12_RESOURCE_BARRIER::Transition(
-			mpPeraResource.Get(),
-			D3D12_RESOURCE_STATE_RENDER_TARGET,
-			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
-		)
-	);
-}
@@ -1,19 +1,39 @@
-#ifndef RENDERER_DX12_H_INCLUDED
+﻿#ifndef RENDERER_DX12_H_INCLUDED
 #define RENDERER_DX12_H_INCLUDED
 
 #include <array>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
-#include <map>
+#include <unordered_map>
 #include <vector>
 #include <d3d12.h>
 #include <dxgi1_6.h>
 #include <DirectXMath.h>
 #include <wrl/client.h>
+#include "asset_archive.h"
+#include "frame_statistics.h"
 #include "pmd_actor.h"
 #include "pmd_renderer.h"
+#include "render_graph.h"
+#include "resource_state_tracker.h"
+#include "staging_uploader.h"
+#include "texture_atlas.h"
+#include "texture_cache.h"
+
+class ThreadPool;
+class AsyncFileReader;
+class CopyQueueDX12;
+class PipelineStateLibrary;
+
+namespace DirectX
+{
+	class ScratchImage;
+}
 
 class RendererDX12
 {
@@ -33,7 +53,8 @@ public:
 		LPCWSTR path,
 		const char * entry_point,
 		const char * target,
-		Microsoft::WRL::ComPtr<ID3DBlob> & p_shader_blob
+		Microsoft::WRL::ComPtr<ID3DBlob> & p_shader_blob,
+		const D3D_SHADER_MACRO * p_defines = nullptr
 	);
 
 	bool createGraphicsPipelineState(
@@ -41,6 +62,10 @@ public:
 		const D3D12_GRAPHICS_PIPELINE_STATE_DESC & graphics_pipeline_state_desc
 	);
 
+	std::shared_future<Microsoft::WRL::ComPtr<ID3D12PipelineState>> createGraphicsPipelineStateAsync(
+		const D3D12_GRAPHICS_PIPELINE_STATE_DESC & graphics_pipeline_state_desc
+	);
+
 	bool createDescriptorHeap(
 		Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> & p_descriptor_heap,
 		const D3D12_DESCRIPTOR_HEAP_DESC & descriptor_heap_desc
@@ -51,11 +76,58 @@ public:
 		size_t buffer_size
 	);
 
+	// 書き換えない頂点やインデックス．DEFAULTヒープに作り，コピーキューで転送する
+	// 描画キューはendDrawでコピーの完了を待ってから実行する
+	bool createStaticBuffer(
+		Microsoft::WRL::ComPtr<ID3D12Resource> & p_dst,
+		const void * p_data,
+		size_t buffer_size
+	);
+
 	bool loadTexture(
 		Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture,
 		const std::filesystem::path & texture_path
 	);
 
+	using TextureCallback = std::function<void(const Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture)>;
+
+	// ワーカで読み込みを始め，終わったらメインスレッドでcallbackを呼ぶ．キャッシュにあればすぐに呼ぶ
+	// 読み込めなかったときは呼ばないので，呼び出し側で仮のテクスチャを入れておく
+	void requestTexture(
+		const void * p_owner,
+		const std::filesystem::path & texture_path,
+		TextureCallback callback
+	);
+
+	// p_ownerの要求のcallbackを呼ばないようにする．p_ownerを破棄する前に呼ぶ
+	void cancelTextureRequests(const void * p_owner);
+
+	// 終わった読み込みのcallbackを呼ぶ．GPUが前のフレームを描き終えるまでは呼ばないので，記述子を書き換えてよい
+	void updateTextureRequests();
+
+	// 全ての読み込みが終わるまで待つ
+	void flushTextureRequests();
+
+	// 無効にすると，モデルのテクスチャを全て読み込んでから最初のフレームを描く
+	void setTextureStreaming(bool is_enabled) { mIsTextureStreaming = is_enabled; }
+
+	// TextureCookerの--atlasでroot_pathのアトラスにtexture_pathが詰めてあれば，
+	// 代わりに要求するアトラスのパスと，UVを写すscale(xy)とoffset(zw)を返す
+	bool findAtlasTexture(
+		const std::filesystem::path & root_path,
+		const std::filesystem::path & texture_path,
+		std::filesystem::path & atlas_path,
+		DirectX::XMFLOAT4 & transform
+	);
+
+	void setTextureAtlas(bool is_enabled) { mIsTextureAtlas = is_enabled; }
+
+	// initializeの前に無効にすると，アーカイブがあってもファイルを読む
+	void setAssetArchive(bool is_enabled) { mIsAssetArchive = is_enabled; }
+
+	// 開いていなければnullptr
+	const asset_archive::Archive * getAssetArchive() const { return mAssetArchive.isOpen() ? &mAssetArchive : nullptr; }
+
 	void createConstantBufferView(
 		const D3D12_GPU_VIRTUAL_ADDRESS buffer_location,
 		uint32_t size_in_bytes,
@@ -92,6 +164,11 @@ public:
 		D3D12_GPU_DESCRIPTOR_HANDLE base_descriptor
 	);
 
+	void setGraphicsRootConstantBufferView(
+		const uint32_t root_parameter_index,
+		D3D12_GPU_VIRTUAL_ADDRESS buffer_location
+	);
+
 	void drawIndexedInstanced(
 		uint32_t index_count_per_instance,
 		uint32_t instance_count,
@@ -102,14 +179,45 @@ public:
 
 	void endDraw();
 
+	DirectX::XMMATRIX getViewProjection() const;
+	DirectX::XMMATRIX getView() const { return DirectX::XMMatrixTranspose(mSceneData.view); }
+	DirectX::XMMATRIX getProjection() const { return DirectX::XMMatrixTranspose(mSceneData.projection); }
+
+	static constexpr const char * ShaderCacheDirectory = "shader_cache";
+	static constexpr const char * PipelineStateCacheDirectory = "pso_cache";
+	// TextureCookerの出力先．<元のパス>.ddsが元の画像より新しければそちらを読む
+	static constexpr const char * CookedTextureDirectory = "cooked_textures";
+	// AssetPackerの出力．中にあるファイルは更新日時を比べずにファイルより優先する
+	static constexpr const char * AssetArchiveFileName = "assets.pak";
+
+	ThreadPool & getThreadPool() { return *mpThreadPool; }
+
+	// モデルやモーションはtakeで，loadModelで先読みしたものを受け取る
+	AsyncFileReader & getFileReader() { return *mpFileReader; }
+
+	const FrameStatistics & getFrameStatistics() const { return mFrameStatistics; }
+
+	AnimationClock & getAnimationClock() { return mpPMDRenderer->getAnimationClock(); }
+
+	// 予算を変えたり，アクターを削除した後にtrimしたりする
+	TextureCache & getTextureCache() { return mTextureCache; }
+
 	const Microsoft::WRL::ComPtr<ID3D12Resource> & getNullWhite() const { return mpNullWhite; }
 	const Microsoft::WRL::ComPtr<ID3D12Resource> & getNullBlack() const { return mpNullBlack; }
-	const Microsoft::WRL::ComPtr<ID3D12Resource> & getNullGradation() const { return mpNullGradation; }
+	// toon/toon01.bmp～toon10.bmpを1つのTexture2DArrayにまとめたもの．0番はファイルが無いときの既定の階調
+	static constexpr uint32_t ToonRampCount = 11;
+	static constexpr uint32_t ToonRampWidth = 4;
+	static constexpr uint32_t ToonRampHeight = 256;
+	Microsoft::WRL::ComPtr<ID3D12Resource> & getToonRamps() { return mpToonRamps; }
+
+	// PMDのマテリアルのトゥーン番号(0xffはなし)から配列の番号を求める
+	static uint32_t getToonRampLayer(uint8_t toon_index);
 
 private:
 	bool enableDebugLayer();
 	bool createFactory();
 	bool createDevice();
+	bool createPipelineStateLibrary();
 	bool createCommandAllocator();
 	bool createGraphicsCommandList();
 	bool createCommandQueue();
@@ -119,23 +227,37 @@ private:
 	bool createDSVDescriptorHeap();
 	bool createDSV();
 	bool createFence();
+	bool createCopyQueue();
+	void openAssetArchive();
 	bool createTexture(
 		uint32_t width,
 		uint32_t height,
 		Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture
 	);
+	struct TextureLoad;
+	static void readTextureFile(TextureLoad & load);
+	static void decodeTextureFile(TextureLoad & load);
+	void processTextureLoads(bool wait);
+	bool createTextureResource(
+		const DirectX::ScratchImage & scratch_image,
+		Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture,
+		uint64_t & size_in_bytes
+	);
 	bool createNullWhite();
 	bool createNullBlack();
-	bool createNullGradation();
+	bool createToonRamps();
 
-	bool createPeraResource();
+	bool createRenderGraph();
+	void submitBarriers(const RenderGraph::Barrier * p_barriers, uint32_t barrier_count);
+	void flushBarriers();
+	void reportStatistics();
 	bool createPeraRTV();
 	bool createPeraSRV();
 	bool createPeraVertexBuffer();
 	bool createPeraRootSignature();
 	bool createPeraGraphicsPipelineState();
+	bool resolvePipelineStates();
 	void beginPeraDraw();
-	void endPeraDraw();
 
 	bool loadModel();
 	bool createSceneDescriptorHeap();
@@ -150,6 +272,10 @@ private:
 
 	Microsoft::WRL::ComPtr<ID3D12Device> mpDevice;
 
+	// ワーカがライブラリを参照するので，スレッドプールを先に破棄する
+	std::unique_ptr<PipelineStateLibrary> mpPipelineStateLibrary;
+	std::unique_ptr<ThreadPool> mpThreadPool;
+
 	Microsoft::WRL::ComPtr<ID3D12CommandAllocator> mpCommandAllocator;
 	Microsoft::WRL::ComPtr<ID3D12GraphicsCommandList> mpGraphicsCommandList;
 	Microsoft::WRL::ComPtr<ID3D12CommandQueue> mpCommandQueue;
@@ -194,14 +320,64 @@ private:
 
 	Microsoft::WRL::ComPtr<ID3D12Resource> mpNullWhite;
 	Microsoft::WRL::ComPtr<ID3D12Resource> mpNullBlack;
-	Microsoft::WRL::ComPtr<ID3D12Resource> mpNullGradation;
+	Microsoft::WRL::ComPtr<ID3D12Resource> mpToonRamps;
 
 	std::unique_ptr<PMDRenderer> mpPMDRenderer;
 
-	std::map<
-		std::filesystem::path,
-		Microsoft::WRL::ComPtr<ID3D12Resource>
-	> mTextureCache;
+	// 読み込み中のテクスチャがマップしたメモリを指すので，読み込みより先に解放しない
+	asset_archive::Archive mAssetArchive;
+	bool mIsAssetArchive = true;
+
+	// アーカイブから読むので，アーカイブより先に止める
+	std::unique_ptr<AsyncFileReader> mpFileReader;
+
+	TextureCache mTextureCache;
+
+	struct TextureRequest
+	{
+		const void * pOwner;
+		TextureCache::PathID pathID;
+		TextureCallback callback;
+	};
+	std::vector<TextureRequest> mTextureRequests;
+	std::vector<std::unique_ptr<TextureLoad>> mpTextureLoads;
+	bool mIsTextureStreaming = true;
+
+	// クック済みのフォルダごとの対応表．無ければ空の対応表を入れておく
+	std::unordered_map<std::string, texture_atlas::Manifest> mTextureAtlasManifests;
+	bool mIsTextureAtlas = true;
+
+	// 読み込みが途切れるまでの集計
+	struct TextureLoadStatistics
+	{
+		uint32_t loadCount = 0;
+		uint32_t createdCount = 0;
+		uint32_t cookedCount = 0;
+		uint32_t sameFileCount = 0;
+		uint32_t samePixelsCount = 0;
+		uint32_t failedCount = 0;
+		uint64_t beginTime = 0;
+	};
+	TextureLoadStatistics mTextureLoadStatistics;
+
+	// 最初のフレームまでの時間を測る
+	uint64_t mInitializeTime = 0;
+	bool mIsFirstFramePresented = false;
+
+	RenderGraph mRenderGraph;
+	RenderGraph::SubmitBarriers mSubmitBarriers;
+	uint32_t mBackBufferPhysicalIndex = 0;
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mpRenderGraphTransientResources;
+	std::vector<ID3D12Resource *> mRenderGraphResources;
+	std::vector<D3D12_RESOURCE_BARRIER> mBarrierScratch;
+
+	// mpGraphicsCommandListに積んだ状態遷移を記録する
+	ResourceStateTracker mResourceStateTracker;
+	static constexpr uint32_t StatisticsReportInterval = 600;
+	uint32_t mFrameCount = 0;
+
+	FrameStatistics mFrameStatistics { StatisticsReportInterval };
+	uint64_t mLastPresentTime = 0;
 
 	Microsoft::WRL::ComPtr<ID3D12Resource> mpPeraResource;
 	Microsoft::WRL::ComPtr<ID3D12DescriptorHeap> mpPeraRTVDescriptorHeap;
@@ -211,6 +387,23 @@ private:
 
 	Microsoft::WRL::ComPtr<ID3D12RootSignature> mpPeraRootSignature;
 	Microsoft::WRL::ComPtr<ID3D12PipelineState> mpPeraGraphicsPipelineState;
+	std::shared_future<Microsoft::WRL::ComPtr<ID3D12PipelineState>> mPeraGraphicsPipelineStateFuture;
+
+	// コピー先のリソースより先に破棄されて，コピーの完了を待つよう最後に置く
+	static constexpr uint64_t UploadRingSize = 64ull * 1024 * 1024;
+	std::unique_ptr<CopyQueueDX12> mpCopyQueue;
+	StagingUploader mStagingUploader;
+
+	// 送るまではコピーキューが参照を持たないので，キャッシュから捨てられないよう持っておく
+	std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> mpStagedResources;
+
+	// 送ったコピー先は，コピーキューがフェンス値に届くまで解放しない
+	struct SubmittedStagedResources
+	{
+		uint64_t fenceValue;
+		std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> pResources;
+	};
+	std::deque<SubmittedStagedResources> mSubmittedStagedResources;
 };
 
 #endif // RENDERER_DX12_H_INCLUDED
\ No newline at end of file
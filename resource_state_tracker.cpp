@@ -0,0 +1,87 @@
+﻿#include "resource_state_tracker.h"
+
+using namespace std;
+
+namespace
+{
+	// D3D12_RESOURCE_STATE_GENERIC_READに含まれる読み込み専用の状態
+	constexpr uint32_t ReadOnlyStateMask =
+		0x1 | 0x2 | 0x20 | 0x40 | 0x80 | 0x200 | 0x800;
+
+	bool isReadOnlyState(uint32_t state)
+	{
+		return state != 0 && (state & ~ReadOnlyStateMask) == 0;
+	}
+}
+
+void ResourceStateTracker::setState(void * resource, uint32_t state)
+{
+	mStates[resource] = state;
+}
+
+uint32_t ResourceStateTracker::getState(const void * resource) const
+{
+	auto it = mStates.find(resource);
+	if(it == mStates.end())
+	{
+		return 0;
+	}
+
+	return it->second;
+}
+
+void ResourceStateTracker::transition(void * resource, uint32_t before, uint32_t after)
+{
+	// emplaceは既にあってもノードを確保することがあるので，try_emplaceを使う
+	mStates.try_emplace(resource, before);
+
+	transition(resource, after);
+}
+
+void ResourceStateTracker::transition(void * resource, uint32_t after)
+{
+	auto & state = mStates[resource];
+
+	// 必要な読み込み状態を既に含んでいれば遷移しない
+	if(state == after || (isReadOnlyState(state) && isReadOnlyState(after) && (state & after) == after))
+	{
+		++mFrameStatistics.redundantCount;
+		return;
+	}
+
+	// まだ発行していない遷移があれば，行き先を書き換えてまとめる
+	for(auto it = mPendingBarriers.begin(); it != mPendingBarriers.end(); ++it)
+	{
+		if(it->resource != resource)
+		{
+			continue;
+		}
+
+		++mFrameStatistics.mergedCount;
+
+		if(it->before == after)
+		{
+			mPendingBarriers.erase(it);
+		}
+		else
+		{
+			it->after = after;
+		}
+
+		state = after;
+		return;
+	}
+
+	mPendingBarriers.push_back({ resource, state, after });
+	state = after;
+}
+
+void ResourceStateTracker::beginFrame()
+{
+	mFrameStatistics = Statistics();
+}
+
+void ResourceStateTracker::forget(const void * resource)
+{
+	mStates.erase(resource);
+}
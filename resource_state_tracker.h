@@ -0,0 +1,66 @@
+﻿#pragma once
+#ifndef RESOURCE_STATE_TRACKER_H_INCLUDED
+#define RESOURCE_STATE_TRACKER_H_INCLUDED
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// コマンドリストごとにリソースの現在の状態を記録し，
+// 状態遷移をまとめて描画やコピーの直前に1回で発行する
+// D3D12には依存せず，状態の値はD3D12_RESOURCE_STATESと同じものを使う
+class ResourceStateTracker
+{
+public:
+	struct Barrier
+	{
+		void * resource;
+		uint32_t before;
+		uint32_t after;
+	};
+
+	struct Statistics
+	{
+		uint32_t barrierCallCount = 0;
+		uint32_t barrierCount = 0;
+		uint32_t redundantCount = 0;
+		uint32_t mergedCount = 0;
+	};
+
+	// 作成時など，既知の状態を登録する
+	void setState(void * resource, uint32_t state);
+	uint32_t getState(const void * resource) const;
+
+	// 未登録のリソースはbeforeの状態にあるとみなす
+	void transition(void * resource, uint32_t before, uint32_t after);
+	void transition(void * resource, uint32_t after);
+
+	template<typename F>
+	void flush(F && submit_barriers)
+	{
+		if(mPendingBarriers.empty())
+		{
+			return;
+		}
+
+		submit_barriers(mPendingBarriers.data(), static_cast<uint32_t>(mPendingBarriers.size()));
+
+		++mFrameStatistics.barrierCallCount;
+		mFrameStatistics.barrierCount += static_cast<uint32_t>(mPendingBarriers.size());
+		mPendingBarriers.clear();
+	}
+
+	bool hasPendingBarriers() const { return !mPendingBarriers.empty(); }
+
+	void beginFrame();
+	void forget(const void * resource);
+
+	const Statistics & getFrameStatistics() const { return mFrameStatistics; }
+
+private:
+	std::unordered_map<const void *, uint32_t> mStates;
+	std::vector<Barrier> mPendingBarriers;
+	Statistics mFrameStatistics;
+};
+
+#endif // RESOURCE_STATE_TRACKER_H_INCLUDED
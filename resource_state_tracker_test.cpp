@@ -0,0 +1,192 @@
+﻿#include <cstdio>
+#include <vector>
+#include "resource_state_tracker.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	// D3D12_RESOURCE_STATES
+	constexpr uint32_t state_common = 0x0;
+	constexpr uint32_t state_vertex_and_constant_buffer = 0x1;
+	constexpr uint32_t state_index_buffer = 0x2;
+	constexpr uint32_t state_render_target = 0x4;
+	constexpr uint32_t state_pixel_shader_resource = 0x80;
+	constexpr uint32_t state_copy_dest = 0x400;
+
+	struct Batch
+	{
+		vector<ResourceStateTracker::Barrier> barriers;
+	};
+
+	vector<Batch> flush(ResourceStateTracker & tracker)
+	{
+		vector<Batch> batches;
+		tracker.flush(
+			[&batches](const ResourceStateTracker::Barrier * p_barriers, uint32_t barrier_count)
+			{
+				batches.push_back({ vector<ResourceStateTracker::Barrier>(p_barriers, p_barriers + barrier_count) });
+			}
+		);
+
+		return batches;
+	}
+
+	bool equals(const ResourceStateTracker::Barrier & barrier, void * resource, uint32_t before, uint32_t after)
+	{
+		return barrier.resource == resource && barrier.before == before && barrier.after == after;
+	}
+
+	// 遷移すると1つのバリアになり，同じ状態への遷移はバリアにならない
+	void testTransition()
+	{
+		ResourceStateTracker tracker;
+		int texture = 0;
+
+		tracker.setState(&texture, state_copy_dest);
+		tracker.transition(&texture, state_pixel_shader_resource);
+		expect(tracker.getState(&texture) == state_pixel_shader_resource, "the state was not updated by a transition.");
+		expect(tracker.hasPendingBarriers(), "a transition did not queue a barrier.");
+
+		auto batches = flush(tracker);
+		expect(batches.size() == 1 && batches[0].barriers.size() == 1, "a transition did not flush one barrier.");
+		expect(
+			!batches.empty() && !batches[0].barriers.empty() &&
+			equals(batches[0].barriers[0], &texture, state_copy_dest, state_pixel_shader_resource),
+			"a transition flushed a wrong barrier."
+		);
+		expect(!tracker.hasPendingBarriers(), "flushing left pending barriers.");
+		expect(flush(tracker).empty(), "flushing with no pending barriers submitted a batch.");
+
+		// 同じ状態への遷移
+		tracker.transition(&texture, state_pixel_shader_resource);
+		expect(!tracker.hasPendingBarriers(), "a redundant transition queued a barrier.");
+		expect(tracker.getFrameStatistics().redundantCount == 1, "a redundant transition was not counted.");
+
+		// 既に含んでいる読み込み状態への遷移
+		int buffer = 0;
+		tracker.setState(&buffer, state_vertex_and_constant_buffer | state_index_buffer);
+		tracker.transition(&buffer, state_index_buffer);
+		expect(!tracker.hasPendingBarriers(), "a transition to an included read state queued a barrier.");
+		expect(tracker.getState(&buffer) == (state_vertex_and_constant_buffer | state_index_buffer), "an included read state narrowed the state.");
+
+		// 含んでいない読み込み状態へは遷移する
+		tracker.transition(&buffer, state_pixel_shader_resource);
+		batches = flush(tracker);
+		expect(
+			batches.size() == 1 && batches[0].barriers.size() == 1 &&
+			equals(batches[0].barriers[0], &buffer, state_vertex_and_constant_buffer | state_index_buffer, state_pixel_shader_resource),
+			"a transition to another read state did not flush a barrier."
+		);
+
+		const auto & statistics = tracker.getFrameStatistics();
+		expect(statistics.barrierCallCount == 2 && statistics.barrierCount == 2, "the barrier statistics are wrong.");
+		expect(statistics.redundantCount == 2, "the redundant statistics are wrong.");
+	}
+
+	// 発行前の遷移はまとめ，元の状態に戻るものは消す
+	void testMerge()
+	{
+		ResourceStateTracker tracker;
+		int a = 0;
+		int b = 0;
+
+		tracker.setState(&a, state_common);
+		tracker.setState(&b, state_render_target);
+
+		tracker.transition(&a, state_copy_dest);
+		tracker.transition(&b, state_pixel_shader_resource);
+		tracker.transition(&a, state_pixel_shader_resource);
+		tracker.transition(&b, state_render_target);
+
+		auto batches = flush(tracker);
+		expect(batches.size() == 1 && batches[0].barriers.size() == 1, "pending transitions were not merged.");
+		expect(
+			!batches.empty() && !batches[0].barriers.empty() &&
+			equals(batches[0].barriers[0], &a, state_common, state_pixel_shader_resource),
+			"merged transitions flushed a wrong barrier."
+		);
+		expect(tracker.getState(&b) == state_render_target, "a cancelled transition left a wrong state.");
+		expect(tracker.getFrameStatistics().mergedCount == 2, "merged transitions were not counted.");
+	}
+
+	// 未登録のリソースは最初の遷移のbeforeから始まり，beginFrameは状態を残して統計だけを戻す
+	void testFirstUseAndBeginFrame()
+	{
+		ResourceStateTracker tracker;
+		int back_buffer = 0;
+
+		expect(tracker.getState(&back_buffer) == state_common, "an unknown resource is not in the common state.");
+
+		tracker.transition(&back_buffer, state_common, state_render_target);
+		auto batches = flush(tracker);
+		expect(
+			batches.size() == 1 && batches[0].barriers.size() == 1 &&
+			equals(batches[0].barriers[0], &back_buffer, state_common, state_render_target),
+			"the first use did not start from the given before state."
+		);
+
+		// 登録済みならbeforeは無視する
+		tracker.transition(&back_buffer, state_copy_dest, state_render_target);
+		expect(!tracker.hasPendingBarriers(), "a known resource used the given before state.");
+
+		tracker.beginFrame();
+		const auto & statistics = tracker.getFrameStatistics();
+		expect(
+			statistics.barrierCallCount == 0 && statistics.barrierCount == 0 && statistics.redundantCount == 0 && statistics.mergedCount == 0,
+			"beginFrame did not reset the statistics."
+		);
+		expect(tracker.getState(&back_buffer) == state_render_target, "beginFrame dropped the tracked state.");
+
+		// 次のフレームは前のフレームの最後の状態から遷移する
+		tracker.transition(&back_buffer, state_common, state_common);
+		batches = flush(tracker);
+		expect(
+			batches.size() == 1 && batches[0].barriers.size() == 1 &&
+			equals(batches[0].barriers[0], &back_buffer, state_render_target, state_common),
+			"the next frame did not start from the last state."
+		);
+		expect(tracker.getFrameStatistics().barrierCount == 1, "the statistics were not counted after beginFrame.");
+
+		// forgetした後は未登録として扱う
+		tracker.forget(&back_buffer);
+		expect(tracker.getState(&back_buffer) == state_common, "a forgotten resource kept its state.");
+		tracker.transition(&back_buffer, state_copy_dest, state_pixel_shader_resource);
+		batches = flush(tracker);
+		expect(
+			batches.size() == 1 && batches[0].barriers.size() == 1 &&
+			equals(batches[0].barriers[0], &back_buffer, state_copy_dest, state_pixel_shader_resource),
+			"a forgotten resource did not start from the given before state."
+		);
+	}
+}
+
+// resource_state_tracker_test
+// 状態遷移から発行されるバリアの並びを確かめる
+int main()
+{
+	testTransition();
+	testMerge();
+	testFirstUseAndBeginFrame();
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+﻿#include "shader_cache.h"
+#include <fstream>
+#include <iterator>
+#include <regex>
+#include <set>
+#include <sstream>
+#include "hash.h"
+
+using namespace std;
+
+namespace
+{
+	bool hashSourceRecursively(
+		const filesystem::path & source_path,
+		set<filesystem::path> & visited,
+		uint64_t & hash
+	)
+	{
+		auto canonical_path = filesystem::weakly_canonical(source_path);
+		if(!visited.insert(canonical_path).second)
+		{
+			return true;
+		}
+
+		ifstream fin(source_path, ios::in | ios::binary);
+		if(!fin)
+		{
+			return false;
+		}
+
+		string source((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+		hash = hashing::fnv1a64(source.data(), source.size(), hash);
+
+		static const regex include_pattern(R"pattern(^\s*#\s*include\s*"([^"]+)")pattern");
+		auto root_path = source_path.parent_path();
+		istringstream lines(source);
+		string line;
+		while(getline(lines, line))
+		{
+			smatch match;
+			if(!regex_search(line, match, include_pattern))
+			{
+				continue;
+			}
+
+			if(!hashSourceRecursively(root_path / match[1].str(), visited, hash))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+}
+
+ShaderCache::ShaderCache(const std::filesystem::path & directory)
+	: mBlobCache(directory, ".cso")
+{
+}
+
+bool ShaderCache::computeSourceHash(const std::filesystem::path & source_path, uint64_t & source_hash)
+{
+	set<filesystem::path> visited;
+	source_hash = hashing::FNV1aOffsetBasis;
+
+	return hashSourceRecursively(source_path, visited, source_hash);
+}
+
+uint64_t ShaderCache::computeKey(
+	uint64_t source_hash,
+	const char * entry_point,
+	const char * target,
+	const Defines & defines,
+	uint64_t compile_flags,
+	uint32_t compiler_version
+)
+{
+	uint64_t key = hashing::fnv1a64Value(FormatVersion);
+	key = hashing::fnv1a64Value(source_hash, key);
+	key = hashing::fnv1a64(entry_point, key);
+	key = hashing::fnv1a64(target, key);
+	for(auto & define : defines)
+	{
+		key = hashing::fnv1a64(define.first.c_str(), key);
+		key = hashing::fnv1a64(define.second.c_str(), key);
+	}
+	key = hashing::fnv1a64Value(compile_flags, key);
+	key = hashing::fnv1a64Value(compiler_version, key);
+
+	return key;
+}
+
+bool ShaderCache::load(uint64_t key, std::vector<uint8_t> & bytecode)
+{
+	return mBlobCache.load(key, bytecode);
+}
+
+bool ShaderCache::store(uint64_t key, const void * p_bytecode, size_t size)
+{
+	return mBlobCache.store(key, p_bytecode, size);
+}
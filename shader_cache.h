@@ -0,0 +1,48 @@
+﻿#pragma once
+#ifndef SHADER_CACHE_H_INCLUDED
+#define SHADER_CACHE_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+#include "blob_cache.h"
+
+// ソースの内容，エントリポイント，ターゲット，マクロ，コンパイルフラグ，コンパイラのバージョンを
+// キーにしてシェーダのバイトコードをディスクへ保存する
+// D3Dのコンパイラには依存しない
+class ShaderCache
+{
+public:
+	using Defines = std::vector<std::pair<std::string, std::string>>;
+
+	static constexpr uint32_t FormatVersion = 1;
+
+	explicit ShaderCache(const std::filesystem::path & directory);
+
+	// #include "..." で参照されるファイルも再帰的に含めたハッシュ
+	static bool computeSourceHash(const std::filesystem::path & source_path, uint64_t & source_hash);
+
+	static uint64_t computeKey(
+		uint64_t source_hash,
+		const char * entry_point,
+		const char * target,
+		const Defines & defines,
+		uint64_t compile_flags,
+		uint32_t compiler_version
+	);
+
+	bool load(uint64_t key, std::vector<uint8_t> & bytecode);
+	bool store(uint64_t key, const void * p_bytecode, size_t size);
+
+	std::filesystem::path getEntryPath(uint64_t key) const { return mBlobCache.getEntryPath(key); }
+
+	uint32_t getHitCount() const { return mBlobCache.getHitCount(); }
+	uint32_t getMissCount() const { return mBlobCache.getMissCount(); }
+
+private:
+	BlobCache mBlobCache;
+};
+
+#endif // SHADER_CACHE_H_INCLUDED
@@ -0,0 +1,178 @@
+﻿#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "shader_cache.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	void writeFile(const filesystem::path & path, const string & text)
+	{
+		ofstream fout(path, ios::out | ios::binary | ios::trunc);
+		fout << text;
+	}
+
+	uint64_t hashSource(const filesystem::path & path)
+	{
+		uint64_t source_hash = 0;
+		expect(ShaderCache::computeSourceHash(path, source_hash), "failed to hash the source.");
+		return source_hash;
+	}
+
+	// #includeしたファイルの変更でソースのハッシュが変わる
+	void testSourceHash(const filesystem::path & directory)
+	{
+		const auto shader_path = directory / "shader.hlsl";
+		writeFile(shader_path, "#include \"common.hlsli\"\nfloat4 main() : SV_TARGET { return color(); }\n");
+		writeFile(directory / "common.hlsli", "  #  include \"nested.hlsli\"\nfloat4 color() { return value; }\n");
+		writeFile(directory / "nested.hlsli", "static const float4 value = 1;\n");
+
+		const auto original = hashSource(shader_path);
+		expect(hashSource(shader_path) == original, "the source hash is not stable.");
+
+		writeFile(directory / "nested.hlsli", "static const float4 value = 0;\n");
+		expect(hashSource(shader_path) != original, "changing a nested #include did not change the source hash.");
+
+		writeFile(directory / "nested.hlsli", "static const float4 value = 1;\n");
+		expect(hashSource(shader_path) == original, "restoring a nested #include did not restore the source hash.");
+
+		writeFile(directory / "common.hlsli", "  #  include \"nested.hlsli\"\nfloat4 color() { return -value; }\n");
+		expect(hashSource(shader_path) != original, "changing an #include did not change the source hash.");
+
+		filesystem::remove(directory / "nested.hlsli");
+		uint64_t source_hash = 0;
+		expect(!ShaderCache::computeSourceHash(shader_path, source_hash), "a missing #include was not reported.");
+	}
+
+	// キーを作る要素のどれが変わってもキーが変わる
+	void testKey()
+	{
+		const ShaderCache::Defines defines { { "USE_TOON", "1" } };
+		const auto key = ShaderCache::computeKey(1, "BasicVS", "vs_5_0", defines, 0, 47);
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_0", defines, 0, 47) == key, "the key is not stable.");
+
+		expect(ShaderCache::computeKey(2, "BasicVS", "vs_5_0", defines, 0, 47) != key, "the source hash did not change the key.");
+		expect(ShaderCache::computeKey(1, "BasicPS", "vs_5_0", defines, 0, 47) != key, "the entry point did not change the key.");
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_1", defines, 0, 47) != key, "the target did not change the key.");
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_0", defines, 1, 47) != key, "the compile flags did not change the key.");
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_0", defines, 0, 46) != key, "the compiler version did not change the key.");
+
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_0", {}, 0, 47) != key, "removing a define did not change the key.");
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_0", { { "USE_TOON", "0" } }, 0, 47) != key, "a define value did not change the key.");
+		expect(ShaderCache::computeKey(1, "BasicVS", "vs_5_0", { { "USE_SPHERE", "1" } }, 0, 47) != key, "a define name did not change the key.");
+		expect(
+			ShaderCache::computeKey(1, "BasicVS", "vs_5_0", { { "USE_TOON", "1" }, { "USE_SPHERE", "1" } }, 0, 47) != key,
+			"adding a define did not change the key."
+		);
+
+		// 文字列の区切りが変わっただけでも別のキーになる
+		expect(
+			ShaderCache::computeKey(1, "BasicVSv", "s_5_0", defines, 0, 47) != key,
+			"moving characters between the entry point and the target did not change the key."
+		);
+		expect(
+			ShaderCache::computeKey(1, "BasicVS", "vs_5_0", { { "USE_TOON1", "" } }, 0, 47) != key,
+			"moving characters between a define name and value did not change the key."
+		);
+	}
+
+	// 途中で切れたものや大きさが壊れたものはミスになり，保存し直すと読める
+	void testTruncatedEntry(const filesystem::path & directory)
+	{
+		ShaderCache cache(directory / "cache");
+		const uint64_t key = ShaderCache::computeKey(1, "BasicVS", "vs_5_0", {}, 0, 47);
+
+		vector<uint8_t> bytecode(256);
+		for(size_t i = 0; i < bytecode.size(); ++i)
+		{
+			bytecode[i] = static_cast<uint8_t>(i * 7);
+		}
+
+		vector<uint8_t> loaded;
+		expect(!cache.load(key, loaded), "an empty cache returned an entry.");
+		expect(cache.store(key, bytecode.data(), bytecode.size()), "failed to store an entry.");
+		expect(cache.load(key, loaded) && loaded == bytecode, "failed to load a stored entry.");
+
+		const auto entry_path = cache.getEntryPath(key);
+		const auto entry_size = filesystem::file_size(entry_path);
+		for(const auto size : { entry_size - 1, entry_size - bytecode.size(), uint64_t(10), uint64_t(0) })
+		{
+			filesystem::resize_file(entry_path, size);
+
+			const auto miss_count = cache.getMissCount();
+			expect(!cache.load(key, loaded), "a truncated entry was loaded.");
+			expect(cache.getMissCount() == miss_count + 1, "a truncated entry was not counted as a miss.");
+
+			expect(cache.store(key, bytecode.data(), bytecode.size()), "failed to rewrite a truncated entry.");
+			expect(filesystem::file_size(entry_path) == entry_size, "the rewritten entry has a wrong size.");
+			expect(cache.load(key, loaded) && loaded == bytecode, "failed to load a rewritten entry.");
+		}
+
+		// ヘッダの大きさを壊しても，その大きさを確保せずに弾く
+		{
+			fstream file(entry_path, ios::in | ios::out | ios::binary);
+			const uint64_t size = 1ull << 60;
+			file.seekp(16);
+			file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+		}
+		expect(!cache.load(key, loaded), "an entry with a broken size was loaded.");
+
+		// 別のキーの場所に置かれたものも弾く
+		expect(cache.store(key, bytecode.data(), bytecode.size()), "failed to rewrite an entry.");
+		const uint64_t other_key = key + 1;
+		filesystem::copy_file(entry_path, cache.getEntryPath(other_key), filesystem::copy_options::overwrite_existing);
+		expect(!cache.load(other_key, loaded), "an entry stored for another key was loaded.");
+
+		// 1バイトでも変わっていればチェックサムで弾く
+		{
+			fstream file(entry_path, ios::in | ios::out | ios::binary);
+			file.seekp(-1, ios::end);
+			file.put(0x55);
+		}
+		expect(!cache.load(key, loaded), "a corrupted entry was loaded.");
+	}
+}
+
+// shader_cache_test
+// シェーダキャッシュのキーが変わるべきときに変わり，壊れたエントリを読まないことを確かめる
+int main()
+{
+	const auto directory = filesystem::temp_directory_path() / "shader_cache_test";
+	error_code ec;
+	filesystem::remove_all(directory, ec);
+	if(!filesystem::create_directories(directory, ec))
+	{
+		fprintf(stderr, "error: failed to create %s.\n", directory.string().c_str());
+		return 1;
+	}
+
+	testSourceHash(directory);
+	testKey();
+	testTruncatedEntry(directory);
+
+	filesystem::remove_all(directory, ec);
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
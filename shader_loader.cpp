@@ -0,0 +1,100 @@
+﻿#include "shader_loader.h"
+#include <cstring>
+#include <vector>
+#include <Windows.h>
+#include <d3dcompiler.h>
+#include "shader_cache.h"
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+uint32_t shader::getCompileFlags()
+{
+	uint32_t flags = 0;
+#ifdef _DEBUG
+	flags |= D3DCOMPILE_DEBUG;
+	flags |= D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+
+	return flags;
+}
+
+bool shader::load(
+	ShaderCache & cache,
+	const std::filesystem::path & path,
+	const char * entry_point,
+	const char * target,
+	const D3D_SHADER_MACRO * p_defines,
+	Microsoft::WRL::ComPtr<ID3DBlob> & p_shader_blob
+)
+{
+	OutputDebugStringA("Load Shader : ");
+	OutputDebugStringW(path.c_str());
+	OutputDebugStringA(" ");
+	OutputDebugStringA(entry_point);
+
+	uint64_t source_hash = 0;
+	if(!ShaderCache::computeSourceHash(path, source_hash))
+	{
+		OutputDebugStringA(" failed.\n");
+		return false;
+	}
+
+	ShaderCache::Defines defines;
+	for(auto p = p_defines; p != nullptr && p->Name != nullptr; ++p)
+	{
+		defines.emplace_back(p->Name, p->Definition != nullptr ? p->Definition : "");
+	}
+
+	// コンパイラが変わったら作り直す
+	const uint32_t flags = getCompileFlags();
+	const uint64_t key = ShaderCache::computeKey(source_hash, entry_point, target, defines, flags, D3D_COMPILER_VERSION);
+
+	vector<uint8_t> bytecode;
+	if(cache.load(key, bytecode))
+	{
+		HRESULT hr = D3DCreateBlob(bytecode.size(), &p_shader_blob);
+		if(FAILED(hr))
+		{
+			OutputDebugStringA(" failed.\n");
+			return false;
+		}
+
+		memcpy(p_shader_blob->GetBufferPointer(), bytecode.data(), bytecode.size());
+
+		OutputDebugStringA(" succeeded. (cache)\n");
+
+		return true;
+	}
+
+	ComPtr<ID3DBlob> p_error_blob;
+	HRESULT hr = D3DCompileFromFile(
+		path.c_str(),
+		p_defines,
+		D3D_COMPILE_STANDARD_FILE_INCLUDE,
+		entry_point,
+		target,
+		flags,
+		0,
+		&p_shader_blob,
+		&p_error_blob
+	);
+	if(FAILED(hr))
+	{
+		OutputDebugStringA(" failed.\n");
+		if(p_error_blob)
+		{
+			OutputDebugStringA(reinterpret_cast<LPCSTR>(p_error_blob->GetBufferPointer()));
+		}
+		return false;
+	}
+
+	if(!cache.store(key, p_shader_blob->GetBufferPointer(), p_shader_blob->GetBufferSize()))
+	{
+		OutputDebugStringA(" (cache store failed)");
+	}
+
+	OutputDebugStringA(" succeeded.\n");
+
+	return true;
+}
@@ -0,0 +1,27 @@
+﻿#pragma once
+#ifndef SHADER_LOADER_H_INCLUDED
+#define SHADER_LOADER_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <d3dcommon.h>
+#include <wrl/client.h>
+
+class ShaderCache;
+
+namespace shader
+{
+	uint32_t getCompileFlags();
+
+	// キャッシュに無いときだけコンパイルしてキャッシュに保存する
+	bool load(
+		ShaderCache & cache,
+		const std::filesystem::path & path,
+		const char * entry_point,
+		const char * target,
+		const D3D_SHADER_MACRO * p_defines,
+		Microsoft::WRL::ComPtr<ID3DBlob> & p_shader_blob
+	);
+}
+
+#endif // SHADER_LOADER_H_INCLUDED
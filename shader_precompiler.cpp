@@ -0,0 +1,46 @@
+﻿#include <cstdio>
+#include <filesystem>
+#include <Windows.h>
+#include "shader_cache.h"
+#include "shader_loader.h"
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+// shader_precompiler <cache directory> <file> <entry point> <target> [<file> <entry point> <target> ...]
+int main(int argc, char * argv[])
+{
+	if(argc < 5 || (argc - 2) % 3 != 0)
+	{
+		fprintf(stderr, "usage: %s <cache directory> <file> <entry point> <target> ...\n", argv[0]);
+		return 1;
+	}
+
+	ShaderCache shader_cache(argv[1]);
+
+	int result = 0;
+	for(int i = 2; i + 2 < argc; i += 3)
+	{
+		filesystem::path path(argv[i]);
+		if(!filesystem::exists(path))
+		{
+			// 実行時にも読めないので，ここでは警告だけにする
+			fprintf(stderr, "warning: %s not found.\n", argv[i]);
+			continue;
+		}
+
+		ComPtr<ID3DBlob> p_shader_blob;
+		if(!shader::load(shader_cache, path, argv[i + 1], argv[i + 2], nullptr, p_shader_blob))
+		{
+			fprintf(stderr, "error: failed to compile %s (%s, %s).\n", argv[i], argv[i + 1], argv[i + 2]);
+			result = 1;
+			continue;
+		}
+
+		printf("%s (%s, %s) : %zu bytes\n", argv[i], argv[i + 1], argv[i + 2], p_shader_blob->GetBufferSize());
+	}
+
+	printf("cache hits %u, misses %u\n", shader_cache.getHitCount(), shader_cache.getMissCount());
+
+	return result;
+}
@@ -0,0 +1,164 @@
+﻿#include "staging_uploader.h"
+
+using namespace std;
+
+void UploadRing::reset(uint64_t capacity)
+{
+	mCapacity = capacity;
+	mHead = 0;
+	mTail = 0;
+	mSubmissions.clear();
+}
+
+bool UploadRing::allocate(uint64_t size, uint64_t alignment, uint64_t & offset)
+{
+	if(size == 0 || size > mCapacity)
+	{
+		return false;
+	}
+
+	// 全て空いていれば先頭に戻す．途中から始めると，末尾の余りのせいで大きな領域が取れない
+	if(mHead == mTail)
+	{
+		mHead = 0;
+		mTail = 0;
+	}
+
+	const uint64_t position = mHead % mCapacity;
+	const uint64_t aligned_position = (position + alignment - 1) & ~(alignment - 1);
+
+	// 末尾の余りは捨てて先頭から使う
+	uint64_t begin = mHead + (aligned_position - position);
+	if(aligned_position + size > mCapacity)
+	{
+		begin = mHead + (mCapacity - position);
+	}
+
+	if(begin + size - mTail > mCapacity)
+	{
+		return false;
+	}
+
+	offset = begin % mCapacity;
+	mHead = begin + size;
+
+	return true;
+}
+
+void UploadRing::submit(uint64_t fence_value)
+{
+	const uint64_t submitted_end = mSubmissions.empty() ? mTail : mSubmissions.back().end;
+	if(mHead == submitted_end)
+	{
+		return;
+	}
+
+	mSubmissions.push_back({ fence_value, mHead });
+}
+
+void UploadRing::reclaim(uint64_t completed_fence_value)
+{
+	while(!mSubmissions.empty() && mSubmissions.front().fenceValue <= completed_fence_value)
+	{
+		mTail = mSubmissions.front().end;
+		mSubmissions.pop_front();
+	}
+}
+
+void StagingUploader::initialize(UploadQueue * p_queue, uint8_t * p_ring, uint64_t ring_size)
+{
+	mpQueue = p_queue;
+	mpRing = p_ring;
+	mRing.reset(ring_size);
+	mCommands.clear();
+	mLastFenceValue = 0;
+	mStatistics = {};
+}
+
+uint8_t * StagingUploader::allocate(uint64_t size, uint64_t alignment, uint64_t & ring_offset)
+{
+	if(size > mRing.getCapacity())
+	{
+		return nullptr;
+	}
+
+	while(!mRing.allocate(size, alignment, ring_offset))
+	{
+		// 割り当て済みの領域はまだ送っていないコピーが使っているので，先に送る
+		flush();
+
+		if(!mRing.hasSubmissions())
+		{
+			return nullptr;
+		}
+
+		++mStatistics.stallCount;
+		mpQueue->wait(mRing.getOldestFenceValue());
+		mRing.reclaim(mpQueue->getCompletedValue());
+	}
+
+	if(mRing.getUsedBytes() > mStatistics.peakUsedBytes)
+	{
+		mStatistics.peakUsedBytes = mRing.getUsedBytes();
+	}
+
+	return mpRing + ring_offset;
+}
+
+void StagingUploader::copyBuffer(void * p_destination, uint64_t destination_offset, uint64_t ring_offset, uint64_t size)
+{
+	UploadCommand command {};
+	command.pDestination = p_destination;
+	command.subresource = UploadCommand::BufferSubresource;
+	command.destinationOffset = destination_offset;
+	command.sourceOffset = ring_offset;
+	command.size = size;
+
+	mCommands.push_back(command);
+}
+
+void StagingUploader::copyTexture(
+	void * p_destination,
+	uint32_t subresource,
+	uint64_t ring_offset,
+	uint32_t format,
+	uint32_t width,
+	uint32_t height,
+	uint32_t row_pitch,
+	uint64_t size
+)
+{
+	UploadCommand command {};
+	command.pDestination = p_destination;
+	command.subresource = subresource;
+	command.sourceOffset = ring_offset;
+	command.size = size;
+	command.format = format;
+	command.width = width;
+	command.height = height;
+	command.rowPitch = row_pitch;
+
+	mCommands.push_back(command);
+}
+
+uint64_t StagingUploader::flush()
+{
+	if(!mCommands.empty())
+	{
+		mLastFenceValue = mpQueue->execute(mCommands.data(), mCommands.size());
+		mRing.submit(mLastFenceValue);
+
+		++mStatistics.submissionCount;
+		mStatistics.commandCount += static_cast<uint32_t>(mCommands.size());
+		for(const auto & command : mCommands)
+		{
+			mStatistics.uploadedBytes += command.size;
+		}
+
+		mCommands.clear();
+	}
+
+	mRing.reclaim(mpQueue->getCompletedValue());
+
+	return mLastFenceValue;
+}
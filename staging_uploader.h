@@ -0,0 +1,123 @@
+﻿#pragma once
+#ifndef STAGING_UPLOADER_H_INCLUDED
+#define STAGING_UPLOADER_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// アップロード用のリングバッファの割り当て．GPUのコピーが終わった領域を古い順に返す
+// 位置は全て空くまで単調に増やし，容量で割った余りをオフセットにする
+class UploadRing
+{
+public:
+	void reset(uint64_t capacity);
+
+	// alignmentは2の累乗．末尾に収まらなければ先頭から取る．空きが無ければfalse
+	bool allocate(uint64_t size, uint64_t alignment, uint64_t & offset);
+
+	// ここまでに割り当てた領域を，fence_valueのコピーで使うことにする
+	void submit(uint64_t fence_value);
+
+	// completed_fence_valueまでのコピーが使った領域を空ける
+	void reclaim(uint64_t completed_fence_value);
+
+	bool hasSubmissions() const { return !mSubmissions.empty(); }
+	uint64_t getOldestFenceValue() const { return mSubmissions.front().fenceValue; }
+
+	uint64_t getCapacity() const { return mCapacity; }
+	uint64_t getUsedBytes() const { return mHead - mTail; }
+
+private:
+	uint64_t mCapacity = 0;
+	uint64_t mHead = 0;
+	uint64_t mTail = 0;
+
+	struct Submission
+	{
+		uint64_t fenceValue;
+		uint64_t end;
+	};
+	std::deque<Submission> mSubmissions;
+};
+
+// リングからコピー先への1回のコピー．D3D12に依存しないよう，リソースは型を消して持つ
+struct UploadCommand
+{
+	static constexpr uint32_t BufferSubresource = UINT32_MAX;
+
+	void * pDestination;
+	uint32_t subresource;
+	uint64_t destinationOffset;
+	uint64_t sourceOffset;
+	uint64_t size;
+
+	// テクスチャのときのD3D12_SUBRESOURCE_FOOTPRINT
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t rowPitch;
+};
+
+// コピーキュー．差し替えれば，GPUなしでリングとまとめ送りを確かめられる
+class UploadQueue
+{
+public:
+	virtual ~UploadQueue() = default;
+
+	// 全てのコマンドを1回で実行し，完了を表すフェンス値を返す
+	virtual uint64_t execute(const UploadCommand * p_commands, size_t command_count) = 0;
+	virtual uint64_t getCompletedValue() = 0;
+	virtual void wait(uint64_t fence_value) = 0;
+};
+
+// リングに書き込んだデータのコピーを溜め，flushでまとめてキューに送る
+class StagingUploader
+{
+public:
+	struct Statistics
+	{
+		uint32_t submissionCount = 0;
+		uint32_t commandCount = 0;
+		uint64_t uploadedBytes = 0;
+		// リングが一杯で，GPUのコピーを待った回数
+		uint32_t stallCount = 0;
+		uint64_t peakUsedBytes = 0;
+	};
+
+	void initialize(UploadQueue * p_queue, uint8_t * p_ring, uint64_t ring_size);
+
+	// リングの書き込み先．空きが無ければ溜めた分を送り，古いコピーの終わりを待つ
+	// sizeがリングより大きいときはnullptr
+	uint8_t * allocate(uint64_t size, uint64_t alignment, uint64_t & ring_offset);
+
+	void copyBuffer(void * p_destination, uint64_t destination_offset, uint64_t ring_offset, uint64_t size);
+	void copyTexture(
+		void * p_destination,
+		uint32_t subresource,
+		uint64_t ring_offset,
+		uint32_t format,
+		uint32_t width,
+		uint32_t height,
+		uint32_t row_pitch,
+		uint64_t size
+	);
+
+	// 溜めたコピーを送る．直前までのコピーの完了を表すフェンス値を返す
+	uint64_t flush();
+
+	uint64_t getRingCapacity() const { return mRing.getCapacity(); }
+	uint64_t getLastFenceValue() const { return mLastFenceValue; }
+	const Statistics & getStatistics() const { return mStatistics; }
+
+private:
+	UploadQueue * mpQueue = nullptr;
+	uint8_t * mpRing = nullptr;
+	UploadRing mRing;
+	std::vector<UploadCommand> mCommands;
+	uint64_t mLastFenceValue = 0;
+	Statistics mStatistics;
+};
+
+#endif // STAGING_UPLOADER_H_INCLUDED
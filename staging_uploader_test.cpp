@@ -0,0 +1,247 @@
+﻿#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "staging_uploader.h"
+
+using namespace std;
+
+namespace
+{
+	uint32_t failure_count = 0;
+
+	void expect(bool condition, const char * message)
+	{
+		if(!condition)
+		{
+			fprintf(stderr, "error: %s\n", message);
+			++failure_count;
+		}
+	}
+
+	// GPUの代わりに，送られたコマンドと待ったフェンス値を記録する．
+	// コピーはcompleteを呼ぶまで終わらず，waitはそのフェンス値まで終わらせる
+	class MockUploadQueue : public UploadQueue
+	{
+	public:
+		uint64_t execute(const UploadCommand * p_commands, size_t command_count) override
+		{
+			executions.emplace_back(p_commands, p_commands + command_count);
+			return ++mLastFenceValue;
+		}
+
+		uint64_t getCompletedValue() override { return mCompletedValue; }
+
+		void wait(uint64_t fence_value) override
+		{
+			waits.push_back(fence_value);
+			complete(fence_value);
+		}
+
+		void complete(uint64_t fence_value)
+		{
+			mCompletedValue = max(mCompletedValue, fence_value);
+		}
+
+		vector<vector<UploadCommand>> executions;
+		vector<uint64_t> waits;
+
+	private:
+		uint64_t mLastFenceValue = 0;
+		uint64_t mCompletedValue = 0;
+	};
+
+	// 末尾に収まらない割り当ては余りを捨てて先頭から取り，まだ空いていなければ失敗する
+	void testRingWrapAround()
+	{
+		UploadRing ring;
+		ring.reset(256);
+
+		uint64_t offset = 0;
+		expect(ring.allocate(100, 16, offset) && offset == 0, "the first allocation is not at the beginning.");
+		ring.submit(1);
+		expect(ring.allocate(100, 16, offset) && offset == 112, "an allocation was not aligned.");
+		expect(ring.getUsedBytes() == 212, "the used bytes include a wrong alignment padding.");
+		ring.submit(2);
+
+		// 224からの64バイトは末尾を越えるが，先頭はまだコピーが使っている
+		expect(!ring.allocate(64, 16, offset), "an allocation overwrote a region in use.");
+		expect(ring.getUsedBytes() == 212, "a failed allocation changed the used bytes.");
+
+		ring.reclaim(1);
+		expect(ring.getUsedBytes() == 112, "reclaiming did not free the first submission.");
+		expect(ring.allocate(64, 16, offset) && offset == 0, "an allocation past the end did not wrap around.");
+
+		// 捨てた末尾の44バイトも，次に先頭を空けるまで使用中になる
+		expect(ring.getUsedBytes() == 220, "the skipped end of the ring was not counted as used.");
+		ring.submit(3);
+
+		expect(ring.allocate(36, 4, offset) && offset == 64, "an allocation did not fill the ring exactly.");
+		expect(!ring.allocate(1, 1, offset), "an allocation succeeded in a full ring.");
+		ring.submit(4);
+
+		ring.reclaim(2);
+		expect(ring.allocate(64, 64, offset) && offset == 128, "the freed middle of the ring was not reused.");
+
+		// 容量ちょうどは空のリングになら取れ，それより大きいものは取れない
+		ring.reset(256);
+		expect(ring.allocate(256, 256, offset) && offset == 0, "an allocation of the whole ring failed.");
+		ring.reset(256);
+		expect(!ring.allocate(257, 1, offset), "an allocation larger than the ring succeeded.");
+		expect(!ring.allocate(0, 1, offset), "an empty allocation succeeded.");
+	}
+
+	// 全て空いたリングは先頭に戻るので，途中で空いても半分より大きい領域が取れる
+	void testRingRewindWhenEmpty()
+	{
+		UploadRing ring;
+		ring.reset(256);
+
+		uint64_t offset = 0;
+		expect(ring.allocate(64, 16, offset) && offset == 0, "the first allocation is not at the beginning.");
+		ring.submit(1);
+		ring.reclaim(1);
+		expect(ring.getUsedBytes() == 0, "reclaiming did not free the ring.");
+
+		expect(ring.allocate(200, 16, offset) && offset == 0, "an allocation in an empty ring did not start at the beginning.");
+		expect(ring.getUsedBytes() == 200, "the rewound ring uses wrong bytes.");
+
+		// アップローダーも待たずに取れる
+		MockUploadQueue queue;
+		vector<uint8_t> ring_memory(256);
+		int destination = 0;
+
+		StagingUploader uploader;
+		uploader.initialize(&queue, ring_memory.data(), ring_memory.size());
+
+		uint64_t ring_offset = 0;
+		expect(uploader.allocate(64, 16, ring_offset) != nullptr, "a small allocation failed.");
+		uploader.copyBuffer(&destination, 0, ring_offset, 64);
+		uploader.flush();
+		queue.complete(1);
+		uploader.flush();
+
+		expect(uploader.allocate(200, 16, ring_offset) == ring_memory.data() && ring_offset == 0, "a large allocation in an empty ring failed.");
+		expect(queue.waits.empty() && uploader.getStatistics().stallCount == 0, "a large allocation in an empty ring waited.");
+	}
+
+	// 完了したフェンス値までの送信を古い順に空け，割り当てていない送信は記録しない
+	void testRingReclaimOrder()
+	{
+		UploadRing ring;
+		ring.reset(1024);
+
+		uint64_t offset = 0;
+		ring.allocate(100, 4, offset);
+		ring.submit(1);
+		ring.allocate(200, 4, offset);
+		ring.submit(2);
+		ring.allocate(300, 4, offset);
+		ring.submit(3);
+
+		// 新しい割り当てがなければ送信を増やさない
+		ring.submit(4);
+
+		expect(ring.hasSubmissions() && ring.getOldestFenceValue() == 1, "the oldest submission is not the first one.");
+		expect(ring.getUsedBytes() == 600, "the submissions use wrong bytes.");
+
+		ring.reclaim(0);
+		expect(ring.getUsedBytes() == 600, "reclaiming before any completion freed a submission.");
+
+		ring.reclaim(1);
+		expect(ring.getUsedBytes() == 500 && ring.getOldestFenceValue() == 2, "reclaiming fence 1 did not free only the first submission.");
+
+		ring.reclaim(3);
+		expect(ring.getUsedBytes() == 0, "reclaiming fence 3 did not free the rest.");
+		expect(!ring.hasSubmissions(), "an empty submission was recorded.");
+	}
+
+	// リングが一杯なら，溜めたコピーを送ってから最も古い送信の完了だけを待つ
+	void testUploaderStall()
+	{
+		MockUploadQueue queue;
+		vector<uint8_t> ring(256);
+		int destination = 0;
+
+		StagingUploader uploader;
+		uploader.initialize(&queue, ring.data(), ring.size());
+
+		uint64_t ring_offset = 0;
+		expect(uploader.allocate(128, 16, ring_offset) == ring.data() && ring_offset == 0, "the first allocation is wrong.");
+		uploader.copyBuffer(&destination, 0, ring_offset, 128);
+		expect(uploader.allocate(128, 16, ring_offset) == ring.data() + 128 && ring_offset == 128, "the second allocation is wrong.");
+		uploader.copyBuffer(&destination, 128, ring_offset, 128);
+		expect(queue.executions.empty(), "copies were sent before flush.");
+
+		// 送っていない2つのコピーがリングを使い切っている
+		auto p_data = uploader.allocate(64, 16, ring_offset);
+		expect(p_data == ring.data() && ring_offset == 0, "an allocation after a stall is wrong.");
+		expect(queue.executions.size() == 1 && queue.executions[0].size() == 2, "the pending copies were not sent in one batch before waiting.");
+		expect(queue.waits.size() == 1 && queue.waits[0] == 1, "the stall did not wait for the flushed copies.");
+		expect(uploader.getStatistics().stallCount == 1, "the stall was not counted.");
+		uploader.copyBuffer(&destination, 0, ring_offset, 64);
+		uploader.flush();
+
+		// 2回に分けて送ると，空けるのに足りる最も古い送信だけを待つ
+		queue.waits.clear();
+		expect(uploader.allocate(192, 16, ring_offset) != nullptr && ring_offset == 64, "an allocation after the first copy is wrong.");
+		expect(queue.waits.empty(), "an allocation that fits waited.");
+		uploader.copyBuffer(&destination, 0, ring_offset, 192);
+		uploader.flush();
+
+		expect(uploader.allocate(64, 16, ring_offset) != nullptr && ring_offset == 0, "an allocation at the freed beginning is wrong.");
+		expect(queue.waits.size() == 1 && queue.waits[0] == 2, "the stall did not wait for the oldest submission only.");
+		uploader.copyBuffer(&destination, 0, ring_offset, 64);
+		uploader.flush();
+
+		expect(uploader.allocate(192, 16, ring_offset) != nullptr && ring_offset == 64, "an allocation waiting for the oldest copy is wrong.");
+		expect(queue.waits.size() == 2 && queue.waits[1] == 3, "the stall waited for a newer submission than needed.");
+		expect(uploader.getStatistics().stallCount == 3, "the later stalls were not counted.");
+
+		const auto & statistics = uploader.getStatistics();
+		expect(statistics.submissionCount == 4 && statistics.commandCount == 5, "the submission statistics are wrong.");
+		expect(statistics.uploadedBytes == 576, "the uploaded bytes are wrong.");
+		expect(statistics.peakUsedBytes == 256, "the peak used bytes are wrong.");
+	}
+
+	// リングより大きい割り当ては，送ったり待ったりせずにnullptrを返す
+	void testUploaderOversize()
+	{
+		MockUploadQueue queue;
+		vector<uint8_t> ring(256);
+		int destination = 0;
+
+		StagingUploader uploader;
+		uploader.initialize(&queue, ring.data(), ring.size());
+
+		uint64_t ring_offset = 0;
+		expect(uploader.allocate(64, 16, ring_offset) != nullptr, "a small allocation failed.");
+		uploader.copyBuffer(&destination, 0, ring_offset, 64);
+
+		expect(uploader.allocate(257, 16, ring_offset) == nullptr, "an allocation larger than the ring did not return nullptr.");
+		expect(queue.executions.empty() && queue.waits.empty(), "an allocation larger than the ring flushed or waited.");
+		expect(uploader.getStatistics().stallCount == 0, "an allocation larger than the ring was counted as a stall.");
+
+		expect(uploader.flush() == 1 && queue.executions.size() == 1, "the pending copy was lost.");
+	}
+}
+
+// staging_uploader_test
+// コピーキューを差し替えて，リングの割り当てと空け方，一杯のときの待ち方を確かめる
+int main()
+{
+	testRingWrapAround();
+	testRingRewindWhenEmpty();
+	testRingReclaimOrder();
+	testUploaderStall();
+	testUploaderOversize();
+
+	if(failure_count > 0)
+	{
+		fprintf(stderr, "%u checks failed.\n", failure_count);
+		return 1;
+	}
+
+	printf("all checks passed.\n");
+
+	return 0;
+}
@@ -0,0 +1,558 @@
+﻿#include "texture_atlas.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+using namespace std;
+
+namespace texture_atlas
+{
+	namespace
+	{
+		uint32_t alignUp(uint32_t value, uint32_t alignment)
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		uint32_t ceilPowerOfTwo(uint32_t value)
+		{
+			uint32_t power = 1;
+			while(power < value)
+			{
+				power <<= 1;
+			}
+
+			return power;
+		}
+
+		bool intersects(const Rect & a, const Rect & b)
+		{
+			return
+				a.x < b.x + b.width && b.x < a.x + a.width &&
+				a.y < b.y + b.height && b.y < a.y + a.height;
+		}
+
+		bool contains(const Rect & outer, const Rect & inner)
+		{
+			return
+				outer.x <= inner.x && inner.x + inner.width <= outer.x + outer.width &&
+				outer.y <= inner.y && inner.y + inner.height <= outer.y + outer.height;
+		}
+
+		// 1枚のアトラスに入れられるだけ入れる．大きさの単位は区画の揃え
+		template<typename Packer>
+		void packAtlas(
+			const vector<Size> & cells,
+			const vector<uint32_t> & indices,
+			uint32_t width,
+			uint32_t height,
+			vector<pair<uint32_t, Rect>> & placed,
+			vector<uint32_t> & rejected
+		)
+		{
+			Packer packer;
+			packer.reset(width, height);
+
+			placed.clear();
+			rejected.clear();
+			for(const auto index : indices)
+			{
+				Rect rect;
+				if(packer.insert(cells[index].width, cells[index].height, rect))
+				{
+					placed.emplace_back(index, rect);
+				}
+				else
+				{
+					rejected.push_back(index);
+				}
+			}
+		}
+	}
+
+	const char * getAlgorithmName(Algorithm algorithm)
+	{
+		switch(algorithm)
+		{
+		case Algorithm::MaxRects: return "MaxRects";
+		default: return "Skyline";
+		}
+	}
+
+	void SkylinePacker::reset(uint32_t width, uint32_t height)
+	{
+		mWidth = width;
+		mHeight = height;
+		mSkyline.clear();
+		mSkyline.push_back({ 0, 0, width });
+	}
+
+	bool SkylinePacker::fit(size_t index, uint32_t width, uint32_t height, uint32_t & y) const
+	{
+		const auto x = mSkyline[index].x;
+		if(x + width > mWidth)
+		{
+			return false;
+		}
+
+		// 幅の範囲にある輪郭の最も低いところの上に置く
+		y = 0;
+		int64_t width_left = width;
+		for(size_t i = index; width_left > 0; ++i)
+		{
+			y = max(y, mSkyline[i].y);
+			if(y + height > mHeight)
+			{
+				return false;
+			}
+			width_left -= mSkyline[i].width;
+		}
+
+		return true;
+	}
+
+	bool SkylinePacker::insert(uint32_t width, uint32_t height, Rect & rect)
+	{
+		size_t best_index = mSkyline.size();
+		uint32_t best_bottom = UINT32_MAX;
+		uint32_t best_width = UINT32_MAX;
+		for(size_t i = 0; i < mSkyline.size(); ++i)
+		{
+			uint32_t y;
+			if(!fit(i, width, height, y))
+			{
+				continue;
+			}
+
+			if(y + height < best_bottom || (y + height == best_bottom && mSkyline[i].width < best_width))
+			{
+				best_index = i;
+				best_bottom = y + height;
+				best_width = mSkyline[i].width;
+				rect = { mSkyline[i].x, y, width, height };
+			}
+		}
+
+		if(best_index == mSkyline.size())
+		{
+			return false;
+		}
+
+		mSkyline.insert(mSkyline.begin() + best_index, { rect.x, rect.y + height, width });
+
+		// 新しい輪郭に隠れた分を削る
+		for(size_t i = best_index + 1; i < mSkyline.size();)
+		{
+			const auto & previous = mSkyline[i - 1];
+			auto & node = mSkyline[i];
+			if(node.x >= previous.x + previous.width)
+			{
+				break;
+			}
+
+			const auto shrink = previous.x + previous.width - node.x;
+			if(node.width <= shrink)
+			{
+				mSkyline.erase(mSkyline.begin() + i);
+				continue;
+			}
+
+			node.x += shrink;
+			node.width -= shrink;
+			break;
+		}
+
+		for(size_t i = 1; i < mSkyline.size();)
+		{
+			if(mSkyline[i - 1].y == mSkyline[i].y)
+			{
+				mSkyline[i - 1].width += mSkyline[i].width;
+				mSkyline.erase(mSkyline.begin() + i);
+				continue;
+			}
+			++i;
+		}
+
+		return true;
+	}
+
+	void MaxRectsPacker::reset(uint32_t width, uint32_t height)
+	{
+		mFreeRects.clear();
+		mFreeRects.push_back({ 0, 0, width, height });
+	}
+
+	bool MaxRectsPacker::insert(uint32_t width, uint32_t height, Rect & rect)
+	{
+		bool is_found = false;
+		uint32_t best_short_side = UINT32_MAX;
+		uint32_t best_long_side = UINT32_MAX;
+		for(const auto & free_rect : mFreeRects)
+		{
+			if(free_rect.width < width || free_rect.height < height)
+			{
+				continue;
+			}
+
+			const auto leftover_width = free_rect.width - width;
+			const auto leftover_height = free_rect.height - height;
+			const auto short_side = min(leftover_width, leftover_height);
+			const auto long_side = max(leftover_width, leftover_height);
+			if(short_side < best_short_side || (short_side == best_short_side && long_side < best_long_side))
+			{
+				is_found = true;
+				best_short_side = short_side;
+				best_long_side = long_side;
+				rect = { free_rect.x, free_rect.y, width, height };
+			}
+		}
+
+		if(!is_found)
+		{
+			return false;
+		}
+
+		splitFreeRects(rect);
+		pruneFreeRects();
+
+		return true;
+	}
+
+	void MaxRectsPacker::splitFreeRects(const Rect & used)
+	{
+		// 置いた矩形と重なる空き矩形を，重ならない最大の4つに分ける
+		mNewFreeRects.clear();
+		for(const auto & free_rect : mFreeRects)
+		{
+			if(!intersects(free_rect, used))
+			{
+				mNewFreeRects.push_back(free_rect);
+				continue;
+			}
+
+			const auto used_right = used.x + used.width;
+			const auto used_bottom = used.y + used.height;
+			const auto free_right = free_rect.x + free_rect.width;
+			const auto free_bottom = free_rect.y + free_rect.height;
+			if(used.x > free_rect.x)
+			{
+				mNewFreeRects.push_back({ free_rect.x, free_rect.y, used.x - free_rect.x, free_rect.height });
+			}
+			if(used_right < free_right)
+			{
+				mNewFreeRects.push_back({ used_right, free_rect.y, free_right - used_right, free_rect.height });
+			}
+			if(used.y > free_rect.y)
+			{
+				mNewFreeRects.push_back({ free_rect.x, free_rect.y, free_rect.width, used.y - free_rect.y });
+			}
+			if(used_bottom < free_bottom)
+			{
+				mNewFreeRects.push_back({ free_rect.x, used_bottom, free_rect.width, free_bottom - used_bottom });
+			}
+		}
+
+		mFreeRects.swap(mNewFreeRects);
+	}
+
+	void MaxRectsPacker::pruneFreeRects()
+	{
+		// 他に含まれる空き矩形は選ばれることがないので捨てる
+		for(size_t i = 0; i < mFreeRects.size(); ++i)
+		{
+			for(size_t j = i + 1; j < mFreeRects.size();)
+			{
+				if(contains(mFreeRects[i], mFreeRects[j]))
+				{
+					mFreeRects.erase(mFreeRects.begin() + j);
+					continue;
+				}
+
+				if(contains(mFreeRects[j], mFreeRects[i]))
+				{
+					mFreeRects.erase(mFreeRects.begin() + i);
+					--i;
+					break;
+				}
+				++j;
+			}
+		}
+	}
+
+	uint32_t PaddingPolicy::getCellSize(uint32_t size) const
+	{
+		return alignUp(size + getPadding() * 2, getAlignment());
+	}
+
+	bool pack(
+		const vector<Size> & sizes,
+		const PaddingPolicy & policy,
+		uint32_t max_size,
+		Algorithm algorithm,
+		vector<Size> & atlas_sizes,
+		vector<Placement> & placements
+	)
+	{
+		const auto alignment = policy.getAlignment();
+		const auto padding = policy.getPadding();
+		if(max_size < alignment)
+		{
+			return false;
+		}
+
+		// 区画の揃えを単位にして詰める
+		vector<Size> cells(sizes.size());
+		for(size_t i = 0; i < sizes.size(); ++i)
+		{
+			const auto cell_width = policy.getCellSize(sizes[i].width);
+			const auto cell_height = policy.getCellSize(sizes[i].height);
+			if(cell_width > max_size || cell_height > max_size)
+			{
+				return false;
+			}
+
+			cells[i] = { cell_width / alignment, cell_height / alignment };
+		}
+
+		vector<uint32_t> remaining(sizes.size());
+		iota(remaining.begin(), remaining.end(), 0);
+		stable_sort(
+			remaining.begin(),
+			remaining.end(),
+			[&cells](uint32_t a, uint32_t b)
+			{
+				if(cells[a].height != cells[b].height)
+				{
+					return cells[a].height > cells[b].height;
+				}
+				return cells[a].width > cells[b].width;
+			}
+		);
+
+		atlas_sizes.clear();
+		placements.assign(sizes.size(), {});
+
+		vector<pair<uint32_t, Rect>> placed;
+		vector<uint32_t> rejected;
+		while(!remaining.empty())
+		{
+			uint64_t area = 0;
+			uint32_t width = alignment;
+			uint32_t height = alignment;
+			for(const auto index : remaining)
+			{
+				area += static_cast<uint64_t>(cells[index].width) * cells[index].height * alignment * alignment;
+				width = max(width, ceilPowerOfTwo(cells[index].width * alignment));
+				height = max(height, ceilPowerOfTwo(cells[index].height * alignment));
+			}
+
+			while(static_cast<uint64_t>(width) * height < area && (width < max_size || height < max_size))
+			{
+				if((width <= height && width < max_size) || height >= max_size)
+				{
+					width *= 2;
+				}
+				else
+				{
+					height *= 2;
+				}
+			}
+
+			// 入り切らなければ，max_sizeになるまで短い辺を倍にしてやり直す
+			for(;;)
+			{
+				if(algorithm == Algorithm::MaxRects)
+				{
+					packAtlas<MaxRectsPacker>(cells, remaining, width / alignment, height / alignment, placed, rejected);
+				}
+				else
+				{
+					packAtlas<SkylinePacker>(cells, remaining, width / alignment, height / alignment, placed, rejected);
+				}
+
+				if(rejected.empty() || (width >= max_size && height >= max_size))
+				{
+					break;
+				}
+
+				if((width <= height && width < max_size) || height >= max_size)
+				{
+					width *= 2;
+				}
+				else
+				{
+					height *= 2;
+				}
+			}
+
+			if(placed.empty())
+			{
+				return false;
+			}
+
+			const auto atlas = static_cast<uint32_t>(atlas_sizes.size());
+			atlas_sizes.push_back({ width, height });
+			for(const auto & item : placed)
+			{
+				auto & placement = placements[item.first];
+				placement.atlas = atlas;
+				placement.rect.x = item.second.x * alignment + padding;
+				placement.rect.y = item.second.y * alignment + padding;
+				placement.rect.width = sizes[item.first].width;
+				placement.rect.height = sizes[item.first].height;
+			}
+
+			remaining.swap(rejected);
+		}
+
+		return true;
+	}
+
+	void blit(
+		const image_decoder::Image & image,
+		const Placement & placement,
+		const PaddingPolicy & policy,
+		image_decoder::Image & atlas
+	)
+	{
+		const auto padding = policy.getPadding();
+		const auto cell_x = placement.rect.x - padding;
+		const auto cell_y = placement.rect.y - padding;
+		const auto cell_width = policy.getCellSize(image.width);
+		const auto cell_height = policy.getCellSize(image.height);
+
+		for(uint32_t y = 0; y < cell_height; ++y)
+		{
+			const auto source_y = static_cast<uint32_t>(clamp<int64_t>(static_cast<int64_t>(y) - padding, 0, image.height - 1));
+			auto p_destination = atlas.pixels.data() + (static_cast<size_t>(cell_y + y) * atlas.width + cell_x) * 4;
+			const auto p_source_row = image.pixels.data() + static_cast<size_t>(source_y) * image.width * 4;
+			for(uint32_t x = 0; x < cell_width; ++x)
+			{
+				const auto source_x = static_cast<uint32_t>(clamp<int64_t>(static_cast<int64_t>(x) - padding, 0, image.width - 1));
+				memcpy(p_destination + x * 4, p_source_row + source_x * 4, 4);
+			}
+		}
+	}
+
+	const Entry * Manifest::find(const string & path) const
+	{
+		for(const auto & entry : entries)
+		{
+			if(entry.path == path)
+			{
+				return &entry;
+			}
+		}
+
+		return nullptr;
+	}
+
+	string getAtlasName(uint32_t index)
+	{
+		return "atlas" + to_string(index);
+	}
+
+	// atlas <幅> <高さ>
+	// entry <アトラス> <x> <y> <幅> <高さ> <パス>
+	// をタブ区切りで1行ずつ書く
+	bool writeManifest(const filesystem::path & path, const Manifest & manifest)
+	{
+		auto tmp_path = path;
+		tmp_path += ".tmp";
+
+		error_code error;
+		filesystem::create_directories(path.parent_path(), error);
+		{
+			ofstream fout(tmp_path, ios::binary);
+			if(!fout)
+			{
+				return false;
+			}
+
+			for(const auto & atlas : manifest.atlases)
+			{
+				fout << "atlas\t" << atlas.width << '\t' << atlas.height << '\n';
+			}
+
+			for(const auto & entry : manifest.entries)
+			{
+				const auto & rect = entry.placement.rect;
+				fout
+					<< "entry\t" << entry.placement.atlas
+					<< '\t' << rect.x << '\t' << rect.y << '\t' << rect.width << '\t' << rect.height
+					<< '\t' << entry.path << '\n';
+			}
+
+			if(!fout)
+			{
+				return false;
+			}
+		}
+
+		filesystem::rename(tmp_path, path, error);
+
+		return !error;
+	}
+
+	bool readManifest(const filesystem::path & path, Manifest & manifest)
+	{
+		ifstream fin(path, ios::binary);
+		if(!fin)
+		{
+			return false;
+		}
+
+		return readManifest(fin, manifest);
+	}
+
+	bool readManifest(const uint8_t * p_data, size_t size, Manifest & manifest)
+	{
+		istringstream iss(string(reinterpret_cast<const char *>(p_data), size));
+
+		return readManifest(iss, manifest);
+	}
+
+	bool readManifest(istream & in, Manifest & manifest)
+	{
+		manifest = {};
+
+		string line;
+		while(getline(in, line))
+		{
+			istringstream iss(line);
+			string kind;
+			iss >> kind;
+			if(kind == "atlas")
+			{
+				Size size;
+				if(!(iss >> size.width >> size.height))
+				{
+					return false;
+				}
+				manifest.atlases.push_back(size);
+			}
+			else if(kind == "entry")
+			{
+				Entry entry;
+				auto & rect = entry.placement.rect;
+				if(!(iss >> entry.placement.atlas >> rect.x >> rect.y >> rect.width >> rect.height))
+				{
+					return false;
+				}
+
+				// パスは空白を含むことがあるので，最後のタブの後ろを全て使う
+				const auto separator = line.rfind('\t');
+				entry.path = line.substr(separator + 1);
+				if(entry.placement.atlas >= manifest.atlases.size())
+				{
+					return false;
+				}
+				manifest.entries.push_back(move(entry));
+			}
+		}
+
+		return true;
+	}
+}
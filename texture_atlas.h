@@ -0,0 +1,145 @@
+﻿#pragma once
+#ifndef TEXTURE_ATLAS_H_INCLUDED
+#define TEXTURE_ATLAS_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <string>
+#include <vector>
+#include "image_decoder.h"
+
+// 小さいテクスチャを1枚にまとめる．マテリアルはUVをscaleとoffsetで写して使う
+// TextureCookerがアトラスのDDSと対応表を書き出し，実行時は対応表にあるテクスチャの代わりにアトラスを読む
+namespace texture_atlas
+{
+	struct Rect
+	{
+		uint32_t x = 0;
+		uint32_t y = 0;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+
+	enum class Algorithm : uint32_t
+	{
+		Skyline,
+		MaxRects,
+	};
+
+	const char * getAlgorithmName(Algorithm algorithm);
+
+	// 上端の輪郭線を持ち，最も低く置ける位置に置く(Bottom-Left)．速いが輪郭の下の隙間は使えない
+	class SkylinePacker
+	{
+	public:
+		void reset(uint32_t width, uint32_t height);
+		bool insert(uint32_t width, uint32_t height, Rect & rect);
+
+	private:
+		bool fit(size_t index, uint32_t width, uint32_t height, uint32_t & y) const;
+
+	private:
+		struct Node
+		{
+			uint32_t x;
+			uint32_t y;
+			uint32_t width;
+		};
+		std::vector<Node> mSkyline;
+		uint32_t mWidth = 0;
+		uint32_t mHeight = 0;
+	};
+
+	// 重なりを許した空き矩形の集合を持ち，短い辺の余りが最小の位置に置く(Best Short Side Fit)
+	class MaxRectsPacker
+	{
+	public:
+		void reset(uint32_t width, uint32_t height);
+		bool insert(uint32_t width, uint32_t height, Rect & rect);
+
+	private:
+		void splitFreeRects(const Rect & used);
+		void pruneFreeRects();
+
+	private:
+		std::vector<Rect> mFreeRects;
+		std::vector<Rect> mNewFreeRects;
+	};
+
+	// ミップごとの縁の確保
+	// 画像の原点を2^(mipCount-1)に揃えると，どのミップでも2x2の平均が別の画像にまたがらない
+	// 縁をgutter << (mipCount-1)にすると，最小のミップでもgutter画素の縁が残る
+	struct PaddingPolicy
+	{
+		uint32_t gutter = 2;
+		uint32_t mipCount = 4;
+		// BCは4x4ブロックが別の画像にまたがらないよう，区画をさらに揃える
+		uint32_t blockSize = 1;
+
+		uint32_t getPadding() const { return gutter << (mipCount - 1); }
+		uint32_t getAlignment() const { return blockSize << (mipCount - 1); }
+		// 画像と縁を合わせた区画の大きさ
+		uint32_t getCellSize(uint32_t size) const;
+	};
+
+	struct Placement
+	{
+		uint32_t atlas = 0;
+		// 縁を除いた画像の位置
+		Rect rect;
+	};
+
+	struct Size
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+
+	// 大きい順に詰め，max_sizeに収まらない分は次のアトラスに回す
+	// アトラスは2の累乗の大きさで，全てを入れられる最小のものから広げていく
+	// 区画がmax_sizeより大きい画像があればfalse
+	bool pack(
+		const std::vector<Size> & sizes,
+		const PaddingPolicy & policy,
+		uint32_t max_size,
+		Algorithm algorithm,
+		std::vector<Size> & atlas_sizes,
+		std::vector<Placement> & placements
+	);
+
+	// 画像を区画全体に端の画素を伸ばしながら書き込む
+	void blit(
+		const image_decoder::Image & image,
+		const Placement & placement,
+		const PaddingPolicy & policy,
+		image_decoder::Image & atlas
+	);
+
+	// 対応表．パスは対応表のあるフォルダからの相対パスで，区切りは/
+	struct Entry
+	{
+		std::string path;
+		Placement placement;
+	};
+
+	struct Manifest
+	{
+		std::vector<Size> atlases;
+		std::vector<Entry> entries;
+
+		const Entry * find(const std::string & path) const;
+	};
+
+	constexpr const char * ManifestFileName = "atlas.txt";
+
+	// アトラスのテクスチャの名前．クック済みのDDSは<名前>.ddsになる
+	std::string getAtlasName(uint32_t index);
+
+	bool writeManifest(const std::filesystem::path & path, const Manifest & manifest);
+	bool readManifest(const std::filesystem::path & path, Manifest & manifest);
+	bool readManifest(const uint8_t * p_data, size_t size, Manifest & manifest);
+	bool readManifest(std::istream & in, Manifest & manifest);
+}
+
+#endif // TEXTURE_ATLAS_H_INCLUDED
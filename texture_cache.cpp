@@ -0,0 +1,292 @@
+﻿#include "texture_cache.h"
+#include "hash.h"
+
+using namespace std;
+using namespace Microsoft::WRL;
+
+TextureCache::TextureCache(uint64_t budget_bytes)
+	: mBudgetBytes(budget_bytes)
+{
+}
+
+void TextureCache::setBudget(uint64_t budget_bytes)
+{
+	mBudgetBytes = budget_bytes;
+
+	trim();
+}
+
+size_t TextureCache::PathHash::operator()(const filesystem::path::string_type & path) const
+{
+	return static_cast<size_t>(
+		hashing::fnv1a64(path.data(), path.size() * sizeof(filesystem::path::value_type))
+	);
+}
+
+TextureCache::PathID TextureCache::internPath(const filesystem::path & path)
+{
+	// 区切り文字や "." の違いで別のテクスチャとして読み込まないようにする
+	auto normalized_path = path.lexically_normal();
+	normalized_path.make_preferred();
+
+	auto result = mPathIDs.try_emplace(normalized_path.native(), static_cast<PathID>(mPathEntries.size()));
+	if(result.second)
+	{
+		mPathEntries.emplace_back();
+	}
+
+	return result.first->second;
+}
+
+bool TextureCache::find(PathID path_id, ComPtr<ID3D12Resource> & p_texture)
+{
+	const auto & path_entry = mPathEntries[path_id];
+	if(!isValid(path_entry))
+	{
+		++mMissCount;
+		return false;
+	}
+
+	unlink(path_entry.entryIndex);
+	linkFront(path_entry.entryIndex);
+
+	p_texture = mEntries[path_entry.entryIndex].pTexture;
+	++mHitCount;
+
+	return true;
+}
+
+bool TextureCache::findByFileHash(PathID path_id, uint64_t file_hash, ComPtr<ID3D12Resource> & p_texture)
+{
+	auto it = mFileHashEntries.find(file_hash);
+	if(it == mFileHashEntries.end() || !bindPath(path_id, it->second, p_texture))
+	{
+		return false;
+	}
+
+	++mSameFileCount;
+
+	return true;
+}
+
+bool TextureCache::findByPixelHash(
+	PathID path_id,
+	uint64_t file_hash,
+	uint64_t pixel_hash,
+	ComPtr<ID3D12Resource> & p_texture
+)
+{
+	auto it = mPixelHashEntries.find(pixel_hash);
+	if(it == mPixelHashEntries.end() || !bindPath(path_id, it->second, p_texture))
+	{
+		return false;
+	}
+
+	++mSamePixelsCount;
+
+	// 次に同じファイルを読んだときはデコードしない
+	mFileHashEntries[file_hash] = it->second;
+	mEntries[it->second.entryIndex].fileHashes.push_back(file_hash);
+
+	return true;
+}
+
+void TextureCache::insert(
+	PathID path_id,
+	const ComPtr<ID3D12Resource> & p_texture,
+	uint64_t size_in_bytes,
+	uint64_t file_hash,
+	uint64_t pixel_hash
+)
+{
+	EntryIndex entry_index;
+	if(mFreeEntries.empty())
+	{
+		entry_index = static_cast<EntryIndex>(mEntries.size());
+		mEntries.emplace_back();
+	}
+	else
+	{
+		entry_index = mFreeEntries.back();
+		mFreeEntries.pop_back();
+	}
+
+	auto & entry = mEntries[entry_index];
+	entry.pTexture = p_texture;
+	entry.sizeInBytes = size_in_bytes;
+	entry.fileHashes.push_back(file_hash);
+	entry.pixelHash = pixel_hash;
+	linkFront(entry_index);
+
+	const EntryReference reference { entry_index, entry.generation };
+	mPathEntries[path_id] = reference;
+	mFileHashEntries[file_hash] = reference;
+	mPixelHashEntries[pixel_hash] = reference;
+
+	++mTextureCount;
+	mResidentBytes += size_in_bytes;
+
+	trim();
+
+	if(mResidentBytes > mPeakBytes)
+	{
+		mPeakBytes = mResidentBytes;
+	}
+}
+
+void TextureCache::trim()
+{
+	// 参照されているものは捨てられないので，予算を超えたままになることがある
+	auto entry_index = mLeastRecent;
+	while(mResidentBytes > mBudgetBytes && entry_index != InvalidEntryIndex)
+	{
+		const auto next_entry_index = mEntries[entry_index].previous;
+		if(!isReferenced(mEntries[entry_index].pTexture.Get()))
+		{
+			evict(entry_index);
+		}
+		entry_index = next_entry_index;
+	}
+}
+
+void TextureCache::clear()
+{
+	while(mLeastRecent != InvalidEntryIndex)
+	{
+		evict(mLeastRecent);
+	}
+}
+
+TextureCache::Statistics TextureCache::getStatistics() const
+{
+	Statistics statistics;
+	statistics.textureCount = mTextureCount;
+	statistics.hitCount = mHitCount;
+	statistics.missCount = mMissCount;
+	statistics.evictionCount = mEvictionCount;
+	statistics.residentBytes = mResidentBytes;
+	statistics.peakBytes = mPeakBytes;
+	statistics.budgetBytes = mBudgetBytes;
+	statistics.sameFileCount = mSameFileCount;
+	statistics.samePixelsCount = mSamePixelsCount;
+	statistics.deduplicatedBytes = mDeduplicatedBytes;
+
+	return statistics;
+}
+
+bool TextureCache::isReferenced(ID3D12Resource * p_texture)
+{
+	// キャッシュ以外に参照しているマテリアルがあれば，参照カウントが1より大きい
+	p_texture->AddRef();
+	return p_texture->Release() > 1;
+}
+
+bool TextureCache::isValid(const EntryReference & reference) const
+{
+	return
+		reference.entryIndex != InvalidEntryIndex &&
+		mEntries[reference.entryIndex].generation == reference.generation;
+}
+
+bool TextureCache::bindPath(PathID path_id, const EntryReference & reference, ComPtr<ID3D12Resource> & p_texture)
+{
+	if(!isValid(reference))
+	{
+		return false;
+	}
+
+	mPathEntries[path_id] = reference;
+
+	unlink(reference.entryIndex);
+	linkFront(reference.entryIndex);
+
+	auto & entry = mEntries[reference.entryIndex];
+	p_texture = entry.pTexture;
+	mDeduplicatedBytes += entry.sizeInBytes;
+
+	return true;
+}
+
+void TextureCache::unlink(EntryIndex entry_index)
+{
+	auto & entry = mEntries[entry_index];
+
+	if(entry.previous != InvalidEntryIndex)
+	{
+		mEntries[entry.previous].next = entry.next;
+	}
+	else
+	{
+		mMostRecent = entry.next;
+	}
+
+	if(entry.next != InvalidEntryIndex)
+	{
+		mEntries[entry.next].previous = entry.previous;
+	}
+	else
+	{
+		mLeastRecent = entry.previous;
+	}
+
+	entry.previous = InvalidEntryIndex;
+	entry.next = InvalidEntryIndex;
+}
+
+void TextureCache::linkFront(EntryIndex entry_index)
+{
+	auto & entry = mEntries[entry_index];
+	entry.previous = InvalidEntryIndex;
+	entry.next = mMostRecent;
+
+	if(mMostRecent != InvalidEntryIndex)
+	{
+		mEntries[mMostRecent].previous = entry_index;
+	}
+	else
+	{
+		mLeastRecent = entry_index;
+	}
+
+	mMostRecent = entry_index;
+}
+
+void TextureCache::evict(EntryIndex entry_index)
+{
+	auto & entry = mEntries[entry_index];
+
+	unlink(entry_index);
+
+	mResidentBytes -= entry.sizeInBytes;
+	--mTextureCount;
+	++mEvictionCount;
+
+	// ハッシュの対応は消し，パスは世代を進めて無効にする．パスの数はファイルの数までしか増えない
+	const EntryReference reference { entry_index, entry.generation };
+	for(auto file_hash : entry.fileHashes)
+	{
+		eraseHash(mFileHashEntries, file_hash, reference);
+	}
+	eraseHash(mPixelHashEntries, entry.pixelHash, reference);
+
+	entry.pTexture.Reset();
+	entry.sizeInBytes = 0;
+	entry.fileHashes.clear();
+	entry.pixelHash = 0;
+	++entry.generation;
+	mFreeEntries.push_back(entry_index);
+}
+
+void TextureCache::eraseHash(unordered_map<uint64_t, EntryReference> & hash_entries, uint64_t hash, const EntryReference & reference)
+{
+	// 同じハッシュで後から入れた別のエントリは消さない
+	auto it = hash_entries.find(hash);
+	if(
+		it != hash_entries.end() &&
+		it->second.entryIndex == reference.entryIndex &&
+		it->second.generation == reference.generation
+	)
+	{
+		hash_entries.erase(it);
+	}
+}
@@ -0,0 +1,137 @@
+﻿#pragma once
+#ifndef TEXTURE_CACHE_H_INCLUDED
+#define TEXTURE_CACHE_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+#include <d3d12.h>
+#include <wrl/client.h>
+
+// パスごとにテクスチャを共有し，使っているバイト数を予算内に収める
+// 予算を超えたときは，マテリアルから参照されていないものを使われていない順に捨てる
+// 別のパスでも，ファイルの内容かデコードした画素が同じなら同じリソースを使う
+class TextureCache
+{
+public:
+	using PathID = uint32_t;
+	static constexpr PathID InvalidPathID = UINT32_MAX;
+
+	static constexpr uint64_t DefaultBudgetBytes = 256ull * 1024 * 1024;
+
+	struct Statistics
+	{
+		uint32_t textureCount = 0;
+		uint32_t hitCount = 0;
+		uint32_t missCount = 0;
+		uint32_t evictionCount = 0;
+		uint64_t residentBytes = 0;
+		uint64_t peakBytes = 0;
+		uint64_t budgetBytes = 0;
+
+		// 内容が同じで共有したパスの数と，作らずに済んだバイト数
+		uint32_t sameFileCount = 0;
+		uint32_t samePixelsCount = 0;
+		uint64_t deduplicatedBytes = 0;
+	};
+
+	explicit TextureCache(uint64_t budget_bytes = DefaultBudgetBytes);
+
+	// 超えている分はすぐに捨てる
+	void setBudget(uint64_t budget_bytes);
+	uint64_t getBudget() const { return mBudgetBytes; }
+
+	// パスは一度だけハッシュして，以降は番号で引く
+	PathID internPath(const std::filesystem::path & path);
+
+	bool find(PathID path_id, Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture);
+
+	// 見つかったときはpath_idからも引けるようにする
+	bool findByFileHash(PathID path_id, uint64_t file_hash, Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture);
+	// 再エンコードされた画像．file_hashからも引けるようにする
+	bool findByPixelHash(
+		PathID path_id,
+		uint64_t file_hash,
+		uint64_t pixel_hash,
+		Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture
+	);
+
+	void insert(
+		PathID path_id,
+		const Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture,
+		uint64_t size_in_bytes,
+		uint64_t file_hash,
+		uint64_t pixel_hash
+	);
+
+	// GPUが参照していないとき(フェンスを待った後)に呼ぶ
+	void trim();
+	void clear();
+
+	Statistics getStatistics() const;
+
+private:
+	using EntryIndex = uint32_t;
+	static constexpr EntryIndex InvalidEntryIndex = UINT32_MAX;
+
+	static bool isReferenced(ID3D12Resource * p_texture);
+
+	// 世代が一致しなければ，指していたエントリは捨てられている
+	struct EntryReference
+	{
+		EntryIndex entryIndex = InvalidEntryIndex;
+		uint32_t generation = 0;
+	};
+
+	bool isValid(const EntryReference & reference) const;
+	bool bindPath(PathID path_id, const EntryReference & reference, Microsoft::WRL::ComPtr<ID3D12Resource> & p_texture);
+	void unlink(EntryIndex entry_index);
+	void linkFront(EntryIndex entry_index);
+	void evict(EntryIndex entry_index);
+	// まだentry_indexを指していれば，ハッシュの対応を消す
+	static void eraseHash(std::unordered_map<uint64_t, EntryReference> & hash_entries, uint64_t hash, const EntryReference & reference);
+
+private:
+	struct PathHash
+	{
+		size_t operator()(const std::filesystem::path::string_type & path) const;
+	};
+	std::unordered_map<std::filesystem::path::string_type, PathID, PathHash> mPathIDs;
+
+	std::vector<EntryReference> mPathEntries;
+
+	// 前後の番号で使われた順のリストを作る
+	struct Entry
+	{
+		Microsoft::WRL::ComPtr<ID3D12Resource> pTexture;
+		uint64_t sizeInBytes = 0;
+		uint32_t generation = 0;
+		EntryIndex previous = InvalidEntryIndex;
+		EntryIndex next = InvalidEntryIndex;
+
+		// 捨てるときに対応を消せるよう，このエントリを指すハッシュを覚えておく
+		std::vector<uint64_t> fileHashes;
+		uint64_t pixelHash = 0;
+	};
+	std::vector<Entry> mEntries;
+	std::vector<EntryIndex> mFreeEntries;
+	EntryIndex mMostRecent = InvalidEntryIndex;
+	EntryIndex mLeastRecent = InvalidEntryIndex;
+
+	std::unordered_map<uint64_t, EntryReference> mFileHashEntries;
+	std::unordered_map<uint64_t, EntryReference> mPixelHashEntries;
+
+	uint64_t mBudgetBytes = 0;
+	uint64_t mResidentBytes = 0;
+	uint64_t mPeakBytes = 0;
+	uint32_t mTextureCount = 0;
+	uint32_t mHitCount = 0;
+	uint32_t mMissCount = 0;
+	uint32_t mEvictionCount = 0;
+	uint32_t mSameFileCount = 0;
+	uint32_t mSamePixelsCount = 0;
+	uint64_t mDeduplicatedBytes = 0;
+};
+
+#endif // TEXTURE_CACHE_H_INCLUDED
@@ -0,0 +1,456 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "cooked_texture.h"
+#include "image_decoder.h"
+#include "profiler.h"
+#include "texture_atlas.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace
+{
+	struct Options
+	{
+		vector<filesystem::path> inputs;
+		filesystem::path outputDirectory = "cooked_textures";
+		string format = "auto";
+		uint32_t threadCount = 0;
+		bool benchmark = false;
+		bool atlas = false;
+		uint32_t atlasSize = 2048;
+		uint32_t atlasTextureSize = 256;
+		uint32_t atlasMipCount = 4;
+	};
+
+	void printUsage(const char * program)
+	{
+		fprintf(
+			stderr,
+			"usage: %s <image or directory>... [options]\n"
+			"  --output <dir>       output directory (default cooked_textures)\n"
+			"  --format <name>      auto, rgba8, bc1, bc3 or bc7 (default auto)\n"
+			"  --threads <n>        compression threads (default hardware threads - 1)\n"
+			"  --benchmark          compare 1 thread with the thread pool and report PSNR\n"
+			"  --atlas              also pack small textures of each input directory into atlases\n"
+			"  --atlas-size <n>     maximum atlas width and height (default 2048)\n"
+			"  --atlas-texture <n>  largest width or height packed into an atlas (default 256)\n"
+			"  --atlas-mips <n>     atlas mip levels kept apart by the gutter (default 4)\n",
+			program
+		);
+	}
+
+	bool parseOptions(int argc, char * argv[], Options & options)
+	{
+		for(int i = 1; i < argc; ++i)
+		{
+			const string argument = argv[i];
+			if(argument == "--benchmark")
+			{
+				options.benchmark = true;
+				continue;
+			}
+
+			if(argument == "--atlas")
+			{
+				options.atlas = true;
+				continue;
+			}
+
+			if(argument.compare(0, 2, "--") != 0)
+			{
+				options.inputs.push_back(argument);
+				continue;
+			}
+
+			if(i + 1 >= argc)
+			{
+				return false;
+			}
+
+			const char * value = argv[++i];
+			if(argument == "--output")
+			{
+				options.outputDirectory = value;
+			}
+			else if(argument == "--format")
+			{
+				options.format = value;
+			}
+			else if(argument == "--threads")
+			{
+				options.threadCount = static_cast<uint32_t>(atoi(value));
+			}
+			else if(argument == "--atlas-size")
+			{
+				options.atlasSize = static_cast<uint32_t>(atoi(value));
+			}
+			else if(argument == "--atlas-texture")
+			{
+				options.atlasTextureSize = static_cast<uint32_t>(atoi(value));
+			}
+			else if(argument == "--atlas-mips")
+			{
+				options.atlasMipCount = static_cast<uint32_t>(atoi(value));
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		return !options.inputs.empty() &&
+			options.atlasMipCount >= 1 &&
+			(options.format == "auto" || options.format == "rgba8" || options.format == "bc1" || options.format == "bc3" || options.format == "bc7");
+	}
+
+	bool isImagePath(const filesystem::path & path)
+	{
+		const auto extension = path.extension();
+		return
+			extension == ".bmp" ||
+			extension == ".png" ||
+			extension == ".tga" ||
+			extension == ".sph" ||
+			extension == ".spa";
+	}
+
+	// PMDのトゥーンはtoon01.bmpのような名前で参照される
+	bool isToonPath(const filesystem::path & path)
+	{
+		return path.filename().string().compare(0, 4, "toon") == 0;
+	}
+
+	bool readFile(const filesystem::path & path, vector<uint8_t> & data)
+	{
+		ifstream fin(path, ios::binary | ios::ate);
+		if(!fin)
+		{
+			return false;
+		}
+
+		data.resize(static_cast<size_t>(fin.tellg()));
+		fin.seekg(0);
+		fin.read(reinterpret_cast<char *>(data.data()), data.size());
+
+		return static_cast<bool>(fin);
+	}
+
+	cooked_texture::Format selectFormat(const Options & options, const image_decoder::Image & image, const filesystem::path & path)
+	{
+		const bool is_toon = isToonPath(path);
+		if(options.format == "auto")
+		{
+			return cooked_texture::chooseFormat(image, is_toon, false);
+		}
+
+		const auto format =
+			options.format == "bc1" ? cooked_texture::Format::BC1 :
+			options.format == "bc3" ? cooked_texture::Format::BC3 :
+			options.format == "bc7" ? cooked_texture::Format::BC7 :
+			cooked_texture::Format::RGBA8;
+
+		// BCにできない大きさのときは非圧縮にする
+		if(is_toon || cooked_texture::chooseFormat(image, false, true) == cooked_texture::Format::RGBA8)
+		{
+			return cooked_texture::Format::RGBA8;
+		}
+
+		return format;
+	}
+
+	// 最上位ミップのRGBAのPSNR
+	double computePSNR(const image_decoder::Image & source, const cooked_texture::Texture & texture)
+	{
+		image_decoder::Image image;
+		if(!cooked_texture::decompress(texture, 0, image) || image.pixels.size() != source.pixels.size())
+		{
+			return 0.0;
+		}
+
+		double squared_error = 0.0;
+		for(size_t i = 0; i < source.pixels.size(); ++i)
+		{
+			const double difference = static_cast<double>(source.pixels[i]) - image.pixels[i];
+			squared_error += difference * difference;
+		}
+
+		if(squared_error == 0.0)
+		{
+			return INFINITY;
+		}
+
+		return 10.0 * log10(255.0 * 255.0 * source.pixels.size() / squared_error);
+	}
+
+	size_t getTextureSize(const cooked_texture::Texture & texture)
+	{
+		size_t size = 0;
+		for(const auto & mip_level : texture.mipLevels)
+		{
+			size += mip_level.data.size();
+		}
+
+		return size;
+	}
+
+	// フォルダの小さい画像をアトラスに詰め，<出力先>/<フォルダ>/atlas<番号>.ddsと対応表を書き出す
+	// UVが0～1を超えて繰り返すマテリアルもあるので，個別のクック済みも残しておく
+	bool cookAtlases(const filesystem::path & directory, const Options & options, ThreadPool & thread_pool)
+	{
+		vector<string> paths;
+		vector<image_decoder::Image> images;
+		for(const auto & entry : filesystem::recursive_directory_iterator(directory))
+		{
+			if(!entry.is_regular_file() || !isImagePath(entry.path()) || isToonPath(entry.path()))
+			{
+				continue;
+			}
+
+			vector<uint8_t> file_data;
+			image_decoder::Image image;
+			if(!readFile(entry.path(), file_data) || !image_decoder::decode(file_data.data(), file_data.size(), image))
+			{
+				continue;
+			}
+
+			if(image.width > options.atlasTextureSize || image.height > options.atlasTextureSize)
+			{
+				continue;
+			}
+
+			paths.push_back(entry.path().lexically_relative(directory).generic_u8string());
+			images.push_back(move(image));
+		}
+
+		// 1枚だけならまとめても減らない
+		if(images.size() < 2)
+		{
+			return true;
+		}
+
+		texture_atlas::PaddingPolicy policy;
+		policy.mipCount = options.atlasMipCount;
+		policy.blockSize = options.format == "rgba8" ? 1 : 4;
+
+		vector<texture_atlas::Size> sizes;
+		for(const auto & image : images)
+		{
+			sizes.push_back({ image.width, image.height });
+		}
+
+		texture_atlas::Manifest manifest;
+		vector<texture_atlas::Placement> placements;
+		if(!texture_atlas::pack(sizes, policy, options.atlasSize, texture_atlas::Algorithm::Skyline, manifest.atlases, placements))
+		{
+			fprintf(stderr, "error: failed to pack %s into %u atlases.\n", directory.string().c_str(), options.atlasSize);
+			return false;
+		}
+
+		vector<image_decoder::Image> atlases(manifest.atlases.size());
+		for(size_t i = 0; i < atlases.size(); ++i)
+		{
+			atlases[i].width = manifest.atlases[i].width;
+			atlases[i].height = manifest.atlases[i].height;
+			atlases[i].pixels.assign(static_cast<size_t>(atlases[i].width) * atlases[i].height * 4, 0);
+		}
+
+		uint64_t image_area = 0;
+		for(size_t i = 0; i < images.size(); ++i)
+		{
+			texture_atlas::blit(images[i], placements[i], policy, atlases[placements[i].atlas]);
+			manifest.entries.push_back({ paths[i], placements[i] });
+			image_area += static_cast<uint64_t>(images[i].width) * images[i].height;
+		}
+
+		const auto output_directory = options.outputDirectory / directory.relative_path();
+		uint64_t atlas_area = 0;
+		for(uint32_t i = 0; i < atlases.size(); ++i)
+		{
+			const auto name = texture_atlas::getAtlasName(i);
+			const auto format = selectFormat(options, atlases[i], name);
+
+			cooked_texture::Texture texture;
+			if(!cooked_texture::cook(atlases[i], format, &thread_pool, texture, policy.mipCount))
+			{
+				fprintf(stderr, "error: failed to cook %s.\n", name.c_str());
+				return false;
+			}
+
+			const auto output_path = output_directory / (name + ".dds");
+			if(!cooked_texture::writeDDS(output_path, texture))
+			{
+				fprintf(stderr, "error: failed to write %s.\n", output_path.string().c_str());
+				return false;
+			}
+
+			atlas_area += static_cast<uint64_t>(atlases[i].width) * atlases[i].height;
+			printf(
+				"%s : %ux%u %s, %zu mips\n",
+				output_path.string().c_str(),
+				atlases[i].width,
+				atlases[i].height,
+				cooked_texture::getFormatName(format),
+				texture.mipLevels.size()
+			);
+		}
+
+		// 対応表は最後に書くので，途中で失敗しても古いアトラスと食い違わない
+		if(!texture_atlas::writeManifest(output_directory / texture_atlas::ManifestFileName, manifest))
+		{
+			fprintf(stderr, "error: failed to write the atlas manifest of %s.\n", directory.string().c_str());
+			return false;
+		}
+
+		printf(
+			"%s : %zu textures -> %zu atlases, padding %u, alignment %u, occupancy %.1f%%\n",
+			directory.string().c_str(),
+			images.size(),
+			atlases.size(),
+			policy.getPadding(),
+			policy.getAlignment(),
+			100.0 * image_area / atlas_area
+		);
+
+		return true;
+	}
+}
+
+// texture_cooker <image or directory>... [--output <dir>] [--format auto|rgba8|bc1|bc3|bc7] [--threads <n>] [--benchmark] [--atlas]
+// 入力と同じ相対パスに.ddsを付けて書き出す．ランタイムはcooked_textures/<元のパス>.ddsがあればそちらを読む
+int main(int argc, char * argv[])
+{
+	Options options;
+	if(!parseOptions(argc, argv, options))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	PROFILE_THREAD_NAME("Main");
+
+	vector<filesystem::path> files;
+	for(const auto & input : options.inputs)
+	{
+		if(filesystem::is_directory(input))
+		{
+			for(const auto & entry : filesystem::recursive_directory_iterator(input))
+			{
+				if(entry.is_regular_file() && isImagePath(entry.path()))
+				{
+					files.push_back(entry.path());
+				}
+			}
+		}
+		else
+		{
+			files.push_back(input);
+		}
+	}
+
+	ThreadPool thread_pool(options.threadCount);
+
+	size_t source_bytes = 0;
+	size_t cooked_bytes = 0;
+	uint64_t pixel_count = 0;
+	double serial_seconds = 0.0;
+	double parallel_seconds = 0.0;
+	uint32_t failed_count = 0;
+	for(const auto & file : files)
+	{
+		vector<uint8_t> file_data;
+		image_decoder::Image image;
+		if(!readFile(file, file_data) || !image_decoder::decode(file_data.data(), file_data.size(), image))
+		{
+			fprintf(stderr, "error: failed to decode %s.\n", file.string().c_str());
+			++failed_count;
+			continue;
+		}
+
+		const auto format = selectFormat(options, image, file);
+
+		auto start = chrono::steady_clock::now();
+		cooked_texture::Texture texture;
+		cooked_texture::cook(image, format, &thread_pool, texture);
+		const auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		parallel_seconds += seconds;
+
+		auto output_path = options.outputDirectory / file.relative_path();
+		output_path += ".dds";
+		if(!cooked_texture::writeDDS(output_path, texture))
+		{
+			fprintf(stderr, "error: failed to write %s.\n", output_path.string().c_str());
+			++failed_count;
+			continue;
+		}
+
+		source_bytes += image.pixels.size();
+		cooked_bytes += getTextureSize(texture);
+		pixel_count += static_cast<uint64_t>(image.width) * image.height;
+
+		printf(
+			"%s : %ux%u %s, %zu mips, %.1f KB -> %.1f KB, %.2f ms",
+			file.string().c_str(),
+			image.width,
+			image.height,
+			cooked_texture::getFormatName(format),
+			texture.mipLevels.size(),
+			image.pixels.size() / 1024.0,
+			getTextureSize(texture) / 1024.0,
+			seconds * 1000.0
+		);
+
+		if(options.benchmark)
+		{
+			start = chrono::steady_clock::now();
+			cooked_texture::Texture serial_texture;
+			cooked_texture::cook(image, format, nullptr, serial_texture);
+			serial_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			printf(", PSNR %.2f dB", computePSNR(image, texture));
+		}
+
+		printf("\n");
+	}
+
+	if(options.atlas)
+	{
+		for(const auto & input : options.inputs)
+		{
+			if(filesystem::is_directory(input) && !cookAtlases(input, options, thread_pool))
+			{
+				++failed_count;
+			}
+		}
+	}
+
+	// 元の画素はミップを含まない大きさなので，比はミップ込みの圧縮後との比較になる
+	printf(
+		"%zu textures, %u failed, %.2f MB RGBA8 -> %.2f MB cooked\n",
+		files.size(),
+		failed_count,
+		source_bytes / (1024.0 * 1024.0),
+		cooked_bytes / (1024.0 * 1024.0)
+	);
+
+	if(options.benchmark && serial_seconds > 0.0 && parallel_seconds > 0.0)
+	{
+		printf("    mode  threads   MPixel/s\n");
+		printf("  serial  %7u  %9.2f\n", 1u, pixel_count / serial_seconds / 1000000.0);
+		printf(
+			"    pool  %7u  %9.2f (x%.2f)\n",
+			thread_pool.getThreadCount(),
+			pixel_count / parallel_seconds / 1000000.0,
+			serial_seconds / parallel_seconds
+		);
+	}
+
+	return failed_count == 0 ? 0 : 1;
+}
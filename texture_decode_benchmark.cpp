@@ -0,0 +1,217 @@
+﻿#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <vector>
+#include "hash.h"
+#include "image_decoder.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace
+{
+	struct SourceImage
+	{
+		filesystem::path path;
+		vector<uint8_t> fileData;
+	};
+
+	bool isImagePath(const filesystem::path & path)
+	{
+		const auto extension = path.extension();
+		return
+			extension == ".bmp" ||
+			extension == ".png" ||
+			extension == ".tga" ||
+			extension == ".sph" ||
+			extension == ".spa";
+	}
+
+	bool readFile(const filesystem::path & path, vector<uint8_t> & data)
+	{
+		ifstream fin(path, ios::binary | ios::ate);
+		if(!fin)
+		{
+			return false;
+		}
+
+		data.resize(static_cast<size_t>(fin.tellg()));
+		fin.seekg(0);
+		fin.read(reinterpret_cast<char *>(data.data()), data.size());
+
+		return static_cast<bool>(fin);
+	}
+
+	// 展開した画素のハッシュの和．逐次と並列で結果が同じことを確かめる
+	uint64_t decodeImage(const SourceImage & source, uint64_t & pixel_bytes)
+	{
+		PROFILE_SCOPE("Decode");
+
+		image_decoder::Image image;
+		if(!image_decoder::decode(source.fileData.data(), source.fileData.size(), image))
+		{
+			return 0;
+		}
+
+		pixel_bytes = image.pixels.size();
+
+		return hashing::xxh64(image.pixels.data(), image.pixels.size());
+	}
+}
+
+// texture_decode_benchmark <image or directory>... [--repeat <count>] [--threads <count>]
+int main(int argc, char * argv[])
+{
+	vector<filesystem::path> paths;
+	uint32_t repeat_count = 10;
+	uint32_t thread_count = 0;
+	for(int i = 1; i < argc; ++i)
+	{
+		const string argument = argv[i];
+		if(argument == "--repeat" && i + 1 < argc)
+		{
+			repeat_count = static_cast<uint32_t>(atoi(argv[++i]));
+		}
+		else if(argument == "--threads" && i + 1 < argc)
+		{
+			thread_count = static_cast<uint32_t>(atoi(argv[++i]));
+		}
+		else
+		{
+			paths.push_back(argument);
+		}
+	}
+
+	if(paths.empty() || repeat_count == 0)
+	{
+		fprintf(stderr, "usage: %s <image or directory>... [--repeat <count>] [--threads <count>]\n", argv[0]);
+		return 1;
+	}
+
+	PROFILE_THREAD_NAME("Main");
+
+	vector<SourceImage> sources;
+	for(const auto & path : paths)
+	{
+		vector<filesystem::path> files;
+		if(filesystem::is_directory(path))
+		{
+			for(const auto & entry : filesystem::recursive_directory_iterator(path))
+			{
+				if(entry.is_regular_file() && isImagePath(entry.path()))
+				{
+					files.push_back(entry.path());
+				}
+			}
+		}
+		else
+		{
+			files.push_back(path);
+		}
+
+		for(const auto & file : files)
+		{
+			SourceImage source;
+			source.path = file;
+			if(!readFile(file, source.fileData))
+			{
+				fprintf(stderr, "error: failed to read %s.\n", file.string().c_str());
+				return 1;
+			}
+			sources.push_back(move(source));
+		}
+	}
+
+	size_t file_bytes = 0;
+	uint64_t pixel_bytes = 0;
+	uint32_t unsupported_count = 0;
+	uint64_t serial_checksum = 0;
+	for(const auto & source : sources)
+	{
+		file_bytes += source.fileData.size();
+
+		uint64_t bytes = 0;
+		const auto hash = decodeImage(source, bytes);
+		if(bytes == 0)
+		{
+			++unsupported_count;
+			printf("unsupported : %s\n", source.path.string().c_str());
+		}
+		pixel_bytes += bytes;
+		serial_checksum += hash;
+	}
+
+	printf(
+		"%zu images, %.2f MB compressed, %.2f MB decoded, %u unsupported\n",
+		sources.size(),
+		file_bytes / (1024.0 * 1024.0),
+		pixel_bytes / (1024.0 * 1024.0),
+		unsupported_count
+	);
+
+	ThreadPool thread_pool(thread_count);
+
+	// 逐次と，1画像を1タスクにした並列
+	auto start = chrono::steady_clock::now();
+	for(uint32_t repeat = 0; repeat < repeat_count; ++repeat)
+	{
+		for(const auto & source : sources)
+		{
+			uint64_t bytes = 0;
+			decodeImage(source, bytes);
+		}
+	}
+	const auto serial_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / repeat_count;
+
+	uint64_t parallel_checksum = 0;
+	start = chrono::steady_clock::now();
+	for(uint32_t repeat = 0; repeat < repeat_count; ++repeat)
+	{
+		vector<future<uint64_t>> futures;
+		futures.reserve(sources.size());
+		for(const auto & source : sources)
+		{
+			futures.push_back(thread_pool.submit([&source]()
+			{
+				uint64_t bytes = 0;
+				return decodeImage(source, bytes);
+			}));
+		}
+
+		parallel_checksum = 0;
+		for(auto & f : futures)
+		{
+			parallel_checksum += f.get();
+		}
+	}
+	const auto parallel_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count() / repeat_count;
+
+	printf("    mode  threads     ms/batch   MB/s(out)   images/s\n");
+	printf(
+		"  serial  %7u  %11.3f  %10.1f  %9.0f\n",
+		1u,
+		serial_seconds * 1000.0,
+		pixel_bytes / (1024.0 * 1024.0) / serial_seconds,
+		sources.size() / serial_seconds
+	);
+	printf(
+		"parallel  %7u  %11.3f  %10.1f  %9.0f (x%.2f)\n",
+		thread_pool.getThreadCount(),
+		parallel_seconds * 1000.0,
+		pixel_bytes / (1024.0 * 1024.0) / parallel_seconds,
+		sources.size() / parallel_seconds,
+		serial_seconds / parallel_seconds
+	);
+
+	if(parallel_checksum != serial_checksum)
+	{
+		fprintf(stderr, "error: parallel decode produced different pixels.\n");
+		return 1;
+	}
+
+	return 0;
+}
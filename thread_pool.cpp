@@ -0,0 +1,58 @@
+﻿#include "thread_pool.h"
+#include <algorithm>
+#include "profiler.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(uint32_t thread_count)
+{
+	if(thread_count == 0)
+	{
+		thread_count = max(thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	mThreads.reserve(thread_count);
+	for(uint32_t i = 0; i < thread_count; ++i)
+	{
+		mThreads.emplace_back(&ThreadPool::workerMain, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mCondition.notify_all();
+
+	for(auto & t : mThreads)
+	{
+		t.join();
+	}
+}
+
+void ThreadPool::workerMain()
+{
+	PROFILE_THREAD_NAME("Worker");
+
+	while(true)
+	{
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+
+			// 停止時も積まれているタスクは最後まで処理する
+			if(mTasks.empty())
+			{
+				return;
+			}
+
+			task = move(mTasks.front());
+			mTasks.pop_front();
+		}
+
+		task();
+	}
+}
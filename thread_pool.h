@@ -0,0 +1,55 @@
+﻿#pragma once
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// 0のときはハードウェアスレッド数 - 1 (最低1)
+	explicit ThreadPool(uint32_t thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	template<typename F>
+	std::future<std::invoke_result_t<F>> submit(F && f)
+	{
+		using Result = std::invoke_result_t<F>;
+
+		auto p_task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+		auto future = p_task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mTasks.emplace_back([p_task]() { (*p_task)(); });
+		}
+		mCondition.notify_one();
+
+		return future;
+	}
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(mThreads.size()); }
+
+private:
+	void workerMain();
+
+private:
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<std::function<void()>> mTasks;
+	bool mStopping = false;
+};
+
+#endif // THREAD_POOL_H_INCLUDED
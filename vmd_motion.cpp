@@ -0,0 +1,191 @@
+﻿#include "vmd_motion.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include "byte_reader.h"
+
+using namespace std;
+using namespace DirectX;
+
+bool VMDMotion::load(const std::filesystem::path & path)
+{
+	ifstream fin(path, ios::in | ios::binary | ios::ate);
+	if(!fin)
+	{
+		return false;
+	}
+
+	vector<uint8_t> data(static_cast<size_t>(fin.tellg()));
+	fin.seekg(0, ios::beg);
+	fin.read(reinterpret_cast<char *>(data.data()), data.size());
+	if(!fin)
+	{
+		return false;
+	}
+
+	return load(data.data(), data.size());
+}
+
+bool VMDMotion::load(const uint8_t * p_data, size_t size)
+{
+	ByteReader reader(p_data, size);
+
+	// ヘッダをスキップ
+	reader.seek(50);
+
+	uint32_t key_frame_count = 0;
+	reader.read(key_frame_count);
+
+	vector<FileKeyFrame> vmd_key_frames;
+	if(!reader.readArray(vmd_key_frames, key_frame_count))
+	{
+		return false;
+	}
+
+	map<string, vector<KeyFrame>> name_to_key_frames;
+	for(auto & vmd_key_frame : vmd_key_frames)
+	{
+		// 15文字ちょうどの名前は終端されていない
+		string bone_name(vmd_key_frame.boneName, strnlen(vmd_key_frame.boneName, sizeof(vmd_key_frame.boneName)));
+
+		name_to_key_frames[bone_name].emplace_back(
+			vmd_key_frame.frameNo,
+			XMLoadFloat4(&vmd_key_frame.quaternion),
+			vmd_key_frame.location,
+			XMFLOAT2(vmd_key_frame.bezier[3] / 127.0f, vmd_key_frame.bezier[7] / 127.0f),
+			XMFLOAT2(vmd_key_frame.bezier[11] / 127.0f, vmd_key_frame.bezier[15] / 127.0f)
+		);
+	}
+
+	mTracks.clear();
+	mTracks.reserve(name_to_key_frames.size());
+
+	mMaxFrame = 0;
+	for(auto & kv : name_to_key_frames)
+	{
+		std::sort(
+			kv.second.begin(),
+			kv.second.end(),
+			[](const KeyFrame & lhs, const KeyFrame & rhs)
+			{
+				return lhs.frameNo < rhs.frameNo;
+			}
+		);
+
+		mMaxFrame = max(mMaxFrame, kv.second[kv.second.size() - 1].frameNo);
+
+		mTracks.push_back({ kv.first, move(kv.second) });
+	}
+
+	return true;
+}
+
+static float getYFromXOnBezier(float x, const XMFLOAT2 & a, const XMFLOAT2 & b, int32_t n)
+{
+	if(a.x == a.y && b.x == b.y)
+	{
+		return x;
+	}
+
+	float t = x;
+	const float k0 = 1.0f + 3.0f * a.x - 3.0f * b.x;
+	const float k1 = 3.0f * b.x - 6.0f * a.x;
+	const float k2 = 3.0f * a.x;
+
+	constexpr float epsilon = 0.0005f;
+
+	for(int32_t i = 0; i < n; ++i)
+	{
+		auto ft = k0 * t + k1;
+		ft = ft * t + k2;
+		ft = ft * t - x;
+
+		if(-epsilon <= ft && ft <= epsilon)
+		{
+			break;
+		}
+
+		t -= ft * 0.5f;
+
+	}
+
+	auto r = 1.0f - t;
+	return t * t * t + 3.0f * t * t * r * b.y + 3.0f * t * r * r * a.y;
+}
+
+void VMDMotion::sample(uint32_t frame, TrackPose * p_poses) const
+{
+	for(size_t i = 0; i < mTracks.size(); ++i)
+	{
+		auto & motions = mTracks[i].keyFrames;
+		auto & pose = p_poses[i];
+
+		auto it = find_if(
+			motions.rbegin(),
+			motions.rend(),
+			[frame](const KeyFrame & key_frame)
+			{
+				return key_frame.frameNo <= frame;
+			}
+		);
+
+		if(it == motions.rend())
+		{
+			pose.isValid = false;
+			continue ;
+		}
+
+		pose.rotation = it->quaternion;
+		pose.translation = XMLoadFloat3(&it->offset);
+		pose.isValid = true;
+
+		auto next = it.base();
+		if(next != motions.end())
+		{
+			auto t = 
+				static_cast<float>(frame - it->frameNo) /
+				static_cast<float>(next->frameNo - it->frameNo);
+
+			t = getYFromXOnBezier(t, next->p1, next->p2, 12);
+
+			pose.rotation = XMQuaternionSlerp(it->quaternion, next->quaternion, t);
+			pose.translation = XMVectorLerp(pose.translation, XMLoadFloat3(&next->offset), t);
+		}
+	}
+}
+
+bool VMDMotion::saveFile(
+	const std::filesystem::path & path,
+	const char * model_name,
+	const std::vector<FileKeyFrame> & key_frames
+)
+{
+	ofstream fout(path, ios::out | ios::binary);
+	if(!fout)
+	{
+		return false;
+	}
+
+	char signature[30] {};
+	strncpy(signature, "Vocaloid Motion Data 0002", sizeof(signature));
+	fout.write(signature, sizeof(signature));
+
+	// 20バイトちょうどの名前も読み手が終端を探せるよう，最後の1バイトは0のままにする
+	char name[20] {};
+	memcpy(name, model_name, min(strlen(model_name), sizeof(name) - 1));
+	fout.write(name, sizeof(name));
+
+	auto key_frame_count = static_cast<uint32_t>(key_frames.size());
+	fout.write(reinterpret_cast<const char *>(&key_frame_count), sizeof(key_frame_count));
+	fout.write(
+		reinterpret_cast<const char *>(key_frames.data()),
+		sizeof(key_frames[0]) * key_frames.size()
+	);
+
+	// 表情，カメラ，照明，セルフシャドウ，IKのキーフレームは空
+	const uint32_t empty_counts[] { 0, 0, 0, 0, 0 };
+	fout.write(reinterpret_cast<const char *>(empty_counts), sizeof(empty_counts));
+
+	return static_cast<bool>(fout);
+}
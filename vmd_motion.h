@@ -0,0 +1,87 @@
+﻿#pragma once
+#ifndef VMD_MOTION_H_INCLUDED
+#define VMD_MOTION_H_INCLUDED
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+
+// VMDファイルのボーンのキーフレーム
+class VMDMotion
+{
+public:
+#pragma pack(push, 1)
+	struct FileKeyFrame
+	{
+		char boneName[15];
+		uint32_t frameNo;
+		DirectX::XMFLOAT3 location;
+		DirectX::XMFLOAT4 quaternion;
+		uint8_t bezier[64];
+	};
+#pragma pack(pop)
+
+	struct KeyFrame
+	{
+		uint32_t frameNo;
+		DirectX::XMVECTOR quaternion;
+		DirectX::XMFLOAT3 offset;
+		DirectX::XMFLOAT2 p1;
+		DirectX::XMFLOAT2 p2;
+
+		KeyFrame(
+			const uint32_t frame_no,
+			const DirectX::XMVECTOR & q,
+			const DirectX::XMFLOAT3 & ofs,
+			const DirectX::XMFLOAT2 & vp1,
+			const DirectX::XMFLOAT2 & vp2
+		)
+			: frameNo(frame_no)
+			, quaternion(q)
+			, offset(ofs)
+			, p1(vp1)
+			, p2(vp2)
+		{}
+	};
+
+	// ボーン名はShift-JIS
+	struct Track
+	{
+		std::string boneName;
+		std::vector<KeyFrame> keyFrames;
+	};
+
+	// あるフレームでのトラックの値．最初のキーフレームより前ならisValidがfalse
+	struct TrackPose
+	{
+		DirectX::XMVECTOR rotation;
+		DirectX::XMVECTOR translation;
+		bool isValid;
+	};
+
+	bool load(const std::filesystem::path & path);
+	bool load(const uint8_t * p_data, size_t size);
+
+	// ボーンのキーフレームだけを持つVMDファイルを書き出す
+	static bool saveFile(
+		const std::filesystem::path & path,
+		const char * model_name,
+		const std::vector<FileKeyFrame> & key_frames
+	);
+
+	// トラックはボーン名の順
+	const std::vector<Track> & getTracks() const { return mTracks; }
+	uint32_t getTrackCount() const { return static_cast<uint32_t>(mTracks.size()); }
+	uint32_t getMaxFrame() const { return mMaxFrame; }
+
+	// 全トラックをframeで補間してp_posesに書く．p_posesはトラック数分
+	void sample(uint32_t frame, TrackPose * p_poses) const;
+
+private:
+	std::vector<Track> mTracks;
+	uint32_t mMaxFrame = 0;
+};
+
+#endif // VMD_MOTION_H_INCLUDED